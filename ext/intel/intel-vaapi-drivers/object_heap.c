@@ -35,7 +35,27 @@
 #define ALLOCATED   -2
 
 /*
- * Expands the heap
+ * Bucket arrays are never reallocated in place, since object_heap_lookup()
+ * may still be reading them without holding the mutex. A grown array is
+ * published atomically and the old one is retired until the heap is
+ * destroyed. The extra slot at the end of each array links to the array it
+ * replaced.
+ */
+#define RETIRED_BUCKET(bucket, num_buckets) ((bucket)[num_buckets])
+
+static void object_heap_free_buckets(void **bucket, int num_buckets)
+{
+    while (bucket) {
+        void **retired = RETIRED_BUCKET(bucket, num_buckets);
+
+        free(bucket);
+        bucket = retired;
+        num_buckets -= 8;
+    }
+}
+
+/*
+ * Expands the heap, must be called with the mutex held
  * Return 0 on success, -1 on error
  */
 static int object_heap_expand(object_heap_p heap)
@@ -46,17 +66,26 @@ static int object_heap_expand(object_heap_p heap)
     int new_heap_size = heap->heap_size + heap->heap_increment;
     int bucket_index = new_heap_size / heap->heap_increment - 1;
 
+    if (new_heap_size > OBJECT_HEAP_INDEX_MASK + 1) {
+        return -1; /* Out of object indices */
+    }
+
     if (bucket_index >= heap->num_buckets) {
         int new_num_buckets = heap->num_buckets + 8;
         void **new_bucket;
 
-        new_bucket = realloc(heap->bucket, new_num_buckets * sizeof(void *));
+        new_bucket = calloc(new_num_buckets + 1, sizeof(void *));
         if (NULL == new_bucket) {
             return -1;
         }
 
+        if (heap->num_buckets) {
+            memcpy(new_bucket, heap->bucket, heap->num_buckets * sizeof(void *));
+        }
+        RETIRED_BUCKET(new_bucket, new_num_buckets) = heap->bucket;
+
         heap->num_buckets = new_num_buckets;
-        heap->bucket = new_bucket;
+        __atomic_store_n(&heap->bucket, new_bucket, __ATOMIC_RELEASE);
     }
 
     new_heap_index = (void *) malloc(heap->heap_increment * heap->object_size);
@@ -73,7 +102,9 @@ static int object_heap_expand(object_heap_p heap)
         next_free = i;
     }
     heap->next_free = next_free;
-    heap->heap_size = new_heap_size;
+    /* Publish the new size last, so that lookups of the new IDs see the
+     * bucket array holding them */
+    __atomic_store_n(&heap->heap_size, new_heap_size, __ATOMIC_RELEASE);
     return 0; /* Success */
 }
 
@@ -98,7 +129,7 @@ int object_heap_init(object_heap_p heap, int object_size, int id_offset)
         ASSERT(!heap->heap_size);
         ASSERT(!heap->bucket || !heap->bucket[0]);
 
-        free(heap->bucket);
+        object_heap_free_buckets(heap->bucket, heap->num_buckets);
 
         return -1;
     }
@@ -129,32 +160,94 @@ int object_heap_allocate(object_heap_p heap)
     heap->next_free = obj->next_free;
     _i965UnlockMutex(&heap->mutex);
 
-    obj->next_free = ALLOCATED;
+    __atomic_store_n(&obj->next_free, ALLOCATED, __ATOMIC_RELEASE);
     return obj->id;
 }
 
+/*
+ * Allocates num_objects objects at once, or none of them
+ * Returns 0 on success, storing the object IDs in ids, returns -1 on error
+ *
+ * The objects are only marked as allocated once all of them are taken, so
+ * on failure they are pushed back in reverse order, which restores the free
+ * list as it was.
+ */
+int object_heap_allocate_n(object_heap_p heap, int num_objects, int *ids)
+{
+    object_base_p obj;
+    int i, bucket_index, obj_index;
+
+    _i965LockMutex(&heap->mutex);
+    for (i = 0; i < num_objects; i++) {
+        if (LAST_FREE == heap->next_free) {
+            if (-1 == object_heap_expand(heap)) {
+                while (i-- > 0) {
+                    int index = ids[i] & OBJECT_HEAP_INDEX_MASK;
+
+                    bucket_index = index / heap->heap_increment;
+                    obj_index = index % heap->heap_increment;
+                    obj = (object_base_p)(heap->bucket[bucket_index] + obj_index * heap->object_size);
+                    obj->next_free = heap->next_free;
+                    heap->next_free = index;
+                }
+                _i965UnlockMutex(&heap->mutex);
+                return -1; /* Out of memory */
+            }
+        }
+        ASSERT(heap->next_free >= 0);
+
+        bucket_index = heap->next_free / heap->heap_increment;
+        obj_index = heap->next_free % heap->heap_increment;
+
+        obj = (object_base_p)(heap->bucket[bucket_index] + obj_index * heap->object_size);
+        heap->next_free = obj->next_free;
+        ids[i] = obj->id;
+    }
+
+    for (i = 0; i < num_objects; i++) {
+        int index = ids[i] & OBJECT_HEAP_INDEX_MASK;
+
+        bucket_index = index / heap->heap_increment;
+        obj_index = index % heap->heap_increment;
+        obj = (object_base_p)(heap->bucket[bucket_index] + obj_index * heap->object_size);
+        __atomic_store_n(&obj->next_free, ALLOCATED, __ATOMIC_RELEASE);
+    }
+    _i965UnlockMutex(&heap->mutex);
+
+    return 0;
+}
+
 /*
  * Lookup an object by object ID
  * Returns a pointer to the object on success, returns NULL on error
+ *
+ * This takes no lock: buckets never move once created and the bucket array
+ * is published after them, before the heap size that makes them reachable.
  */
 object_base_p object_heap_lookup(object_heap_p heap, int id)
 {
     object_base_p obj;
-    int bucket_index, obj_index;
+    void **bucket;
+    int heap_size;
+    int index, bucket_index, obj_index;
 
-    _i965LockMutex(&heap->mutex);
-    if ((id < heap->id_offset) || (id > (heap->heap_size + heap->id_offset))) {
-        _i965UnlockMutex(&heap->mutex);
+    heap_size = __atomic_load_n(&heap->heap_size, __ATOMIC_ACQUIRE);
+    index = id & OBJECT_HEAP_INDEX_MASK;
+    if ((id & ~(OBJECT_HEAP_ID_MASK)) != heap->id_offset || index >= heap_size) {
         return NULL;
     }
-    id &= OBJECT_HEAP_ID_MASK;
-    bucket_index = id / heap->heap_increment;
-    obj_index = id % heap->heap_increment;
-    obj = (object_base_p)(heap->bucket[bucket_index] + obj_index * heap->object_size);
-    _i965UnlockMutex(&heap->mutex);
-
-    /* Check if the object has in fact been allocated */
-    if (obj->next_free != ALLOCATED) {
+    bucket = __atomic_load_n(&heap->bucket, __ATOMIC_ACQUIRE);
+    bucket_index = index / heap->heap_increment;
+    obj_index = index % heap->heap_increment;
+    obj = (object_base_p)(bucket[bucket_index] + obj_index * heap->object_size);
+
+    /*
+     * Freeing an object bumps the generation of its ID, which rejects the
+     * stale IDs. A slot never allocated still holds the ID it will be
+     * handed out with, so it is rejected as not allocated.
+     */
+    if (__atomic_load_n(&obj->id, __ATOMIC_ACQUIRE) != id ||
+        __atomic_load_n(&obj->next_free, __ATOMIC_ACQUIRE) != ALLOCATED) {
         return NULL;
     }
     return obj;
@@ -211,8 +304,12 @@ void object_heap_free(object_heap_p heap, object_base_p obj)
         ASSERT(obj->next_free == ALLOCATED);
 
         _i965LockMutex(&heap->mutex);
-        obj->next_free = heap->next_free;
-        heap->next_free = obj->id & OBJECT_HEAP_ID_MASK;
+        __atomic_store_n(&obj->next_free, heap->next_free, __ATOMIC_RELAXED);
+        heap->next_free = obj->id & OBJECT_HEAP_INDEX_MASK;
+        /* Invalidate the handles to this object */
+        __atomic_store_n(&obj->id, (obj->id & ~OBJECT_HEAP_GENERATION_MASK) |
+                         ((obj->id + OBJECT_HEAP_GENERATION_ONE) & OBJECT_HEAP_GENERATION_MASK),
+                         __ATOMIC_RELEASE);
         _i965UnlockMutex(&heap->mutex);
     }
 }
@@ -242,10 +339,11 @@ void object_heap_destroy(object_heap_p heap)
             free(heap->bucket[i]);
         }
 
-        free(heap->bucket);
+        object_heap_free_buckets(heap->bucket, heap->num_buckets);
     }
 
     heap->bucket = NULL;
+    heap->num_buckets = 0;
     heap->heap_size = 0;
     heap->next_free = LAST_FREE;
 }
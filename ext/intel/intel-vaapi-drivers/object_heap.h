@@ -27,8 +27,16 @@
 
 #include "i965_mutext.h"
 
+/*
+ * Object IDs are laid out as [offset:7][generation:8][index:16]. The
+ * generation of a slot is bumped every time it is freed, so a stale ID no
+ * longer matches the ID of the object that reuses the slot.
+ */
 #define OBJECT_HEAP_OFFSET_MASK     0x7F000000
 #define OBJECT_HEAP_ID_MASK         0x00FFFFFF
+#define OBJECT_HEAP_GENERATION_MASK 0x00FF0000
+#define OBJECT_HEAP_GENERATION_ONE  0x00010000
+#define OBJECT_HEAP_INDEX_MASK      0x0000FFFF
 
 typedef struct object_base *object_base_p;
 typedef struct object_heap *object_heap_p;
@@ -63,8 +71,15 @@ int object_heap_init(object_heap_p heap, int object_size, int id_offset);
 int object_heap_allocate(object_heap_p heap);
 
 /*
- * Lookup an allocated object by object ID
- * Returns a pointer to the object on success, returns NULL on error
+ * Allocates num_objects objects at once, or none of them
+ * Returns 0 on success, storing the object IDs in ids, returns -1 on error
+ */
+int object_heap_allocate_n(object_heap_p heap, int num_objects, int *ids);
+
+/*
+ * Lookup an allocated object by object ID, without taking the heap mutex
+ * Returns a pointer to the object on success, returns NULL on error or if
+ * the ID belongs to an object that has already been freed
  */
 object_base_p object_heap_lookup(object_heap_p heap, int id);
 
@@ -0,0 +1,225 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "flu_va_drivers_bitstream.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#define FLU_VA_DRIVERS_H264_NAL_SLICE 1
+#define FLU_VA_DRIVERS_H264_NAL_SLICE_IDR 5
+
+/* The vector paths compare three unaligned loads, shifted by one byte each,
+ * against 00, 00 and 01, so a match at lane i is a start code at offset i.
+ * SSE2 and NEON are part of the x86-64 and AArch64 baselines; wider vectors
+ * do not pay off, as the search is bound by the loads. */
+size_t
+flu_va_drivers_bitstream_find_start_code (const uint8_t *data, size_t size)
+{
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i one = _mm_set1_epi8 (1);
+
+  for (; i + 18 <= size; i += 16) {
+    __m128i b0 = _mm_loadu_si128 ((const __m128i *) (data + i));
+    __m128i b1 = _mm_loadu_si128 ((const __m128i *) (data + i + 1));
+    __m128i b2 = _mm_loadu_si128 ((const __m128i *) (data + i + 2));
+    uint32_t mask = (uint32_t) _mm_movemask_epi8 (_mm_and_si128 (
+        _mm_and_si128 (_mm_cmpeq_epi8 (b0, zero), _mm_cmpeq_epi8 (b1, zero)),
+        _mm_cmpeq_epi8 (b2, one)));
+
+    if (mask != 0)
+      return i + __builtin_ctz (mask);
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const uint8x16_t zero = vdupq_n_u8 (0);
+  const uint8x16_t one = vdupq_n_u8 (1);
+
+  for (; i + 18 <= size; i += 16) {
+    uint8x16_t match = vandq_u8 (
+        vandq_u8 (vceqq_u8 (vld1q_u8 (data + i), zero),
+            vceqq_u8 (vld1q_u8 (data + i + 1), zero)),
+        vceqq_u8 (vld1q_u8 (data + i + 2), one));
+
+    /* Locate the lane in the scalar loop below. */
+    if (vmaxvq_u8 (match) != 0)
+      break;
+  }
+#endif
+
+  for (; i + 3 <= size; i++) {
+    if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+      return i;
+  }
+
+  return size;
+}
+
+unsigned int
+flu_va_drivers_bitstream_start_code_size (const uint8_t *data, size_t size)
+{
+  if (size >= 3 && data[0] == 0 && data[1] == 0 && data[2] == 1)
+    return 3;
+  if (size >= 4 && data[0] == 0 && data[1] == 0 && data[2] == 0 &&
+      data[3] == 1)
+    return 4;
+  return 0;
+}
+
+static void
+flu_va_drivers_bitstream_count_nal_unit (
+    const uint8_t *data, size_t size, FluVaDriversH264BitstreamInfo *info)
+{
+  unsigned int nal_unit_type;
+
+  if (size == 0)
+    return;
+
+  info->num_nal_units++;
+  nal_unit_type = data[0] & 0x1f;
+  if (nal_unit_type >= FLU_VA_DRIVERS_H264_NAL_SLICE &&
+      nal_unit_type <= FLU_VA_DRIVERS_H264_NAL_SLICE_IDR)
+    info->num_slices++;
+}
+
+void
+flu_va_drivers_bitstream_inspect_h264 (
+    const uint8_t *data, size_t size, FluVaDriversH264BitstreamInfo *info)
+{
+  size_t offset;
+
+  info->num_nal_units = 0;
+  info->num_slices = 0;
+
+  info->start_code_size = flu_va_drivers_bitstream_start_code_size (data, size);
+
+  /* Without start code the data begins with the NAL unit header. */
+  offset = info->start_code_size;
+  if (offset == 0)
+    flu_va_drivers_bitstream_count_nal_unit (data, size, info);
+  else
+    offset -= 3;
+
+  while (offset < size) {
+    offset += flu_va_drivers_bitstream_find_start_code (
+        data + offset, size - offset);
+    if (offset >= size)
+      break;
+    offset += 3;
+    flu_va_drivers_bitstream_count_nal_unit (
+        data + offset, size - offset, info);
+  }
+}
+
+void
+flu_va_drivers_bit_reader_init (
+    FluVaDriversBitReader *reader, const uint8_t *data, size_t size)
+{
+  reader->data = data;
+  reader->size = size;
+  reader->offset = 0;
+  reader->bit = 0;
+  reader->skip_emulation_prevention = 1;
+  reader->num_zeros = 0;
+  reader->num_bits = 0;
+  reader->overflow = 0;
+}
+
+void
+flu_va_drivers_bit_reader_init_raw (
+    FluVaDriversBitReader *reader, const uint8_t *data, size_t size)
+{
+  flu_va_drivers_bit_reader_init (reader, data, size);
+  reader->skip_emulation_prevention = 0;
+}
+
+static unsigned int
+flu_va_drivers_bit_reader_read_bit (FluVaDriversBitReader *reader)
+{
+  unsigned int value;
+
+  if (reader->bit == 0) {
+    /* 00 00 03 is followed by the payload byte that needed escaping. */
+    if (reader->skip_emulation_prevention && reader->num_zeros >= 2 &&
+        reader->offset < reader->size &&
+        reader->data[reader->offset] == 0x03) {
+      reader->offset++;
+      reader->num_zeros = 0;
+    }
+    if (reader->offset >= reader->size) {
+      reader->overflow = 1;
+      return 0;
+    }
+  }
+
+  value = (reader->data[reader->offset] >> (7 - reader->bit)) & 1;
+  reader->num_bits++;
+  if (++reader->bit == 8) {
+    reader->num_zeros =
+        reader->data[reader->offset] == 0 ? reader->num_zeros + 1 : 0;
+    reader->offset++;
+    reader->bit = 0;
+  }
+
+  return value;
+}
+
+uint32_t
+flu_va_drivers_bit_reader_read (
+    FluVaDriversBitReader *reader, unsigned int num_bits)
+{
+  uint32_t value = 0;
+
+  while (num_bits-- > 0)
+    value = (value << 1) | flu_va_drivers_bit_reader_read_bit (reader);
+
+  return value;
+}
+
+void
+flu_va_drivers_bit_reader_skip (FluVaDriversBitReader *reader, size_t num_bits)
+{
+  while (num_bits-- > 0 && !reader->overflow)
+    flu_va_drivers_bit_reader_read_bit (reader);
+}
+
+uint32_t
+flu_va_drivers_bit_reader_read_ue (FluVaDriversBitReader *reader)
+{
+  unsigned int leading_zeros = 0;
+
+  while (flu_va_drivers_bit_reader_read_bit (reader) == 0) {
+    if (reader->overflow || ++leading_zeros == 32) {
+      reader->overflow = 1;
+      return 0;
+    }
+  }
+
+  return ((1u << leading_zeros) - 1) +
+         flu_va_drivers_bit_reader_read (reader, leading_zeros);
+}
@@ -0,0 +1,90 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __FLU_VA_DRIVERS_BITSTREAM_H__
+#define __FLU_VA_DRIVERS_BITSTREAM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct _FluVaDriversH264BitstreamInfo FluVaDriversH264BitstreamInfo;
+
+struct _FluVaDriversH264BitstreamInfo
+{
+  /* Size of the start code the data begins with, 0 if there is none. */
+  unsigned int start_code_size;
+  /* NAL units in the data, the first one counts even without start code. */
+  unsigned int num_nal_units;
+  /* Coded slice NAL units (nal_unit_type 1 to 5) among them. */
+  unsigned int num_slices;
+};
+
+/* Reader of the RBSP bits of a NAL unit, the emulation prevention bytes are
+ * skipped unless initialized as raw. Reading past the end yields zero bits
+ * and sets overflow. */
+typedef struct _FluVaDriversBitReader FluVaDriversBitReader;
+
+struct _FluVaDriversBitReader
+{
+  const uint8_t *data;
+  size_t size;
+  size_t offset;
+  unsigned int bit;
+  int skip_emulation_prevention;
+  /* Zero bytes preceding offset, to detect the emulation prevention bytes. */
+  unsigned int num_zeros;
+  /* RBSP bits read so far. */
+  size_t num_bits;
+  int overflow;
+};
+
+/* Returns the offset of the first 3-byte start code (00 00 01) in the data,
+ * or size if there is none. */
+size_t flu_va_drivers_bitstream_find_start_code (
+    const uint8_t *data, size_t size);
+
+/* Returns the size of the start code the data begins with, 0 if none. */
+unsigned int flu_va_drivers_bitstream_start_code_size (
+    const uint8_t *data, size_t size);
+
+void flu_va_drivers_bitstream_inspect_h264 (
+    const uint8_t *data, size_t size, FluVaDriversH264BitstreamInfo *info);
+
+void flu_va_drivers_bit_reader_init (
+    FluVaDriversBitReader *reader, const uint8_t *data, size_t size);
+
+/* For bitstreams without emulation prevention, such as VP9 frames. */
+void flu_va_drivers_bit_reader_init_raw (
+    FluVaDriversBitReader *reader, const uint8_t *data, size_t size);
+
+/* Reads up to 32 bits, most significant first. */
+uint32_t flu_va_drivers_bit_reader_read (
+    FluVaDriversBitReader *reader, unsigned int num_bits);
+
+void flu_va_drivers_bit_reader_skip (
+    FluVaDriversBitReader *reader, size_t num_bits);
+
+/* Reads an unsigned Exp-Golomb code, ue(v). */
+uint32_t flu_va_drivers_bit_reader_read_ue (FluVaDriversBitReader *reader);
+
+#endif /* __FLU_VA_DRIVERS_BITSTREAM_H__ */
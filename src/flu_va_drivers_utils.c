@@ -33,3 +33,27 @@ flu_va_drivers_get_vendor (char *str_vendor)
   sprintf (str_vendor, "%s (%s) - %s", FLU_VA_DRIVERS_COMMERCIAL_NAME,
       FLU_VA_DRIVERS_VENDOR, FLU_VA_DRIVERS_PROJECT_VERSION);
 }
+
+/* Deadlines are measured on CLOCK_MONOTONIC so that they are not affected by
+ * wall clock changes. */
+void
+flu_va_drivers_get_deadline (uint64_t timeout_ns, struct timespec *deadline)
+{
+  clock_gettime (CLOCK_MONOTONIC, deadline);
+  deadline->tv_sec += timeout_ns / 1000000000;
+  deadline->tv_nsec += timeout_ns % 1000000000;
+  if (deadline->tv_nsec >= 1000000000) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000;
+  }
+}
+
+int
+flu_va_drivers_deadline_expired (const struct timespec *deadline)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return now.tv_sec > deadline->tv_sec ||
+         (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
@@ -26,6 +26,8 @@
 
 #include <va/va_backend.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <time.h>
 
 #define FLU_VA_DRIVERS_ALIGN(n, alignment)                                    \
   (((n) + ((alignment) -1)) & ~((alignment) -1))
@@ -35,4 +37,9 @@ typedef int FluVaDriversID;
 
 void flu_va_drivers_get_vendor (char *str_vendor);
 
+void flu_va_drivers_get_deadline (
+    uint64_t timeout_ns, struct timespec *deadline);
+
+int flu_va_drivers_deadline_expired (const struct timespec *deadline);
+
 #endif /* __FLU_VA_DRIVERS_UTILS_H__ */
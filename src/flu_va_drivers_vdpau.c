@@ -21,6 +21,7 @@
  * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <limits.h>
 #include <va/va.h>
 #include <vdpau/vdpau.h>
 #ifdef HAVE_CONFIG_H
@@ -45,6 +46,22 @@ static VAStatus set_image_format (FluVaDriversVdpauImageObject *image_obj,
     const VAImageFormat *format, int width, int height);
 static VAStatus get_image_ptr (FluVaDriversVdpauDriverData *driver_data,
     FluVaDriversVdpauImageObject *image_obj, ImagePtr *ptr);
+static VAStatus flu_va_drivers_vdpau_destroy_context (
+    VADriverContextP ctx, FluVaDriversVdpauContextObject *context_obj);
+
+/* Pixel format of the surfaces of each render target format, the one
+ * reported by vaQuerySurfaceAttributes and used by vaDeriveImage. */
+static const struct
+{
+  unsigned int rt_format;
+  uint32_t fourcc;
+} FLU_VA_DRIVERS_VDPAU_SURFACE_PIXEL_FORMATS[] = {
+  { VA_RT_FORMAT_YUV420, VA_FOURCC_NV12 },
+  { VA_RT_FORMAT_YUV420_10, VA_FOURCC_P010 },
+  { VA_RT_FORMAT_YUV420_12, VA_FOURCC_P016 },
+  { VA_RT_FORMAT_YUV422, VA_FOURCC_YUY2 },
+  { VA_RT_FORMAT_YUV444, VA_FOURCC_444P },
+};
 
 // clang-format off
 #define _DEFAULT_OFFSET     24
@@ -57,21 +74,351 @@ static VAStatus get_image_ptr (FluVaDriversVdpauDriverData *driver_data,
 #define VIDEO_MIXER_ID_OFFSET 7 << _DEFAULT_OFFSET
 // clang-format on
 
+/* The state is read and written by every thread that decodes, syncs or
+ * queries the surface. It only moves back to READY if no other thread
+ * changed it meanwhile. */
+static void
+flu_va_drivers_vdpau_surface_complete_state (
+    FluVaDriversVdpauSurfaceObject *surface_obj,
+    FluVaDriversVdpauSurfaceState state)
+{
+  __atomic_compare_exchange_n (&surface_obj->state, &state,
+      FLU_VA_DRIVERS_VDPAU_SURFACE_STATE_READY, 0, __ATOMIC_ACQ_REL,
+      __ATOMIC_ACQUIRE);
+}
+
+static VAStatus
+flu_va_drivers_vdpau_surface_wait_decode (
+    FluVaDriversVdpauDriverData *driver_data,
+    FluVaDriversVdpauSurfaceObject *surface_obj,
+    const struct timespec *deadline)
+{
+  FluVaDriversVdpauContextObject *context_obj;
+  VAStatus va_st = VA_STATUS_SUCCESS;
+
+  /* Without context there is no decode in flight for the surface. */
+  context_obj = (FluVaDriversVdpauContextObject *) object_heap_lookup (
+      &driver_data->context_heap, surface_obj->context_id);
+  if (context_obj != NULL)
+    va_st = flu_va_drivers_vdpau_decode_queue_wait (
+        &context_obj->decode_queue, &surface_obj->decode_fence, deadline);
+
+  if (va_st != VA_STATUS_ERROR_TIMEDOUT)
+    flu_va_drivers_vdpau_surface_complete_state (
+        surface_obj, FLU_VA_DRIVERS_VDPAU_SURFACE_STATE_DECODING);
+
+  return va_st;
+}
+
+static VAStatus
+flu_va_drivers_vdpau_surface_wait_display (
+    FluVaDriversVdpauDriverData *driver_data,
+    FluVaDriversVdpauSurfaceObject *surface_obj,
+    const struct timespec *deadline)
+{
+  struct timespec poll_interval = { 0,
+    FLU_VA_DRIVERS_VDPAU_DISPLAY_POLL_MIN_INTERVAL_NS };
+
+  /* VDPAU can only block until an output surface is idle, which only happens
+   * once a newer one is shown, so the queue is polled instead. The interval
+   * doubles up to FLU_VA_DRIVERS_VDPAU_DISPLAY_POLL_MAX_INTERVAL_NS, which
+   * bounds how late a shown surface is noticed. */
+  while (1) {
+    VdpPresentationQueueStatus vdp_pq_st;
+    VdpTime first_presentation_time;
+    VdpStatus vdp_st;
+
+    /* Once the output surface is visible the video mixer is done with the
+     * surface. A failure means the output surface or the queue are gone. */
+    vdp_st =
+        driver_data->vdp_impl.vdp_presentation_queue_query_surface_status (
+            surface_obj->vdp_presentation_queue,
+            surface_obj->vdp_output_surface, &vdp_pq_st,
+            &first_presentation_time);
+    if (vdp_st != VDP_STATUS_OK ||
+        vdp_pq_st != VDP_PRESENTATION_QUEUE_STATUS_QUEUED) {
+      flu_va_drivers_vdpau_surface_complete_state (
+          surface_obj, FLU_VA_DRIVERS_VDPAU_SURFACE_STATE_DISPLAYING);
+      return VA_STATUS_SUCCESS;
+    }
+
+    if (deadline != NULL && flu_va_drivers_deadline_expired (deadline))
+      return VA_STATUS_ERROR_TIMEDOUT;
+    nanosleep (&poll_interval, NULL);
+    poll_interval.tv_nsec *= 2;
+    if (poll_interval.tv_nsec >
+        FLU_VA_DRIVERS_VDPAU_DISPLAY_POLL_MAX_INTERVAL_NS)
+      poll_interval.tv_nsec =
+          FLU_VA_DRIVERS_VDPAU_DISPLAY_POLL_MAX_INTERVAL_NS;
+  }
+}
+
+/* Waits for the pending decode and presentation of the surface. A NULL
+ * deadline waits forever. */
+static VAStatus
+flu_va_drivers_vdpau_surface_sync (FluVaDriversVdpauDriverData *driver_data,
+    FluVaDriversVdpauSurfaceObject *surface_obj,
+    const struct timespec *deadline)
+{
+  VAStatus va_st, display_va_st;
+
+  va_st = flu_va_drivers_vdpau_surface_wait_decode (
+      driver_data, surface_obj, deadline);
+  if (va_st == VA_STATUS_ERROR_TIMEDOUT)
+    return va_st;
+
+  if (__atomic_load_n (&surface_obj->state, __ATOMIC_ACQUIRE) ==
+      FLU_VA_DRIVERS_VDPAU_SURFACE_STATE_DISPLAYING) {
+    display_va_st = flu_va_drivers_vdpau_surface_wait_display (
+        driver_data, surface_obj, deadline);
+    if (display_va_st != VA_STATUS_SUCCESS)
+      return display_va_st;
+  }
+
+  return va_st;
+}
+
+/* Reads the whole surface into the image, which must not be smaller. */
+static VAStatus
+flu_va_drivers_vdpau_read_surface (FluVaDriversVdpauDriverData *driver_data,
+    FluVaDriversVdpauSurfaceObject *surface_obj,
+    FluVaDriversVdpauImageObject *image_obj)
+{
+  ImagePtr img_ptr;
+  VdpStatus vdp_st;
+  VAStatus ret;
+
+  ret = get_image_ptr (driver_data, image_obj, &img_ptr);
+  if (ret != VA_STATUS_SUCCESS)
+    return ret;
+
+  switch (image_obj->format_type) {
+    case FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_YCBCR:
+      vdp_st = driver_data->vdp_impl.vdp_video_surface_get_bits_y_cb_cr (
+          surface_obj->vdp_surface, image_obj->vdp_format, img_ptr.planes,
+          img_ptr.pitches);
+      if (vdp_st != VDP_STATUS_OK)
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+      break;
+    default:
+      return VA_STATUS_ERROR_INVALID_IMAGE;
+  }
+
+  return VA_STATUS_SUCCESS;
+}
+
+/* Reads the surface of a derived image back into its shadow, unless the
+ * shadow already holds the current content of the surface. */
+static VAStatus
+flu_va_drivers_vdpau_update_shadow (FluVaDriversVdpauDriverData *driver_data,
+    FluVaDriversVdpauBufferObject *buffer_obj)
+{
+  FluVaDriversVdpauSurfaceObject *surface_obj;
+  FluVaDriversVdpauImageObject *image_obj;
+  VAStatus ret;
+
+  image_obj = (FluVaDriversVdpauImageObject *) object_heap_lookup (
+      &driver_data->image_heap, buffer_obj->derived_image);
+  if (image_obj == NULL)
+    return VA_STATUS_ERROR_INVALID_IMAGE;
+
+  surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
+      &driver_data->surface_heap, image_obj->derived_surface);
+  if (surface_obj == NULL)
+    return VA_STATUS_ERROR_INVALID_SURFACE;
+
+  flu_va_drivers_vdpau_surface_wait_decode (driver_data, surface_obj, NULL);
+  if (surface_obj->shadow_generation == surface_obj->generation)
+    return VA_STATUS_SUCCESS;
+
+  ret = flu_va_drivers_vdpau_read_surface (driver_data, surface_obj, image_obj);
+  if (ret != VA_STATUS_SUCCESS)
+    return ret;
+
+  surface_obj->shadow_generation = surface_obj->generation;
+  return VA_STATUS_SUCCESS;
+}
+
+/* Cheap digest of a shadow, to tell whether a mapping was written to. */
+static uint64_t
+flu_va_drivers_vdpau_shadow_digest (const void *data, size_t size)
+{
+  const uint8_t *bytes = data;
+  uint64_t digest = size, word;
+  size_t i;
+
+  for (i = 0; i + sizeof (word) <= size; i += sizeof (word)) {
+    memcpy (&word, bytes + i, sizeof (word));
+    digest = (digest ^ word) * 0x9e3779b97f4a7c15ULL;
+    digest ^= digest >> 29;
+  }
+  for (; i < size; i++)
+    digest = (digest ^ bytes[i]) * 0x9e3779b97f4a7c15ULL;
+
+  return digest;
+}
+
+/* Writes the shadow of a derived image, as mapped for writing, back to its
+ * surface. A picture decoded or put into the surface since the shadow was
+ * read wins over the writes to the mapping. */
+static VAStatus
+flu_va_drivers_vdpau_upload_shadow (FluVaDriversVdpauDriverData *driver_data,
+    FluVaDriversVdpauBufferObject *buffer_obj)
+{
+  FluVaDriversVdpauSurfaceObject *surface_obj;
+  FluVaDriversVdpauImageObject *image_obj;
+  ImagePtr img_ptr;
+  VdpStatus vdp_st;
+  VAStatus ret;
+
+  image_obj = (FluVaDriversVdpauImageObject *) object_heap_lookup (
+      &driver_data->image_heap, buffer_obj->derived_image);
+  if (image_obj == NULL)
+    return VA_STATUS_ERROR_INVALID_IMAGE;
+
+  surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
+      &driver_data->surface_heap, image_obj->derived_surface);
+  if (surface_obj == NULL)
+    return VA_STATUS_ERROR_INVALID_SURFACE;
+
+  /* The decodes queued before the mapping were waited for by
+   * flu_va_drivers_vdpau_update_shadow. */
+  if (surface_obj->shadow_generation != surface_obj->generation)
+    return VA_STATUS_SUCCESS;
+
+  ret = get_image_ptr (driver_data, image_obj, &img_ptr);
+  if (ret != VA_STATUS_SUCCESS)
+    return ret;
+
+  vdp_st = driver_data->vdp_impl.vdp_video_surface_put_bits_y_cb_cr (
+      surface_obj->vdp_surface, image_obj->vdp_format,
+      (const void *const *) img_ptr.planes, img_ptr.pitches);
+  if (vdp_st != VDP_STATUS_OK)
+    return VA_STATUS_ERROR_OPERATION_FAILED;
+
+  /* The shadow is now the content of the surface. */
+  surface_obj->generation++;
+  surface_obj->shadow_generation = surface_obj->generation;
+  return VA_STATUS_SUCCESS;
+}
+
+/* Pairs with the release store of flu_va_drivers_vdpau_ensure_device, so a
+ * table probed by another thread is seen whole. */
+static const FluVaDriversVdpauCaps *
+flu_va_drivers_vdpau_get_caps (FluVaDriversVdpauDriverData *driver_data)
+{
+  return __atomic_load_n (&driver_data->caps, __ATOMIC_ACQUIRE);
+}
+
+/* The device is created on the first call that needs it, since the
+ * capabilities of a probing process may come from the on-disk cache. Creating
+ * it validates that cache, which is refreshed if the VDPAU driver changed. */
+static VAStatus
+flu_va_drivers_vdpau_ensure_device (FluVaDriversVdpauDriverData *driver_data)
+{
+  VADriverContextP ctx = driver_data->ctx;
+  VdpGetProcAddress *get_proc_address;
+  VdpDevice device = VDP_INVALID_HANDLE;
+  const char *info_string = NULL;
+  VAStatus va_st = VA_STATUS_SUCCESS;
+
+  if (__atomic_load_n (&driver_data->has_device, __ATOMIC_ACQUIRE))
+    return VA_STATUS_SUCCESS;
+
+  pthread_mutex_lock (&driver_data->device_mutex);
+  if (driver_data->has_device)
+    goto beach;
+
+  if (vdp_device_create_x11 (driver_data->x11_dpy, ctx->x11_screen, &device,
+          &get_proc_address) != VDP_STATUS_OK) {
+    va_st = VA_STATUS_ERROR_UNKNOWN;
+    goto beach;
+  }
+
+  if (flu_va_drivers_vdpau_vdp_device_impl_init (
+          &driver_data->vdp_impl, device, get_proc_address) != VDP_STATUS_OK) {
+    va_st = VA_STATUS_ERROR_UNKNOWN;
+    goto beach;
+  }
+
+  if (driver_data->vdp_impl.vdp_get_information_string (&info_string) !=
+          VDP_STATUS_OK ||
+      info_string == NULL)
+    info_string = "";
+  if (!flu_va_drivers_vdpau_caps_cache_is_valid (
+          &driver_data->caps_cache, info_string)) {
+    /* Probe into the table nobody reads yet, then publish it in one step so
+     * that concurrent queries see either the cached or the probed table. */
+    FluVaDriversVdpauCaps *caps = &driver_data->caps_storage[1];
+
+    flu_va_drivers_vdpau_caps_init (caps, &driver_data->vdp_impl);
+    flu_va_drivers_vdpau_caps_cache_store (
+        &driver_data->caps_cache, info_string, caps);
+    __atomic_store_n (&driver_data->caps, caps, __ATOMIC_RELEASE);
+  }
+
+  __atomic_store_n (&driver_data->has_device, 1, __ATOMIC_RELEASE);
+
+beach:
+  pthread_mutex_unlock (&driver_data->device_mutex);
+  return va_st;
+}
+
 static VAStatus
 flu_va_drivers_vdpau_Terminate (VADriverContextP ctx)
 {
   FluVaDriversVdpauDriverData *driver_data =
       (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  FluVaDriversVdpauContextObject *context_obj;
+  FluVaDriversVdpauSurfaceObject *surface_obj;
+  FluVaDriversVdpauBufferObject *buffer_obj;
+  object_heap_iterator iter;
+
+  /* Stop the workers of the contexts not destroyed by the client, and give
+   * their decoders back, while the decoder cache and the pools still exist. */
+  context_obj = (FluVaDriversVdpauContextObject *) object_heap_first (
+      &driver_data->context_heap, &iter);
+  while (context_obj != NULL) {
+    flu_va_drivers_vdpau_destroy_context (ctx, context_obj);
+    context_obj = (FluVaDriversVdpauContextObject *) object_heap_next (
+        &driver_data->context_heap, &iter);
+  }
 
   object_heap_terminate (&driver_data->config_heap);
   object_heap_terminate (&driver_data->context_heap);
+
+  /* Give the data of the surfaces and buffers not destroyed by the client
+   * back to the pool, which frees it on destruction. */
+  surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_first (
+      &driver_data->surface_heap, &iter);
+  while (surface_obj != NULL) {
+    flu_va_drivers_vdpau_buffer_pool_release (&driver_data->buffer_pool,
+        surface_obj->shadow, surface_obj->shadow_capacity);
+    surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_next (
+        &driver_data->surface_heap, &iter);
+  }
   object_heap_terminate (&driver_data->surface_heap);
+
+  buffer_obj = (FluVaDriversVdpauBufferObject *) object_heap_first (
+      &driver_data->buffer_heap, &iter);
+  while (buffer_obj != NULL) {
+    if (buffer_obj->derived_image == VA_INVALID_ID) {
+      flu_va_drivers_vdpau_buffer_pool_release (
+          &driver_data->buffer_pool, buffer_obj->data, buffer_obj->capacity);
+    }
+    buffer_obj = (FluVaDriversVdpauBufferObject *) object_heap_next (
+        &driver_data->buffer_heap, &iter);
+  }
   object_heap_terminate (&driver_data->buffer_heap);
+  flu_va_drivers_vdpau_buffer_pool_destroy (&driver_data->buffer_pool);
+  flu_va_drivers_vdpau_decoder_cache_destroy (&driver_data->decoder_cache);
+  flu_va_drivers_vdpau_surface_pool_destroy (&driver_data->surface_pool);
   object_heap_terminate (&driver_data->image_heap);
   object_heap_terminate (&driver_data->subpic_heap);
 
-  if (driver_data->x11_dpy != ctx->native_dpy)
+  if (driver_data->x11_dpy != NULL && driver_data->x11_dpy != ctx->native_dpy)
     XCloseDisplay (driver_data->x11_dpy);
+  pthread_mutex_destroy (&driver_data->device_mutex);
 
   free (driver_data);
 
@@ -82,43 +429,19 @@ static VAStatus
 flu_va_drivers_vdpau_QueryConfigProfiles (
     VADriverContextP ctx, VAProfile *profile_list, int *num_profiles)
 {
-  VAProfile suported_profiles[FLU_VA_DRIVERS_VDPAU_MAX_PROFILES] = {
-    VAProfileH264ConstrainedBaseline, VAProfileH264Main, VAProfileH264High
-  };
   FluVaDriversVdpauDriverData *driver_data =
       (FluVaDriversVdpauDriverData *) ctx->pDriverData;
-  int i;
-
-  for (i = 0, *num_profiles = 0; i < FLU_VA_DRIVERS_VDPAU_MAX_PROFILES; i++) {
-    VdpDecoderProfile vdp_profile;
-    VdpBool is_supported;
-    uint32_t unused_max_macroblocks, unused_max_level, unused_max_width,
-        unused_max_height;
-    VdpStatus vdp_st;
-    VAStatus va_st;
-
-    va_st = flu_va_drivers_map_va_profile_to_vdpau_decoder_profile (
-        suported_profiles[i], &vdp_profile);
-    if (va_st == VA_STATUS_ERROR_UNSUPPORTED_PROFILE)
-      continue;
-
-    vdp_st = driver_data->vdp_impl.vdp_decoder_query_capabilities (
-        driver_data->vdp_impl.vdp_device, vdp_profile, &is_supported,
-        &unused_max_level, &unused_max_macroblocks, &unused_max_width,
-        &unused_max_height);
-
-    if (vdp_st != VDP_STATUS_OK)
-      goto vdp_query_failed;
-    if (!is_supported)
-      continue;
-
-    profile_list[(*num_profiles)++] = suported_profiles[i];
+  const FluVaDriversVdpauCaps *caps =
+      flu_va_drivers_vdpau_get_caps (driver_data);
+  unsigned int i;
+
+  *num_profiles = 0;
+  for (i = 0; i < caps->num_decoders; i++) {
+    if (caps->decoders[i].is_supported)
+      profile_list[(*num_profiles)++] = caps->decoders[i].va_profile;
   }
 
   return VA_STATUS_SUCCESS;
-
-vdp_query_failed:
-  return VA_STATUS_ERROR_UNKNOWN;
 }
 
 static VAStatus
@@ -128,9 +451,27 @@ flu_va_drivers_vdpau_QueryConfigEntrypoints (VADriverContextP ctx,
   *num_entrypoints = 0;
 
   switch (profile) {
+    case VAProfileMPEG2Simple:
+    case VAProfileMPEG2Main:
+    case VAProfileMPEG4Simple:
+    case VAProfileMPEG4AdvancedSimple:
+    case VAProfileVC1Simple:
+    case VAProfileVC1Main:
+    case VAProfileVC1Advanced:
     case VAProfileH264ConstrainedBaseline:
     case VAProfileH264Main:
     case VAProfileH264High:
+    case VAProfileHEVCMain:
+    case VAProfileHEVCMain10:
+#ifdef HAVE_VDPAU_HIGH_BIT_DEPTH
+    case VAProfileHEVCMain12:
+#endif
+#ifdef HAVE_VDPAU_VP9
+    case VAProfileVP9Profile0:
+#endif
+#ifdef HAVE_VDPAU_AV1
+    case VAProfileAV1Profile0:
+#endif
       entrypoint_list[(*num_entrypoints)++] = VAEntrypointVLD;
       break;
     default:
@@ -145,6 +486,9 @@ flu_va_drivers_vdpau_GetConfigAttributes (VADriverContextP ctx,
     VAProfile profile, VAEntrypoint entrypoint, VAConfigAttrib *attrib_list,
     int num_attribs)
 {
+  FluVaDriversVdpauDriverData *driver_data =
+      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  const FluVaDriversVdpauDecoderCaps *decoder_caps;
   int i;
 
   if (!flu_va_drivers_vdpau_is_profile_supported (profile))
@@ -152,12 +496,14 @@ flu_va_drivers_vdpau_GetConfigAttributes (VADriverContextP ctx,
   if (!flu_va_drivers_vdpau_is_entrypoint_supported (entrypoint))
     return VA_STATUS_ERROR_UNSUPPORTED_ENTRYPOINT;
 
-  // For vdpau >= 1.2, we should check if the chroma type is supported by
-  // calling VdpDecoderQueryProfileCapability.
+  decoder_caps = flu_va_drivers_vdpau_caps_get_decoder (
+      flu_va_drivers_vdpau_get_caps (driver_data), profile);
   for (i = 0; i < num_attribs; i++) {
     switch (attrib_list[i].type) {
       case VAConfigAttribRTFormat:
-        attrib_list[i].value = VA_RT_FORMAT_YUV420;
+        attrib_list[i].value = decoder_caps != NULL
+                                   ? decoder_caps->rt_formats
+                                   : VA_ATTRIB_NOT_SUPPORTED;
         break;
       default:
         attrib_list[i].value = VA_ATTRIB_NOT_SUPPORTED;
@@ -176,27 +522,38 @@ flu_va_drivers_vdpau_CreateConfig (VADriverContextP ctx, VAProfile profile,
   FluVaDriversVdpauDriverData *driver_data =
       (FluVaDriversVdpauDriverData *) ctx->pDriverData;
   FluVaDriversVdpauConfigObject *config_obj;
+  const FluVaDriversVdpauDecoderCaps *decoder_caps;
+  const FluVaDriversVdpauCodecOps *codec_ops;
   VAConfigAttrib *attrib;
-  VdpStatus vdp_st;
+  unsigned int rt_format;
   VAStatus va_st;
-  VdpDecoderProfile vdp_profile;
-  uint32_t unused_max_level, unused_max_macroblocks, max_width, max_height;
-  VdpBool is_profile_supported;
 
-  va_st = flu_va_drivers_map_va_profile_to_vdpau_decoder_profile (
-      profile, &vdp_profile);
+  va_st = flu_va_drivers_vdpau_ensure_device (driver_data);
   if (va_st != VA_STATUS_SUCCESS)
-    return VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
+    return va_st;
+
   /* Check profile hardware support */
-  vdp_st = driver_data->vdp_impl.vdp_decoder_query_capabilities (
-      driver_data->vdp_impl.vdp_device, vdp_profile, &is_profile_supported,
-      &unused_max_level, &unused_max_macroblocks, &max_width, &max_height);
-  if (vdp_st != VDP_STATUS_OK || !is_profile_supported)
+  decoder_caps = flu_va_drivers_vdpau_caps_get_decoder (
+      flu_va_drivers_vdpau_get_caps (driver_data), profile);
+  if (decoder_caps == NULL)
+    return VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
+  codec_ops = flu_va_drivers_vdpau_get_codec_ops (profile);
+  if (codec_ops == NULL)
     return VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
 
   if (!flu_va_drivers_vdpau_is_entrypoint_supported (entrypoint))
     return VA_STATUS_ERROR_UNSUPPORTED_ENTRYPOINT;
 
+  /* Without the attribute, any of the formats decoded by the profile. */
+  rt_format = decoder_caps->rt_formats;
+  attrib = flu_va_drivers_vdpau_lookup_config_attrib_type (
+      attrib_list, num_attribs, VAConfigAttribRTFormat);
+  if (attrib) {
+    if (attrib->value == 0 || (attrib->value & ~decoder_caps->rt_formats))
+      return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
+    rt_format = attrib->value;
+  }
+
   *config_id = object_heap_allocate (&driver_data->config_heap);
   if (*config_id == -1)
     return VA_STATUS_ERROR_ALLOCATION_FAILED;
@@ -205,17 +562,15 @@ flu_va_drivers_vdpau_CreateConfig (VADriverContextP ctx, VAProfile profile,
   assert (config_obj != NULL);
 
   config_obj->profile = profile;
-  config_obj->max_width = max_width;
-  config_obj->max_height = max_height;
+  config_obj->vdp_profile = decoder_caps->vdp_profile;
+  config_obj->codec_ops = codec_ops;
+  config_obj->max_width = decoder_caps->max_width;
+  config_obj->max_height = decoder_caps->max_height;
   config_obj->entrypoint = entrypoint;
 
   config_obj->num_attribs = 1;
   config_obj->attrib_list[0].type = VAConfigAttribRTFormat;
-  config_obj->attrib_list[0].value = VA_RT_FORMAT_YUV420;
-  attrib = flu_va_drivers_vdpau_lookup_config_attrib_type (
-      attrib_list, num_attribs, VAConfigAttribRTFormat);
-  if (attrib && attrib->value != VA_RT_FORMAT_YUV420)
-    return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
+  config_obj->attrib_list[0].value = rt_format;
 
   return VA_STATUS_SUCCESS;
 }
@@ -286,7 +641,7 @@ flu_va_drivers_vdpau_DestroySurfaces (
 
   for (i = 0; i < num_surfaces; i++) {
     FluVaDriversVdpauSurfaceObject *surface_obj;
-    VdpStatus vdp_st;
+    FluVaDriversVdpauContextObject *context_obj;
 
     surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
         &driver_data->surface_heap, surface_list[i]);
@@ -297,12 +652,21 @@ flu_va_drivers_vdpau_DestroySurfaces (
       continue;
     }
 
-    vdp_st = driver_data->vdp_impl.vdp_video_surface_destroy (
+    /* The surface can be handed to a later vaCreateSurfaces once no job of
+     * its context uses it, as target or as reference of another target. */
+    context_obj = (FluVaDriversVdpauContextObject *) object_heap_lookup (
+        &driver_data->context_heap, surface_obj->context_id);
+    if (context_obj != NULL)
+      flu_va_drivers_vdpau_decode_queue_drain (&context_obj->decode_queue);
+    flu_va_drivers_vdpau_surface_wait_decode (driver_data, surface_obj, NULL);
+    flu_va_drivers_vdpau_surface_pool_release (&driver_data->surface_pool,
+        surface_obj->vdp_chroma_type, surface_obj->width, surface_obj->height,
         surface_obj->vdp_surface);
-    if (ret == VA_STATUS_SUCCESS && vdp_st != VDP_STATUS_OK)
-      ret = VA_STATUS_ERROR_UNKNOWN;
+    flu_va_drivers_vdpau_buffer_pool_release (&driver_data->buffer_pool,
+        surface_obj->shadow, surface_obj->shadow_capacity);
     object_heap_free (&driver_data->surface_heap, (object_base_p) surface_obj);
   }
+  __atomic_add_fetch (&driver_data->surface_epoch, 1, __ATOMIC_RELEASE);
 
   return ret;
 }
@@ -314,14 +678,24 @@ flu_va_drivers_vdpau_destroy_context (
   FluVaDriversVdpauDriverData *driver_data =
       (FluVaDriversVdpauDriverData *) ctx->pDriverData;
   VAStatus va_st, ret = VA_STATUS_SUCCESS;
-  VdpStatus vdp_st;
   FluVaDriversVdpauVideoMixerObject *video_mixer_obj;
-
-  if (context_obj->vdp_decoder != VDP_INVALID_HANDLE) {
-    vdp_st =
-        driver_data->vdp_impl.vdp_decoder_destroy (context_obj->vdp_decoder);
-    if (vdp_st != VDP_STATUS_OK)
-      ret = VA_STATUS_ERROR_UNKNOWN;
+  FluVaDriversVdpauSurfaceObject *surface_obj;
+  object_heap_iterator iter;
+
+  /* Buffers adopted by a picture that was never ended. */
+  flu_va_drivers_vdpau_bitstream_release (
+      &context_obj->bitstream, &driver_data->buffer_pool);
+  flu_va_drivers_vdpau_decode_queue_destroy (&context_obj->decode_queue);
+
+  /* The surfaces outlive the context and can be bound to a new one, whose ID
+   * differs from this one even when it reuses its slot. */
+  surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_first (
+      &driver_data->surface_heap, &iter);
+  while (surface_obj != NULL) {
+    if (surface_obj->context_id == (VAContextID) context_obj->base.id)
+      surface_obj->context_id = VA_INVALID_ID;
+    surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_next (
+        &driver_data->surface_heap, &iter);
   }
 
   video_mixer_obj = (FluVaDriversVdpauVideoMixerObject *) object_heap_lookup (
@@ -344,9 +718,10 @@ flu_va_drivers_vdpau_destroy_context (
     ret = va_st;
 
   free (context_obj->render_targets);
+  flu_va_drivers_vdpau_context_object_finalize (context_obj);
   object_heap_free (&driver_data->context_heap, (object_base_p) context_obj);
 
-  return va_st;
+  return ret;
 }
 
 static VAStatus
@@ -358,13 +733,32 @@ flu_va_drivers_vdpau_CreateContext (VADriverContextP ctx, VAConfigID config_id,
       (FluVaDriversVdpauDriverData *) ctx->pDriverData;
   FluVaDriversVdpauConfigObject *config_obj;
   FluVaDriversVdpauContextObject *context_obj;
+  FluVaDriversVdpauDecoderConfig decoder_config;
+  const FluVaDriversVdpauDecoderConfig *initial_config = NULL;
   int i = 0, context_obj_id;
+  VAStatus va_st;
 
   config_obj = (FluVaDriversVdpauConfigObject *) object_heap_lookup (
       &driver_data->config_heap, config_id);
   if (config_obj == NULL)
     return VA_STATUS_ERROR_INVALID_CONFIG;
 
+  if (picture_width > config_obj->max_width ||
+      picture_height > config_obj->max_height)
+    return VA_STATUS_ERROR_RESOLUTION_NOT_SUPPORTED;
+
+  /* The decoder is created by the context worker, sized for the default
+   * references of the codec, and recreated if the stream uses another
+   * count. */
+  if (picture_width > 0 && picture_height > 0) {
+    decoder_config.vdp_profile = config_obj->vdp_profile;
+    decoder_config.width = picture_width;
+    decoder_config.height = picture_height;
+    decoder_config.max_references =
+        config_obj->codec_ops->default_max_references;
+    initial_config = &decoder_config;
+  }
+
   context_obj_id = object_heap_allocate (&driver_data->context_heap);
   if (context_obj_id == -1)
     return VA_STATUS_ERROR_ALLOCATION_FAILED;
@@ -372,18 +766,23 @@ flu_va_drivers_vdpau_CreateContext (VADriverContextP ctx, VAConfigID config_id,
       &driver_data->context_heap, context_obj_id);
   assert (context_obj != NULL);
 
-  if (picture_width > config_obj->max_width ||
-      picture_height > config_obj->max_height)
-    return VA_STATUS_ERROR_RESOLUTION_NOT_SUPPORTED;
-
   context_obj->config_id = config_id;
+  context_obj->vdp_profile = config_obj->vdp_profile;
+  context_obj->codec_ops = config_obj->codec_ops;
   context_obj->flag = flag;
   context_obj->picture_width = picture_width;
   context_obj->picture_height = picture_height;
   context_obj->render_targets = NULL;
   context_obj->num_render_targets = num_render_targets;
-  context_obj->vdp_bs_buf = NULL;
-  context_obj->vdp_decoder = VDP_INVALID_HANDLE;
+  context_obj->slice_params = NULL;
+  context_obj->slice_param_size = 0;
+  context_obj->num_slice_params = 0;
+  context_obj->cap_slice_params = 0;
+  memset (&context_obj->bitstream, 0, sizeof (context_obj->bitstream));
+  memset (&context_obj->vdp_pic_info, 0, sizeof (context_obj->vdp_pic_info));
+  memset (&context_obj->param_cache, 0, sizeof (context_obj->param_cache));
+  flu_va_drivers_vdpau_ref_frame_cache_clear (&context_obj->ref_frame_cache,
+      __atomic_load_n (&driver_data->surface_epoch, __ATOMIC_ACQUIRE));
   context_obj->video_mixer_id = FLU_VA_DRIVERS_INVALID_ID;
   flu_va_drivers_vdpau_context_init_presentaton_queue_map (context_obj);
   context_obj->vdp_presentation_queue = VDP_INVALID_HANDLE;
@@ -391,6 +790,14 @@ flu_va_drivers_vdpau_CreateContext (VADriverContextP ctx, VAConfigID config_id,
   context_obj->vdp_output_surface_idx = 0;
   flu_va_drivers_vdpau_context_clear_output_surfaces (context_obj);
 
+  va_st = flu_va_drivers_vdpau_decode_queue_init (&context_obj->decode_queue,
+      &driver_data->vdp_impl, &driver_data->decoder_cache,
+      &driver_data->buffer_pool, initial_config);
+  if (va_st != VA_STATUS_SUCCESS) {
+    object_heap_free (&driver_data->context_heap, (object_base_p) context_obj);
+    return va_st;
+  }
+
   flu_va_drivers_vdpau_context_object_reset (context_obj);
 
   if (num_render_targets == 0)
@@ -398,6 +805,11 @@ flu_va_drivers_vdpau_CreateContext (VADriverContextP ctx, VAConfigID config_id,
 
   context_obj->render_targets =
       calloc (num_render_targets, sizeof (VASurfaceID));
+  if (context_obj->render_targets == NULL) {
+    flu_va_drivers_vdpau_destroy_context (ctx, context_obj);
+    return VA_STATUS_ERROR_ALLOCATION_FAILED;
+  }
+
   do {
     FluVaDriversVdpauSurfaceObject *surface_obj;
     surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
@@ -455,14 +867,13 @@ flu_va_drivers_vdpau_CreateBuffer (VADriverContextP ctx, VAContextID context,
   FluVaDriversVdpauBufferObject *buffer_obj;
   int buffer_obj_id;
 
-  // Support only num_elements == 1, because this is the use-case of most of
-  // the programs, including Chromium that is what we target in this project.
-  if (size == 0 || num_elements != 1)
+  if (size == 0 || num_elements == 0 || num_elements > SIZE_MAX / size)
     return VA_STATUS_ERROR_INVALID_VALUE;
 
   switch (type) {
     case VAPictureParameterBufferType:
     case VAIQMatrixBufferType:
+    case VABitPlaneBufferType:
     case VASliceParameterBufferType:
     case VASliceDataBufferType:
     case VAImageBufferType:
@@ -482,8 +893,15 @@ flu_va_drivers_vdpau_CreateBuffer (VADriverContextP ctx, VAContextID context,
   buffer_obj->type = type;
   buffer_obj->size = size;
   buffer_obj->num_elements = num_elements;
-  buffer_obj->data = malloc (buffer_obj->size);
-  assert (buffer_obj->data != NULL);
+  buffer_obj->derived_image = VA_INVALID_ID;
+  buffer_obj->map_access = 0;
+  buffer_obj->data = flu_va_drivers_vdpau_buffer_pool_acquire (
+      &driver_data->buffer_pool, buffer_obj->size * buffer_obj->num_elements,
+      &buffer_obj->capacity);
+  if (buffer_obj->data == NULL) {
+    object_heap_free (&driver_data->buffer_heap, (object_base_p) buffer_obj);
+    return VA_STATUS_ERROR_ALLOCATION_FAILED;
+  }
   if (data != NULL) {
     memcpy (
         buffer_obj->data, data, buffer_obj->size * buffer_obj->num_elements);
@@ -499,13 +917,17 @@ flu_va_drivers_vdpau_BufferSetNumElements (
   return VA_STATUS_ERROR_UNIMPLEMENTED;
 }
 
+/* A derived image mapped for writing is uploaded to its surface on unmap.
+ * Most clients map without telling the access, so the image is then only
+ * uploaded if its content changed. */
 static VAStatus
-flu_va_drivers_vdpau_MapBuffer (
-    VADriverContextP ctx, VABufferID buf_id, void **pbuf)
+flu_va_drivers_vdpau_map_buffer (
+    VADriverContextP ctx, VABufferID buf_id, void **pbuf, unsigned int access)
 {
   FluVaDriversVdpauDriverData *driver_data =
       (FluVaDriversVdpauDriverData *) ctx->pDriverData;
   FluVaDriversVdpauBufferObject *buffer_obj;
+  VAStatus va_st;
 
   if (pbuf == NULL)
     return VA_STATUS_ERROR_INVALID_PARAMETER;
@@ -515,25 +937,74 @@ flu_va_drivers_vdpau_MapBuffer (
   if (buffer_obj == NULL)
     return VA_STATUS_ERROR_INVALID_BUFFER;
 
+  if (buffer_obj->derived_image != VA_INVALID_ID) {
+    va_st = flu_va_drivers_vdpau_update_shadow (driver_data, buffer_obj);
+    if (va_st != VA_STATUS_SUCCESS)
+      return va_st;
+    buffer_obj->map_access = access;
+    if (access == (FLU_VA_DRIVERS_VDPAU_MAP_READ |
+                      FLU_VA_DRIVERS_VDPAU_MAP_WRITE)) {
+      buffer_obj->map_digest = flu_va_drivers_vdpau_shadow_digest (
+          buffer_obj->data, buffer_obj->size);
+    }
+  }
+
   assert (buffer_obj->data != NULL);
   *pbuf = buffer_obj->data;
 
   return VA_STATUS_SUCCESS;
 }
 
+/* Without access flags the mapping may be read and written. */
+static VAStatus
+flu_va_drivers_vdpau_MapBuffer (
+    VADriverContextP ctx, VABufferID buf_id, void **pbuf)
+{
+  return flu_va_drivers_vdpau_map_buffer (ctx, buf_id, pbuf,
+      FLU_VA_DRIVERS_VDPAU_MAP_READ | FLU_VA_DRIVERS_VDPAU_MAP_WRITE);
+}
+
+#if VA_CHECK_VERSION(1, 21, 0)
+static VAStatus
+flu_va_drivers_vdpau_MapBuffer2 (
+    VADriverContextP ctx, VABufferID buf_id, void **pbuf, uint32_t flags)
+{
+  unsigned int access = 0;
+
+  if (flags & VA_MAPBUFFER_FLAG_READ)
+    access |= FLU_VA_DRIVERS_VDPAU_MAP_READ;
+  if (flags & VA_MAPBUFFER_FLAG_WRITE)
+    access |= FLU_VA_DRIVERS_VDPAU_MAP_WRITE;
+  if (access == 0)
+    access = FLU_VA_DRIVERS_VDPAU_MAP_READ | FLU_VA_DRIVERS_VDPAU_MAP_WRITE;
+
+  return flu_va_drivers_vdpau_map_buffer (ctx, buf_id, pbuf, access);
+}
+#endif
+
 static VAStatus
 flu_va_drivers_vdpau_UnmapBuffer (VADriverContextP ctx, VABufferID buf_id)
 {
   FluVaDriversVdpauDriverData *driver_data =
       (FluVaDriversVdpauDriverData *) ctx->pDriverData;
   FluVaDriversVdpauBufferObject *buffer_obj;
+  unsigned int access;
 
   buffer_obj = (FluVaDriversVdpauBufferObject *) object_heap_lookup (
       &driver_data->buffer_heap, buf_id);
   if (buffer_obj == NULL)
     return VA_STATUS_ERROR_INVALID_BUFFER;
 
-  return VA_STATUS_SUCCESS;
+  access = buffer_obj->map_access;
+  buffer_obj->map_access = 0;
+  if (!(access & FLU_VA_DRIVERS_VDPAU_MAP_WRITE))
+    return VA_STATUS_SUCCESS;
+  if ((access & FLU_VA_DRIVERS_VDPAU_MAP_READ) &&
+      flu_va_drivers_vdpau_shadow_digest (buffer_obj->data,
+          buffer_obj->size) == buffer_obj->map_digest)
+    return VA_STATUS_SUCCESS;
+
+  return flu_va_drivers_vdpau_upload_shadow (driver_data, buffer_obj);
 }
 
 static VAStatus
@@ -549,7 +1020,11 @@ flu_va_drivers_vdpau_DestroyBuffer (VADriverContextP ctx, VABufferID buffer_id)
     return VA_STATUS_ERROR_INVALID_BUFFER;
 
   assert (buffer_obj->data);
-  free (buffer_obj->data);
+  /* The shadow of a derived image belongs to its surface. */
+  if (buffer_obj->derived_image == VA_INVALID_ID) {
+    flu_va_drivers_vdpau_buffer_pool_release (
+        &driver_data->buffer_pool, buffer_obj->data, buffer_obj->capacity);
+  }
   object_heap_free (&driver_data->buffer_heap, (object_base_p) buffer_obj);
 
   return VA_STATUS_SUCCESS;
@@ -614,19 +1089,21 @@ flu_va_drivers_vdpau_RenderPicture (VADriverContextP ctx, VAContextID context,
     buffer_obj = (FluVaDriversVdpauBufferObject *) object_heap_lookup (
         &driver_data->buffer_heap, buffers[i]);
     if (buffer_obj == NULL ||
-        !flu_va_driver_vdpau_is_buffer_type_supported (buffer_obj->type))
+        !context_obj->codec_ops->is_buffer_type_supported (buffer_obj->type))
       return VA_STATUS_ERROR_INVALID_BUFFER;
   }
 
   for (i = 0; i < num_buffers; i++) {
     FluVaDriversVdpauBufferObject *buffer_obj;
+    VAStatus va_st;
 
     buffer_obj = (FluVaDriversVdpauBufferObject *) object_heap_lookup (
         &driver_data->buffer_heap, buffers[i]);
     assert (buffer_obj != NULL);
 
-    if (flu_va_driver_vdpau_translate_buffer_h264 (
-            ctx, context_obj, buffer_obj) != VA_STATUS_SUCCESS)
+    va_st = context_obj->codec_ops->translate_buffer (
+        ctx, context_obj, buffer_obj);
+    if (va_st != VA_STATUS_SUCCESS)
       goto translation_error;
   }
 
@@ -644,10 +1121,8 @@ flu_va_drivers_vdpau_EndPicture (VADriverContextP ctx, VAContextID context)
   FluVaDriversVdpauDriverData *driver_data =
       (FluVaDriversVdpauDriverData *) ctx->pDriverData;
   FluVaDriversVdpauContextObject *context_obj;
-  FluVaDriversVdpauConfigObject *config_obj;
   FluVaDriversVdpauSurfaceObject *surface_obj;
-  VdpDecoderProfile vdp_profile;
-  VdpStatus vdp_st;
+  FluVaDriversVdpauDecoderConfig decoder_config;
   VAStatus ret;
 
   context_obj = (FluVaDriversVdpauContextObject *) object_heap_lookup (
@@ -655,54 +1130,44 @@ flu_va_drivers_vdpau_EndPicture (VADriverContextP ctx, VAContextID context)
   if (context_obj == NULL)
     return VA_STATUS_ERROR_INVALID_CONTEXT;
 
-  config_obj = (FluVaDriversVdpauConfigObject *) object_heap_lookup (
-      &driver_data->config_heap, context_obj->config_id);
-  if (config_obj == NULL)
-    return VA_STATUS_ERROR_INVALID_CONFIG;
-
   surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
       &driver_data->surface_heap, context_obj->current_render_target);
   if (surface_obj == NULL)
     return VA_STATUS_ERROR_INVALID_SURFACE;
 
-  if (flu_va_drivers_map_va_profile_to_vdpau_decoder_profile (
-          config_obj->profile, &vdp_profile) != VA_STATUS_SUCCESS)
-    return VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
+  /* The context worker recreates the decoder if it does not fit this
+   * configuration. */
+  decoder_config.vdp_profile = context_obj->vdp_profile;
+  decoder_config.width = context_obj->picture_width;
+  decoder_config.height = context_obj->picture_height;
+  decoder_config.max_references = 0;
+  context_obj->codec_ops->end_picture (context_obj, &decoder_config);
 
-  // FIXME: Using 16 as a temporary max_ref_frames, but may lead into
-  // waste of memory.
-  if (context_obj->vdp_decoder == VDP_INVALID_HANDLE) {
-    vdp_st = driver_data->vdp_impl.vdp_decoder_create (
-        driver_data->vdp_impl.vdp_device, vdp_profile,
-        context_obj->picture_width, context_obj->picture_height, 16,
-        &context_obj->vdp_decoder);
-
-    if (vdp_st != VDP_STATUS_OK) {
-      context_obj->vdp_decoder = VDP_INVALID_HANDLE;
-      ret = VA_STATUS_ERROR_UNKNOWN;
-      goto beach;
-    }
-  }
+  if (decoder_config.max_references < 1)
+    decoder_config.max_references = 1;
+  else if (decoder_config.max_references > 16)
+    decoder_config.max_references = 16;
 
   /* TODO: Check validity of VdpPictureInfo? */
-  vdp_st = driver_data->vdp_impl.vdp_decoder_render (context_obj->vdp_decoder,
-      surface_obj->vdp_surface, (VdpPictureInfo *) &context_obj->vdp_pic_info,
-      context_obj->num_vdp_bs_buf, context_obj->vdp_bs_buf);
-
-  if (vdp_st != VDP_STATUS_OK) {
-    ret = VA_STATUS_ERROR_DECODING_ERROR;
-    goto beach;
+  /* The picture is decoded by the context worker, decoding errors are
+   * reported when syncing the surface. */
+  ret = flu_va_drivers_vdpau_decode_queue_submit (&context_obj->decode_queue,
+      &decoder_config, surface_obj->vdp_surface,
+      &surface_obj->decode_fence, &context_obj->vdp_pic_info,
+      context_obj->codec_ops->vdp_pic_info_size, &context_obj->bitstream);
+  if (ret == VA_STATUS_SUCCESS) {
+    __atomic_store_n (&surface_obj->state,
+        FLU_VA_DRIVERS_VDPAU_SURFACE_STATE_DECODING, __ATOMIC_RELEASE);
+    surface_obj->generation++;
   }
 
-  ret = VA_STATUS_SUCCESS;
-beach:
   flu_va_drivers_vdpau_context_object_reset (context_obj);
   return ret;
 }
 
 static VAStatus
-flu_va_drivers_vdpau_SyncSurface (
-    VADriverContextP ctx, VASurfaceID render_target)
+flu_va_drivers_vdpau_sync_surface (VADriverContextP ctx,
+    VASurfaceID render_target, const struct timespec *deadline)
 {
   FluVaDriversVdpauDriverData *driver_data =
       (FluVaDriversVdpauDriverData *) ctx->pDriverData;
@@ -714,25 +1179,58 @@ flu_va_drivers_vdpau_SyncSurface (
   if (surface_obj == NULL)
     return VA_STATUS_ERROR_INVALID_SURFACE;
 
+  /* A surface without context, never decoded to or unbound by the
+   * destruction of its context, has no decode in flight. */
   context_obj = (FluVaDriversVdpauContextObject *) object_heap_lookup (
       &driver_data->context_heap, surface_obj->context_id);
-  if (context_obj == NULL)
-    return VA_STATUS_ERROR_INVALID_CONTEXT;
+  if (context_obj != NULL) {
+    /* Users of VA-API usually call vaSyncSurface after vaEndPicture */
+    assert (context_obj->current_render_target != render_target);
+  }
 
-  /* Users of VA-API usually call vaSyncSurface after vaEndPicture */
-  assert (context_obj->current_render_target != render_target);
+  return flu_va_drivers_vdpau_surface_sync (driver_data, surface_obj, deadline);
+}
+
+static VAStatus
+flu_va_drivers_vdpau_SyncSurface (
+    VADriverContextP ctx, VASurfaceID render_target)
+{
+  return flu_va_drivers_vdpau_sync_surface (ctx, render_target, NULL);
+}
+
+static VAStatus
+flu_va_drivers_vdpau_QuerySurfaceStatus (
+    VADriverContextP ctx, VASurfaceID render_target, VASurfaceStatus *status)
+{
+  FluVaDriversVdpauDriverData *driver_data =
+      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  FluVaDriversVdpauSurfaceObject *surface_obj;
+  struct timespec deadline;
+
+  surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
+      &driver_data->surface_heap, render_target);
+  if (surface_obj == NULL)
+    return VA_STATUS_ERROR_INVALID_SURFACE;
+
+  /* Only refresh the state, decoding errors are reported by vaSyncSurface. */
+  flu_va_drivers_get_deadline (0, &deadline);
+  flu_va_drivers_vdpau_surface_sync (driver_data, surface_obj, &deadline);
+
+  switch (__atomic_load_n (&surface_obj->state, __ATOMIC_ACQUIRE)) {
+    case FLU_VA_DRIVERS_VDPAU_SURFACE_STATE_DECODING:
+      *status = VASurfaceRendering;
+      break;
+    case FLU_VA_DRIVERS_VDPAU_SURFACE_STATE_DISPLAYING:
+      *status = VASurfaceDisplaying;
+      break;
+    default:
+      *status = VASurfaceReady;
+      break;
+  }
 
-  /* TODO: When vaPutSurface gets implemented, do polling here. */
   return VA_STATUS_SUCCESS;
 }
 
-static VAStatus
-flu_va_drivers_vdpau_QuerySurfaceStatus (
-    VADriverContextP ctx, VASurfaceID render_target, VASurfaceStatus *status)
-{
-  return VA_STATUS_ERROR_UNIMPLEMENTED;
-}
-
 static VAStatus
 flu_va_drivers_vdpau_QuerySurfaceError (VADriverContextP ctx,
     VASurfaceID render_target, VAStatus error_status, void **error_info)
@@ -779,6 +1277,8 @@ flu_va_drivers_vdpau_PutSurface (VADriverContextP ctx, VASurfaceID surface,
   if (context_obj == NULL)
     return VA_STATUS_ERROR_INVALID_CONTEXT;
 
+  flu_va_drivers_vdpau_surface_wait_decode (driver_data, surface_obj, NULL);
+
   va_st = flu_va_drivers_vdpau_context_ensure_video_mixer (ctx, context_obj,
       surface_obj->width, surface_obj->height, surface_obj->format);
   if (va_st != VA_STATUS_SUCCESS)
@@ -809,28 +1309,25 @@ flu_va_drivers_vdpau_QueryImageFormats (
 {
   FluVaDriversVdpauDriverData *driver_data =
       (FluVaDriversVdpauDriverData *) ctx->pDriverData;
-  FluVaDriversVdpauVdpDeviceImpl impl = driver_data->vdp_impl;
   const FluVaDriversVdpauImageFormatMapItem *item =
       FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_MAP;
 
   *num_formats = 0;
   while (item->type != FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_NONE) {
-    VdpStatus vdp_st;
-    VdpBool is_format_supported = 0;
+    int is_format_supported;
 
     switch (item->type) {
       case FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_YCBCR:
-        vdp_st =
-            impl.vdp_video_surface_query_get_put_bits_y_cb_cr_capabilities (
-                driver_data->vdp_impl.vdp_device, VDP_CHROMA_TYPE_420,
-                item->vdp_image_format, &is_format_supported);
+        is_format_supported = flu_va_drivers_vdpau_caps_has_ycbcr_format (
+            flu_va_drivers_vdpau_get_caps (driver_data), item->vdp_chroma_type,
+            item->vdp_image_format);
         break;
       default:
-        vdp_st = VDP_STATUS_NO_IMPLEMENTATION;
+        is_format_supported = 0;
         break;
     }
 
-    if (vdp_st == VDP_STATUS_OK && is_format_supported)
+    if (is_format_supported)
       format_list[(*num_formats)++] = item->va_image_format;
 
     item++;
@@ -867,6 +1364,7 @@ flu_va_drivers_vdpau_CreateImage (VADriverContextP ctx, VAImageFormat *format,
   va_image = &image_obj->va_image;
 
   va_image->image_id = image_id;
+  image_obj->derived_surface = VA_INVALID_SURFACE;
 
   ret = flu_va_drivers_vdpau_CreateBuffer (
       ctx, 0, VAImageBufferType, va_image->data_size, 1, NULL, &va_image->buf);
@@ -884,7 +1382,94 @@ static VAStatus
 flu_va_drivers_vdpau_DeriveImage (
     VADriverContextP ctx, VASurfaceID surface, VAImage *image)
 {
-  return VA_STATUS_ERROR_UNIMPLEMENTED;
+  FluVaDriversVdpauDriverData *driver_data =
+      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  const FluVaDriversVdpauImageFormatMapItem *item = NULL;
+  FluVaDriversVdpauSurfaceObject *surface_obj;
+  FluVaDriversVdpauImageObject *image_obj;
+  FluVaDriversVdpauBufferObject *buffer_obj;
+  VAImage *va_image;
+  int image_id, buffer_id;
+  unsigned int i;
+  VAStatus ret;
+
+  if (image == NULL)
+    return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+  surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
+      &driver_data->surface_heap, surface);
+  if (surface_obj == NULL)
+    return VA_STATUS_ERROR_INVALID_SURFACE;
+
+  for (i = 0; i < sizeof (FLU_VA_DRIVERS_VDPAU_SURFACE_PIXEL_FORMATS) /
+                      sizeof (*FLU_VA_DRIVERS_VDPAU_SURFACE_PIXEL_FORMATS);
+       i++) {
+    if (FLU_VA_DRIVERS_VDPAU_SURFACE_PIXEL_FORMATS[i].rt_format ==
+        surface_obj->format) {
+      item = flu_va_drivers_vdpau_lookup_image_format (
+          FLU_VA_DRIVERS_VDPAU_SURFACE_PIXEL_FORMATS[i].fourcc);
+      break;
+    }
+  }
+  if (item == NULL ||
+      !flu_va_drivers_vdpau_caps_has_ycbcr_format (
+          flu_va_drivers_vdpau_get_caps (driver_data),
+          item->vdp_chroma_type, item->vdp_image_format))
+    return VA_STATUS_ERROR_OPERATION_FAILED;
+
+  image_id = object_heap_allocate (&driver_data->image_heap);
+  if (image_id == VA_INVALID_ID)
+    return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+  image_obj = (FluVaDriversVdpauImageObject *) object_heap_lookup (
+      &driver_data->image_heap, image_id);
+  assert (image_obj != NULL);
+
+  ret = set_image_format (image_obj, &item->va_image_format,
+      surface_obj->width, surface_obj->height);
+  if (ret != VA_STATUS_SUCCESS)
+    goto error;
+  va_image = &image_obj->va_image;
+
+  va_image->image_id = image_id;
+  image_obj->derived_surface = surface;
+
+  /* The shadow is kept by the surface, so that deriving it again for its
+   * next frame neither allocates nor reads back an unchanged content. */
+  if (surface_obj->shadow == NULL) {
+    surface_obj->shadow = flu_va_drivers_vdpau_buffer_pool_acquire (
+        &driver_data->buffer_pool, va_image->data_size,
+        &surface_obj->shadow_capacity);
+    if (surface_obj->shadow == NULL) {
+      ret = VA_STATUS_ERROR_ALLOCATION_FAILED;
+      goto error;
+    }
+  }
+  assert (surface_obj->shadow_capacity >= va_image->data_size);
+
+  buffer_id = object_heap_allocate (&driver_data->buffer_heap);
+  if (buffer_id == -1) {
+    ret = VA_STATUS_ERROR_ALLOCATION_FAILED;
+    goto error;
+  }
+  buffer_obj = (FluVaDriversVdpauBufferObject *) object_heap_lookup (
+      &driver_data->buffer_heap, buffer_id);
+  assert (buffer_obj != NULL);
+
+  buffer_obj->type = VAImageBufferType;
+  buffer_obj->size = va_image->data_size;
+  buffer_obj->num_elements = 1;
+  buffer_obj->data = surface_obj->shadow;
+  buffer_obj->capacity = surface_obj->shadow_capacity;
+  buffer_obj->derived_image = image_id;
+  buffer_obj->map_access = 0;
+  va_image->buf = buffer_id;
+
+  *image = *va_image;
+  return VA_STATUS_SUCCESS;
+error:
+  object_heap_free (&driver_data->image_heap, (object_base_p) image_obj);
+  return ret;
 }
 
 static VAStatus
@@ -922,9 +1507,6 @@ flu_va_drivers_vdpau_GetImage (VADriverContextP ctx, VASurfaceID surface,
       (FluVaDriversVdpauDriverData *) ctx->pDriverData;
   FluVaDriversVdpauSurfaceObject *surface_obj;
   FluVaDriversVdpauImageObject *image_obj;
-  ImagePtr img_ptr;
-  VdpStatus vdp_st;
-  VAStatus ret;
 
   surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
       &driver_data->surface_heap, surface);
@@ -936,23 +1518,10 @@ flu_va_drivers_vdpau_GetImage (VADriverContextP ctx, VASurfaceID surface,
   if (image_obj == NULL)
     return VA_STATUS_ERROR_INVALID_IMAGE;
 
-  ret = get_image_ptr (driver_data, image_obj, &img_ptr);
-  if (ret != VA_STATUS_SUCCESS)
-    return ret;
-
-  switch (image_obj->format_type) {
-    case FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_YCBCR:
-      vdp_st = driver_data->vdp_impl.vdp_video_surface_get_bits_y_cb_cr (
-          surface_obj->vdp_surface, image_obj->vdp_format, img_ptr.planes,
-          img_ptr.pitches);
-      if (vdp_st != VDP_STATUS_OK)
-        return VA_STATUS_ERROR_OPERATION_FAILED;
-      break;
-    default:
-      return VA_STATUS_ERROR_INVALID_IMAGE;
-  }
+  flu_va_drivers_vdpau_surface_wait_decode (driver_data, surface_obj, NULL);
 
-  return VA_STATUS_SUCCESS;
+  return flu_va_drivers_vdpau_read_surface (
+      driver_data, surface_obj, image_obj);
 }
 
 static VAStatus
@@ -995,13 +1564,184 @@ get_image_ptr (FluVaDriversVdpauDriverData *driver_data,
   return VA_STATUS_SUCCESS;
 }
 
+/* Subsampling shifts of a plane, and bytes of each of its samples, which
+ * for YUY2 are pairs of pixels. */
+static void
+flu_va_drivers_vdpau_get_plane_layout (uint32_t fourcc, int plane,
+    unsigned int *x_shift, unsigned int *y_shift, unsigned int *sample_bytes)
+{
+  switch (fourcc) {
+    case VA_FOURCC_NV12:
+      *x_shift = *y_shift = plane > 0;
+      *sample_bytes = plane > 0 ? 2 : 1;
+      break;
+    case VA_FOURCC_P010:
+    case VA_FOURCC_P016:
+      *x_shift = *y_shift = plane > 0;
+      *sample_bytes = plane > 0 ? 4 : 2;
+      break;
+    case VA_FOURCC_YUY2:
+      *x_shift = 1;
+      *y_shift = 0;
+      *sample_bytes = 4;
+      break;
+    default:
+      *x_shift = *y_shift = 0;
+      *sample_bytes = 1;
+      break;
+  }
+}
+
+/* Moves the planes to the pixel at x, y, which must be aligned to the
+ * chroma subsampling. */
+static void
+flu_va_drivers_vdpau_image_ptr_offset (
+    const VAImage *va_image, ImagePtr *ptr, unsigned int x, unsigned int y)
+{
+  unsigned int x_shift, y_shift, sample_bytes;
+  int i;
+
+  for (i = 0; i < va_image->num_planes; i++) {
+    flu_va_drivers_vdpau_get_plane_layout (
+        va_image->format.fourcc, i, &x_shift, &y_shift, &sample_bytes);
+    ptr->planes[i] = (uint8_t *) ptr->planes[i] +
+                     (y >> y_shift) * ptr->pitches[i] +
+                     (x >> x_shift) * sample_bytes;
+  }
+}
+
+static void
+flu_va_drivers_vdpau_copy_image_rect (const VAImage *va_image, ImagePtr *dst,
+    const ImagePtr *src, unsigned int width, unsigned int height)
+{
+  unsigned int x_shift, y_shift, sample_bytes, row_bytes, num_rows, row;
+  int i;
+
+  for (i = 0; i < va_image->num_planes; i++) {
+    flu_va_drivers_vdpau_get_plane_layout (
+        va_image->format.fourcc, i, &x_shift, &y_shift, &sample_bytes);
+    row_bytes = ((width + (1 << x_shift) - 1) >> x_shift) * sample_bytes;
+    num_rows = (height + (1 << y_shift) - 1) >> y_shift;
+    for (row = 0; row < num_rows; row++) {
+      memcpy ((uint8_t *) dst->planes[i] + row * dst->pitches[i],
+          (const uint8_t *) src->planes[i] + row * src->pitches[i], row_bytes);
+    }
+  }
+}
+
 static VAStatus
 flu_va_drivers_vdpau_PutImage (VADriverContextP ctx, VASurfaceID surface,
     VAImageID image, int src_x, int src_y, unsigned int src_width,
     unsigned int src_height, int dest_x, int dest_y, unsigned int dest_width,
     unsigned int dest_height)
 {
-  return VA_STATUS_ERROR_UNIMPLEMENTED;
+  FluVaDriversVdpauDriverData *driver_data =
+      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  FluVaDriversVdpauSurfaceObject *surface_obj;
+  FluVaDriversVdpauImageObject *image_obj;
+  FluVaDriversVdpauImageObject surface_image;
+  ImagePtr img_ptr, surface_ptr, rect_ptr;
+  unsigned int x_shift, y_shift, sample_bytes;
+  VAImage *va_image;
+  size_t capacity;
+  uint8_t *data;
+  VdpStatus vdp_st;
+  VAStatus ret;
+  int i;
+
+  surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
+      &driver_data->surface_heap, surface);
+  if (surface_obj == NULL)
+    return VA_STATUS_ERROR_INVALID_SURFACE;
+
+  image_obj = (FluVaDriversVdpauImageObject *) object_heap_lookup (
+      &driver_data->image_heap, image);
+  if (image_obj == NULL)
+    return VA_STATUS_ERROR_INVALID_IMAGE;
+  va_image = &image_obj->va_image;
+
+  if (image_obj->format_type != FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_YCBCR ||
+      !flu_va_drivers_vdpau_caps_has_ycbcr_format (
+          flu_va_drivers_vdpau_get_caps (driver_data),
+          surface_obj->vdp_chroma_type, image_obj->vdp_format))
+    return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+
+  /* VDPAU uploads do not scale. */
+  if (src_width != dest_width || src_height != dest_height)
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+
+  if (src_x < 0 || src_y < 0 || dest_x < 0 || dest_y < 0 ||
+      src_x + src_width > va_image->width ||
+      src_y + src_height > va_image->height ||
+      dest_x + dest_width > surface_obj->width ||
+      dest_y + dest_height > surface_obj->height)
+    return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+  /* The chroma planes are the most subsampled ones. */
+  flu_va_drivers_vdpau_get_plane_layout (va_image->format.fourcc,
+      va_image->num_planes - 1, &x_shift, &y_shift, &sample_bytes);
+  if (((src_x | dest_x) & ((1 << x_shift) - 1)) ||
+      ((src_y | dest_y) & ((1 << y_shift) - 1)))
+    return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+  ret = get_image_ptr (driver_data, image_obj, &img_ptr);
+  if (ret != VA_STATUS_SUCCESS)
+    return ret;
+  flu_va_drivers_vdpau_image_ptr_offset (va_image, &img_ptr, src_x, src_y);
+
+  /* Neither a pending decode nor the upload may overwrite the other. */
+  flu_va_drivers_vdpau_surface_wait_decode (driver_data, surface_obj, NULL);
+
+  /* A whole surface update passes the image planes straight to VDPAU. */
+  if (dest_x == 0 && dest_y == 0 && dest_width == surface_obj->width &&
+      dest_height == surface_obj->height) {
+    vdp_st = driver_data->vdp_impl.vdp_video_surface_put_bits_y_cb_cr (
+        surface_obj->vdp_surface, image_obj->vdp_format,
+        (const void *const *) img_ptr.planes, img_ptr.pitches);
+    goto beach;
+  }
+
+  /* Otherwise the rectangle is merged into a readback of the surface in the
+   * image format, which is uploaded whole. */
+  ret = set_image_format (&surface_image, &va_image->format,
+      surface_obj->width, surface_obj->height);
+  if (ret != VA_STATUS_SUCCESS)
+    return ret;
+
+  data = flu_va_drivers_vdpau_buffer_pool_acquire (&driver_data->buffer_pool,
+      surface_image.va_image.data_size, &capacity);
+  if (data == NULL)
+    return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+  for (i = 0; i < surface_image.va_image.num_planes; i++) {
+    surface_ptr.planes[i] = data + surface_image.va_image.offsets[i];
+    surface_ptr.pitches[i] = surface_image.va_image.pitches[i];
+  }
+
+  vdp_st = driver_data->vdp_impl.vdp_video_surface_get_bits_y_cb_cr (
+      surface_obj->vdp_surface, image_obj->vdp_format, surface_ptr.planes,
+      surface_ptr.pitches);
+  if (vdp_st == VDP_STATUS_OK) {
+    rect_ptr = surface_ptr;
+    flu_va_drivers_vdpau_image_ptr_offset (
+        va_image, &rect_ptr, dest_x, dest_y);
+    flu_va_drivers_vdpau_copy_image_rect (
+        va_image, &rect_ptr, &img_ptr, dest_width, dest_height);
+    vdp_st = driver_data->vdp_impl.vdp_video_surface_put_bits_y_cb_cr (
+        surface_obj->vdp_surface, image_obj->vdp_format,
+        (const void *const *) surface_ptr.planes, surface_ptr.pitches);
+  }
+
+  flu_va_drivers_vdpau_buffer_pool_release (
+      &driver_data->buffer_pool, data, capacity);
+
+beach:
+  if (vdp_st != VDP_STATUS_OK)
+    return VA_STATUS_ERROR_OPERATION_FAILED;
+
+  /* Derived images of the surface read it back again. */
+  surface_obj->generation++;
+  return VA_STATUS_SUCCESS;
 }
 
 static VAStatus
@@ -1128,42 +1868,25 @@ flu_va_drivers_vdpau_GetSurfaceAttributes (VADriverContextP dpy,
   return VA_STATUS_ERROR_UNIMPLEMENTED;
 }
 
-static VAStatus
-flu_va_drivers_vdpau_create_surface (VADriverContextP ctx, int width,
-    int height, int format, VASurfaceAttrib *attrib_list, int num_attribs,
-    VASurfaceID *surface_id)
+static void
+flu_va_drivers_vdpau_init_surface (FluVaDriversVdpauSurfaceObject *surface_obj,
+    unsigned int format, unsigned int width, unsigned int height,
+    VdpChromaType vdp_chroma_type)
 {
-  FluVaDriversVdpauDriverData *driver_data =
-      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
-  FluVaDriversVdpauSurfaceObject *surface_obj;
-  VdpVideoSurface vdp_surface;
-  VdpStatus vdp_st;
-  int surface_obj_id;
-
-  assert (format == VA_RT_FORMAT_YUV420);
-  assert (num_attribs <= FLU_VA_DRIVERS_VDPAU_MAX_SURFACE_ATTRIBUTES);
-
-  vdp_st = driver_data->vdp_impl.vdp_video_surface_create (
-      driver_data->vdp_impl.vdp_device, VDP_CHROMA_TYPE_420, width, height,
-      &vdp_surface);
-  if (vdp_st != VDP_STATUS_OK)
-    return VA_STATUS_ERROR_OPERATION_FAILED;
-
-  surface_obj_id = object_heap_allocate (&driver_data->surface_heap);
-  if (surface_obj_id == -1)
-    return VA_STATUS_ERROR_ALLOCATION_FAILED;
-  surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
-      &driver_data->surface_heap, surface_obj_id);
-  assert (surface_obj != NULL);
-
-  *surface_id = surface_obj_id;
   surface_obj->context_id = VA_INVALID_ID;
   surface_obj->format = format;
   surface_obj->width = width;
   surface_obj->height = height;
-  surface_obj->vdp_surface = vdp_surface;
-
-  return VA_STATUS_SUCCESS;
+  surface_obj->vdp_chroma_type = vdp_chroma_type;
+  surface_obj->vdp_surface = VDP_INVALID_HANDLE;
+  flu_va_drivers_vdpau_fence_init (&surface_obj->decode_fence);
+  surface_obj->state = FLU_VA_DRIVERS_VDPAU_SURFACE_STATE_IDLE;
+  surface_obj->vdp_output_surface = VDP_INVALID_HANDLE;
+  surface_obj->vdp_presentation_queue = VDP_INVALID_HANDLE;
+  surface_obj->generation = 1;
+  surface_obj->shadow = NULL;
+  surface_obj->shadow_capacity = 0;
+  surface_obj->shadow_generation = 0;
 }
 
 static VAStatus
@@ -1172,28 +1895,67 @@ flu_va_drivers_vdpau_CreateSurfaces2 (VADriverContextP ctx,
     VASurfaceID *surfaces, unsigned int num_surfaces,
     VASurfaceAttrib *attrib_list, unsigned int num_attribs)
 {
+  FluVaDriversVdpauDriverData *driver_data =
+      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  FluVaDriversVdpauSurfaceObject *surface_obj;
+  VdpChromaType vdp_chroma_type;
   VAStatus va_st = VA_STATUS_SUCCESS;
-  int i;
+  VdpStatus vdp_st;
+  unsigned int i, j;
 
-  if (width < 0 || height < 0 || num_surfaces < 0 ||
-      num_surfaces > FLU_VA_DRIVERS_VDPAU_MAX_SURFACE_ATTRIBUTES)
+  if (num_surfaces > INT_MAX ||
+      num_attribs > FLU_VA_DRIVERS_VDPAU_MAX_SURFACE_ATTRIBUTES)
     return VA_STATUS_ERROR_INVALID_PARAMETER;
 
-  if (format != VA_RT_FORMAT_YUV420)
-    return VA_STATUS_ERROR_UNSUPPORTED_ENTRYPOINT;
+  if (flu_va_drivers_map_va_rt_format_to_vdp_chroma_type (
+          format, &vdp_chroma_type) != VA_STATUS_SUCCESS ||
+      !flu_va_drivers_vdpau_caps_has_chroma_type (
+          flu_va_drivers_vdpau_get_caps (driver_data), vdp_chroma_type))
+    return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
 
-  for (i = 0; i < num_surfaces; i++) {
-    VAStatus va_st;
+  va_st = flu_va_drivers_vdpau_ensure_device (driver_data);
+  if (va_st != VA_STATUS_SUCCESS)
+    return va_st;
 
-    va_st = flu_va_drivers_vdpau_create_surface (
-        ctx, width, height, format, attrib_list, num_attribs, &surfaces[i]);
+  /* All the IDs are taken under a single heap lock, and either every surface
+   * is created or none is. */
+  if (object_heap_allocate_n (
+          &driver_data->surface_heap, num_surfaces, (int *) surfaces) == -1) {
+    for (i = 0; i < num_surfaces; i++)
+      surfaces[i] = VA_INVALID_SURFACE;
+    return VA_STATUS_ERROR_ALLOCATION_FAILED;
+  }
 
-    if (va_st != VA_STATUS_SUCCESS)
+  for (i = 0; i < num_surfaces; i++) {
+    surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
+        &driver_data->surface_heap, surfaces[i]);
+    assert (surface_obj != NULL);
+
+    flu_va_drivers_vdpau_init_surface (
+        surface_obj, format, width, height, vdp_chroma_type);
+    vdp_st = flu_va_drivers_vdpau_surface_pool_acquire (
+        &driver_data->surface_pool, vdp_chroma_type, width, height,
+        &surface_obj->vdp_surface);
+    if (vdp_st != VDP_STATUS_OK) {
+      va_st = VA_STATUS_ERROR_OPERATION_FAILED;
       break;
+    }
   }
 
-  if (va_st != VA_STATUS_SUCCESS) {
-    flu_va_drivers_vdpau_DestroySurfaces (ctx, surfaces, i);
+  if (va_st == VA_STATUS_SUCCESS)
+    return VA_STATUS_SUCCESS;
+
+  /* Never decoded, so the surfaces go back to the pool without waiting. They
+   * are freed in reverse order, which restores the free list of the heap. */
+  for (j = num_surfaces; j-- > 0;) {
+    surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
+        &driver_data->surface_heap, surfaces[j]);
+    if (j < i) {
+      flu_va_drivers_vdpau_surface_pool_release (&driver_data->surface_pool,
+          vdp_chroma_type, width, height, surface_obj->vdp_surface);
+    }
+    object_heap_free (&driver_data->surface_heap, (object_base_p) surface_obj);
+    surfaces[j] = VA_INVALID_SURFACE;
   }
 
   return va_st;
@@ -1203,36 +1965,66 @@ static VAStatus
 set_image_format (FluVaDriversVdpauImageObject *image_obj,
     const VAImageFormat *format, int width, int height)
 {
+  const FluVaDriversVdpauImageFormatMapItem *item;
   VAImage *va_image = &image_obj->va_image;
+  int padded_width = FLU_VA_DRIVERS_ALIGN (
+      width, FLU_VA_DRIVERS_DEFAULT_SURFACE_WIDTH_ALIGNMENT);
+  int padded_height = FLU_VA_DRIVERS_ALIGN (
+      height, FLU_VA_DRIVERS_DEFAULT_SURFACE_HEIGHT_ALIGNMENT);
+  int padded_size = padded_width * padded_height;
+  int padded_quarter_size = (padded_width / 2) * (padded_height / 2);
+
+  item = flu_va_drivers_vdpau_lookup_image_format (format->fourcc);
+  if (item == NULL)
+    return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
 
   memset (va_image->component_order, 0, sizeof (va_image->component_order));
+  memset (va_image->pitches, 0, sizeof (va_image->pitches));
+  memset (va_image->offsets, 0, sizeof (va_image->offsets));
 
   switch (format->fourcc) {
-    case VA_FOURCC_NV12: {
-      int padded_width = FLU_VA_DRIVERS_ALIGN (
-          width, FLU_VA_DRIVERS_DEFAULT_SURFACE_WIDTH_ALIGNMENT);
-      int padded_height = FLU_VA_DRIVERS_ALIGN (
-          height, FLU_VA_DRIVERS_DEFAULT_SURFACE_HEIGHT_ALIGNMENT);
-      int padded_size = padded_width * padded_height;
-      int padded_quarter_size = (padded_width / 2) * (padded_height / 2);
-
-      image_obj->format_type = FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_YCBCR;
-      image_obj->vdp_format = VDP_YCBCR_FORMAT_NV12;
-
+    case VA_FOURCC_NV12:
       va_image->num_planes = 2;
       va_image->pitches[0] = padded_width;
       va_image->offsets[0] = 0;
       va_image->pitches[1] = padded_width;
       va_image->offsets[1] = padded_size;
       va_image->data_size = padded_size + (2 * padded_quarter_size);
-      va_image->num_palette_entries = 0;
-      va_image->entry_bytes = 0;
       break;
-    }
+    /* As NV12, with 16-bit samples. */
+    case VA_FOURCC_P010:
+    case VA_FOURCC_P016:
+      va_image->num_planes = 2;
+      va_image->pitches[0] = 2 * padded_width;
+      va_image->offsets[0] = 0;
+      va_image->pitches[1] = 2 * padded_width;
+      va_image->offsets[1] = 2 * padded_size;
+      va_image->data_size = 2 * (padded_size + (2 * padded_quarter_size));
+      break;
+    case VA_FOURCC_YUY2:
+      va_image->num_planes = 1;
+      va_image->pitches[0] = 2 * padded_width;
+      va_image->offsets[0] = 0;
+      va_image->data_size = 2 * padded_size;
+      break;
+    case VA_FOURCC_444P:
+      va_image->num_planes = 3;
+      va_image->pitches[0] = padded_width;
+      va_image->offsets[0] = 0;
+      va_image->pitches[1] = padded_width;
+      va_image->offsets[1] = padded_size;
+      va_image->pitches[2] = padded_width;
+      va_image->offsets[2] = 2 * padded_size;
+      va_image->data_size = 3 * padded_size;
+      break;
     default:
       return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
   }
 
+  image_obj->format_type = item->type;
+  image_obj->vdp_format = item->vdp_image_format;
+  va_image->num_palette_entries = 0;
+  va_image->entry_bytes = 0;
   va_image->format = *format;
   va_image->width = width;
   va_image->height = height;
@@ -1247,6 +2039,7 @@ flu_va_drivers_vdpau_QuerySurfaceAttributes (VADriverContextP ctx,
   FluVaDriversVdpauDriverData *driver_data =
       (FluVaDriversVdpauDriverData *) ctx->pDriverData;
   FluVaDriversVdpauConfigObject *config_obj;
+  unsigned int rt_formats, num_pixel_formats = 0, i, n;
 
   config_obj = (FluVaDriversVdpauConfigObject *) object_heap_lookup (
       &driver_data->config_heap, config);
@@ -1256,9 +2049,17 @@ flu_va_drivers_vdpau_QuerySurfaceAttributes (VADriverContextP ctx,
   if (num_attribs == NULL)
     return VA_STATUS_ERROR_INVALID_PARAMETER;
 
+  rt_formats = config_obj->attrib_list[0].value;
+  for (i = 0; i < sizeof (FLU_VA_DRIVERS_VDPAU_SURFACE_PIXEL_FORMATS) /
+                      sizeof (*FLU_VA_DRIVERS_VDPAU_SURFACE_PIXEL_FORMATS);
+       i++) {
+    if (rt_formats & FLU_VA_DRIVERS_VDPAU_SURFACE_PIXEL_FORMATS[i].rt_format)
+      num_pixel_formats++;
+  }
+
   /* vaQuerySurfaceAttributes can be used just to determine the number of
    * supported attributes according the libva reference manual. */
-  *num_attribs = 4;
+  *num_attribs = 3 + num_pixel_formats;
   if (!attrib_list)
     return VA_STATUS_SUCCESS;
 
@@ -1272,19 +2073,28 @@ flu_va_drivers_vdpau_QuerySurfaceAttributes (VADriverContextP ctx,
   attrib_list[1].value.type = VAGenericValueTypeInteger;
   attrib_list[1].value.value.i = config_obj->max_height;
 
-  /* We only support VA_FOURCC_NV12 for now. */
-  attrib_list[2].type = VASurfaceAttribPixelFormat;
+  /* NOTE: Not sure if this is needed, but include for now. */
+  attrib_list[2].type = VASurfaceAttribMemoryType;
   /* HACK: Don't support to write this attribute, even when docs allow it. */
   attrib_list[2].flags = VA_SURFACE_ATTRIB_GETTABLE;
   attrib_list[2].value.type = VAGenericValueTypeInteger;
-  attrib_list[2].value.value.i = VA_FOURCC_NV12;
+  attrib_list[2].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_VA;
 
-  /* NOTE: Not sure if this is needed, but include for now. */
-  attrib_list[3].type = VASurfaceAttribMemoryType;
-  /* HACK: Don't support to write this attribute, even when docs allow it. */
-  attrib_list[3].flags = VA_SURFACE_ATTRIB_GETTABLE;
-  attrib_list[3].value.type = VAGenericValueTypeInteger;
-  attrib_list[3].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_VA;
+  n = 3;
+  for (i = 0; i < sizeof (FLU_VA_DRIVERS_VDPAU_SURFACE_PIXEL_FORMATS) /
+                      sizeof (*FLU_VA_DRIVERS_VDPAU_SURFACE_PIXEL_FORMATS);
+       i++) {
+    if (!(rt_formats & FLU_VA_DRIVERS_VDPAU_SURFACE_PIXEL_FORMATS[i].rt_format))
+      continue;
+
+    attrib_list[n].type = VASurfaceAttribPixelFormat;
+    /* HACK: Don't support to write this attribute, even when docs allow it. */
+    attrib_list[n].flags = VA_SURFACE_ATTRIB_GETTABLE;
+    attrib_list[n].value.type = VAGenericValueTypeInteger;
+    attrib_list[n].value.value.i =
+        FLU_VA_DRIVERS_VDPAU_SURFACE_PIXEL_FORMATS[i].fourcc;
+    n++;
+  }
 
   return VA_STATUS_SUCCESS;
 }
@@ -1357,8 +2167,13 @@ static VAStatus
 flu_va_drivers_vdpau_SyncSurface2 (
     VADriverContextP ctx, VASurfaceID surface, uint64_t timeout_ns)
 {
-  /* TODO: Use timeout_ns when polling for ready surfaces is added. */
-  return flu_va_drivers_vdpau_SyncSurface (ctx, surface);
+  struct timespec deadline;
+
+  if (timeout_ns == VA_TIMEOUT_INFINITE)
+    return flu_va_drivers_vdpau_sync_surface (ctx, surface, NULL);
+
+  flu_va_drivers_get_deadline (timeout_ns, &deadline);
+  return flu_va_drivers_vdpau_sync_surface (ctx, surface, &deadline);
 }
 
 static VAStatus
@@ -1375,32 +2190,21 @@ flu_va_drivers_vdpau_Copy (VADriverContextP ctx, VACopyObject *dst,
   return VA_STATUS_ERROR_UNIMPLEMENTED;
 }
 
-static VAStatus
-flu_va_drivers_vdpau_data_init (FluVaDriversVdpauDriverData *driver_data)
+/* The state that does not depend on the display, also set up by the tests
+ * around a stub device. */
+static void
+flu_va_drivers_vdpau_data_init_objects (
+    FluVaDriversVdpauDriverData *driver_data)
 {
-  VADriverContextP ctx = driver_data->ctx;
-  VdpGetProcAddress *get_proc_address;
-  VdpDevice device = VDP_INVALID_HANDLE;
   int heap_sz = sizeof (struct object_heap);
-  const char *x11_dpy_name;
 
   flu_va_drivers_get_vendor (driver_data->va_vendor);
-
-  if (ctx->display_type != VA_DISPLAY_X11)
-    return VA_STATUS_ERROR_INVALID_DISPLAY;
-
-  x11_dpy_name = XDisplayString (ctx->native_dpy);
-  driver_data->x11_dpy = XOpenDisplay (x11_dpy_name);
-  if (!driver_data->x11_dpy)
-    driver_data->x11_dpy = ctx->native_dpy;
-
-  if (vdp_device_create_x11 (driver_data->x11_dpy, ctx->x11_screen, &device,
-          &get_proc_address) != VDP_STATUS_OK)
-    return VA_STATUS_ERROR_UNKNOWN;
-
-  if (flu_va_drivers_vdpau_vdp_device_impl_init (
-          &driver_data->vdp_impl, device, get_proc_address) != VDP_STATUS_OK)
-    return VA_STATUS_ERROR_UNKNOWN;
+  pthread_mutex_init (&driver_data->device_mutex, NULL);
+  flu_va_drivers_vdpau_buffer_pool_init (&driver_data->buffer_pool);
+  flu_va_drivers_vdpau_decoder_cache_init (
+      &driver_data->decoder_cache, &driver_data->vdp_impl);
+  flu_va_drivers_vdpau_surface_pool_init (
+      &driver_data->surface_pool, &driver_data->vdp_impl);
 
   object_heap_init (&driver_data->config_heap,
       sizeof (FluVaDriversVdpauConfigObject), CONFIG_ID_OFFSET);
@@ -1415,6 +2219,34 @@ flu_va_drivers_vdpau_data_init (FluVaDriversVdpauDriverData *driver_data)
   object_heap_init (&driver_data->video_mixer_heap,
       sizeof (FluVaDriversVdpauVideoMixerObject), VIDEO_MIXER_ID_OFFSET);
   object_heap_init (&driver_data->subpic_heap, heap_sz, SUBPIC_ID_OFFSET);
+}
+
+static VAStatus
+flu_va_drivers_vdpau_data_init (FluVaDriversVdpauDriverData *driver_data)
+{
+  VADriverContextP ctx = driver_data->ctx;
+  const char *x11_dpy_name;
+  VAStatus va_st;
+
+  flu_va_drivers_vdpau_data_init_objects (driver_data);
+
+  if (ctx->display_type != VA_DISPLAY_X11)
+    return VA_STATUS_ERROR_INVALID_DISPLAY;
+
+  x11_dpy_name = XDisplayString (ctx->native_dpy);
+  driver_data->x11_dpy = XOpenDisplay (x11_dpy_name);
+  if (!driver_data->x11_dpy)
+    driver_data->x11_dpy = ctx->native_dpy;
+
+  driver_data->caps = &driver_data->caps_storage[0];
+  flu_va_drivers_vdpau_caps_cache_init (
+      &driver_data->caps_cache, x11_dpy_name, ctx->x11_screen);
+  if (!flu_va_drivers_vdpau_caps_cache_load (
+          &driver_data->caps_cache, &driver_data->caps_storage[0])) {
+    va_st = flu_va_drivers_vdpau_ensure_device (driver_data);
+    if (va_st != VA_STATUS_SUCCESS)
+      return va_st;
+  }
 
   return VA_STATUS_SUCCESS;
 }
@@ -1525,6 +2357,9 @@ FLU_VA_DRIVERS_DRIVER_INIT (VADriverContextP ctx)
   ctx->vtable->vaSyncSurface2 = flu_va_drivers_vdpau_SyncSurface2;
   ctx->vtable->vaSyncBuffer = flu_va_drivers_vdpau_SyncBuffer;
   ctx->vtable->vaCopy = flu_va_drivers_vdpau_Copy;
+#if VA_CHECK_VERSION(1, 21, 0)
+  ctx->vtable->vaMapBuffer2 = flu_va_drivers_vdpau_MapBuffer2;
+#endif
 
   return VA_STATUS_SUCCESS;
 }
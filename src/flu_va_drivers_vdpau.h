@@ -34,20 +34,30 @@
 #include <stdlib.h>
 #include <sys/queue.h>
 #include "flu_va_drivers_vdpau_vdp_device_impl.h"
+#include "flu_va_drivers_vdpau_caps.h"
+#include "flu_va_drivers_vdpau_caps_cache.h"
+#include "flu_va_drivers_vdpau_decode_queue.h"
+#include "flu_va_drivers_vdpau_buffer_pool.h"
+#include "flu_va_drivers_vdpau_surface_pool.h"
 #include "../ext/intel/intel-vaapi-drivers/object_heap.h"
 #include "object_heap/object_heap_utils.h"
 
 // clang-format off
-#define FLU_VA_DRIVERS_VDPAU_MAX_PROFILES              3
+#define FLU_VA_DRIVERS_VDPAU_MAX_PROFILES              15
 #define FLU_VA_DRIVERS_VDPAU_MAX_ENTRYPOINTS           1
 #define FLU_VA_DRIVERS_VDPAU_MAX_ATTRIBUTES            1
 #define FLU_VA_DRIVERS_VDPAU_MAX_SURFACE_ATTRIBUTES    32
-// This has been forced to 1 to make va_openDriver to pass.
-#define FLU_VA_DRIVERS_VDPAU_MAX_IMAGE_FORMATS         1
+// Entries of FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_MAP.
+#define FLU_VA_DRIVERS_VDPAU_MAX_IMAGE_FORMATS         5
 // This has been forced to 1 to make va_openDriver to pass.
 #define FLU_VA_DRIVERS_VDPAU_MAX_SUBPIC_FORMATS        1
 #define FLU_VA_DRIVERS_VDPAU_MAX_DISPLAY_ATTRIBUTES    0
 #define FLU_VA_DRIVERS_VDPAU_NUM_OUTPUT_SURFACES       3
+#define FLU_VA_DRIVERS_VDPAU_DISPLAY_POLL_MIN_INTERVAL_NS 100000
+#define FLU_VA_DRIVERS_VDPAU_DISPLAY_POLL_MAX_INTERVAL_NS 4000000
+/* Access to a mapped buffer, as the VA_MAPBUFFER_FLAG_* of libva 1.21. */
+#define FLU_VA_DRIVERS_VDPAU_MAP_READ                  (1 << 0)
+#define FLU_VA_DRIVERS_VDPAU_MAP_WRITE                 (1 << 1)
 // clang-format on
 
 /* HACK: Use alignment values for CFL. */
@@ -55,7 +65,6 @@
 #define FLU_VA_DRIVERS_DEFAULT_SURFACE_HEIGHT_ALIGNMENT 16
 
 static const uint8_t NALU_START_CODE[3] = { 0x00, 0x0, 0x01 };
-static const uint8_t NALU_START_CODE_4[4] = { 0x00, 0x00, 0x0, 0x01 };
 
 typedef enum
 {
@@ -63,13 +72,36 @@ typedef enum
   FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_NONE
 } FluVaDriversVdpauImageFormatType;
 
+/* IDLE: never decoded. DECODING: a decode is queued on the context worker.
+ * READY: decoded and not in the display ring. DISPLAYING: mixed into an output
+ * surface that is still queued for presentation. */
+typedef enum
+{
+  FLU_VA_DRIVERS_VDPAU_SURFACE_STATE_IDLE,
+  FLU_VA_DRIVERS_VDPAU_SURFACE_STATE_DECODING,
+  FLU_VA_DRIVERS_VDPAU_SURFACE_STATE_READY,
+  FLU_VA_DRIVERS_VDPAU_SURFACE_STATE_DISPLAYING
+} FluVaDriversVdpauSurfaceState;
+
 typedef struct _FluVaDriversVdpauDriverData FluVaDriversVdpauDriverData;
 
+typedef struct _FluVaDriversVdpauCodecOps FluVaDriversVdpauCodecOps;
+
 struct _FluVaDriversVdpauDriverData
 {
   VADriverContextP ctx;
   char va_vendor[256];
   FluVaDriversVdpauVdpDeviceImpl vdp_impl;
+  /* Set once vdp_impl is usable, see flu_va_drivers_vdpau_ensure_device. */
+  int has_device;
+  pthread_mutex_t device_mutex;
+  /* The published capabilities, read without the device lock. Points into
+   * caps_storage: the table loaded from the cache, or the one probed once the
+   * device exists and the cache turned out stale. See
+   * flu_va_drivers_vdpau_get_caps. */
+  const FluVaDriversVdpauCaps *caps;
+  FluVaDriversVdpauCaps caps_storage[2];
+  FluVaDriversVdpauCapsCache caps_cache;
   Display *x11_dpy;
   struct object_heap config_heap;
   struct object_heap context_heap;
@@ -78,6 +110,12 @@ struct _FluVaDriversVdpauDriverData
   struct object_heap image_heap;
   struct object_heap subpic_heap;
   struct object_heap video_mixer_heap;
+  FluVaDriversVdpauBufferPool buffer_pool;
+  FluVaDriversVdpauDecoderCache decoder_cache;
+  FluVaDriversVdpauSurfacePool surface_pool;
+  /* Bumped on every surface destruction, to invalidate the translations
+   * cached by the contexts. */
+  uint64_t surface_epoch;
 
   char _reserved[16];
 };
@@ -88,6 +126,8 @@ struct _FluVaDriversVdpauConfigObject
 {
   struct object_base base;
   VAProfile profile;
+  VdpDecoderProfile vdp_profile;
+  const FluVaDriversVdpauCodecOps *codec_ops;
   uint32_t max_width;
   uint32_t max_height;
   VAEntrypoint entrypoint;
@@ -103,10 +143,131 @@ struct _FluVaDriversVdpauSurfaceObject
   unsigned int format;
   unsigned int width;
   unsigned int height;
+  VdpChromaType vdp_chroma_type;
   VdpVideoSurface vdp_surface;
+  FluVaDriversVdpauFence decode_fence;
+  FluVaDriversVdpauSurfaceState state;
+  /* Last presentation of the surface, valid while DISPLAYING. */
+  VdpOutputSurface vdp_output_surface;
+  VdpPresentationQueue vdp_presentation_queue;
+  /* Bumped on every change of the surface content. */
+  uint64_t generation;
+  /* CPU copy of the surface shared by its derived images, allocated on the
+   * first vaDeriveImage and kept until the surface is destroyed. It holds
+   * the content of shadow_generation. */
+  void *shadow;
+  size_t shadow_capacity;
+  uint64_t shadow_generation;
 };
 typedef struct _FluVaDriversVdpauSurfaceObject FluVaDriversVdpauSurfaceObject;
 
+/* Number of VASurfaceID to VdpVideoSurface translations kept per context, a
+ * power of two. */
+#define FLU_VA_DRIVERS_VDPAU_REF_FRAME_CACHE_SIZE 32
+
+typedef struct _FluVaDriversVdpauSurfaceMapEntry
+    FluVaDriversVdpauSurfaceMapEntry;
+
+struct _FluVaDriversVdpauSurfaceMapEntry
+{
+  VASurfaceID surface_id;
+  VdpVideoSurface vdp_surface;
+};
+
+/* Translation of the reference frames of the previous picture, reused for the
+ * entries that did not change. It is dropped whenever a surface is destroyed,
+ * which bumps the driver surface_epoch. */
+typedef struct _FluVaDriversVdpauRefFrameCache FluVaDriversVdpauRefFrameCache;
+
+struct _FluVaDriversVdpauRefFrameCache
+{
+  uint64_t surface_epoch;
+  FluVaDriversVdpauSurfaceMapEntry
+      surfaces[FLU_VA_DRIVERS_VDPAU_REF_FRAME_CACHE_SIZE];
+  int has_ref_frames;
+  VAPictureH264 va_ref_frames[16];
+  VdpReferenceFrameH264 vdp_ref_frames[16];
+};
+
+/* Last parameters translated into the context vdp_pic_info. The fields that
+ * only change at SPS, PPS or scaling matrix boundaries are kept across
+ * pictures and only mapped again when their source changes. */
+typedef struct _FluVaDriversVdpauH264ParamCache FluVaDriversVdpauH264ParamCache;
+
+struct _FluVaDriversVdpauH264ParamCache
+{
+  int has_pic_param;
+  VAPictureParameterBufferH264 pic_param;
+  int has_iq_matrix;
+  VAIQMatrixBufferH264 iq_matrix;
+  int has_flat_scaling_lists;
+  /* Set if the current picture carries its own IQ matrix. */
+  int iq_matrix_rendered;
+};
+
+/* The HEVC picture parameters are translated in full for every picture, only
+ * the scaling lists are kept across pictures. */
+typedef struct _FluVaDriversVdpauHEVCParamCache FluVaDriversVdpauHEVCParamCache;
+
+struct _FluVaDriversVdpauHEVCParamCache
+{
+  int has_flat_scaling_lists;
+  /* Set if the current picture carries its own IQ matrix. */
+  int iq_matrix_rendered;
+};
+
+/* MPEG-2 and MPEG-4 Part 2 quantizer matrices are kept across pictures, until
+ * an IQ matrix replaces them. */
+typedef struct _FluVaDriversVdpauMPEGParamCache FluVaDriversVdpauMPEGParamCache;
+
+struct _FluVaDriversVdpauMPEGParamCache
+{
+  int has_iq_matrix;
+};
+
+/* Picture parameters the VC-1 slice data start codes depend on. */
+typedef struct _FluVaDriversVdpauVC1ParamCache FluVaDriversVdpauVC1ParamCache;
+
+struct _FluVaDriversVdpauVC1ParamCache
+{
+  int is_advanced;
+  int is_first_field;
+};
+
+typedef struct _FluVaDriversVdpauAV1FrameInfo FluVaDriversVdpauAV1FrameInfo;
+
+struct _FluVaDriversVdpauAV1FrameInfo
+{
+  VASurfaceID surface_id;
+  /* Surface the frame was decoded to, its display picture if it has one. */
+  VASurfaceID target_id;
+  uint32_t order_hint;
+  uint32_t width;
+  uint32_t height;
+};
+
+/* VA only gives the order hint and size of the current AV1 frame, those of
+ * the references are remembered from the pictures that filled their slots. */
+typedef struct _FluVaDriversVdpauAV1ParamCache FluVaDriversVdpauAV1ParamCache;
+
+struct _FluVaDriversVdpauAV1ParamCache
+{
+  FluVaDriversVdpauAV1FrameInfo ref_frames[8];
+  FluVaDriversVdpauAV1FrameInfo last_frame;
+};
+
+/* Scratch state of the codec of a context. */
+typedef union _FluVaDriversVdpauParamCache FluVaDriversVdpauParamCache;
+
+union _FluVaDriversVdpauParamCache
+{
+  FluVaDriversVdpauMPEGParamCache mpeg;
+  FluVaDriversVdpauVC1ParamCache vc1;
+  FluVaDriversVdpauH264ParamCache h264;
+  FluVaDriversVdpauHEVCParamCache hevc;
+  FluVaDriversVdpauAV1ParamCache av1;
+};
+
 typedef struct _FluVaDriversVdpauPresentationQueueMapEntry
     FluVaDriversVdpauPresentationQueueMapEntry;
 SLIST_HEAD (_FluVaDriversVdpauPresentationQueueMap,
@@ -118,8 +279,10 @@ struct _FluVaDriversVdpauContextObject
 {
   struct object_base base;
   VAConfigID config_id;
+  VdpDecoderProfile vdp_profile;
+  const FluVaDriversVdpauCodecOps *codec_ops;
   int video_mixer_id;
-  VdpDecoder vdp_decoder;
+  FluVaDriversVdpauDecodeQueue decode_queue;
   VdpOutputSurface
       vdp_output_surfaces[FLU_VA_DRIVERS_VDPAU_NUM_OUTPUT_SURFACES];
   unsigned int vdp_output_surface_idx;
@@ -130,15 +293,21 @@ struct _FluVaDriversVdpauContextObject
   int picture_width;
   int picture_height;
   VASurfaceID current_render_target;
-  VdpPictureInfoH264 vdp_pic_info;
+  FluVaDriversVdpauPictureInfo vdp_pic_info;
+  FluVaDriversVdpauRefFrameCache ref_frame_cache;
+  FluVaDriversVdpauParamCache param_cache;
   VASurfaceID *render_targets;
   unsigned int num_render_targets;
-  /* Only one needed, because we support only 1 element per buffer */
   VABufferType last_buffer_type;
-  VASliceParameterBufferH264 *last_slice_param;
-  VdpBitstreamBuffer *vdp_bs_buf;
-  unsigned int num_vdp_bs_buf;
-  unsigned int cap_vdp_bs_buf;
+  /* Copies of the slice parameters waiting for the next slice data buffer,
+   * in order, slice_param_size bytes each. The client may destroy or reuse
+   * its parameter buffers before then. */
+  uint8_t *slice_params;
+  size_t slice_param_size;
+  unsigned int num_slice_params;
+  /* In bytes. */
+  size_t cap_slice_params;
+  FluVaDriversVdpauBitstream bitstream;
 };
 typedef struct _FluVaDriversVdpauContextObject FluVaDriversVdpauContextObject;
 
@@ -147,17 +316,51 @@ struct _FluVaDriversVdpauBufferObject
   struct object_base base;
   VABufferType type;
   void *data;
+  /* Real size of data, as allocated by the buffer pool. */
+  size_t capacity;
   size_t size;
   unsigned int num_elements;
+  /* Image whose surface shadow is data, which is then not owned by the
+   * buffer. VA_INVALID_ID otherwise. */
+  VAImageID derived_image;
+  /* FLU_VA_DRIVERS_VDPAU_MAP_* access of the current mapping of a derived
+   * image. When mapped for both, the digest of the shadow at map time tells
+   * on unmap whether it was written. */
+  unsigned int map_access;
+  uint64_t map_digest;
 };
 typedef struct _FluVaDriversVdpauBufferObject FluVaDriversVdpauBufferObject;
 
+/* Translation of the VA buffers of a codec to its VdpPictureInfo, selected
+ * from the profile at vaCreateConfig. */
+struct _FluVaDriversVdpauCodecOps
+{
+  /* Bytes of vdp_pic_info used by the codec. */
+  size_t vdp_pic_info_size;
+  /* References of the decoder created along with the context, before the
+   * stream tells how many it needs: a common count for the codec, the
+   * decoder is recreated if the stream uses another one. */
+  uint32_t default_max_references;
+  int (*is_buffer_type_supported) (VABufferType buffer_type);
+  /* Clears the per-picture state, if the codec has any. */
+  void (*begin_picture) (FluVaDriversVdpauContextObject *context_obj);
+  VAStatus (*translate_buffer) (VADriverContextP ctx,
+      FluVaDriversVdpauContextObject *context_obj,
+      FluVaDriversVdpauBufferObject *buffer_obj);
+  /* Completes vdp_pic_info once all the buffers of the picture are rendered,
+   * and sets the references and size the decoder needs. */
+  void (*end_picture) (FluVaDriversVdpauContextObject *context_obj,
+      FluVaDriversVdpauDecoderConfig *decoder_config);
+};
+
 struct _FluVaDriversVdpauImageObject
 {
   struct object_base base;
   VAImage va_image;
   FluVaDriversVdpauImageFormatType format_type;
   uint32_t vdp_format;
+  /* Surface the image was derived from, VA_INVALID_SURFACE otherwise. */
+  VASurfaceID derived_surface;
 };
 typedef struct _FluVaDriversVdpauImageObject FluVaDriversVdpauImageObject;
 
@@ -0,0 +1,658 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "flu_va_drivers_vdpau_av1.h"
+#include "flu_va_drivers_vdpau_utils.h"
+
+#ifdef HAVE_VDPAU_AV1
+
+#define N_ELEMENTS(array) (sizeof (array) / sizeof (*(array)))
+
+#define FLU_VA_DRIVERS_AV1_KEY_FRAME 0
+#define FLU_VA_DRIVERS_AV1_INTRA_ONLY_FRAME 2
+#define FLU_VA_DRIVERS_AV1_PRIMARY_REF_NONE 7
+#define FLU_VA_DRIVERS_AV1_REFS_PER_FRAME 7
+#define FLU_VA_DRIVERS_AV1_NUM_REF_FRAMES 8
+#define FLU_VA_DRIVERS_AV1_MAX_SEGMENTS 8
+#define FLU_VA_DRIVERS_AV1_SEG_LVL_ALT_Q 0
+#define FLU_VA_DRIVERS_AV1_LAST_FRAME 1
+#define FLU_VA_DRIVERS_AV1_SUPERRES_DENOM_MIN 9
+
+/* get_relative_dist () */
+static int
+flu_va_drivers_av1_get_relative_dist (
+    const VdpPictureInfoAV1 *vdp_pic_info, uint32_t a, uint32_t b)
+{
+  int diff, m;
+
+  if (!vdp_pic_info->enable_order_hint)
+    return 0;
+
+  diff = (int) a - (int) b;
+  m = 1 << vdp_pic_info->order_hint_bits_minus1;
+  return (diff & (m - 1)) - (diff & m);
+}
+
+/* A frame that is not in the cache gets a zero order hint and the size of
+ * the context. */
+static void
+flu_va_driver_vdpau_get_frame_info_av1 (
+    const FluVaDriversVdpauContextObject *context_obj, VASurfaceID surface_id,
+    FluVaDriversVdpauAV1FrameInfo *frame)
+{
+  const FluVaDriversVdpauAV1ParamCache *cache = &context_obj->param_cache.av1;
+  unsigned int i;
+
+  if (cache->last_frame.width != 0 &&
+      cache->last_frame.surface_id == surface_id) {
+    *frame = cache->last_frame;
+    return;
+  }
+
+  for (i = 0; i < N_ELEMENTS (cache->ref_frames); i++) {
+    if (cache->ref_frames[i].width != 0 &&
+        cache->ref_frames[i].surface_id == surface_id) {
+      *frame = cache->ref_frames[i];
+      return;
+    }
+  }
+
+  frame->surface_id = surface_id;
+  frame->target_id = surface_id;
+  frame->order_hint = 0;
+  frame->width = context_obj->picture_width;
+  frame->height = context_obj->picture_height;
+}
+
+/* skip_mode_params (), VA only tells whether the skip mode is used.
+ * Note: AV1 Bitstream & Decoding Process Specification. Section: 5.9.22. */
+static void
+flu_va_driver_vdpau_set_skip_mode_frames_av1 (VdpPictureInfoAV1 *vdp_pic_info,
+    const VADecPictureParameterBufferAV1 *param,
+    const FluVaDriversVdpauAV1FrameInfo *ref_frames)
+{
+  int forward_idx = -1, backward_idx = -1, second_forward_idx = -1;
+  uint32_t forward_hint = 0, backward_hint = 0, second_forward_hint = 0;
+  int i;
+
+  vdp_pic_info->SkipModeFrame0 = 0;
+  vdp_pic_info->SkipModeFrame1 = 0;
+  if (!vdp_pic_info->skip_mode)
+    return;
+
+  for (i = 0; i < FLU_VA_DRIVERS_AV1_REFS_PER_FRAME; i++) {
+    uint32_t ref_hint = ref_frames[param->ref_frame_idx[i]].order_hint;
+
+    if (flu_va_drivers_av1_get_relative_dist (
+            vdp_pic_info, ref_hint, param->order_hint) < 0) {
+      if (forward_idx < 0 || flu_va_drivers_av1_get_relative_dist (vdp_pic_info,
+                                 ref_hint, forward_hint) > 0) {
+        forward_idx = i;
+        forward_hint = ref_hint;
+      }
+    } else if (flu_va_drivers_av1_get_relative_dist (
+                   vdp_pic_info, ref_hint, param->order_hint) > 0) {
+      if (backward_idx < 0 ||
+          flu_va_drivers_av1_get_relative_dist (
+              vdp_pic_info, ref_hint, backward_hint) < 0) {
+        backward_idx = i;
+        backward_hint = ref_hint;
+      }
+    }
+  }
+
+  if (forward_idx < 0)
+    return;
+
+  if (backward_idx < 0) {
+    for (i = 0; i < FLU_VA_DRIVERS_AV1_REFS_PER_FRAME; i++) {
+      uint32_t ref_hint = ref_frames[param->ref_frame_idx[i]].order_hint;
+
+      if (flu_va_drivers_av1_get_relative_dist (
+              vdp_pic_info, ref_hint, forward_hint) < 0 &&
+          (second_forward_idx < 0 ||
+              flu_va_drivers_av1_get_relative_dist (
+                  vdp_pic_info, ref_hint, second_forward_hint) > 0)) {
+        second_forward_idx = i;
+        second_forward_hint = ref_hint;
+      }
+    }
+    if (second_forward_idx < 0)
+      return;
+    backward_idx = second_forward_idx;
+  }
+
+  vdp_pic_info->SkipModeFrame0 = FLU_VA_DRIVERS_AV1_LAST_FRAME +
+      (forward_idx < backward_idx ? forward_idx : backward_idx);
+  vdp_pic_info->SkipModeFrame1 = FLU_VA_DRIVERS_AV1_LAST_FRAME +
+      (forward_idx > backward_idx ? forward_idx : backward_idx);
+}
+
+/* CodedLossless, see the end of uncompressed_header () in the spec. */
+static int
+flu_va_driver_vdpau_is_coded_lossless_av1 (
+    const VADecPictureParameterBufferAV1 *param)
+{
+  const VASegmentationStructAV1 *seg_info = &param->seg_info;
+  unsigned int i;
+
+  if (param->y_dc_delta_q != 0 || param->u_dc_delta_q != 0 ||
+      param->u_ac_delta_q != 0 || param->v_dc_delta_q != 0 ||
+      param->v_ac_delta_q != 0)
+    return 0;
+
+  for (i = 0; i < FLU_VA_DRIVERS_AV1_MAX_SEGMENTS; i++) {
+    int qindex = param->base_qindex;
+
+    if (!seg_info->segment_info_fields.bits.enabled)
+      return qindex == 0;
+
+    if (seg_info->feature_mask[i] & (1 << FLU_VA_DRIVERS_AV1_SEG_LVL_ALT_Q))
+      qindex += seg_info->feature_data[i][FLU_VA_DRIVERS_AV1_SEG_LVL_ALT_Q];
+    if (qindex > 0)
+      return 0;
+  }
+
+  return 1;
+}
+
+static void
+flu_va_driver_vdpau_translate_film_grain_av1 (
+    VdpPictureInfoAV1 *vdp_pic_info, const VAFilmGrainStructAV1 *film_grain)
+{
+  unsigned int i;
+
+  vdp_pic_info->apply_grain =
+      film_grain->film_grain_info_fields.bits.apply_grain;
+  if (!vdp_pic_info->apply_grain)
+    return;
+
+  vdp_pic_info->overlap_flag =
+      film_grain->film_grain_info_fields.bits.overlap_flag;
+  vdp_pic_info->scaling_shift_minus8 =
+      film_grain->film_grain_info_fields.bits.grain_scaling_minus_8;
+  vdp_pic_info->chroma_scaling_from_luma =
+      film_grain->film_grain_info_fields.bits.chroma_scaling_from_luma;
+  vdp_pic_info->ar_coeff_lag =
+      film_grain->film_grain_info_fields.bits.ar_coeff_lag;
+  vdp_pic_info->ar_coeff_shift_minus6 =
+      film_grain->film_grain_info_fields.bits.ar_coeff_shift_minus_6;
+  vdp_pic_info->grain_scale_shift =
+      film_grain->film_grain_info_fields.bits.grain_scale_shift;
+  vdp_pic_info->clip_to_restricted_range =
+      film_grain->film_grain_info_fields.bits.clip_to_restricted_range;
+  vdp_pic_info->random_seed = film_grain->grain_seed;
+  vdp_pic_info->num_y_points = film_grain->num_y_points;
+  vdp_pic_info->num_cb_points = film_grain->num_cb_points;
+  vdp_pic_info->num_cr_points = film_grain->num_cr_points;
+  vdp_pic_info->cb_mult = film_grain->cb_mult;
+  vdp_pic_info->cb_luma_mult = film_grain->cb_luma_mult;
+  vdp_pic_info->cb_offset = film_grain->cb_offset;
+  vdp_pic_info->cr_mult = film_grain->cr_mult;
+  vdp_pic_info->cr_luma_mult = film_grain->cr_luma_mult;
+  vdp_pic_info->cr_offset = film_grain->cr_offset;
+
+  for (i = 0; i < N_ELEMENTS (film_grain->point_y_value); i++) {
+    vdp_pic_info->scaling_points_y[i][0] = film_grain->point_y_value[i];
+    vdp_pic_info->scaling_points_y[i][1] = film_grain->point_y_scaling[i];
+  }
+  for (i = 0; i < N_ELEMENTS (film_grain->point_cb_value); i++) {
+    vdp_pic_info->scaling_points_cb[i][0] = film_grain->point_cb_value[i];
+    vdp_pic_info->scaling_points_cb[i][1] = film_grain->point_cb_scaling[i];
+    vdp_pic_info->scaling_points_cr[i][0] = film_grain->point_cr_value[i];
+    vdp_pic_info->scaling_points_cr[i][1] = film_grain->point_cr_scaling[i];
+  }
+
+  /* VA already removed the 128 bias of the coefficients. */
+  for (i = 0; i < N_ELEMENTS (film_grain->ar_coeffs_y); i++)
+    vdp_pic_info->ar_coeffs_y[i] = film_grain->ar_coeffs_y[i];
+  for (i = 0; i < N_ELEMENTS (film_grain->ar_coeffs_cb); i++) {
+    vdp_pic_info->ar_coeffs_cb[i] = film_grain->ar_coeffs_cb[i];
+    vdp_pic_info->ar_coeffs_cr[i] = film_grain->ar_coeffs_cr[i];
+  }
+}
+
+/* The reference slots are translated for inter frames only, as the slots of
+ * intra frames may hold surfaces destroyed since. A slot that none of the
+ * seven references uses is left invalid if its surface is gone. */
+static VAStatus
+flu_va_driver_vdpau_translate_ref_frames_av1 (
+    FluVaDriversVdpauDriverData *driver_data,
+    FluVaDriversVdpauContextObject *context_obj,
+    const VADecPictureParameterBufferAV1 *param,
+    const FluVaDriversVdpauAV1FrameInfo *ref_frames)
+{
+  FluVaDriversVdpauRefFrameCache *cache = &context_obj->ref_frame_cache;
+  VdpPictureInfoAV1 *vdp_pic_info = &context_obj->vdp_pic_info.av1;
+  unsigned int used_slots = 0;
+  unsigned int i;
+  VAStatus ret;
+
+  for (i = 0; i < FLU_VA_DRIVERS_AV1_NUM_REF_FRAMES; i++)
+    vdp_pic_info->ref_frame_map[i] = VDP_INVALID_HANDLE;
+  for (i = 0; i < FLU_VA_DRIVERS_AV1_REFS_PER_FRAME; i++) {
+    vdp_pic_info->ref_frame[i].index = VDP_INVALID_HANDLE;
+    vdp_pic_info->ref_frame[i].width = 0;
+    vdp_pic_info->ref_frame[i].height = 0;
+  }
+  vdp_pic_info->primary_ref_frame = VDP_INVALID_HANDLE;
+
+  if (vdp_pic_info->frame_type == FLU_VA_DRIVERS_AV1_KEY_FRAME ||
+      vdp_pic_info->frame_type == FLU_VA_DRIVERS_AV1_INTRA_ONLY_FRAME)
+    return VA_STATUS_SUCCESS;
+
+  for (i = 0; i < FLU_VA_DRIVERS_AV1_REFS_PER_FRAME; i++) {
+    if (param->ref_frame_idx[i] >= FLU_VA_DRIVERS_AV1_NUM_REF_FRAMES)
+      return VA_STATUS_ERROR_INVALID_PARAMETER;
+    used_slots |= 1 << param->ref_frame_idx[i];
+  }
+
+  flu_va_drivers_vdpau_ref_frame_cache_sync (driver_data, cache);
+  for (i = 0; i < FLU_VA_DRIVERS_AV1_NUM_REF_FRAMES; i++) {
+    if (param->ref_frame_map[i] == VA_INVALID_SURFACE)
+      continue;
+
+    ret = flu_va_drivers_vdpau_ref_frame_cache_lookup_surface (driver_data,
+        cache, ref_frames[i].target_id, &vdp_pic_info->ref_frame_map[i]);
+    if (ret != VA_STATUS_SUCCESS) {
+      if (used_slots & (1 << i))
+        return ret;
+      vdp_pic_info->ref_frame_map[i] = VDP_INVALID_HANDLE;
+    }
+  }
+
+  for (i = 0; i < FLU_VA_DRIVERS_AV1_REFS_PER_FRAME; i++) {
+    uint8_t slot = param->ref_frame_idx[i];
+
+    vdp_pic_info->ref_frame[i].index = vdp_pic_info->ref_frame_map[slot];
+    vdp_pic_info->ref_frame[i].width = ref_frames[slot].width;
+    vdp_pic_info->ref_frame[i].height = ref_frames[slot].height;
+  }
+
+  if (param->primary_ref_frame < FLU_VA_DRIVERS_AV1_PRIMARY_REF_NONE) {
+    uint8_t slot = param->ref_frame_idx[param->primary_ref_frame];
+
+    vdp_pic_info->primary_ref_frame = vdp_pic_info->ref_frame_map[slot];
+  }
+
+  return VA_STATUS_SUCCESS;
+}
+
+#define _MAP_SEQ_FIELD(FIELD, SEQ_FIELD)                                      \
+  vdp_pic_info->FIELD = param->seq_info_fields.fields.SEQ_FIELD
+#define _MAP_PIC_FIELD(FIELD, PIC_FIELD)                                      \
+  vdp_pic_info->FIELD = param->pic_info_fields.bits.PIC_FIELD
+#define _MAP_MODE_FIELD(FIELD, MODE_FIELD)                                    \
+  vdp_pic_info->FIELD = param->mode_control_fields.bits.MODE_FIELD
+static VAStatus
+flu_va_driver_vdpau_translate_pic_param_av1 (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj,
+    const VADecPictureParameterBufferAV1 *param)
+{
+  FluVaDriversVdpauDriverData *driver_data =
+      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  FluVaDriversVdpauAV1ParamCache *cache = &context_obj->param_cache.av1;
+  VdpPictureInfoAV1 *vdp_pic_info = &context_obj->vdp_pic_info.av1;
+  FluVaDriversVdpauAV1FrameInfo ref_frames[FLU_VA_DRIVERS_AV1_NUM_REF_FRAMES];
+  VASurfaceID target_id = context_obj->current_render_target;
+  unsigned int i;
+  VAStatus ret;
+
+  /* Main profile only, and no large scale tile decoding. */
+  if (param->profile != 0 || param->bit_depth_idx > 1 ||
+      param->pic_info_fields.bits.large_scale_tile ||
+      param->anchor_frames_num != 0)
+    return VA_STATUS_ERROR_UNKNOWN;
+  if (param->tile_cols > N_ELEMENTS (param->width_in_sbs_minus_1) ||
+      param->tile_rows > N_ELEMENTS (param->height_in_sbs_minus_1))
+    return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+  /* With film grain, the frame is decoded to the display picture, while the
+   * client keeps referencing it by current_frame. */
+  if (param->current_display_picture != VA_INVALID_SURFACE &&
+      param->current_display_picture != target_id) {
+    if (object_heap_lookup (&driver_data->surface_heap,
+            param->current_display_picture) == NULL)
+      return VA_STATUS_ERROR_INVALID_SURFACE;
+    target_id = param->current_display_picture;
+    context_obj->current_render_target = target_id;
+  }
+
+  vdp_pic_info->major_version = 0;
+  vdp_pic_info->minor_version = 0;
+
+  /* Sequence header */
+  vdp_pic_info->profile = param->profile;
+  _MAP_SEQ_FIELD (use_128x128_superblock, use_128x128_superblock);
+  _MAP_SEQ_FIELD (subsampling_x, subsampling_x);
+  _MAP_SEQ_FIELD (subsampling_y, subsampling_y);
+  _MAP_SEQ_FIELD (mono_chrome, mono_chrome);
+  vdp_pic_info->bit_depth_minus8 = param->bit_depth_idx * 2;
+  _MAP_SEQ_FIELD (enable_filter_intra, enable_filter_intra);
+  _MAP_SEQ_FIELD (enable_intra_edge_filter, enable_intra_edge_filter);
+  _MAP_SEQ_FIELD (enable_interintra_compound, enable_interintra_compound);
+  _MAP_SEQ_FIELD (enable_masked_compound, enable_masked_compound);
+  _MAP_SEQ_FIELD (enable_dual_filter, enable_dual_filter);
+  _MAP_SEQ_FIELD (enable_order_hint, enable_order_hint);
+  vdp_pic_info->order_hint_bits_minus1 = param->order_hint_bits_minus_1;
+  _MAP_SEQ_FIELD (enable_jnt_comp, enable_jnt_comp);
+  _MAP_SEQ_FIELD (enable_cdef, enable_cdef);
+  _MAP_SEQ_FIELD (enable_fgs, film_grain_params_present);
+  /* VA has no enable_superres nor enable_restoration, the frame level flags
+   * are enough to enable the tools. */
+  _MAP_PIC_FIELD (enable_superres, use_superres);
+  vdp_pic_info->enable_restoration =
+      param->loop_restoration_fields.bits.yframe_restoration_type != 0 ||
+      param->loop_restoration_fields.bits.cbframe_restoration_type != 0 ||
+      param->loop_restoration_fields.bits.crframe_restoration_type != 0;
+
+  /* Frame header */
+  vdp_pic_info->width = param->frame_width_minus1 + 1;
+  vdp_pic_info->height = param->frame_height_minus1 + 1;
+  _MAP_PIC_FIELD (frame_type, frame_type);
+  _MAP_PIC_FIELD (show_frame, show_frame);
+  _MAP_PIC_FIELD (disable_cdf_update, disable_cdf_update);
+  _MAP_PIC_FIELD (allow_screen_content_tools, allow_screen_content_tools);
+  _MAP_PIC_FIELD (force_integer_mv, force_integer_mv);
+  _MAP_PIC_FIELD (allow_intrabc, allow_intrabc);
+  _MAP_PIC_FIELD (use_superres, use_superres);
+  vdp_pic_info->coded_denom =
+      vdp_pic_info->use_superres ? param->superres_scale_denominator -
+                                       FLU_VA_DRIVERS_AV1_SUPERRES_DENOM_MIN
+                                 : 0;
+  _MAP_PIC_FIELD (allow_high_precision_mv, allow_high_precision_mv);
+  vdp_pic_info->interp_filter = param->interp_filter;
+  _MAP_PIC_FIELD (switchable_motion_mode, is_motion_mode_switchable);
+  _MAP_PIC_FIELD (use_ref_frame_mvs, use_ref_frame_mvs);
+  _MAP_PIC_FIELD (disable_frame_end_update_cdf, disable_frame_end_update_cdf);
+  _MAP_PIC_FIELD (allow_warped_motion, allow_warped_motion);
+  _MAP_MODE_FIELD (delta_q_present, delta_q_present_flag);
+  _MAP_MODE_FIELD (delta_q_res, log2_delta_q_res);
+  _MAP_MODE_FIELD (delta_lf_present, delta_lf_present_flag);
+  _MAP_MODE_FIELD (delta_lf_res, log2_delta_lf_res);
+  _MAP_MODE_FIELD (delta_lf_multi, delta_lf_multi);
+  _MAP_MODE_FIELD (tx_mode, tx_mode);
+  _MAP_MODE_FIELD (reference_mode, reference_select);
+  _MAP_MODE_FIELD (reduced_tx_set, reduced_tx_set_used);
+  _MAP_MODE_FIELD (skip_mode, skip_mode_present);
+  vdp_pic_info->coded_lossless =
+      flu_va_driver_vdpau_is_coded_lossless_av1 (param);
+  vdp_pic_info->temporal_layer_id = 0;
+  vdp_pic_info->spatial_layer_id = 0;
+
+  /* Tiles, their offsets are set from the slice parameters. */
+  vdp_pic_info->num_tile_cols = param->tile_cols;
+  vdp_pic_info->num_tile_rows = param->tile_rows;
+  vdp_pic_info->context_update_tile_id = param->context_update_tile_id;
+  for (i = 0; i < param->tile_cols; i++)
+    vdp_pic_info->tile_widths[i] = param->width_in_sbs_minus_1[i] + 1;
+  for (i = 0; i < param->tile_rows; i++)
+    vdp_pic_info->tile_heights[i] = param->height_in_sbs_minus_1[i] + 1;
+
+  /* CDEF, VA packs the primary strength above the 2 bits of the secondary
+   * one, and VDPAU in the low 4 bits below it. */
+  vdp_pic_info->cdef_damping_minus_3 = param->cdef_damping_minus_3;
+  vdp_pic_info->cdef_bits = param->cdef_bits;
+  for (i = 0; i < N_ELEMENTS (param->cdef_y_strengths); i++) {
+    vdp_pic_info->cdef_y_strength[i] = (param->cdef_y_strengths[i] >> 2) |
+                                       (param->cdef_y_strengths[i] & 3) << 4;
+    vdp_pic_info->cdef_uv_strength[i] = (param->cdef_uv_strengths[i] >> 2) |
+                                        (param->cdef_uv_strengths[i] & 3) << 4;
+  }
+
+  /* Quantization */
+  vdp_pic_info->base_qindex = param->base_qindex;
+  vdp_pic_info->qp_y_dc_delta_q = param->y_dc_delta_q;
+  vdp_pic_info->qp_u_dc_delta_q = param->u_dc_delta_q;
+  vdp_pic_info->qp_v_dc_delta_q = param->v_dc_delta_q;
+  vdp_pic_info->qp_u_ac_delta_q = param->u_ac_delta_q;
+  vdp_pic_info->qp_v_ac_delta_q = param->v_ac_delta_q;
+  vdp_pic_info->using_qmatrix = param->qmatrix_fields.bits.using_qmatrix;
+  vdp_pic_info->qm_y = param->qmatrix_fields.bits.qm_y;
+  vdp_pic_info->qm_u = param->qmatrix_fields.bits.qm_u;
+  vdp_pic_info->qm_v = param->qmatrix_fields.bits.qm_v;
+
+  /* Segmentation */
+  vdp_pic_info->segmentation_enabled =
+      param->seg_info.segment_info_fields.bits.enabled;
+  vdp_pic_info->segmentation_update_map =
+      param->seg_info.segment_info_fields.bits.update_map;
+  vdp_pic_info->segmentation_update_data =
+      param->seg_info.segment_info_fields.bits.update_data;
+  vdp_pic_info->segmentation_temporal_update =
+      param->seg_info.segment_info_fields.bits.temporal_update;
+  memcpy (vdp_pic_info->segmentation_feature_mask, param->seg_info.feature_mask,
+      sizeof (vdp_pic_info->segmentation_feature_mask));
+  memcpy (vdp_pic_info->segmentation_feature_data, param->seg_info.feature_data,
+      sizeof (vdp_pic_info->segmentation_feature_data));
+
+  /* Loop filter */
+  vdp_pic_info->loop_filter_level[0] = param->filter_level[0];
+  vdp_pic_info->loop_filter_level[1] = param->filter_level[1];
+  vdp_pic_info->loop_filter_level_u = param->filter_level_u;
+  vdp_pic_info->loop_filter_level_v = param->filter_level_v;
+  vdp_pic_info->loop_filter_sharpness =
+      param->loop_filter_info_fields.bits.sharpness_level;
+  vdp_pic_info->loop_filter_delta_enabled =
+      param->loop_filter_info_fields.bits.mode_ref_delta_enabled;
+  vdp_pic_info->loop_filter_delta_update =
+      param->loop_filter_info_fields.bits.mode_ref_delta_update;
+  for (i = 0; i < N_ELEMENTS (param->ref_deltas); i++)
+    vdp_pic_info->loop_filter_ref_deltas[i] = param->ref_deltas[i];
+  for (i = 0; i < N_ELEMENTS (param->mode_deltas); i++)
+    vdp_pic_info->loop_filter_mode_deltas[i] = param->mode_deltas[i];
+
+  /* Loop restoration, the unit sizes are coded as log2 (size) - 5. */
+  vdp_pic_info->lr_type[0] =
+      param->loop_restoration_fields.bits.yframe_restoration_type;
+  vdp_pic_info->lr_type[1] =
+      param->loop_restoration_fields.bits.cbframe_restoration_type;
+  vdp_pic_info->lr_type[2] =
+      param->loop_restoration_fields.bits.crframe_restoration_type;
+  vdp_pic_info->lr_unit_size[0] =
+      1 + param->loop_restoration_fields.bits.lr_unit_shift;
+  vdp_pic_info->lr_unit_size[1] =
+      vdp_pic_info->lr_unit_size[0] -
+      param->loop_restoration_fields.bits.lr_uv_shift;
+  vdp_pic_info->lr_unit_size[2] = vdp_pic_info->lr_unit_size[1];
+
+  /* Global motion */
+  for (i = 0; i < FLU_VA_DRIVERS_AV1_REFS_PER_FRAME; i++) {
+    unsigned int j;
+
+    vdp_pic_info->global_motion[i].invalid = param->wm[i].invalid;
+    vdp_pic_info->global_motion[i].wmtype = param->wm[i].wmtype;
+    for (j = 0; j < N_ELEMENTS (vdp_pic_info->global_motion[i].wmmat); j++)
+      vdp_pic_info->global_motion[i].wmmat[j] = param->wm[i].wmmat[j];
+  }
+
+  flu_va_driver_vdpau_translate_film_grain_av1 (
+      vdp_pic_info, &param->film_grain_info);
+
+  /* References */
+  for (i = 0; i < FLU_VA_DRIVERS_AV1_NUM_REF_FRAMES; i++)
+    flu_va_driver_vdpau_get_frame_info_av1 (
+        context_obj, param->ref_frame_map[i], &ref_frames[i]);
+
+  ret = flu_va_driver_vdpau_translate_ref_frames_av1 (
+      driver_data, context_obj, param, ref_frames);
+  if (ret != VA_STATUS_SUCCESS)
+    return ret;
+  flu_va_driver_vdpau_set_skip_mode_frames_av1 (
+      vdp_pic_info, param, ref_frames);
+
+  /* The slots of the next frame are those of this one, refreshed with it. */
+  memcpy (cache->ref_frames, ref_frames, sizeof (cache->ref_frames));
+  cache->last_frame.surface_id = param->current_frame;
+  cache->last_frame.target_id = target_id;
+  cache->last_frame.order_hint = param->order_hint;
+  cache->last_frame.width = vdp_pic_info->width;
+  cache->last_frame.height = vdp_pic_info->height;
+
+  return VA_STATUS_SUCCESS;
+}
+#undef _MAP_MODE_FIELD
+#undef _MAP_PIC_FIELD
+#undef _MAP_SEQ_FIELD
+
+/* Each slice parameter is a tile of the tile groups in the slice data buffer.
+ * The buffer is not copied but adopted by the picture bitstream, and the
+ * buffer object gets new storage from the pool in case it is mapped again.
+ * The tile offsets are relative to the whole picture bitstream, made of all
+ * the adopted buffers. */
+static VAStatus
+flu_va_driver_vdpau_push_tile_groups_av1 (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauBufferObject *buffer_obj)
+{
+  FluVaDriversVdpauDriverData *driver_data =
+      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  FluVaDriversVdpauBitstream *bitstream = &context_obj->bitstream;
+  VdpPictureInfoAV1 *vdp_pic_info = &context_obj->vdp_pic_info.av1;
+  size_t data_size = buffer_obj->size * buffer_obj->num_elements;
+  uint64_t base_offset = 0;
+  size_t capacity;
+  void *data;
+  unsigned int i;
+  VAStatus ret;
+
+  if (context_obj->num_slice_params == 0)
+    return VA_STATUS_ERROR_UNKNOWN;
+
+  for (i = 0; i < bitstream->num_buffers; i++)
+    base_offset += bitstream->buffers[i].bitstream_bytes;
+  if (data_size > UINT32_MAX - base_offset)
+    return VA_STATUS_ERROR_INVALID_BUFFER;
+
+  for (i = 0; i < context_obj->num_slice_params; i++) {
+    const VASliceParameterBufferAV1 *param =
+        (const VASliceParameterBufferAV1 *)
+            flu_va_drivers_vdpau_context_object_get_slice_params (
+                context_obj, i);
+    unsigned int tile;
+
+    if (param->tile_row >= vdp_pic_info->num_tile_rows ||
+        param->tile_column >= vdp_pic_info->num_tile_cols)
+      return VA_STATUS_ERROR_INVALID_PARAMETER;
+    tile = param->tile_row * vdp_pic_info->num_tile_cols + param->tile_column;
+    if (tile >= N_ELEMENTS (vdp_pic_info->tile_info) / 2)
+      return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    if (param->slice_data_offset > data_size ||
+        param->slice_data_size > data_size - param->slice_data_offset)
+      return VA_STATUS_ERROR_INVALID_BUFFER;
+
+    vdp_pic_info->tile_info[2 * tile] = base_offset + param->slice_data_offset;
+    vdp_pic_info->tile_info[2 * tile + 1] =
+        vdp_pic_info->tile_info[2 * tile] + param->slice_data_size;
+  }
+
+  data = flu_va_drivers_vdpau_buffer_pool_acquire (
+      &driver_data->buffer_pool, data_size, &capacity);
+  if (data == NULL)
+    return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+  ret = flu_va_drivers_vdpau_bitstream_adopt (
+      bitstream, buffer_obj->data, buffer_obj->capacity, data_size);
+  if (ret != VA_STATUS_SUCCESS) {
+    flu_va_drivers_vdpau_buffer_pool_release (
+        &driver_data->buffer_pool, data, capacity);
+    return ret;
+  }
+
+  buffer_obj->data = data;
+  buffer_obj->capacity = capacity;
+  context_obj->num_slice_params = 0;
+
+  return VA_STATUS_SUCCESS;
+}
+
+static int
+flu_va_driver_vdpau_is_buffer_type_supported_av1 (VABufferType buffer_type)
+{
+  switch (buffer_type) {
+    case VAPictureParameterBufferType:
+    case VASliceParameterBufferType:
+    case VASliceDataBufferType:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static VAStatus
+flu_va_driver_vdpau_translate_buffer_av1 (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauBufferObject *buffer_obj)
+{
+  VAStatus ret = VA_STATUS_SUCCESS;
+
+  switch (buffer_obj->type) {
+    case VAPictureParameterBufferType:
+      ret = flu_va_driver_vdpau_translate_pic_param_av1 (ctx, context_obj,
+          (VADecPictureParameterBufferAV1 *) buffer_obj->data);
+      break;
+    case VASliceParameterBufferType:
+      ret = flu_va_drivers_vdpau_context_object_push_slice_params (context_obj,
+          buffer_obj->data, sizeof (VASliceParameterBufferAV1),
+          buffer_obj->num_elements);
+      break;
+    case VASliceDataBufferType:
+      ret = flu_va_driver_vdpau_push_tile_groups_av1 (
+          ctx, context_obj, buffer_obj);
+      break;
+    default:
+      ret = VA_STATUS_ERROR_UNSUPPORTED_BUFFERTYPE;
+      break;
+  }
+
+  context_obj->last_buffer_type = buffer_obj->type;
+  return ret;
+}
+
+/* As VP9, inter frames may change the frame size. */
+static void
+flu_va_driver_vdpau_end_picture_av1 (
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauDecoderConfig *decoder_config)
+{
+  VdpPictureInfoAV1 *vdp_pic_info = &context_obj->vdp_pic_info.av1;
+
+  if (vdp_pic_info->width > decoder_config->width)
+    decoder_config->width = vdp_pic_info->width;
+  if (vdp_pic_info->height > decoder_config->height)
+    decoder_config->height = vdp_pic_info->height;
+  decoder_config->max_references = 8;
+}
+
+const FluVaDriversVdpauCodecOps FLU_VA_DRIVERS_VDPAU_CODEC_OPS_AV1 = {
+  .vdp_pic_info_size = sizeof (VdpPictureInfoAV1),
+  .default_max_references = 8,
+  .is_buffer_type_supported = flu_va_driver_vdpau_is_buffer_type_supported_av1,
+  .begin_picture = NULL,
+  .translate_buffer = flu_va_driver_vdpau_translate_buffer_av1,
+  .end_picture = flu_va_driver_vdpau_end_picture_av1,
+};
+
+#endif /* HAVE_VDPAU_AV1 */
@@ -0,0 +1,34 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __FLU_VA_DRIVERS_VDPAU_AV1_H__
+#define __FLU_VA_DRIVERS_VDPAU_AV1_H__
+
+#include <va/va.h>
+#include "flu_va_drivers_vdpau.h"
+
+#ifdef HAVE_VDPAU_AV1
+extern const FluVaDriversVdpauCodecOps FLU_VA_DRIVERS_VDPAU_CODEC_OPS_AV1;
+#endif
+
+#endif /* __FLU_VA_DRIVERS_VDPAU_AV1_H__ */
@@ -0,0 +1,175 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flu_va_drivers_vdpau_buffer_pool.h"
+
+/* Pooled allocations are chained through their own storage. */
+struct _FluVaDriversVdpauBufferPoolEntry
+{
+  FluVaDriversVdpauBufferPoolEntry *next;
+};
+
+static int
+flu_va_drivers_vdpau_buffer_pool_get_class (size_t size)
+{
+  size_t class_size = 1 << FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_MIN_SIZE_SHIFT;
+  int i;
+
+  for (i = 0; i < FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_NUM_CLASSES; i++) {
+    if (size <= class_size)
+      return i;
+    class_size <<= 1;
+  }
+
+  return -1;
+}
+
+static size_t
+flu_va_drivers_vdpau_buffer_pool_get_class_size (int class_idx)
+{
+  return (size_t) 1 << (FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_MIN_SIZE_SHIFT +
+                        class_idx);
+}
+
+void
+flu_va_drivers_vdpau_buffer_pool_init (FluVaDriversVdpauBufferPool *pool)
+{
+  const char *max_bytes_env;
+
+  memset (pool, 0, sizeof (*pool));
+  pthread_mutex_init (&pool->mutex, NULL);
+
+  pool->max_bytes = FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_DEFAULT_MAX_BYTES;
+  max_bytes_env = getenv ("FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_MAX_BYTES");
+  if (max_bytes_env != NULL) {
+    char *end;
+    unsigned long long max_bytes = strtoull (max_bytes_env, &end, 10);
+
+    if (end != max_bytes_env && *end == '\0')
+      pool->max_bytes = max_bytes;
+  }
+
+  pool->print_stats =
+      getenv ("FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_STATS") != NULL;
+}
+
+void
+flu_va_drivers_vdpau_buffer_pool_destroy (FluVaDriversVdpauBufferPool *pool)
+{
+  int i;
+
+  if (pool->print_stats) {
+    fprintf (stderr,
+        "flu_va_drivers_vdpau buffer pool: %zu hits, %zu misses, "
+        "%zu evictions, %zu bytes peak (max %zu)\n",
+        pool->stats.hits, pool->stats.misses, pool->stats.evictions,
+        pool->stats.peak_cached_bytes, pool->max_bytes);
+  }
+
+  for (i = 0; i < FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_NUM_CLASSES; i++) {
+    while (pool->free_lists[i] != NULL) {
+      FluVaDriversVdpauBufferPoolEntry *entry = pool->free_lists[i];
+
+      pool->free_lists[i] = entry->next;
+      free (entry);
+    }
+  }
+
+  pthread_mutex_destroy (&pool->mutex);
+}
+
+void *
+flu_va_drivers_vdpau_buffer_pool_acquire (
+    FluVaDriversVdpauBufferPool *pool, size_t size, size_t *capacity)
+{
+  FluVaDriversVdpauBufferPoolEntry *entry = NULL;
+  int class_idx;
+
+  class_idx = flu_va_drivers_vdpau_buffer_pool_get_class (size);
+  if (class_idx < 0) {
+    pthread_mutex_lock (&pool->mutex);
+    pool->stats.misses++;
+    pthread_mutex_unlock (&pool->mutex);
+    *capacity = size;
+    return malloc (size);
+  }
+
+  *capacity = flu_va_drivers_vdpau_buffer_pool_get_class_size (class_idx);
+
+  pthread_mutex_lock (&pool->mutex);
+  entry = pool->free_lists[class_idx];
+  if (entry != NULL) {
+    pool->free_lists[class_idx] = entry->next;
+    pool->stats.cached_bytes -= *capacity;
+    pool->stats.hits++;
+  } else {
+    pool->stats.misses++;
+  }
+  pthread_mutex_unlock (&pool->mutex);
+
+  if (entry == NULL)
+    return malloc (*capacity);
+  return entry;
+}
+
+void
+flu_va_drivers_vdpau_buffer_pool_release (
+    FluVaDriversVdpauBufferPool *pool, void *data, size_t capacity)
+{
+  FluVaDriversVdpauBufferPoolEntry *entry = data;
+  int class_idx;
+
+  if (data == NULL)
+    return;
+
+  class_idx = flu_va_drivers_vdpau_buffer_pool_get_class (capacity);
+
+  pthread_mutex_lock (&pool->mutex);
+  if (class_idx < 0 ||
+      flu_va_drivers_vdpau_buffer_pool_get_class_size (class_idx) != capacity ||
+      pool->stats.cached_bytes + capacity > pool->max_bytes) {
+    pool->stats.evictions++;
+    pthread_mutex_unlock (&pool->mutex);
+    free (data);
+    return;
+  }
+
+  entry->next = pool->free_lists[class_idx];
+  pool->free_lists[class_idx] = entry;
+  pool->stats.cached_bytes += capacity;
+  if (pool->stats.cached_bytes > pool->stats.peak_cached_bytes)
+    pool->stats.peak_cached_bytes = pool->stats.cached_bytes;
+  pthread_mutex_unlock (&pool->mutex);
+}
+
+void
+flu_va_drivers_vdpau_buffer_pool_get_stats (
+    FluVaDriversVdpauBufferPool *pool, FluVaDriversVdpauBufferPoolStats *stats)
+{
+  pthread_mutex_lock (&pool->mutex);
+  *stats = pool->stats;
+  pthread_mutex_unlock (&pool->mutex);
+}
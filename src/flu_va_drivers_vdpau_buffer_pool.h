@@ -0,0 +1,88 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_H__
+#define __FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_H__
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* Size classes are powers of two from 64 bytes to 4 MiB. Bigger buffers are
+ * not pooled. */
+#define FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_MIN_SIZE_SHIFT 6
+#define FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_NUM_CLASSES 17
+
+/* Maximum amount of bytes kept in the pool, overridable with the
+ * FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_MAX_BYTES environment variable. */
+#define FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_DEFAULT_MAX_BYTES (32 * 1024 * 1024)
+
+typedef struct _FluVaDriversVdpauBufferPoolStats
+    FluVaDriversVdpauBufferPoolStats;
+
+struct _FluVaDriversVdpauBufferPoolStats
+{
+  /* Allocations served from the pool. */
+  size_t hits;
+  /* Allocations that needed a malloc. */
+  size_t misses;
+  /* Released allocations freed because the pool was full or they were too
+   * big to be pooled. */
+  size_t evictions;
+  size_t cached_bytes;
+  size_t peak_cached_bytes;
+};
+
+typedef struct _FluVaDriversVdpauBufferPoolEntry
+    FluVaDriversVdpauBufferPoolEntry;
+
+typedef struct _FluVaDriversVdpauBufferPool FluVaDriversVdpauBufferPool;
+
+struct _FluVaDriversVdpauBufferPool
+{
+  pthread_mutex_t mutex;
+  FluVaDriversVdpauBufferPoolEntry
+      *free_lists[FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_NUM_CLASSES];
+  size_t max_bytes;
+  /* Print the statistics on destruction, enabled with the
+   * FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_STATS environment variable. */
+  int print_stats;
+  FluVaDriversVdpauBufferPoolStats stats;
+};
+
+void flu_va_drivers_vdpau_buffer_pool_init (FluVaDriversVdpauBufferPool *pool);
+
+void flu_va_drivers_vdpau_buffer_pool_destroy (
+    FluVaDriversVdpauBufferPool *pool);
+
+/* Returns an allocation of at least size bytes, and its real size in
+ * capacity, which has to be given back on release. */
+void *flu_va_drivers_vdpau_buffer_pool_acquire (
+    FluVaDriversVdpauBufferPool *pool, size_t size, size_t *capacity);
+
+void flu_va_drivers_vdpau_buffer_pool_release (
+    FluVaDriversVdpauBufferPool *pool, void *data, size_t capacity);
+
+void flu_va_drivers_vdpau_buffer_pool_get_stats (
+    FluVaDriversVdpauBufferPool *pool, FluVaDriversVdpauBufferPoolStats *stats);
+
+#endif /* __FLU_VA_DRIVERS_VDPAU_BUFFER_POOL_H__ */
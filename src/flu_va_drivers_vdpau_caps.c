@@ -0,0 +1,216 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "flu_va_drivers_vdpau_caps.h"
+#include "flu_va_drivers_vdpau_utils.h"
+
+static const VAProfile FLU_VA_DRIVERS_VDPAU_CAPS_PROFILES[] = {
+  VAProfileMPEG2Simple, VAProfileMPEG2Main, VAProfileMPEG4Simple,
+  VAProfileMPEG4AdvancedSimple, VAProfileVC1Simple, VAProfileVC1Main,
+  VAProfileVC1Advanced, VAProfileH264ConstrainedBaseline, VAProfileH264Main,
+  VAProfileH264High,
+  VAProfileHEVCMain, VAProfileHEVCMain10,
+#ifdef HAVE_VDPAU_HIGH_BIT_DEPTH
+  VAProfileHEVCMain12,
+#endif
+#ifdef HAVE_VDPAU_VP9
+  VAProfileVP9Profile0,
+#endif
+#ifdef HAVE_VDPAU_AV1
+  VAProfileAV1Profile0,
+#endif
+};
+
+static const VdpChromaType FLU_VA_DRIVERS_VDPAU_CAPS_CHROMA_TYPES[] = {
+  VDP_CHROMA_TYPE_420, VDP_CHROMA_TYPE_422, VDP_CHROMA_TYPE_444,
+#ifdef HAVE_VDPAU_HIGH_BIT_DEPTH
+  VDP_CHROMA_TYPE_420_16, VDP_CHROMA_TYPE_422_16, VDP_CHROMA_TYPE_444_16,
+#endif
+};
+
+static const VdpYCbCrFormat FLU_VA_DRIVERS_VDPAU_CAPS_YCBCR_FORMATS[] = {
+  VDP_YCBCR_FORMAT_NV12, VDP_YCBCR_FORMAT_YV12, VDP_YCBCR_FORMAT_UYVY,
+  VDP_YCBCR_FORMAT_YUYV, VDP_YCBCR_FORMAT_Y8U8V8A8, VDP_YCBCR_FORMAT_V8U8Y8A8,
+#ifdef HAVE_VDPAU_HIGH_BIT_DEPTH
+  VDP_YCBCR_FORMAT_Y_U_V_444, VDP_YCBCR_FORMAT_P010, VDP_YCBCR_FORMAT_P016,
+#endif
+};
+
+static const unsigned int FLU_VA_DRIVERS_VDPAU_CAPS_RT_FORMATS[] = {
+  VA_RT_FORMAT_YUV420, VA_RT_FORMAT_YUV422, VA_RT_FORMAT_YUV444,
+  VA_RT_FORMAT_YUV420_10, VA_RT_FORMAT_YUV420_12
+};
+
+static const VdpVideoMixerFeature FLU_VA_DRIVERS_VDPAU_CAPS_MIXER_FEATURES[] = {
+  VDP_VIDEO_MIXER_FEATURE_DEINTERLACE_TEMPORAL,
+  VDP_VIDEO_MIXER_FEATURE_DEINTERLACE_TEMPORAL_SPATIAL,
+  VDP_VIDEO_MIXER_FEATURE_INVERSE_TELECINE,
+  VDP_VIDEO_MIXER_FEATURE_NOISE_REDUCTION, VDP_VIDEO_MIXER_FEATURE_SHARPNESS,
+  VDP_VIDEO_MIXER_FEATURE_LUMA_KEY,
+  VDP_VIDEO_MIXER_FEATURE_HIGH_QUALITY_SCALING_L1
+};
+
+#define N_ELEMENTS(array) (sizeof (array) / sizeof (*(array)))
+
+/* A failed query leaves the capability unsupported rather than failing the
+ * driver initialization. */
+void
+flu_va_drivers_vdpau_caps_init (
+    FluVaDriversVdpauCaps *caps, FluVaDriversVdpauVdpDeviceImpl *impl)
+{
+  VdpDevice device = impl->vdp_device;
+  unsigned int i, j;
+
+  memset (caps, 0, sizeof (*caps));
+
+  for (i = 0; i < N_ELEMENTS (FLU_VA_DRIVERS_VDPAU_CAPS_PROFILES); i++) {
+    FluVaDriversVdpauDecoderCaps *dec = &caps->decoders[caps->num_decoders];
+
+    dec->va_profile = FLU_VA_DRIVERS_VDPAU_CAPS_PROFILES[i];
+    if (flu_va_drivers_map_va_profile_to_vdpau_decoder_profile (
+            dec->va_profile, &dec->vdp_profile) != VA_STATUS_SUCCESS)
+      continue;
+    if (impl->vdp_decoder_query_capabilities (device, dec->vdp_profile,
+            &dec->is_supported, &dec->max_level, &dec->max_macroblocks,
+            &dec->max_width, &dec->max_height) != VDP_STATUS_OK)
+      dec->is_supported = 0;
+    caps->num_decoders++;
+  }
+
+  for (i = 0; i < N_ELEMENTS (FLU_VA_DRIVERS_VDPAU_CAPS_CHROMA_TYPES); i++) {
+    VdpChromaType chroma_type = FLU_VA_DRIVERS_VDPAU_CAPS_CHROMA_TYPES[i];
+    FluVaDriversVdpauVideoSurfaceCaps *surf =
+        &caps->video_surfaces[chroma_type];
+
+    if (impl->vdp_video_surface_query_capabilities (device, chroma_type,
+            &surf->is_supported, &surf->max_width,
+            &surf->max_height) != VDP_STATUS_OK ||
+        !surf->is_supported) {
+      surf->is_supported = 0;
+      continue;
+    }
+
+    for (j = 0; j < N_ELEMENTS (FLU_VA_DRIVERS_VDPAU_CAPS_YCBCR_FORMATS); j++) {
+      VdpYCbCrFormat format = FLU_VA_DRIVERS_VDPAU_CAPS_YCBCR_FORMATS[j];
+      VdpBool is_supported = 0;
+
+      if (impl->vdp_video_surface_query_get_put_bits_y_cb_cr_capabilities (
+              device, chroma_type, format, &is_supported) == VDP_STATUS_OK &&
+          is_supported)
+        surf->ycbcr_formats |= 1u << format;
+    }
+  }
+
+  /* The decoders only report their limits, the formats they output to are
+   * known from the profile and kept if the device has surfaces for them. */
+  for (i = 0; i < caps->num_decoders; i++) {
+    FluVaDriversVdpauDecoderCaps *dec = &caps->decoders[i];
+    unsigned int rt_formats =
+        flu_va_drivers_vdpau_get_profile_rt_formats (dec->va_profile);
+
+    for (j = 0; j < N_ELEMENTS (FLU_VA_DRIVERS_VDPAU_CAPS_RT_FORMATS); j++) {
+      unsigned int rt_format = FLU_VA_DRIVERS_VDPAU_CAPS_RT_FORMATS[j];
+      VdpChromaType chroma_type;
+
+      if ((rt_formats & rt_format) &&
+          flu_va_drivers_map_va_rt_format_to_vdp_chroma_type (
+              rt_format, &chroma_type) == VA_STATUS_SUCCESS &&
+          flu_va_drivers_vdpau_caps_has_chroma_type (caps, chroma_type))
+        dec->rt_formats |= rt_format;
+    }
+    if (dec->rt_formats == 0)
+      dec->is_supported = 0;
+  }
+
+  for (i = 0; i < FLU_VA_DRIVERS_VDPAU_CAPS_NUM_RGBA_FORMATS; i++) {
+    FluVaDriversVdpauOutputSurfaceCaps *out = &caps->output_surfaces[i];
+
+    if (impl->vdp_output_surface_query_capabilities (device, i,
+            &out->is_supported, &out->max_width,
+            &out->max_height) != VDP_STATUS_OK ||
+        !out->is_supported) {
+      out->is_supported = 0;
+      continue;
+    }
+
+    if (impl->vdp_output_surface_query_get_put_bits_native_capabilities (
+            device, i, &out->has_native_get_put_bits) != VDP_STATUS_OK)
+      out->has_native_get_put_bits = 0;
+  }
+
+  for (i = 0; i < N_ELEMENTS (FLU_VA_DRIVERS_VDPAU_CAPS_MIXER_FEATURES); i++) {
+    VdpVideoMixerFeature feature = FLU_VA_DRIVERS_VDPAU_CAPS_MIXER_FEATURES[i];
+    VdpBool is_supported = 0;
+
+    if (impl->vdp_video_mixer_query_feature_support (
+            device, feature, &is_supported) == VDP_STATUS_OK &&
+        is_supported)
+      caps->mixer_features |= 1u << feature;
+  }
+}
+
+const FluVaDriversVdpauDecoderCaps *
+flu_va_drivers_vdpau_caps_get_decoder (
+    const FluVaDriversVdpauCaps *caps, VAProfile va_profile)
+{
+  unsigned int i;
+
+  for (i = 0; i < caps->num_decoders; i++) {
+    if (caps->decoders[i].va_profile == va_profile)
+      return caps->decoders[i].is_supported ? &caps->decoders[i] : NULL;
+  }
+  return NULL;
+}
+
+int
+flu_va_drivers_vdpau_caps_has_chroma_type (
+    const FluVaDriversVdpauCaps *caps, VdpChromaType vdp_chroma_type)
+{
+  if (vdp_chroma_type >= FLU_VA_DRIVERS_VDPAU_CAPS_NUM_CHROMA_TYPES)
+    return 0;
+
+  return caps->video_surfaces[vdp_chroma_type].is_supported;
+}
+
+int
+flu_va_drivers_vdpau_caps_has_ycbcr_format (const FluVaDriversVdpauCaps *caps,
+    VdpChromaType vdp_chroma_type, VdpYCbCrFormat vdp_format)
+{
+  if (vdp_chroma_type >= FLU_VA_DRIVERS_VDPAU_CAPS_NUM_CHROMA_TYPES ||
+      vdp_format >= 32)
+    return 0;
+
+  return (caps->video_surfaces[vdp_chroma_type].ycbcr_formats >> vdp_format) &
+         1;
+}
+
+int
+flu_va_drivers_vdpau_caps_has_mixer_feature (
+    const FluVaDriversVdpauCaps *caps, VdpVideoMixerFeature vdp_feature)
+{
+  if (vdp_feature >= 32)
+    return 0;
+
+  return (caps->mixer_features >> vdp_feature) & 1;
+}
@@ -0,0 +1,120 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __FLU_VA_DRIVERS_VDPAU_CAPS_H__
+#define __FLU_VA_DRIVERS_VDPAU_CAPS_H__
+
+#include <stdint.h>
+#include <va/va.h>
+#include <vdpau/vdpau.h>
+#include "flu_va_drivers_vdpau_vdp_device_impl.h"
+
+// clang-format off
+#define FLU_VA_DRIVERS_VDPAU_CAPS_MAX_DECODERS       16
+/* Up to VDP_CHROMA_TYPE_444_16, only the frame ones are probed. */
+#define FLU_VA_DRIVERS_VDPAU_CAPS_NUM_CHROMA_TYPES   12
+#define FLU_VA_DRIVERS_VDPAU_CAPS_NUM_RGBA_FORMATS   5
+// clang-format on
+
+/* Bumped whenever the probed capabilities change, so that the caches stored
+ * by older builds are discarded. */
+#define FLU_VA_DRIVERS_VDPAU_CAPS_VERSION 6
+
+typedef struct _FluVaDriversVdpauDecoderCaps FluVaDriversVdpauDecoderCaps;
+
+struct _FluVaDriversVdpauDecoderCaps
+{
+  VAProfile va_profile;
+  VdpDecoderProfile vdp_profile;
+  VdpBool is_supported;
+  uint32_t max_level;
+  uint32_t max_macroblocks;
+  uint32_t max_width;
+  uint32_t max_height;
+  /* VA_RT_FORMAT_* decoded by the profile that the device has surfaces for. */
+  unsigned int rt_formats;
+};
+
+typedef struct _FluVaDriversVdpauVideoSurfaceCaps
+    FluVaDriversVdpauVideoSurfaceCaps;
+
+struct _FluVaDriversVdpauVideoSurfaceCaps
+{
+  VdpBool is_supported;
+  uint32_t max_width;
+  uint32_t max_height;
+  /* Bit n set if VdpYCbCrFormat n can be got and put. */
+  uint32_t ycbcr_formats;
+};
+
+typedef struct _FluVaDriversVdpauOutputSurfaceCaps
+    FluVaDriversVdpauOutputSurfaceCaps;
+
+struct _FluVaDriversVdpauOutputSurfaceCaps
+{
+  VdpBool is_supported;
+  VdpBool has_native_get_put_bits;
+  uint32_t max_width;
+  uint32_t max_height;
+};
+
+/* Device capabilities, loaded from the on-disk cache or probed when the
+ * driver is initialized, so that the VA query entry points do not round trip
+ * to the VDPAU backend. A stale cache is re-probed once the device exists;
+ * the new table is filled aside and published by pointer, never rewritten
+ * while readers may hold it. Holds no pointers, the whole table can be copied
+ * by value. */
+typedef struct _FluVaDriversVdpauCaps FluVaDriversVdpauCaps;
+
+struct _FluVaDriversVdpauCaps
+{
+  FluVaDriversVdpauDecoderCaps decoders[FLU_VA_DRIVERS_VDPAU_CAPS_MAX_DECODERS];
+  unsigned int num_decoders;
+  /* Indexed by VdpChromaType. */
+  FluVaDriversVdpauVideoSurfaceCaps
+      video_surfaces[FLU_VA_DRIVERS_VDPAU_CAPS_NUM_CHROMA_TYPES];
+  /* Indexed by VdpRGBAFormat. */
+  FluVaDriversVdpauOutputSurfaceCaps
+      output_surfaces[FLU_VA_DRIVERS_VDPAU_CAPS_NUM_RGBA_FORMATS];
+  /* Bit n set if VdpVideoMixerFeature n is supported. */
+  uint32_t mixer_features;
+};
+
+void flu_va_drivers_vdpau_caps_init (
+    FluVaDriversVdpauCaps *caps, FluVaDriversVdpauVdpDeviceImpl *impl);
+
+/* Returns NULL if the profile is not supported by the device. */
+const FluVaDriversVdpauDecoderCaps *flu_va_drivers_vdpau_caps_get_decoder (
+    const FluVaDriversVdpauCaps *caps, VAProfile va_profile);
+
+int flu_va_drivers_vdpau_caps_has_chroma_type (
+    const FluVaDriversVdpauCaps *caps, VdpChromaType vdp_chroma_type);
+
+int flu_va_drivers_vdpau_caps_has_ycbcr_format (
+    const FluVaDriversVdpauCaps *caps, VdpChromaType vdp_chroma_type,
+    VdpYCbCrFormat vdp_format);
+
+int flu_va_drivers_vdpau_caps_has_mixer_feature (
+    const FluVaDriversVdpauCaps *caps, VdpVideoMixerFeature vdp_feature);
+
+#endif /* __FLU_VA_DRIVERS_VDPAU_CAPS_H__ */
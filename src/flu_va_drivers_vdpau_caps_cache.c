@@ -0,0 +1,204 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "flu_va_drivers_vdpau_caps_cache.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define FLU_VA_DRIVERS_VDPAU_CAPS_CACHE_MAGIC "FLUVACAP"
+
+typedef struct _FluVaDriversVdpauCapsCacheHeader
+    FluVaDriversVdpauCapsCacheHeader;
+
+struct _FluVaDriversVdpauCapsCacheHeader
+{
+  char magic[8];
+  uint32_t caps_size;
+  uint32_t caps_version;
+  int32_t x11_screen;
+  char driver_version[32];
+  char info_string[FLU_VA_DRIVERS_VDPAU_CAPS_CACHE_INFO_SIZE];
+};
+
+static void
+flu_va_drivers_vdpau_caps_cache_fill_header (
+    FluVaDriversVdpauCapsCacheHeader *header, int x11_screen,
+    const char *info_string)
+{
+  memset (header, 0, sizeof (*header));
+  memcpy (header->magic, FLU_VA_DRIVERS_VDPAU_CAPS_CACHE_MAGIC,
+      sizeof (header->magic));
+  header->caps_size = sizeof (FluVaDriversVdpauCaps);
+  header->caps_version = FLU_VA_DRIVERS_VDPAU_CAPS_VERSION;
+  header->x11_screen = x11_screen;
+  strncpy (header->driver_version, FLU_VA_DRIVERS_PROJECT_VERSION,
+      sizeof (header->driver_version) - 1);
+  strncpy (header->info_string, info_string, sizeof (header->info_string) - 1);
+}
+
+static uint32_t
+flu_va_drivers_vdpau_caps_cache_hash (const char *str)
+{
+  uint32_t hash = 2166136261u;
+
+  while (*str != '\0') {
+    hash ^= (uint8_t) *str++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+void
+flu_va_drivers_vdpau_caps_cache_init (FluVaDriversVdpauCapsCache *cache,
+    const char *x11_dpy_name, int x11_screen)
+{
+  const char *env, *dir, *subdir;
+  int len;
+
+  memset (cache, 0, sizeof (*cache));
+  cache->x11_screen = x11_screen;
+
+  env = getenv ("FLU_VA_DRIVERS_VDPAU_CAPS_CACHE");
+  if (env != NULL && strcmp (env, "0") == 0)
+    return;
+
+  dir = getenv ("XDG_CACHE_HOME");
+  subdir = "flu-va-drivers";
+  if (dir == NULL || dir[0] != '/') {
+    dir = getenv ("HOME");
+    subdir = ".cache/flu-va-drivers";
+    if (dir == NULL || dir[0] != '/')
+      return;
+  }
+
+  len = snprintf (cache->path, sizeof (cache->path),
+      "%s/%s/vdpau-caps-%08x-%d", dir, subdir,
+      flu_va_drivers_vdpau_caps_cache_hash (x11_dpy_name ? x11_dpy_name : ""),
+      x11_screen);
+  if (len < 0 || len >= (int) sizeof (cache->path))
+    cache->path[0] = '\0';
+}
+
+int
+flu_va_drivers_vdpau_caps_cache_load (
+    FluVaDriversVdpauCapsCache *cache, FluVaDriversVdpauCaps *caps)
+{
+  FluVaDriversVdpauCapsCacheHeader header, expected;
+  FluVaDriversVdpauCaps loaded;
+  FILE *file;
+  int ok;
+
+  if (cache->path[0] == '\0')
+    return 0;
+
+  file = fopen (cache->path, "rb");
+  if (file == NULL)
+    return 0;
+  ok = fread (&header, sizeof (header), 1, file) == 1 &&
+       fread (&loaded, sizeof (loaded), 1, file) == 1;
+  fclose (file);
+  if (!ok)
+    return 0;
+
+  /* Everything but the information string has to match. */
+  header.info_string[sizeof (header.info_string) - 1] = '\0';
+  flu_va_drivers_vdpau_caps_cache_fill_header (
+      &expected, cache->x11_screen, header.info_string);
+  if (memcmp (&header, &expected, sizeof (header)) != 0)
+    return 0;
+  if (loaded.num_decoders > FLU_VA_DRIVERS_VDPAU_CAPS_MAX_DECODERS)
+    return 0;
+
+  memcpy (cache->info_string, header.info_string, sizeof (cache->info_string));
+  *caps = loaded;
+  return 1;
+}
+
+int
+flu_va_drivers_vdpau_caps_cache_is_valid (
+    const FluVaDriversVdpauCapsCache *cache, const char *info_string)
+{
+  if (cache->info_string[0] == '\0')
+    return 0;
+
+  return strncmp (cache->info_string, info_string,
+             sizeof (cache->info_string) - 1) == 0;
+}
+
+/* The file is written aside and renamed, so that concurrent readers see
+ * either the old or the new contents. Failures are ignored, the cache is
+ * only an optimization. */
+void
+flu_va_drivers_vdpau_caps_cache_store (FluVaDriversVdpauCapsCache *cache,
+    const char *info_string, const FluVaDriversVdpauCaps *caps)
+{
+  FluVaDriversVdpauCapsCacheHeader header;
+  char tmp_path[PATH_MAX + 32];
+  char *slash;
+  FILE *file;
+  int ok;
+
+  if (cache->path[0] == '\0')
+    return;
+
+  /* Create the cache directory and its parent, if missing. */
+  snprintf (tmp_path, sizeof (tmp_path), "%s", cache->path);
+  slash = strrchr (tmp_path, '/');
+  *slash = '\0';
+  if (mkdir (tmp_path, 0700) != 0 && errno == ENOENT) {
+    char *parent = strrchr (tmp_path, '/');
+
+    *parent = '\0';
+    mkdir (tmp_path, 0700);
+    *parent = '/';
+    mkdir (tmp_path, 0700);
+  }
+
+  snprintf (tmp_path, sizeof (tmp_path), "%s.%ld", cache->path,
+      (long) getpid ());
+  file = fopen (tmp_path, "wb");
+  if (file == NULL)
+    return;
+
+  flu_va_drivers_vdpau_caps_cache_fill_header (
+      &header, cache->x11_screen, info_string);
+  ok = fwrite (&header, sizeof (header), 1, file) == 1 &&
+       fwrite (caps, sizeof (*caps), 1, file) == 1;
+  ok = fclose (file) == 0 && ok;
+
+  if (!ok || rename (tmp_path, cache->path) != 0) {
+    unlink (tmp_path);
+    return;
+  }
+
+  memcpy (cache->info_string, header.info_string, sizeof (cache->info_string));
+}
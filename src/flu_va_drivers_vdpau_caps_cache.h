@@ -0,0 +1,67 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __FLU_VA_DRIVERS_VDPAU_CAPS_CACHE_H__
+#define __FLU_VA_DRIVERS_VDPAU_CAPS_CACHE_H__
+
+#include <limits.h>
+#include "flu_va_drivers_vdpau_caps.h"
+
+#define FLU_VA_DRIVERS_VDPAU_CAPS_CACHE_INFO_SIZE 256
+
+/* On-disk copy of the device capabilities, so that processes that only probe
+ * the driver do not create a VDPAU device.
+ *
+ * The file lives under $XDG_CACHE_HOME/flu-va-drivers and is named after the
+ * X display and screen. It is only loaded if written by the same driver
+ * version for the same screen. The VDPAU information string it was written
+ * with is checked once the device is created: on mismatch the capabilities
+ * are queried again and the file is rewritten. Setting
+ * FLU_VA_DRIVERS_VDPAU_CAPS_CACHE to 0 disables it. */
+typedef struct _FluVaDriversVdpauCapsCache FluVaDriversVdpauCapsCache;
+
+struct _FluVaDriversVdpauCapsCache
+{
+  /* Empty if the cache is disabled. */
+  char path[PATH_MAX];
+  int x11_screen;
+  /* Information string of the loaded file, empty if none was loaded. */
+  char info_string[FLU_VA_DRIVERS_VDPAU_CAPS_CACHE_INFO_SIZE];
+};
+
+void flu_va_drivers_vdpau_caps_cache_init (FluVaDriversVdpauCapsCache *cache,
+    const char *x11_dpy_name, int x11_screen);
+
+/* Returns 1 if caps was filled from the file. */
+int flu_va_drivers_vdpau_caps_cache_load (
+    FluVaDriversVdpauCapsCache *cache, FluVaDriversVdpauCaps *caps);
+
+/* Returns 1 if the loaded capabilities were written by the VDPAU driver
+ * described by info_string. */
+int flu_va_drivers_vdpau_caps_cache_is_valid (
+    const FluVaDriversVdpauCapsCache *cache, const char *info_string);
+
+void flu_va_drivers_vdpau_caps_cache_store (FluVaDriversVdpauCapsCache *cache,
+    const char *info_string, const FluVaDriversVdpauCaps *caps);
+
+#endif /* __FLU_VA_DRIVERS_VDPAU_CAPS_CACHE_H__ */
@@ -0,0 +1,374 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flu_va_drivers_vdpau_decode_queue.h"
+
+/* The decoder is recreated when the stream changes profile, size or number
+ * of references, so that it never holds more references than the SPS asks
+ * for. The references themselves live in the video surfaces. */
+static VdpStatus
+flu_va_drivers_vdpau_decode_queue_ensure_decoder (
+    FluVaDriversVdpauDecodeQueue *queue,
+    const FluVaDriversVdpauDecoderConfig *config)
+{
+  FluVaDriversVdpauDecoderConfig *cur = &queue->decoder_config;
+  VdpStatus vdp_st;
+
+  if (queue->vdp_decoder != VDP_INVALID_HANDLE &&
+      cur->vdp_profile == config->vdp_profile &&
+      cur->width == config->width && cur->height == config->height &&
+      cur->max_references == config->max_references)
+    return VDP_STATUS_OK;
+
+  if (queue->vdp_decoder != VDP_INVALID_HANDLE) {
+    flu_va_drivers_vdpau_decoder_cache_release (
+        queue->decoder_cache, cur, queue->vdp_decoder);
+    queue->vdp_decoder = VDP_INVALID_HANDLE;
+  }
+
+  vdp_st = flu_va_drivers_vdpau_decoder_cache_acquire (
+      queue->decoder_cache, config, &queue->vdp_decoder, cur);
+  if (vdp_st != VDP_STATUS_OK)
+    queue->vdp_decoder = VDP_INVALID_HANDLE;
+
+  return vdp_st;
+}
+
+static void *
+flu_va_drivers_vdpau_decode_queue_thread (void *data)
+{
+  FluVaDriversVdpauDecodeQueue *queue = data;
+
+  /* Pre-warm the decoder with the configuration given at init, so that the
+   * first picture does not pay for its creation. On failure it is retried
+   * with the configuration of that picture. */
+  if (queue->decoder_config.max_references > 0) {
+    FluVaDriversVdpauDecoderConfig decoder_config = queue->decoder_config;
+
+    flu_va_drivers_vdpau_decode_queue_ensure_decoder (queue, &decoder_config);
+  }
+
+  pthread_mutex_lock (&queue->mutex);
+  while (1) {
+    FluVaDriversVdpauDecodeJob *job;
+    VdpBitstreamBuffer vdp_bs_buf;
+    const VdpBitstreamBuffer *vdp_bs_bufs = &vdp_bs_buf;
+    uint32_t num_vdp_bs_bufs = 1;
+    VdpStatus vdp_st;
+
+    while (queue->num_jobs == 0 && queue->running)
+      pthread_cond_wait (&queue->job_cond, &queue->mutex);
+    if (queue->num_jobs == 0)
+      break;
+
+    /* The slot stays counted in num_jobs while it is decoded, so submitters
+     * never overwrite it. */
+    job = &queue->jobs[queue->head];
+    pthread_mutex_unlock (&queue->mutex);
+
+    vdp_bs_buf.struct_version = VDP_BITSTREAM_BUFFER_VERSION;
+    vdp_bs_buf.bitstream = job->bitstream.data;
+    vdp_bs_buf.bitstream_bytes = job->bitstream.size;
+    if (job->bitstream.num_buffers > 0) {
+      vdp_bs_bufs = job->bitstream.buffers;
+      num_vdp_bs_bufs = job->bitstream.num_buffers;
+    }
+    vdp_st = flu_va_drivers_vdpau_decode_queue_ensure_decoder (
+        queue, &job->decoder_config);
+    if (vdp_st == VDP_STATUS_OK)
+      vdp_st = queue->vdp_impl->vdp_decoder_render (queue->vdp_decoder,
+          job->vdp_surface, (VdpPictureInfo *) &job->vdp_pic_info,
+          num_vdp_bs_bufs, vdp_bs_bufs);
+    flu_va_drivers_vdpau_bitstream_release (
+        &job->bitstream, queue->buffer_pool);
+
+    pthread_mutex_lock (&queue->mutex);
+    /* A newer decode may have been submitted on the same surface. */
+    if (job->fence->seqno == job->seqno)
+      job->fence->vdp_status = vdp_st;
+    queue->completed_seqno = job->seqno;
+    queue->head = (queue->head + 1) % FLU_VA_DRIVERS_VDPAU_DECODE_QUEUE_DEPTH;
+    queue->num_jobs--;
+    pthread_cond_broadcast (&queue->done_cond);
+  }
+  pthread_mutex_unlock (&queue->mutex);
+
+  return NULL;
+}
+
+VAStatus
+flu_va_drivers_vdpau_decode_queue_init (FluVaDriversVdpauDecodeQueue *queue,
+    FluVaDriversVdpauVdpDeviceImpl *impl,
+    FluVaDriversVdpauDecoderCache *decoder_cache,
+    FluVaDriversVdpauBufferPool *buffer_pool,
+    const FluVaDriversVdpauDecoderConfig *decoder_config)
+{
+  pthread_condattr_t attr;
+
+  memset (queue, 0, sizeof (*queue));
+  queue->vdp_impl = impl;
+  queue->decoder_cache = decoder_cache;
+  queue->buffer_pool = buffer_pool;
+  queue->vdp_decoder = VDP_INVALID_HANDLE;
+  if (decoder_config != NULL)
+    queue->decoder_config = *decoder_config;
+  queue->running = 1;
+
+  pthread_mutex_init (&queue->mutex, NULL);
+  pthread_cond_init (&queue->job_cond, NULL);
+  pthread_condattr_init (&attr);
+  pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+  pthread_cond_init (&queue->done_cond, &attr);
+  pthread_condattr_destroy (&attr);
+
+  if (pthread_create (&queue->thread, NULL,
+          flu_va_drivers_vdpau_decode_queue_thread, queue) != 0) {
+    pthread_cond_destroy (&queue->done_cond);
+    pthread_cond_destroy (&queue->job_cond);
+    pthread_mutex_destroy (&queue->mutex);
+    memset (queue, 0, sizeof (*queue));
+    return VA_STATUS_ERROR_ALLOCATION_FAILED;
+  }
+
+  return VA_STATUS_SUCCESS;
+}
+
+void
+flu_va_drivers_vdpau_decode_queue_destroy (FluVaDriversVdpauDecodeQueue *queue)
+{
+  int i;
+
+  if (queue->vdp_impl == NULL)
+    return;
+
+  /* Pending jobs are drained by the worker before it exits. */
+  pthread_mutex_lock (&queue->mutex);
+  queue->running = 0;
+  pthread_cond_signal (&queue->job_cond);
+  pthread_mutex_unlock (&queue->mutex);
+  pthread_join (queue->thread, NULL);
+
+  if (queue->vdp_decoder != VDP_INVALID_HANDLE)
+    flu_va_drivers_vdpau_decoder_cache_release (
+        queue->decoder_cache, &queue->decoder_config, queue->vdp_decoder);
+
+  pthread_cond_destroy (&queue->done_cond);
+  pthread_cond_destroy (&queue->job_cond);
+  pthread_mutex_destroy (&queue->mutex);
+
+  for (i = 0; i < FLU_VA_DRIVERS_VDPAU_DECODE_QUEUE_DEPTH; i++)
+    flu_va_drivers_vdpau_bitstream_finalize (&queue->jobs[i].bitstream);
+
+  memset (queue, 0, sizeof (*queue));
+}
+
+VAStatus
+flu_va_drivers_vdpau_decode_queue_submit (FluVaDriversVdpauDecodeQueue *queue,
+    const FluVaDriversVdpauDecoderConfig *decoder_config,
+    VdpVideoSurface vdp_surface, FluVaDriversVdpauFence *fence,
+    const FluVaDriversVdpauPictureInfo *vdp_pic_info, size_t vdp_pic_info_size,
+    FluVaDriversVdpauBitstream *bitstream)
+{
+  FluVaDriversVdpauDecodeJob *job;
+  FluVaDriversVdpauBitstream tmp;
+
+  assert (queue->running);
+
+  pthread_mutex_lock (&queue->mutex);
+  while (queue->num_jobs == FLU_VA_DRIVERS_VDPAU_DECODE_QUEUE_DEPTH)
+    pthread_cond_wait (&queue->done_cond, &queue->mutex);
+
+  job = &queue->jobs[(queue->head + queue->num_jobs) %
+                     FLU_VA_DRIVERS_VDPAU_DECODE_QUEUE_DEPTH];
+  tmp = job->bitstream;
+  job->bitstream = *bitstream;
+  *bitstream = tmp;
+  bitstream->size = 0;
+
+  job->decoder_config = *decoder_config;
+  job->vdp_surface = vdp_surface;
+  assert (vdp_pic_info_size <= sizeof (job->vdp_pic_info));
+  memcpy (&job->vdp_pic_info, vdp_pic_info, vdp_pic_info_size);
+  job->fence = fence;
+  job->seqno = ++queue->submitted_seqno;
+
+  fence->seqno = job->seqno;
+  fence->vdp_status = VDP_STATUS_OK;
+
+  queue->num_jobs++;
+  pthread_cond_signal (&queue->job_cond);
+  pthread_mutex_unlock (&queue->mutex);
+
+  return VA_STATUS_SUCCESS;
+}
+
+VAStatus
+flu_va_drivers_vdpau_decode_queue_wait (FluVaDriversVdpauDecodeQueue *queue,
+    const FluVaDriversVdpauFence *fence, const struct timespec *deadline)
+{
+  VdpStatus vdp_st;
+  int done;
+
+  pthread_mutex_lock (&queue->mutex);
+  while (1) {
+    /* A seqno beyond the submitted ones comes from a destroyed queue whose
+     * jobs were already drained. */
+    done = fence->seqno > queue->submitted_seqno ||
+           queue->completed_seqno >= fence->seqno;
+    if (done)
+      break;
+
+    if (deadline == NULL)
+      pthread_cond_wait (&queue->done_cond, &queue->mutex);
+    else if (pthread_cond_timedwait (&queue->done_cond, &queue->mutex,
+                 deadline) == ETIMEDOUT)
+      break;
+  }
+  vdp_st = fence->vdp_status;
+  pthread_mutex_unlock (&queue->mutex);
+
+  if (!done)
+    return VA_STATUS_ERROR_TIMEDOUT;
+  if (vdp_st != VDP_STATUS_OK)
+    return VA_STATUS_ERROR_DECODING_ERROR;
+  return VA_STATUS_SUCCESS;
+}
+
+void
+flu_va_drivers_vdpau_decode_queue_drain (FluVaDriversVdpauDecodeQueue *queue)
+{
+  uint64_t seqno;
+
+  pthread_mutex_lock (&queue->mutex);
+  seqno = queue->submitted_seqno;
+  while (queue->completed_seqno < seqno)
+    pthread_cond_wait (&queue->done_cond, &queue->mutex);
+  pthread_mutex_unlock (&queue->mutex);
+}
+
+void
+flu_va_drivers_vdpau_fence_init (FluVaDriversVdpauFence *fence)
+{
+  fence->seqno = 0;
+  fence->vdp_status = VDP_STATUS_OK;
+}
+
+VAStatus
+flu_va_drivers_vdpau_bitstream_reserve (
+    FluVaDriversVdpauBitstream *bitstream, uint32_t size)
+{
+  uint8_t *data;
+  uint32_t capacity;
+
+  if (size > UINT32_MAX - bitstream->size)
+    return VA_STATUS_ERROR_ALLOCATION_FAILED;
+  if (bitstream->size + size <= bitstream->capacity)
+    return VA_STATUS_SUCCESS;
+
+  capacity = bitstream->capacity ? bitstream->capacity : 4096;
+  while (capacity < bitstream->size + size && capacity <= UINT32_MAX / 2)
+    capacity *= 2;
+  if (capacity < bitstream->size + size)
+    capacity = bitstream->size + size;
+
+  data = realloc (bitstream->data, capacity);
+  if (data == NULL)
+    return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+  bitstream->data = data;
+  bitstream->capacity = capacity;
+  return VA_STATUS_SUCCESS;
+}
+
+/* The storage has to be reserved beforehand. */
+void
+flu_va_drivers_vdpau_bitstream_append (
+    FluVaDriversVdpauBitstream *bitstream, const uint8_t *data, uint32_t size)
+{
+  assert (bitstream->size + size <= bitstream->capacity);
+
+  memcpy (bitstream->data + bitstream->size, data, size);
+  bitstream->size += size;
+}
+
+VAStatus
+flu_va_drivers_vdpau_bitstream_adopt (FluVaDriversVdpauBitstream *bitstream,
+    void *data, size_t capacity, uint32_t size)
+{
+  VdpBitstreamBuffer *vdp_bs_buf;
+
+  if (bitstream->num_buffers == bitstream->cap_buffers) {
+    unsigned int cap = bitstream->cap_buffers ? bitstream->cap_buffers * 2 : 4;
+    VdpBitstreamBuffer *buffers;
+    FluVaDriversVdpauBitstreamChunk *chunks;
+
+    buffers = realloc (bitstream->buffers, cap * sizeof (*buffers));
+    if (buffers == NULL)
+      return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    bitstream->buffers = buffers;
+
+    chunks = realloc (bitstream->chunks, cap * sizeof (*chunks));
+    if (chunks == NULL)
+      return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    bitstream->chunks = chunks;
+    bitstream->cap_buffers = cap;
+  }
+
+  vdp_bs_buf = &bitstream->buffers[bitstream->num_buffers];
+  vdp_bs_buf->struct_version = VDP_BITSTREAM_BUFFER_VERSION;
+  vdp_bs_buf->bitstream = data;
+  vdp_bs_buf->bitstream_bytes = size;
+  bitstream->chunks[bitstream->num_buffers].data = data;
+  bitstream->chunks[bitstream->num_buffers].capacity = capacity;
+  bitstream->num_buffers++;
+
+  return VA_STATUS_SUCCESS;
+}
+
+void
+flu_va_drivers_vdpau_bitstream_release (
+    FluVaDriversVdpauBitstream *bitstream, FluVaDriversVdpauBufferPool *pool)
+{
+  unsigned int i;
+
+  for (i = 0; i < bitstream->num_buffers; i++)
+    flu_va_drivers_vdpau_buffer_pool_release (
+        pool, bitstream->chunks[i].data, bitstream->chunks[i].capacity);
+  bitstream->num_buffers = 0;
+}
+
+/* The adopted buffers have to be released beforehand. */
+void
+flu_va_drivers_vdpau_bitstream_finalize (FluVaDriversVdpauBitstream *bitstream)
+{
+  assert (bitstream->num_buffers == 0);
+
+  free (bitstream->data);
+  free (bitstream->buffers);
+  free (bitstream->chunks);
+  memset (bitstream, 0, sizeof (*bitstream));
+}
@@ -0,0 +1,191 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __FLU_VA_DRIVERS_VDPAU_DECODE_QUEUE_H__
+#define __FLU_VA_DRIVERS_VDPAU_DECODE_QUEUE_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <va/va.h>
+#include <vdpau/vdpau.h>
+#include "flu_va_drivers_vdpau_vdp_device_impl.h"
+#include "flu_va_drivers_vdpau_decoder_cache.h"
+#include "flu_va_drivers_vdpau_buffer_pool.h"
+
+/* Number of pictures that can be queued per context before vaEndPicture
+ * blocks waiting for the worker. */
+#define FLU_VA_DRIVERS_VDPAU_DECODE_QUEUE_DEPTH 4
+
+/* Completion fence of the last decode submitted on a surface. The surface is
+ * decoded once the queue completed_seqno reaches seqno. */
+typedef struct _FluVaDriversVdpauFence FluVaDriversVdpauFence;
+
+struct _FluVaDriversVdpauFence
+{
+  uint64_t seqno;
+  VdpStatus vdp_status;
+};
+
+/* Storage of a VA buffer adopted by a picture bitstream, given back to the
+ * buffer pool once the picture is decoded. */
+typedef struct _FluVaDriversVdpauBitstreamChunk FluVaDriversVdpauBitstreamChunk;
+
+struct _FluVaDriversVdpauBitstreamChunk
+{
+  void *data;
+  size_t capacity;
+};
+
+/* Contiguous picture bitstream, with start codes in place, kept at its
+ * high-water capacity. Codecs whose slice data needs no rewriting adopt the
+ * VA buffers instead, which are then decoded in place, one VDPAU bitstream
+ * buffer each. */
+typedef struct _FluVaDriversVdpauBitstream FluVaDriversVdpauBitstream;
+
+struct _FluVaDriversVdpauBitstream
+{
+  uint8_t *data;
+  uint32_t size;
+  uint32_t capacity;
+  /* Adopted buffers, decoded instead of data when there is any. */
+  VdpBitstreamBuffer *buffers;
+  FluVaDriversVdpauBitstreamChunk *chunks;
+  unsigned int num_buffers;
+  unsigned int cap_buffers;
+};
+
+/* Picture information of any of the supported codecs. */
+typedef union _FluVaDriversVdpauPictureInfo FluVaDriversVdpauPictureInfo;
+
+union _FluVaDriversVdpauPictureInfo
+{
+  VdpPictureInfoMPEG1Or2 mpeg2;
+  VdpPictureInfoMPEG4Part2 mpeg4;
+  VdpPictureInfoVC1 vc1;
+  VdpPictureInfoH264 h264;
+  VdpPictureInfoHEVC hevc;
+#ifdef HAVE_VDPAU_VP9
+  VdpPictureInfoVP9 vp9;
+#endif
+#ifdef HAVE_VDPAU_AV1
+  VdpPictureInfoAV1 av1;
+#endif
+};
+
+typedef struct _FluVaDriversVdpauDecodeJob FluVaDriversVdpauDecodeJob;
+
+struct _FluVaDriversVdpauDecodeJob
+{
+  uint64_t seqno;
+  FluVaDriversVdpauDecoderConfig decoder_config;
+  VdpVideoSurface vdp_surface;
+  FluVaDriversVdpauFence *fence;
+  FluVaDriversVdpauPictureInfo vdp_pic_info;
+  FluVaDriversVdpauBitstream bitstream;
+};
+
+typedef struct _FluVaDriversVdpauDecodeQueue FluVaDriversVdpauDecodeQueue;
+
+struct _FluVaDriversVdpauDecodeQueue
+{
+  FluVaDriversVdpauVdpDeviceImpl *vdp_impl;
+  FluVaDriversVdpauDecoderCache *decoder_cache;
+  /* Where the worker returns the adopted buffers of the decoded pictures. */
+  FluVaDriversVdpauBufferPool *buffer_pool;
+  /* Acquired and used only by the worker, so that neither vaCreateContext nor
+   * vaEndPicture wait for it. */
+  VdpDecoder vdp_decoder;
+  FluVaDriversVdpauDecoderConfig decoder_config;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  /* Signalled when a job is pushed or the queue is stopped. */
+  pthread_cond_t job_cond;
+  /* Signalled when a job is completed, bound to CLOCK_MONOTONIC. */
+  pthread_cond_t done_cond;
+  FluVaDriversVdpauDecodeJob jobs[FLU_VA_DRIVERS_VDPAU_DECODE_QUEUE_DEPTH];
+  unsigned int head;
+  unsigned int num_jobs;
+  uint64_t submitted_seqno;
+  uint64_t completed_seqno;
+  int running;
+};
+
+/* The worker acquires a decoder for decoder_config, when not NULL, before
+ * the first picture is submitted. It is resized on demand afterwards. */
+VAStatus flu_va_drivers_vdpau_decode_queue_init (
+    FluVaDriversVdpauDecodeQueue *queue, FluVaDriversVdpauVdpDeviceImpl *impl,
+    FluVaDriversVdpauDecoderCache *decoder_cache,
+    FluVaDriversVdpauBufferPool *buffer_pool,
+    const FluVaDriversVdpauDecoderConfig *decoder_config);
+
+void flu_va_drivers_vdpau_decode_queue_destroy (
+    FluVaDriversVdpauDecodeQueue *queue);
+
+/* The bitstream is handed over to the queue without copying. It is swapped
+ * with the empty storage of a completed job, to be reused by the caller. Only
+ * vdp_pic_info_size bytes of the picture information are copied. */
+VAStatus flu_va_drivers_vdpau_decode_queue_submit (
+    FluVaDriversVdpauDecodeQueue *queue,
+    const FluVaDriversVdpauDecoderConfig *decoder_config,
+    VdpVideoSurface vdp_surface, FluVaDriversVdpauFence *fence,
+    const FluVaDriversVdpauPictureInfo *vdp_pic_info, size_t vdp_pic_info_size,
+    FluVaDriversVdpauBitstream *bitstream);
+
+/* Waits until the fence is reached, or returns VA_STATUS_ERROR_TIMEDOUT once
+ * the CLOCK_MONOTONIC deadline expires. A NULL deadline waits forever. */
+VAStatus flu_va_drivers_vdpau_decode_queue_wait (
+    FluVaDriversVdpauDecodeQueue *queue, const FluVaDriversVdpauFence *fence,
+    const struct timespec *deadline);
+
+/* Waits until every job submitted so far is completed, including those that
+ * only read a surface as a reference. */
+void flu_va_drivers_vdpau_decode_queue_drain (
+    FluVaDriversVdpauDecodeQueue *queue);
+
+void flu_va_drivers_vdpau_fence_init (FluVaDriversVdpauFence *fence);
+
+VAStatus flu_va_drivers_vdpau_bitstream_reserve (
+    FluVaDriversVdpauBitstream *bitstream, uint32_t size);
+
+void flu_va_drivers_vdpau_bitstream_append (
+    FluVaDriversVdpauBitstream *bitstream, const uint8_t *data, uint32_t size);
+
+/* Takes ownership of a buffer pool allocation, of which the first size bytes
+ * are the next part of the picture. */
+VAStatus flu_va_drivers_vdpau_bitstream_adopt (
+    FluVaDriversVdpauBitstream *bitstream, void *data, size_t capacity,
+    uint32_t size);
+
+/* Gives the adopted buffers back to the pool. */
+void flu_va_drivers_vdpau_bitstream_release (
+    FluVaDriversVdpauBitstream *bitstream, FluVaDriversVdpauBufferPool *pool);
+
+void flu_va_drivers_vdpau_bitstream_finalize (
+    FluVaDriversVdpauBitstream *bitstream);
+
+#endif /* __FLU_VA_DRIVERS_VDPAU_DECODE_QUEUE_H__ */
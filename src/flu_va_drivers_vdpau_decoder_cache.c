@@ -0,0 +1,120 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "flu_va_drivers_vdpau_decoder_cache.h"
+
+void
+flu_va_drivers_vdpau_decoder_cache_init (
+    FluVaDriversVdpauDecoderCache *cache, FluVaDriversVdpauVdpDeviceImpl *impl)
+{
+  memset (cache, 0, sizeof (*cache));
+  cache->vdp_impl = impl;
+  pthread_mutex_init (&cache->mutex, NULL);
+}
+
+void
+flu_va_drivers_vdpau_decoder_cache_destroy (
+    FluVaDriversVdpauDecoderCache *cache)
+{
+  unsigned int i;
+
+  for (i = 0; i < cache->num_entries; i++)
+    cache->vdp_impl->vdp_decoder_destroy (cache->entries[i].vdp_decoder);
+  cache->num_entries = 0;
+
+  pthread_mutex_destroy (&cache->mutex);
+}
+
+VdpStatus
+flu_va_drivers_vdpau_decoder_cache_acquire (
+    FluVaDriversVdpauDecoderCache *cache,
+    const FluVaDriversVdpauDecoderConfig *config, VdpDecoder *vdp_decoder,
+    FluVaDriversVdpauDecoderConfig *config_out)
+{
+  FluVaDriversVdpauDecoderCacheEntry *match = NULL;
+  VdpStatus vdp_st;
+  unsigned int i;
+
+  pthread_mutex_lock (&cache->mutex);
+  /* A decoder with more references than requested would waste them. */
+  for (i = 0; i < cache->num_entries; i++) {
+    FluVaDriversVdpauDecoderCacheEntry *entry = &cache->entries[i];
+
+    if (entry->config.vdp_profile == config->vdp_profile &&
+        entry->config.width == config->width &&
+        entry->config.height == config->height &&
+        entry->config.max_references == config->max_references) {
+      match = entry;
+      break;
+    }
+  }
+
+  if (match != NULL) {
+    *vdp_decoder = match->vdp_decoder;
+    *config_out = match->config;
+    *match = cache->entries[--cache->num_entries];
+    pthread_mutex_unlock (&cache->mutex);
+    return VDP_STATUS_OK;
+  }
+  pthread_mutex_unlock (&cache->mutex);
+
+  vdp_st = cache->vdp_impl->vdp_decoder_create (cache->vdp_impl->vdp_device,
+      config->vdp_profile, config->width, config->height,
+      config->max_references, vdp_decoder);
+  if (vdp_st != VDP_STATUS_OK)
+    return vdp_st;
+
+  *config_out = *config;
+  return VDP_STATUS_OK;
+}
+
+void
+flu_va_drivers_vdpau_decoder_cache_release (
+    FluVaDriversVdpauDecoderCache *cache,
+    const FluVaDriversVdpauDecoderConfig *config, VdpDecoder vdp_decoder)
+{
+  FluVaDriversVdpauDecoderCacheEntry *entry;
+  VdpDecoder evicted = VDP_INVALID_HANDLE;
+  unsigned int i;
+
+  pthread_mutex_lock (&cache->mutex);
+  if (cache->num_entries < FLU_VA_DRIVERS_VDPAU_DECODER_CACHE_SIZE) {
+    entry = &cache->entries[cache->num_entries++];
+  } else {
+    entry = &cache->entries[0];
+    for (i = 1; i < cache->num_entries; i++) {
+      if (cache->entries[i].last_used < entry->last_used)
+        entry = &cache->entries[i];
+    }
+    evicted = entry->vdp_decoder;
+  }
+
+  entry->config = *config;
+  entry->vdp_decoder = vdp_decoder;
+  entry->last_used = ++cache->clock;
+  pthread_mutex_unlock (&cache->mutex);
+
+  if (evicted != VDP_INVALID_HANDLE)
+    cache->vdp_impl->vdp_decoder_destroy (evicted);
+}
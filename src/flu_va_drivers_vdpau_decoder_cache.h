@@ -0,0 +1,90 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __FLU_VA_DRIVERS_VDPAU_DECODER_CACHE_H__
+#define __FLU_VA_DRIVERS_VDPAU_DECODER_CACHE_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vdpau/vdpau.h>
+#include "flu_va_drivers_vdpau_vdp_device_impl.h"
+
+/* Maximum number of idle decoders kept for reuse. */
+#define FLU_VA_DRIVERS_VDPAU_DECODER_CACHE_SIZE 4
+
+/* Parameters a VdpDecoder is created with. */
+typedef struct _FluVaDriversVdpauDecoderConfig FluVaDriversVdpauDecoderConfig;
+
+struct _FluVaDriversVdpauDecoderConfig
+{
+  VdpDecoderProfile vdp_profile;
+  uint32_t width;
+  uint32_t height;
+  uint32_t max_references;
+};
+
+typedef struct _FluVaDriversVdpauDecoderCacheEntry
+    FluVaDriversVdpauDecoderCacheEntry;
+
+struct _FluVaDriversVdpauDecoderCacheEntry
+{
+  FluVaDriversVdpauDecoderConfig config;
+  VdpDecoder vdp_decoder;
+  uint64_t last_used;
+};
+
+/* Idle decoders released by destroyed contexts, so that short-lived contexts
+ * with the same configuration do not pay the decoder creation again. */
+typedef struct _FluVaDriversVdpauDecoderCache FluVaDriversVdpauDecoderCache;
+
+struct _FluVaDriversVdpauDecoderCache
+{
+  FluVaDriversVdpauVdpDeviceImpl *vdp_impl;
+  pthread_mutex_t mutex;
+  FluVaDriversVdpauDecoderCacheEntry
+      entries[FLU_VA_DRIVERS_VDPAU_DECODER_CACHE_SIZE];
+  unsigned int num_entries;
+  uint64_t clock;
+};
+
+void flu_va_drivers_vdpau_decoder_cache_init (
+    FluVaDriversVdpauDecoderCache *cache, FluVaDriversVdpauVdpDeviceImpl *impl);
+
+void flu_va_drivers_vdpau_decoder_cache_destroy (
+    FluVaDriversVdpauDecoderCache *cache);
+
+/* Returns a cached decoder matching the profile, size and references, or
+ * creates one. The configuration of the returned
+ * decoder is stored in config_out. */
+VdpStatus flu_va_drivers_vdpau_decoder_cache_acquire (
+    FluVaDriversVdpauDecoderCache *cache,
+    const FluVaDriversVdpauDecoderConfig *config, VdpDecoder *vdp_decoder,
+    FluVaDriversVdpauDecoderConfig *config_out);
+
+/* Gives back a decoder, evicting the least recently used one if the cache is
+ * full. */
+void flu_va_drivers_vdpau_decoder_cache_release (
+    FluVaDriversVdpauDecoderCache *cache,
+    const FluVaDriversVdpauDecoderConfig *config, VdpDecoder vdp_decoder);
+
+#endif /* __FLU_VA_DRIVERS_VDPAU_DECODER_CACHE_H__ */
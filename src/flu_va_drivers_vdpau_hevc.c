@@ -0,0 +1,490 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "flu_va_drivers_vdpau_hevc.h"
+#include "flu_va_drivers_vdpau_utils.h"
+#include "flu_va_drivers_bitstream.h"
+
+#define FLU_VA_DRIVERS_HEVC_NAL_BLA_W_LP 16
+#define FLU_VA_DRIVERS_HEVC_NAL_IDR_W_RADL 19
+#define FLU_VA_DRIVERS_HEVC_NAL_IDR_N_LP 20
+#define FLU_VA_DRIVERS_HEVC_NAL_RSV_IRAP_23 23
+
+#define FLU_VA_DRIVERS_HEVC_MAX_RPS_CURR 8
+
+#define N_ELEMENTS(array) (sizeof (array) / sizeof (*(array)))
+
+static unsigned int
+flu_va_drivers_ceil_log2 (uint32_t value)
+{
+  unsigned int n = 0;
+
+  while (n < 32 && (1u << n) < value)
+    n++;
+  return n;
+}
+
+/* Returns NumDeltaPocs[RefRpsIdx] of a st_ref_pic_set () predicted from
+ * another set. Since the entries of the reference set are not known, they are
+ * counted up to the size of the syntax structure, given by st_rps_bits. */
+static uint32_t
+flu_va_driver_vdpau_parse_st_ref_pic_set_hevc (
+    FluVaDriversBitReader *reader, const VdpPictureInfoHEVC *vdp_pic_info)
+{
+  size_t end =
+      reader->num_bits + vdp_pic_info->NumShortTermPictureSliceHeaderBits;
+  uint32_t num_entries = 0;
+
+  if (vdp_pic_info->num_short_term_ref_pic_sets == 0 ||
+      !flu_va_drivers_bit_reader_read (reader, 1)) {
+    flu_va_drivers_bit_reader_skip (reader, end - reader->num_bits);
+    return 0;
+  }
+
+  flu_va_drivers_bit_reader_read_ue (reader); /* delta_idx_minus1 */
+  flu_va_drivers_bit_reader_read (reader, 1); /* delta_rps_sign */
+  flu_va_drivers_bit_reader_read_ue (reader); /* abs_delta_rps_minus1 */
+  while (reader->num_bits < end && !reader->overflow) {
+    /* used_by_curr_pic_flag, then use_delta_flag if it is not set. */
+    if (!flu_va_drivers_bit_reader_read (reader, 1))
+      flu_va_drivers_bit_reader_read (reader, 1);
+    num_entries++;
+  }
+  if (reader->num_bits < end)
+    flu_va_drivers_bit_reader_skip (reader, end - reader->num_bits);
+
+  return num_entries > 0 ? num_entries - 1 : 0;
+}
+
+/* VDPAU parses the slice headers itself, except the reference picture set
+ * selection, whose index and sizes come from the first slice segment. Note:
+ * Rec. ITU-T H.265. Section: 7.3.6.1. */
+static void
+flu_va_driver_vdpau_parse_slice_header_hevc (
+    VdpPictureInfoHEVC *vdp_pic_info, const uint8_t *data, size_t size)
+{
+  FluVaDriversBitReader reader;
+  unsigned int nal_unit_type;
+  unsigned int start_code_size;
+
+  vdp_pic_info->CurrRpsIdx = 0;
+  vdp_pic_info->NumDeltaPocsOfRefRpsIdx = 0;
+  vdp_pic_info->NumLongTermPictureSliceHeaderBits = 0;
+
+  start_code_size = flu_va_drivers_bitstream_start_code_size (data, size);
+  flu_va_drivers_bit_reader_init (
+      &reader, data + start_code_size, size - start_code_size);
+
+  /* nal_unit_header () */
+  flu_va_drivers_bit_reader_read (&reader, 1);
+  nal_unit_type = flu_va_drivers_bit_reader_read (&reader, 6);
+  flu_va_drivers_bit_reader_read (&reader, 9);
+
+  /* first_slice_segment_in_pic_flag */
+  if (!flu_va_drivers_bit_reader_read (&reader, 1))
+    return;
+  if (nal_unit_type >= FLU_VA_DRIVERS_HEVC_NAL_BLA_W_LP &&
+      nal_unit_type <= FLU_VA_DRIVERS_HEVC_NAL_RSV_IRAP_23)
+    flu_va_drivers_bit_reader_read (&reader, 1);
+  flu_va_drivers_bit_reader_read_ue (&reader); /* slice_pic_parameter_set_id */
+  flu_va_drivers_bit_reader_skip (
+      &reader, vdp_pic_info->num_extra_slice_header_bits);
+  flu_va_drivers_bit_reader_read_ue (&reader); /* slice_type */
+  if (vdp_pic_info->output_flag_present_flag)
+    flu_va_drivers_bit_reader_read (&reader, 1);
+  if (vdp_pic_info->separate_colour_plane_flag)
+    flu_va_drivers_bit_reader_read (&reader, 2);
+
+  if (nal_unit_type == FLU_VA_DRIVERS_HEVC_NAL_IDR_W_RADL ||
+      nal_unit_type == FLU_VA_DRIVERS_HEVC_NAL_IDR_N_LP)
+    return;
+
+  flu_va_drivers_bit_reader_skip (
+      &reader, vdp_pic_info->log2_max_pic_order_cnt_lsb_minus4 + 4);
+  if (!flu_va_drivers_bit_reader_read (&reader, 1)) {
+    vdp_pic_info->CurrRpsIdx = vdp_pic_info->num_short_term_ref_pic_sets;
+    vdp_pic_info->NumDeltaPocsOfRefRpsIdx =
+        flu_va_driver_vdpau_parse_st_ref_pic_set_hevc (&reader, vdp_pic_info);
+  } else if (vdp_pic_info->num_short_term_ref_pic_sets > 1) {
+    vdp_pic_info->CurrRpsIdx = flu_va_drivers_bit_reader_read (&reader,
+        flu_va_drivers_ceil_log2 (vdp_pic_info->num_short_term_ref_pic_sets));
+  }
+
+  if (vdp_pic_info->long_term_ref_pics_present_flag) {
+    size_t start = reader.num_bits;
+    uint32_t num_long_term_sps = 0;
+    uint32_t num_long_term_pics;
+    uint32_t i;
+
+    if (vdp_pic_info->num_long_term_ref_pics_sps > 0)
+      num_long_term_sps = flu_va_drivers_bit_reader_read_ue (&reader);
+    num_long_term_pics = flu_va_drivers_bit_reader_read_ue (&reader);
+
+    for (i = 0; i < num_long_term_sps + num_long_term_pics && !reader.overflow;
+         i++) {
+      if (i < num_long_term_sps) {
+        /* lt_idx_sps */
+        flu_va_drivers_bit_reader_skip (&reader,
+            flu_va_drivers_ceil_log2 (
+                vdp_pic_info->num_long_term_ref_pics_sps));
+      } else {
+        /* poc_lsb_lt and used_by_curr_pic_lt_flag */
+        flu_va_drivers_bit_reader_skip (
+            &reader, vdp_pic_info->log2_max_pic_order_cnt_lsb_minus4 + 5);
+      }
+      /* delta_poc_msb_present_flag */
+      if (flu_va_drivers_bit_reader_read (&reader, 1))
+        flu_va_drivers_bit_reader_read_ue (&reader);
+    }
+
+    vdp_pic_info->NumLongTermPictureSliceHeaderBits = reader.num_bits - start;
+  }
+}
+
+/* Insertion sort of the RefPics indices of a reference picture set by POC. */
+static void
+flu_va_driver_vdpau_sort_rps_hevc (uint8_t *rps, unsigned int num_pics,
+    const int32_t *pic_order_cnt, int descending)
+{
+  unsigned int i, j;
+
+  for (i = 1; i < num_pics; i++) {
+    uint8_t idx = rps[i];
+
+    for (j = i; j > 0; j--) {
+      int32_t prev = pic_order_cnt[rps[j - 1]];
+
+      if (descending ? prev >= pic_order_cnt[idx] : prev <= pic_order_cnt[idx])
+        break;
+      rps[j] = rps[j - 1];
+    }
+    rps[j] = idx;
+  }
+}
+
+/* The RefPicSetStCurrBefore, StCurrAfter and LtCurr lists are rebuilt from
+ * the RPS flags of the VA reference frames. StCurrBefore is ordered by
+ * decreasing POC and StCurrAfter by increasing POC, as in the spec. */
+static VAStatus
+flu_va_driver_vdpau_translate_ref_frames_hevc (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj,
+    const VAPictureParameterBufferHEVC *param)
+{
+  FluVaDriversVdpauDriverData *driver_data =
+      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  FluVaDriversVdpauRefFrameCache *cache = &context_obj->ref_frame_cache;
+  VdpPictureInfoHEVC *vdp_pic_info = &context_obj->vdp_pic_info.hevc;
+  unsigned int num_before = 0, num_after = 0, num_lt = 0;
+  VAStatus ret;
+  int i;
+
+  flu_va_drivers_vdpau_ref_frame_cache_sync (driver_data, cache);
+
+  for (i = 0; i < 16; i++) {
+    vdp_pic_info->RefPics[i] = VDP_INVALID_HANDLE;
+    vdp_pic_info->PicOrderCntVal[i] = 0;
+    vdp_pic_info->IsLongTerm[i] = 0;
+  }
+
+  for (i = 0; i < 15; i++) {
+    const VAPictureHEVC *ref = &param->ReferenceFrames[i];
+
+    if (ref->picture_id == VA_INVALID_SURFACE ||
+        (ref->flags & VA_PICTURE_HEVC_INVALID) != 0)
+      continue;
+
+    ret = flu_va_drivers_vdpau_ref_frame_cache_lookup_surface (
+        driver_data, cache, ref->picture_id, &vdp_pic_info->RefPics[i]);
+    if (ret != VA_STATUS_SUCCESS)
+      return ret;
+
+    vdp_pic_info->PicOrderCntVal[i] = ref->pic_order_cnt;
+    vdp_pic_info->IsLongTerm[i] =
+        (ref->flags & VA_PICTURE_HEVC_LONG_TERM_REFERENCE) != 0;
+
+    if ((ref->flags & VA_PICTURE_HEVC_RPS_ST_CURR_BEFORE) != 0 &&
+        num_before < FLU_VA_DRIVERS_HEVC_MAX_RPS_CURR)
+      vdp_pic_info->RefPicSetStCurrBefore[num_before++] = i;
+    else if ((ref->flags & VA_PICTURE_HEVC_RPS_ST_CURR_AFTER) != 0 &&
+             num_after < FLU_VA_DRIVERS_HEVC_MAX_RPS_CURR)
+      vdp_pic_info->RefPicSetStCurrAfter[num_after++] = i;
+    else if ((ref->flags & VA_PICTURE_HEVC_RPS_LT_CURR) != 0 &&
+             num_lt < FLU_VA_DRIVERS_HEVC_MAX_RPS_CURR)
+      vdp_pic_info->RefPicSetLtCurr[num_lt++] = i;
+  }
+
+  flu_va_driver_vdpau_sort_rps_hevc (vdp_pic_info->RefPicSetStCurrBefore,
+      num_before, vdp_pic_info->PicOrderCntVal, 1);
+  flu_va_driver_vdpau_sort_rps_hevc (vdp_pic_info->RefPicSetStCurrAfter,
+      num_after, vdp_pic_info->PicOrderCntVal, 0);
+
+  vdp_pic_info->NumPocStCurrBefore = num_before;
+  vdp_pic_info->NumPocStCurrAfter = num_after;
+  vdp_pic_info->NumPocLtCurr = num_lt;
+  vdp_pic_info->NumPocTotalCurr = num_before + num_after + num_lt;
+
+  return VA_STATUS_SUCCESS;
+}
+
+#define _MAP_FIELD(FIELD) vdp_pic_info->FIELD = param->FIELD
+#define _MAP_BITS_FIELD(FIELD, BITS_FIELD)                                    \
+  vdp_pic_info->BITS_FIELD = param->FIELD.bits.BITS_FIELD
+static VAStatus
+flu_va_driver_vdpau_translate_pic_param_hevc (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj,
+    const VAPictureParameterBufferHEVC *param)
+{
+  VdpPictureInfoHEVC *vdp_pic_info = &context_obj->vdp_pic_info.hevc;
+  unsigned int i;
+
+  /* Note: Rec. ITU-T H.265. Section: 6.2: For now only 4:2:0 support. */
+  if (param->pic_fields.bits.chroma_format_idc != 1)
+    return VA_STATUS_ERROR_UNKNOWN;
+
+  /* SPS level fields. */
+  _MAP_BITS_FIELD (pic_fields, chroma_format_idc);
+  _MAP_BITS_FIELD (pic_fields, separate_colour_plane_flag);
+  _MAP_FIELD (pic_width_in_luma_samples);
+  _MAP_FIELD (pic_height_in_luma_samples);
+  _MAP_FIELD (bit_depth_luma_minus8);
+  _MAP_FIELD (bit_depth_chroma_minus8);
+  _MAP_FIELD (log2_max_pic_order_cnt_lsb_minus4);
+  _MAP_FIELD (sps_max_dec_pic_buffering_minus1);
+  _MAP_FIELD (log2_min_luma_coding_block_size_minus3);
+  _MAP_FIELD (log2_diff_max_min_luma_coding_block_size);
+  _MAP_FIELD (log2_min_transform_block_size_minus2);
+  _MAP_FIELD (log2_diff_max_min_transform_block_size);
+  _MAP_FIELD (max_transform_hierarchy_depth_inter);
+  _MAP_FIELD (max_transform_hierarchy_depth_intra);
+  _MAP_BITS_FIELD (pic_fields, scaling_list_enabled_flag);
+  _MAP_BITS_FIELD (pic_fields, amp_enabled_flag);
+  _MAP_BITS_FIELD (slice_parsing_fields, sample_adaptive_offset_enabled_flag);
+  _MAP_BITS_FIELD (pic_fields, pcm_enabled_flag);
+  _MAP_FIELD (pcm_sample_bit_depth_luma_minus1);
+  _MAP_FIELD (pcm_sample_bit_depth_chroma_minus1);
+  _MAP_FIELD (log2_min_pcm_luma_coding_block_size_minus3);
+  _MAP_FIELD (log2_diff_max_min_pcm_luma_coding_block_size);
+  _MAP_BITS_FIELD (pic_fields, pcm_loop_filter_disabled_flag);
+  _MAP_FIELD (num_short_term_ref_pic_sets);
+  _MAP_BITS_FIELD (slice_parsing_fields, long_term_ref_pics_present_flag);
+  vdp_pic_info->num_long_term_ref_pics_sps = param->num_long_term_ref_pic_sps;
+  _MAP_BITS_FIELD (slice_parsing_fields, sps_temporal_mvp_enabled_flag);
+  _MAP_BITS_FIELD (pic_fields, strong_intra_smoothing_enabled_flag);
+
+  /* PPS level fields. */
+  _MAP_BITS_FIELD (slice_parsing_fields, dependent_slice_segments_enabled_flag);
+  _MAP_BITS_FIELD (slice_parsing_fields, output_flag_present_flag);
+  _MAP_FIELD (num_extra_slice_header_bits);
+  _MAP_BITS_FIELD (pic_fields, sign_data_hiding_enabled_flag);
+  _MAP_BITS_FIELD (slice_parsing_fields, cabac_init_present_flag);
+  _MAP_FIELD (num_ref_idx_l0_default_active_minus1);
+  _MAP_FIELD (num_ref_idx_l1_default_active_minus1);
+  _MAP_FIELD (init_qp_minus26);
+  _MAP_BITS_FIELD (pic_fields, constrained_intra_pred_flag);
+  _MAP_BITS_FIELD (pic_fields, transform_skip_enabled_flag);
+  _MAP_BITS_FIELD (pic_fields, cu_qp_delta_enabled_flag);
+  _MAP_FIELD (diff_cu_qp_delta_depth);
+  _MAP_FIELD (pps_cb_qp_offset);
+  _MAP_FIELD (pps_cr_qp_offset);
+  _MAP_BITS_FIELD (
+      slice_parsing_fields, pps_slice_chroma_qp_offsets_present_flag);
+  _MAP_BITS_FIELD (pic_fields, weighted_pred_flag);
+  _MAP_BITS_FIELD (pic_fields, weighted_bipred_flag);
+  _MAP_BITS_FIELD (pic_fields, transquant_bypass_enabled_flag);
+  _MAP_BITS_FIELD (pic_fields, tiles_enabled_flag);
+  _MAP_BITS_FIELD (pic_fields, entropy_coding_sync_enabled_flag);
+  _MAP_FIELD (num_tile_columns_minus1);
+  _MAP_FIELD (num_tile_rows_minus1);
+  /* VA always gives the explicit tile sizes. */
+  vdp_pic_info->uniform_spacing_flag = 0;
+  for (i = 0; i < N_ELEMENTS (param->column_width_minus1); i++)
+    _MAP_FIELD (column_width_minus1[i]);
+  for (i = 0; i < N_ELEMENTS (param->row_height_minus1); i++)
+    _MAP_FIELD (row_height_minus1[i]);
+  _MAP_BITS_FIELD (pic_fields, loop_filter_across_tiles_enabled_flag);
+  _MAP_BITS_FIELD (pic_fields, pps_loop_filter_across_slices_enabled_flag);
+  _MAP_BITS_FIELD (
+      slice_parsing_fields, deblocking_filter_override_enabled_flag);
+  vdp_pic_info->pps_deblocking_filter_disabled_flag =
+      param->slice_parsing_fields.bits.pps_disable_deblocking_filter_flag;
+  _MAP_FIELD (pps_beta_offset_div2);
+  _MAP_FIELD (pps_tc_offset_div2);
+  /* VA does not carry deblocking_filter_control_present_flag, it can only be
+   * unset when none of the syntax elements it guards is present. */
+  vdp_pic_info->deblocking_filter_control_present_flag =
+      vdp_pic_info->deblocking_filter_override_enabled_flag ||
+      vdp_pic_info->pps_deblocking_filter_disabled_flag ||
+      param->pps_beta_offset_div2 != 0 || param->pps_tc_offset_div2 != 0;
+  _MAP_BITS_FIELD (slice_parsing_fields, lists_modification_present_flag);
+  _MAP_FIELD (log2_parallel_merge_level_minus2);
+  _MAP_BITS_FIELD (
+      slice_parsing_fields, slice_segment_header_extension_present_flag);
+
+  /* Per-picture fields, CurrRpsIdx and the sizes of the reference picture
+   * set syntax are parsed along with the first slice segment. */
+  vdp_pic_info->IDRPicFlag = param->slice_parsing_fields.bits.IdrPicFlag;
+  vdp_pic_info->RAPPicFlag = param->slice_parsing_fields.bits.RapPicFlag;
+  vdp_pic_info->NumShortTermPictureSliceHeaderBits = param->st_rps_bits;
+  vdp_pic_info->CurrPicOrderCntVal = param->CurrPic.pic_order_cnt;
+
+  return flu_va_driver_vdpau_translate_ref_frames_hevc (
+      ctx, context_obj, param);
+}
+#undef _MAP_BITS_FIELD
+#undef _MAP_FIELD
+
+static int
+flu_va_driver_vdpau_is_buffer_type_supported_hevc (VABufferType buffer_type)
+{
+  switch (buffer_type) {
+    case VAPictureParameterBufferType:
+    case VAIQMatrixBufferType:
+    case VASliceParameterBufferType:
+    case VASliceDataBufferType:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static void
+flu_va_driver_vdpau_begin_picture_hevc (
+    FluVaDriversVdpauContextObject *context_obj)
+{
+  context_obj->param_cache.hevc.iq_matrix_rendered = 0;
+}
+
+static VAStatus
+flu_va_driver_vdpau_translate_buffer_hevc (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauBufferObject *buffer_obj)
+{
+  VAStatus ret = VA_STATUS_SUCCESS;
+  VdpPictureInfoHEVC *vdp_pic_info = &context_obj->vdp_pic_info.hevc;
+
+  switch (buffer_obj->type) {
+    case VAPictureParameterBufferType:
+      ret = flu_va_driver_vdpau_translate_pic_param_hevc (ctx, context_obj,
+          (VAPictureParameterBufferHEVC *) buffer_obj->data);
+      break;
+    case VAIQMatrixBufferType: {
+      VAIQMatrixBufferHEVC *iq_matrix =
+          (VAIQMatrixBufferHEVC *) buffer_obj->data;
+      FluVaDriversVdpauHEVCParamCache *cache = &context_obj->param_cache.hevc;
+
+      // Both VA and VDPAU take the scaling lists in up-right diagonal order.
+      memcpy (vdp_pic_info->ScalingList4x4, iq_matrix->ScalingList4x4,
+          sizeof (iq_matrix->ScalingList4x4));
+      memcpy (vdp_pic_info->ScalingList8x8, iq_matrix->ScalingList8x8,
+          sizeof (iq_matrix->ScalingList8x8));
+      memcpy (vdp_pic_info->ScalingList16x16, iq_matrix->ScalingList16x16,
+          sizeof (iq_matrix->ScalingList16x16));
+      memcpy (vdp_pic_info->ScalingList32x32, iq_matrix->ScalingList32x32,
+          sizeof (iq_matrix->ScalingList32x32));
+      memcpy (vdp_pic_info->ScalingListDCCoeff16x16,
+          iq_matrix->ScalingListDC16x16,
+          sizeof (iq_matrix->ScalingListDC16x16));
+      memcpy (vdp_pic_info->ScalingListDCCoeff32x32,
+          iq_matrix->ScalingListDC32x32,
+          sizeof (iq_matrix->ScalingListDC32x32));
+      cache->iq_matrix_rendered = 1;
+      cache->has_flat_scaling_lists = 0;
+      break;
+    }
+    case VASliceParameterBufferType:
+      ret = flu_va_drivers_vdpau_context_object_push_slice_params (context_obj,
+          buffer_obj->data, sizeof (VASliceParameterBufferHEVC),
+          buffer_obj->num_elements);
+      break;
+    case VASliceDataBufferType: {
+      size_t data_size = buffer_obj->size * buffer_obj->num_elements;
+      unsigned int i;
+
+      for (i = 0; i < context_obj->num_slice_params; i++) {
+        const VASliceParameterBufferHEVC *param =
+            (const VASliceParameterBufferHEVC *)
+                flu_va_drivers_vdpau_context_object_get_slice_params (
+                    context_obj, i);
+
+        if (param->slice_segment_address != 0 ||
+            param->slice_data_offset > data_size ||
+            param->slice_data_size > data_size - param->slice_data_offset)
+          continue;
+
+        flu_va_driver_vdpau_parse_slice_header_hevc (vdp_pic_info,
+            (uint8_t *) buffer_obj->data + param->slice_data_offset,
+            param->slice_data_size);
+      }
+
+      ret = flu_va_drivers_vdpau_context_object_push_slice_data (
+          context_obj, buffer_obj, NULL);
+      break;
+    }
+    default:
+      ret = VA_STATUS_ERROR_UNSUPPORTED_BUFFERTYPE;
+      break;
+  }
+
+  context_obj->last_buffer_type = buffer_obj->type;
+  return ret;
+}
+
+/* A picture using scaling lists without IQ matrix gets the flat ones. */
+static void
+flu_va_driver_vdpau_end_picture_hevc (
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauDecoderConfig *decoder_config)
+{
+  FluVaDriversVdpauHEVCParamCache *cache = &context_obj->param_cache.hevc;
+  VdpPictureInfoHEVC *vdp_pic_info = &context_obj->vdp_pic_info.hevc;
+
+  decoder_config->max_references =
+      vdp_pic_info->sps_max_dec_pic_buffering_minus1 + 1;
+  if (!vdp_pic_info->scaling_list_enabled_flag || cache->iq_matrix_rendered ||
+      cache->has_flat_scaling_lists)
+    return;
+
+  memset (vdp_pic_info->ScalingList4x4, 16,
+      sizeof (vdp_pic_info->ScalingList4x4));
+  memset (vdp_pic_info->ScalingList8x8, 16,
+      sizeof (vdp_pic_info->ScalingList8x8));
+  memset (vdp_pic_info->ScalingList16x16, 16,
+      sizeof (vdp_pic_info->ScalingList16x16));
+  memset (vdp_pic_info->ScalingList32x32, 16,
+      sizeof (vdp_pic_info->ScalingList32x32));
+  memset (vdp_pic_info->ScalingListDCCoeff16x16, 16,
+      sizeof (vdp_pic_info->ScalingListDCCoeff16x16));
+  memset (vdp_pic_info->ScalingListDCCoeff32x32, 16,
+      sizeof (vdp_pic_info->ScalingListDCCoeff32x32));
+  cache->has_flat_scaling_lists = 1;
+}
+
+const FluVaDriversVdpauCodecOps FLU_VA_DRIVERS_VDPAU_CODEC_OPS_HEVC = {
+  .vdp_pic_info_size = sizeof (VdpPictureInfoHEVC),
+  .default_max_references = 6,
+  .is_buffer_type_supported =
+      flu_va_driver_vdpau_is_buffer_type_supported_hevc,
+  .begin_picture = flu_va_driver_vdpau_begin_picture_hevc,
+  .translate_buffer = flu_va_driver_vdpau_translate_buffer_hevc,
+  .end_picture = flu_va_driver_vdpau_end_picture_hevc,
+};
@@ -0,0 +1,244 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "flu_va_drivers_vdpau_mpeg2.h"
+#include "flu_va_drivers_vdpau_utils.h"
+
+#define FLU_VA_DRIVERS_MPEG2_P_PICTURE 2
+#define FLU_VA_DRIVERS_MPEG2_B_PICTURE 3
+
+/* In raster order. Note: ISO/IEC 13818-2. Section: 6.3.11. */
+static const uint8_t FLU_VA_DRIVERS_MPEG2_DEFAULT_INTRA_MATRIX[64] = {
+  8, 16, 19, 22, 26, 27, 29, 34, 16, 16, 22, 24, 27, 29, 34, 37, 19, 22, 26,
+  27, 29, 34, 34, 38, 22, 22, 26, 27, 29, 34, 37, 40, 22, 26, 27, 29, 32, 35,
+  40, 48, 26, 27, 29, 32, 35, 40, 48, 58, 26, 27, 29, 34, 38, 46, 56, 69, 27,
+  29, 35, 38, 46, 56, 69, 83
+};
+
+static VAStatus
+flu_va_driver_vdpau_translate_pic_param_mpeg2 (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj,
+    const VAPictureParameterBufferMPEG2 *param)
+{
+  FluVaDriversVdpauDriverData *driver_data =
+      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  FluVaDriversVdpauRefFrameCache *cache = &context_obj->ref_frame_cache;
+  VdpPictureInfoMPEG1Or2 *vdp_pic_info = &context_obj->vdp_pic_info.mpeg2;
+  VAStatus ret = VA_STATUS_SUCCESS;
+
+  vdp_pic_info->picture_coding_type = param->picture_coding_type;
+  vdp_pic_info->picture_structure =
+      param->picture_coding_extension.bits.picture_structure;
+  vdp_pic_info->intra_dc_precision =
+      param->picture_coding_extension.bits.intra_dc_precision;
+  vdp_pic_info->frame_pred_frame_dct =
+      param->picture_coding_extension.bits.frame_pred_frame_dct;
+  vdp_pic_info->concealment_motion_vectors =
+      param->picture_coding_extension.bits.concealment_motion_vectors;
+  vdp_pic_info->intra_vlc_format =
+      param->picture_coding_extension.bits.intra_vlc_format;
+  vdp_pic_info->alternate_scan =
+      param->picture_coding_extension.bits.alternate_scan;
+  vdp_pic_info->q_scale_type =
+      param->picture_coding_extension.bits.q_scale_type;
+  vdp_pic_info->top_field_first =
+      param->picture_coding_extension.bits.top_field_first;
+  /* MPEG-1 only. */
+  vdp_pic_info->full_pel_forward_vector = 0;
+  vdp_pic_info->full_pel_backward_vector = 0;
+  /* VA packs the four 4-bit f_codes, f_code[0][0] being the highest. */
+  vdp_pic_info->f_code[0][0] = (param->f_code >> 12) & 0xf;
+  vdp_pic_info->f_code[0][1] = (param->f_code >> 8) & 0xf;
+  vdp_pic_info->f_code[1][0] = (param->f_code >> 4) & 0xf;
+  vdp_pic_info->f_code[1][1] = param->f_code & 0xf;
+
+  vdp_pic_info->forward_reference = VDP_INVALID_HANDLE;
+  vdp_pic_info->backward_reference = VDP_INVALID_HANDLE;
+  if (param->picture_coding_type != FLU_VA_DRIVERS_MPEG2_P_PICTURE &&
+      param->picture_coding_type != FLU_VA_DRIVERS_MPEG2_B_PICTURE)
+    return VA_STATUS_SUCCESS;
+
+  flu_va_drivers_vdpau_ref_frame_cache_sync (driver_data, cache);
+  ret = flu_va_drivers_vdpau_ref_frame_cache_lookup_reference (driver_data,
+      cache, param->forward_reference_picture,
+      &vdp_pic_info->forward_reference);
+  if (ret == VA_STATUS_SUCCESS &&
+      param->picture_coding_type == FLU_VA_DRIVERS_MPEG2_B_PICTURE)
+    ret = flu_va_drivers_vdpau_ref_frame_cache_lookup_reference (driver_data,
+        cache, param->backward_reference_picture,
+        &vdp_pic_info->backward_reference);
+
+  return ret;
+}
+
+/* VDPAU has no chroma matrices, they are only used by 4:2:2 and 4:4:4. */
+static void
+flu_va_driver_vdpau_translate_iq_matrix_mpeg2 (
+    FluVaDriversVdpauContextObject *context_obj,
+    const VAIQMatrixBufferMPEG2 *iq_matrix)
+{
+  VdpPictureInfoMPEG1Or2 *vdp_pic_info = &context_obj->vdp_pic_info.mpeg2;
+
+  if (iq_matrix->load_intra_quantiser_matrix)
+    flu_va_drivers_vdpau_unzigzag_matrix_8x8 (
+        vdp_pic_info->intra_quantizer_matrix,
+        iq_matrix->intra_quantiser_matrix);
+  else
+    memcpy (vdp_pic_info->intra_quantizer_matrix,
+        FLU_VA_DRIVERS_MPEG2_DEFAULT_INTRA_MATRIX,
+        sizeof (vdp_pic_info->intra_quantizer_matrix));
+
+  if (iq_matrix->load_non_intra_quantiser_matrix)
+    flu_va_drivers_vdpau_unzigzag_matrix_8x8 (
+        vdp_pic_info->non_intra_quantizer_matrix,
+        iq_matrix->non_intra_quantiser_matrix);
+  else
+    memset (vdp_pic_info->non_intra_quantizer_matrix, 16,
+        sizeof (vdp_pic_info->non_intra_quantizer_matrix));
+
+  context_obj->param_cache.mpeg.has_iq_matrix = 1;
+}
+
+/* The slice data starts with the slice start code. */
+static VAStatus
+flu_va_driver_vdpau_push_slice_data_mpeg2 (
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauBufferObject *buffer_obj)
+{
+  VdpPictureInfoMPEG1Or2 *vdp_pic_info = &context_obj->vdp_pic_info.mpeg2;
+  unsigned int i;
+  VAStatus ret;
+
+  if (context_obj->num_slice_params == 0)
+    return VA_STATUS_ERROR_UNKNOWN;
+
+  for (i = 0; i < context_obj->num_slice_params; i++) {
+    const VASliceParameterBufferMPEG2 *param =
+        (const VASliceParameterBufferMPEG2 *)
+            flu_va_drivers_vdpau_context_object_get_slice_params (
+                context_obj, i);
+    const uint8_t *data;
+    uint8_t start_code[4] = { 0x00, 0x00, 0x01 };
+
+    data = flu_va_drivers_vdpau_context_object_get_slice_data (
+        context_obj, buffer_obj, i);
+    if (data == NULL)
+      return VA_STATUS_ERROR_INVALID_BUFFER;
+
+    /* slice_start_code, for the rows below 2800 lines. */
+    start_code[3] = param->slice_vertical_position + 1;
+    ret = flu_va_drivers_vdpau_context_object_append_slice (context_obj, data,
+        param->slice_data_size, start_code, sizeof (start_code));
+    if (ret != VA_STATUS_SUCCESS)
+      return ret;
+  }
+  vdp_pic_info->slice_count += context_obj->num_slice_params;
+  context_obj->num_slice_params = 0;
+
+  return VA_STATUS_SUCCESS;
+}
+
+static int
+flu_va_driver_vdpau_is_buffer_type_supported_mpeg2 (VABufferType buffer_type)
+{
+  switch (buffer_type) {
+    case VAPictureParameterBufferType:
+    case VAIQMatrixBufferType:
+    case VASliceParameterBufferType:
+    case VASliceDataBufferType:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static void
+flu_va_driver_vdpau_begin_picture_mpeg2 (
+    FluVaDriversVdpauContextObject *context_obj)
+{
+  context_obj->vdp_pic_info.mpeg2.slice_count = 0;
+}
+
+static VAStatus
+flu_va_driver_vdpau_translate_buffer_mpeg2 (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauBufferObject *buffer_obj)
+{
+  VAStatus ret = VA_STATUS_SUCCESS;
+
+  switch (buffer_obj->type) {
+    case VAPictureParameterBufferType:
+      ret = flu_va_driver_vdpau_translate_pic_param_mpeg2 (ctx, context_obj,
+          (VAPictureParameterBufferMPEG2 *) buffer_obj->data);
+      break;
+    case VAIQMatrixBufferType:
+      flu_va_driver_vdpau_translate_iq_matrix_mpeg2 (
+          context_obj, (VAIQMatrixBufferMPEG2 *) buffer_obj->data);
+      break;
+    case VASliceParameterBufferType:
+      ret = flu_va_drivers_vdpau_context_object_push_slice_params (context_obj,
+          buffer_obj->data, sizeof (VASliceParameterBufferMPEG2),
+          buffer_obj->num_elements);
+      break;
+    case VASliceDataBufferType:
+      ret = flu_va_driver_vdpau_push_slice_data_mpeg2 (context_obj, buffer_obj);
+      break;
+    default:
+      ret = VA_STATUS_ERROR_UNSUPPORTED_BUFFERTYPE;
+      break;
+  }
+
+  context_obj->last_buffer_type = buffer_obj->type;
+  return ret;
+}
+
+/* Until a first IQ matrix, the default matrices are used. */
+static void
+flu_va_driver_vdpau_end_picture_mpeg2 (
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauDecoderConfig *decoder_config)
+{
+  VdpPictureInfoMPEG1Or2 *vdp_pic_info = &context_obj->vdp_pic_info.mpeg2;
+
+  decoder_config->max_references = 2;
+  if (context_obj->param_cache.mpeg.has_iq_matrix)
+    return;
+
+  memcpy (vdp_pic_info->intra_quantizer_matrix,
+      FLU_VA_DRIVERS_MPEG2_DEFAULT_INTRA_MATRIX,
+      sizeof (vdp_pic_info->intra_quantizer_matrix));
+  memset (vdp_pic_info->non_intra_quantizer_matrix, 16,
+      sizeof (vdp_pic_info->non_intra_quantizer_matrix));
+  context_obj->param_cache.mpeg.has_iq_matrix = 1;
+}
+
+const FluVaDriversVdpauCodecOps FLU_VA_DRIVERS_VDPAU_CODEC_OPS_MPEG2 = {
+  .vdp_pic_info_size = sizeof (VdpPictureInfoMPEG1Or2),
+  .default_max_references = 2,
+  .is_buffer_type_supported =
+      flu_va_driver_vdpau_is_buffer_type_supported_mpeg2,
+  .begin_picture = flu_va_driver_vdpau_begin_picture_mpeg2,
+  .translate_buffer = flu_va_driver_vdpau_translate_buffer_mpeg2,
+  .end_picture = flu_va_driver_vdpau_end_picture_mpeg2,
+};
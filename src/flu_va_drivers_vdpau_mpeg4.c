@@ -0,0 +1,246 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "flu_va_drivers_vdpau_mpeg4.h"
+#include "flu_va_drivers_vdpau_utils.h"
+
+#define FLU_VA_DRIVERS_MPEG4_I_VOP 0
+#define FLU_VA_DRIVERS_MPEG4_B_VOP 2
+
+static const uint8_t FLU_VA_DRIVERS_MPEG4_VOP_START_CODE[4] = { 0x00, 0x00,
+  0x01, 0xb6 };
+
+/* In raster order. Note: ISO/IEC 14496-2. Section: 6.3.3. */
+static const uint8_t FLU_VA_DRIVERS_MPEG4_DEFAULT_INTRA_MATRIX[64] = {
+  8, 17, 18, 19, 21, 23, 25, 27, 17, 18, 19, 21, 23, 25, 27, 28, 20, 21, 22,
+  23, 24, 26, 28, 30, 21, 22, 23, 24, 26, 28, 30, 32, 22, 23, 24, 26, 28, 30,
+  32, 35, 23, 24, 26, 28, 30, 32, 35, 38, 25, 26, 28, 30, 32, 35, 38, 41, 27,
+  28, 30, 32, 35, 38, 41, 45
+};
+
+static const uint8_t FLU_VA_DRIVERS_MPEG4_DEFAULT_NON_INTRA_MATRIX[64] = {
+  16, 17, 18, 19, 20, 21, 22, 23, 17, 18, 19, 20, 21, 22, 23, 24, 18, 19, 20,
+  21, 22, 23, 24, 25, 19, 20, 21, 22, 23, 24, 26, 27, 20, 21, 22, 23, 25, 26,
+  27, 28, 21, 22, 23, 24, 26, 27, 28, 30, 22, 23, 24, 26, 27, 28, 30, 31, 23,
+  24, 25, 27, 28, 30, 31, 33
+};
+
+#define _MAP_VOL_FIELD(FIELD)                                                 \
+  vdp_pic_info->FIELD = param->vol_fields.bits.FIELD
+#define _MAP_VOP_FIELD(FIELD)                                                 \
+  vdp_pic_info->FIELD = param->vop_fields.bits.FIELD
+static VAStatus
+flu_va_driver_vdpau_translate_pic_param_mpeg4 (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj,
+    const VAPictureParameterBufferMPEG4 *param)
+{
+  FluVaDriversVdpauDriverData *driver_data =
+      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  FluVaDriversVdpauRefFrameCache *cache = &context_obj->ref_frame_cache;
+  VdpPictureInfoMPEG4Part2 *vdp_pic_info = &context_obj->vdp_pic_info.mpeg4;
+  VAStatus ret;
+
+  /* VA has no field temporal distances, they only matter for the direct
+   * mode of interlaced B-VOPs. */
+  vdp_pic_info->trd[0] = param->TRD;
+  vdp_pic_info->trd[1] = param->TRD;
+  vdp_pic_info->trb[0] = param->TRB;
+  vdp_pic_info->trb[1] = param->TRB;
+  vdp_pic_info->vop_time_increment_resolution =
+      param->vop_time_increment_resolution;
+  _MAP_VOP_FIELD (vop_coding_type);
+  vdp_pic_info->vop_fcode_forward = param->vop_fcode_forward;
+  vdp_pic_info->vop_fcode_backward = param->vop_fcode_backward;
+  _MAP_VOL_FIELD (resync_marker_disable);
+  _MAP_VOL_FIELD (interlaced);
+  _MAP_VOL_FIELD (quant_type);
+  _MAP_VOL_FIELD (quarter_sample);
+  _MAP_VOL_FIELD (short_video_header);
+  vdp_pic_info->rounding_control = param->vop_fields.bits.vop_rounding_type;
+  _MAP_VOP_FIELD (alternate_vertical_scan_flag);
+  _MAP_VOP_FIELD (top_field_first);
+
+  vdp_pic_info->forward_reference = VDP_INVALID_HANDLE;
+  vdp_pic_info->backward_reference = VDP_INVALID_HANDLE;
+  if (vdp_pic_info->vop_coding_type == FLU_VA_DRIVERS_MPEG4_I_VOP)
+    return VA_STATUS_SUCCESS;
+
+  /* P and S-VOPs only have a forward reference. */
+  flu_va_drivers_vdpau_ref_frame_cache_sync (driver_data, cache);
+  ret = flu_va_drivers_vdpau_ref_frame_cache_lookup_reference (driver_data,
+      cache, param->forward_reference_picture,
+      &vdp_pic_info->forward_reference);
+  if (ret == VA_STATUS_SUCCESS &&
+      vdp_pic_info->vop_coding_type == FLU_VA_DRIVERS_MPEG4_B_VOP)
+    ret = flu_va_drivers_vdpau_ref_frame_cache_lookup_reference (driver_data,
+        cache, param->backward_reference_picture,
+        &vdp_pic_info->backward_reference);
+
+  return ret;
+}
+#undef _MAP_VOP_FIELD
+#undef _MAP_VOL_FIELD
+
+static void
+flu_va_driver_vdpau_translate_iq_matrix_mpeg4 (
+    FluVaDriversVdpauContextObject *context_obj,
+    const VAIQMatrixBufferMPEG4 *iq_matrix)
+{
+  VdpPictureInfoMPEG4Part2 *vdp_pic_info = &context_obj->vdp_pic_info.mpeg4;
+
+  if (iq_matrix->load_intra_quant_mat)
+    flu_va_drivers_vdpau_unzigzag_matrix_8x8 (
+        vdp_pic_info->intra_quantizer_matrix, iq_matrix->intra_quant_mat);
+  else
+    memcpy (vdp_pic_info->intra_quantizer_matrix,
+        FLU_VA_DRIVERS_MPEG4_DEFAULT_INTRA_MATRIX,
+        sizeof (vdp_pic_info->intra_quantizer_matrix));
+
+  if (iq_matrix->load_non_intra_quant_mat)
+    flu_va_drivers_vdpau_unzigzag_matrix_8x8 (
+        vdp_pic_info->non_intra_quantizer_matrix,
+        iq_matrix->non_intra_quant_mat);
+  else
+    memcpy (vdp_pic_info->non_intra_quantizer_matrix,
+        FLU_VA_DRIVERS_MPEG4_DEFAULT_NON_INTRA_MATRIX,
+        sizeof (vdp_pic_info->non_intra_quantizer_matrix));
+
+  context_obj->param_cache.mpeg.has_iq_matrix = 1;
+}
+
+/* VDPAU decodes the VOP from its start code, which some clients strip from
+ * the first slice. The next slices are video packets, passed as they are. */
+static VAStatus
+flu_va_driver_vdpau_push_slice_data_mpeg4 (
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauBufferObject *buffer_obj)
+{
+  unsigned int i;
+  VAStatus ret;
+
+  if (context_obj->num_slice_params == 0)
+    return VA_STATUS_ERROR_UNKNOWN;
+
+  for (i = 0; i < context_obj->num_slice_params; i++) {
+    const VASliceParameterBufferBase *param =
+        flu_va_drivers_vdpau_context_object_get_slice_params (context_obj, i);
+    const uint8_t *data;
+    unsigned int start_code_size = 0;
+
+    data = flu_va_drivers_vdpau_context_object_get_slice_data (
+        context_obj, buffer_obj, i);
+    if (data == NULL)
+      return VA_STATUS_ERROR_INVALID_BUFFER;
+
+    if (context_obj->bitstream.size == 0)
+      start_code_size = sizeof (FLU_VA_DRIVERS_MPEG4_VOP_START_CODE);
+    ret = flu_va_drivers_vdpau_context_object_append_slice (context_obj, data,
+        param->slice_data_size, FLU_VA_DRIVERS_MPEG4_VOP_START_CODE,
+        start_code_size);
+    if (ret != VA_STATUS_SUCCESS)
+      return ret;
+  }
+  context_obj->num_slice_params = 0;
+
+  return VA_STATUS_SUCCESS;
+}
+
+static int
+flu_va_driver_vdpau_is_buffer_type_supported_mpeg4 (VABufferType buffer_type)
+{
+  switch (buffer_type) {
+    case VAPictureParameterBufferType:
+    case VAIQMatrixBufferType:
+    case VASliceParameterBufferType:
+    case VASliceDataBufferType:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static VAStatus
+flu_va_driver_vdpau_translate_buffer_mpeg4 (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauBufferObject *buffer_obj)
+{
+  VAStatus ret = VA_STATUS_SUCCESS;
+
+  switch (buffer_obj->type) {
+    case VAPictureParameterBufferType:
+      ret = flu_va_driver_vdpau_translate_pic_param_mpeg4 (ctx, context_obj,
+          (VAPictureParameterBufferMPEG4 *) buffer_obj->data);
+      break;
+    case VAIQMatrixBufferType:
+      flu_va_driver_vdpau_translate_iq_matrix_mpeg4 (
+          context_obj, (VAIQMatrixBufferMPEG4 *) buffer_obj->data);
+      break;
+    case VASliceParameterBufferType:
+      ret = flu_va_drivers_vdpau_context_object_push_slice_params (context_obj,
+          buffer_obj->data, sizeof (VASliceParameterBufferMPEG4),
+          buffer_obj->num_elements);
+      break;
+    case VASliceDataBufferType:
+      ret = flu_va_driver_vdpau_push_slice_data_mpeg4 (context_obj, buffer_obj);
+      break;
+    default:
+      ret = VA_STATUS_ERROR_UNSUPPORTED_BUFFERTYPE;
+      break;
+  }
+
+  context_obj->last_buffer_type = buffer_obj->type;
+  return ret;
+}
+
+/* Until a first IQ matrix, the default matrices are used. They only matter
+ * with the MPEG quantization type. */
+static void
+flu_va_driver_vdpau_end_picture_mpeg4 (
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauDecoderConfig *decoder_config)
+{
+  VdpPictureInfoMPEG4Part2 *vdp_pic_info = &context_obj->vdp_pic_info.mpeg4;
+
+  decoder_config->max_references = 2;
+  if (context_obj->param_cache.mpeg.has_iq_matrix)
+    return;
+
+  memcpy (vdp_pic_info->intra_quantizer_matrix,
+      FLU_VA_DRIVERS_MPEG4_DEFAULT_INTRA_MATRIX,
+      sizeof (vdp_pic_info->intra_quantizer_matrix));
+  memcpy (vdp_pic_info->non_intra_quantizer_matrix,
+      FLU_VA_DRIVERS_MPEG4_DEFAULT_NON_INTRA_MATRIX,
+      sizeof (vdp_pic_info->non_intra_quantizer_matrix));
+  context_obj->param_cache.mpeg.has_iq_matrix = 1;
+}
+
+const FluVaDriversVdpauCodecOps FLU_VA_DRIVERS_VDPAU_CODEC_OPS_MPEG4 = {
+  .vdp_pic_info_size = sizeof (VdpPictureInfoMPEG4Part2),
+  .default_max_references = 2,
+  .is_buffer_type_supported =
+      flu_va_driver_vdpau_is_buffer_type_supported_mpeg4,
+  .begin_picture = NULL,
+  .translate_buffer = flu_va_driver_vdpau_translate_buffer_mpeg4,
+  .end_picture = flu_va_driver_vdpau_end_picture_mpeg4,
+};
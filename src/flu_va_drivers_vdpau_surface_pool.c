@@ -0,0 +1,264 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flu_va_drivers_utils.h"
+#include "flu_va_drivers_vdpau_surface_pool.h"
+
+/* Approximate memory used by a surface, only to enforce the pool limit. */
+static size_t
+flu_va_drivers_vdpau_surface_pool_get_size (
+    VdpChromaType vdp_chroma_type, uint32_t width, uint32_t height)
+{
+  size_t num_pixels = (size_t) width * height;
+
+  switch (vdp_chroma_type) {
+    case VDP_CHROMA_TYPE_422:
+      return num_pixels * 2;
+    case VDP_CHROMA_TYPE_444:
+      return num_pixels * 3;
+#ifdef HAVE_VDPAU_HIGH_BIT_DEPTH
+    case VDP_CHROMA_TYPE_420_16:
+      return num_pixels * 3;
+    case VDP_CHROMA_TYPE_422_16:
+      return num_pixels * 4;
+    case VDP_CHROMA_TYPE_444_16:
+      return num_pixels * 6;
+#endif
+    default:
+      return num_pixels * 3 / 2;
+  }
+}
+
+static int
+flu_va_drivers_vdpau_surface_pool_is_older (
+    const FluVaDriversVdpauSurfacePoolEntry *a,
+    const FluVaDriversVdpauSurfacePoolEntry *b)
+{
+  return a->deadline.tv_sec < b->deadline.tv_sec ||
+         (a->deadline.tv_sec == b->deadline.tv_sec &&
+             a->deadline.tv_nsec < b->deadline.tv_nsec);
+}
+
+/* Removes the entry by moving the last one into its place. */
+static VdpVideoSurface
+flu_va_drivers_vdpau_surface_pool_remove (
+    FluVaDriversVdpauSurfacePool *pool, unsigned int idx)
+{
+  VdpVideoSurface vdp_surface = pool->entries[idx].vdp_surface;
+
+  pool->stats.cached_bytes -= pool->entries[idx].size;
+  pool->entries[idx] = pool->entries[--pool->num_entries];
+
+  return vdp_surface;
+}
+
+/* Moves the expired surfaces to evicted, to be destroyed once the mutex is
+ * released. Returns how many were moved. */
+static unsigned int
+flu_va_drivers_vdpau_surface_pool_trim (
+    FluVaDriversVdpauSurfacePool *pool, VdpVideoSurface *evicted)
+{
+  unsigned int i = 0, num_evicted = 0;
+
+  while (i < pool->num_entries) {
+    if (!flu_va_drivers_deadline_expired (&pool->entries[i].deadline)) {
+      i++;
+      continue;
+    }
+    evicted[num_evicted++] =
+        flu_va_drivers_vdpau_surface_pool_remove (pool, i);
+    pool->stats.evictions++;
+  }
+
+  return num_evicted;
+}
+
+static void
+flu_va_drivers_vdpau_surface_pool_destroy_surfaces (
+    FluVaDriversVdpauSurfacePool *pool, const VdpVideoSurface *vdp_surfaces,
+    unsigned int num_surfaces)
+{
+  unsigned int i;
+
+  for (i = 0; i < num_surfaces; i++)
+    pool->vdp_impl->vdp_video_surface_destroy (vdp_surfaces[i]);
+}
+
+void
+flu_va_drivers_vdpau_surface_pool_init (
+    FluVaDriversVdpauSurfacePool *pool, FluVaDriversVdpauVdpDeviceImpl *impl)
+{
+  const char *max_bytes_env;
+
+  memset (pool, 0, sizeof (*pool));
+  pool->vdp_impl = impl;
+  pthread_mutex_init (&pool->mutex, NULL);
+
+  pool->max_bytes = FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_DEFAULT_MAX_BYTES;
+  max_bytes_env = getenv ("FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_MAX_BYTES");
+  if (max_bytes_env != NULL) {
+    char *end;
+    unsigned long long max_bytes = strtoull (max_bytes_env, &end, 10);
+
+    if (end != max_bytes_env && *end == '\0')
+      pool->max_bytes = max_bytes;
+  }
+
+  pool->print_stats =
+      getenv ("FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_STATS") != NULL;
+}
+
+void
+flu_va_drivers_vdpau_surface_pool_destroy (FluVaDriversVdpauSurfacePool *pool)
+{
+  if (pool->print_stats) {
+    fprintf (stderr,
+        "flu_va_drivers_vdpau surface pool: %zu hits, %zu misses, "
+        "%zu evictions, %zu bytes peak (max %zu)\n",
+        pool->stats.hits, pool->stats.misses, pool->stats.evictions,
+        pool->stats.peak_cached_bytes, pool->max_bytes);
+  }
+
+  while (pool->num_entries > 0) {
+    pool->vdp_impl->vdp_video_surface_destroy (
+        flu_va_drivers_vdpau_surface_pool_remove (pool, 0));
+  }
+
+  pthread_mutex_destroy (&pool->mutex);
+}
+
+VdpStatus
+flu_va_drivers_vdpau_surface_pool_acquire (
+    FluVaDriversVdpauSurfacePool *pool, VdpChromaType vdp_chroma_type,
+    uint32_t width, uint32_t height, VdpVideoSurface *vdp_surface)
+{
+  VdpVideoSurface evicted[FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_SIZE];
+  FluVaDriversVdpauSurfacePoolEntry *best = NULL;
+  unsigned int num_evicted, i;
+
+  pthread_mutex_lock (&pool->mutex);
+  num_evicted = flu_va_drivers_vdpau_surface_pool_trim (pool, evicted);
+  /* Take the most recently released match, so that the older ones expire. */
+  for (i = 0; i < pool->num_entries; i++) {
+    FluVaDriversVdpauSurfacePoolEntry *entry = &pool->entries[i];
+
+    if (entry->vdp_chroma_type != vdp_chroma_type || entry->width != width ||
+        entry->height != height)
+      continue;
+    if (best == NULL ||
+        flu_va_drivers_vdpau_surface_pool_is_older (best, entry))
+      best = entry;
+  }
+
+  if (best != NULL) {
+    *vdp_surface =
+        flu_va_drivers_vdpau_surface_pool_remove (pool, best - pool->entries);
+    pool->stats.hits++;
+  } else {
+    pool->stats.misses++;
+  }
+  pthread_mutex_unlock (&pool->mutex);
+
+  flu_va_drivers_vdpau_surface_pool_destroy_surfaces (
+      pool, evicted, num_evicted);
+
+  if (best != NULL)
+    return VDP_STATUS_OK;
+
+  return pool->vdp_impl->vdp_video_surface_create (pool->vdp_impl->vdp_device,
+      vdp_chroma_type, width, height, vdp_surface);
+}
+
+void
+flu_va_drivers_vdpau_surface_pool_release (
+    FluVaDriversVdpauSurfacePool *pool, VdpChromaType vdp_chroma_type,
+    uint32_t width, uint32_t height, VdpVideoSurface vdp_surface)
+{
+  /* Trimming and making room can evict every entry, plus the surface itself
+   * when it does not fit at all. */
+  VdpVideoSurface evicted[FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_SIZE + 1];
+  FluVaDriversVdpauSurfacePoolEntry *entry;
+  unsigned int num_evicted, i, oldest;
+  size_t size;
+
+  if (vdp_surface == VDP_INVALID_HANDLE)
+    return;
+
+  size = flu_va_drivers_vdpau_surface_pool_get_size (
+      vdp_chroma_type, width, height);
+
+  pthread_mutex_lock (&pool->mutex);
+  num_evicted = flu_va_drivers_vdpau_surface_pool_trim (pool, evicted);
+  if (size > pool->max_bytes) {
+    evicted[num_evicted++] = vdp_surface;
+    pool->stats.evictions++;
+    goto beach;
+  }
+
+  while (pool->num_entries == FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_SIZE ||
+         pool->stats.cached_bytes + size > pool->max_bytes) {
+    oldest = 0;
+    for (i = 1; i < pool->num_entries; i++) {
+      if (flu_va_drivers_vdpau_surface_pool_is_older (
+              &pool->entries[i], &pool->entries[oldest]))
+        oldest = i;
+    }
+    evicted[num_evicted++] =
+        flu_va_drivers_vdpau_surface_pool_remove (pool, oldest);
+    pool->stats.evictions++;
+  }
+
+  entry = &pool->entries[pool->num_entries++];
+  entry->vdp_chroma_type = vdp_chroma_type;
+  entry->width = width;
+  entry->height = height;
+  entry->vdp_surface = vdp_surface;
+  entry->size = size;
+  flu_va_drivers_get_deadline (
+      FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_MAX_IDLE_NS, &entry->deadline);
+  pool->stats.cached_bytes += size;
+  if (pool->stats.cached_bytes > pool->stats.peak_cached_bytes)
+    pool->stats.peak_cached_bytes = pool->stats.cached_bytes;
+
+beach:
+  pthread_mutex_unlock (&pool->mutex);
+  flu_va_drivers_vdpau_surface_pool_destroy_surfaces (
+      pool, evicted, num_evicted);
+}
+
+void
+flu_va_drivers_vdpau_surface_pool_get_stats (
+    FluVaDriversVdpauSurfacePool *pool,
+    FluVaDriversVdpauSurfacePoolStats *stats)
+{
+  pthread_mutex_lock (&pool->mutex);
+  *stats = pool->stats;
+  pthread_mutex_unlock (&pool->mutex);
+}
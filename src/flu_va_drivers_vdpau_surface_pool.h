@@ -0,0 +1,116 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_H__
+#define __FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <vdpau/vdpau.h>
+#include "flu_va_drivers_vdpau_vdp_device_impl.h"
+
+/* Maximum number of idle surfaces kept for reuse. */
+#define FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_SIZE 64
+
+/* Maximum amount of surface memory kept in the pool, overridable with the
+ * FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_MAX_BYTES environment variable. */
+#define FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_DEFAULT_MAX_BYTES (256 * 1024 * 1024)
+
+/* Idle surfaces older than this are destroyed on the next acquire or
+ * release. */
+#define FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_MAX_IDLE_NS 5000000000ULL
+
+typedef struct _FluVaDriversVdpauSurfacePoolStats
+    FluVaDriversVdpauSurfacePoolStats;
+
+struct _FluVaDriversVdpauSurfacePoolStats
+{
+  /* Surfaces served from the pool. */
+  size_t hits;
+  /* Surfaces that needed a VdpVideoSurfaceCreate. */
+  size_t misses;
+  /* Released surfaces destroyed because the pool was full, or because they
+   * stayed idle for too long. */
+  size_t evictions;
+  size_t cached_bytes;
+  size_t peak_cached_bytes;
+};
+
+typedef struct _FluVaDriversVdpauSurfacePoolEntry
+    FluVaDriversVdpauSurfacePoolEntry;
+
+struct _FluVaDriversVdpauSurfacePoolEntry
+{
+  VdpChromaType vdp_chroma_type;
+  uint32_t width;
+  uint32_t height;
+  VdpVideoSurface vdp_surface;
+  size_t size;
+  /* The surface is destroyed once it expires. */
+  struct timespec deadline;
+};
+
+/* Idle video surfaces released by vaDestroySurfaces, so that clients
+ * recreating their surfaces on resolution changes or decoder resets do not
+ * pay the surface creation again. */
+typedef struct _FluVaDriversVdpauSurfacePool FluVaDriversVdpauSurfacePool;
+
+struct _FluVaDriversVdpauSurfacePool
+{
+  FluVaDriversVdpauVdpDeviceImpl *vdp_impl;
+  pthread_mutex_t mutex;
+  FluVaDriversVdpauSurfacePoolEntry
+      entries[FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_SIZE];
+  unsigned int num_entries;
+  size_t max_bytes;
+  /* Print the statistics on destruction, enabled with the
+   * FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_STATS environment variable. */
+  int print_stats;
+  FluVaDriversVdpauSurfacePoolStats stats;
+};
+
+void flu_va_drivers_vdpau_surface_pool_init (
+    FluVaDriversVdpauSurfacePool *pool, FluVaDriversVdpauVdpDeviceImpl *impl);
+
+void flu_va_drivers_vdpau_surface_pool_destroy (
+    FluVaDriversVdpauSurfacePool *pool);
+
+/* Returns a pooled surface of the same chroma type and size, or creates
+ * one. */
+VdpStatus flu_va_drivers_vdpau_surface_pool_acquire (
+    FluVaDriversVdpauSurfacePool *pool, VdpChromaType vdp_chroma_type,
+    uint32_t width, uint32_t height, VdpVideoSurface *vdp_surface);
+
+/* Gives back a surface no longer decoded to nor displayed, evicting the
+ * oldest ones if the pool is full. */
+void flu_va_drivers_vdpau_surface_pool_release (
+    FluVaDriversVdpauSurfacePool *pool, VdpChromaType vdp_chroma_type,
+    uint32_t width, uint32_t height, VdpVideoSurface vdp_surface);
+
+void flu_va_drivers_vdpau_surface_pool_get_stats (
+    FluVaDriversVdpauSurfacePool *pool,
+    FluVaDriversVdpauSurfacePoolStats *stats);
+
+#endif /* __FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_H__ */
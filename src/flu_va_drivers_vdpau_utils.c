@@ -22,18 +22,65 @@
  */
 
 #include "flu_va_drivers_vdpau_utils.h"
+#include "flu_va_drivers_bitstream.h"
+#include "flu_va_drivers_vdpau_mpeg2.h"
+#include "flu_va_drivers_vdpau_mpeg4.h"
+#include "flu_va_drivers_vdpau_vc1.h"
+#include "flu_va_drivers_vdpau_hevc.h"
+#include "flu_va_drivers_vdpau_vp9.h"
+#include "flu_va_drivers_vdpau_av1.h"
 
 // clang-format off
 FluVaDriversVdpauImageFormatMap FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_MAP = {
   {
       FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_YCBCR,
       VDP_YCBCR_FORMAT_NV12,
+      VDP_CHROMA_TYPE_420,
       {VA_FOURCC_NV12, VA_LSB_FIRST, 12, },
   },
-  { FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_NONE, 0, {0, 0, 0, } },
+  {
+      FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_YCBCR,
+      VDP_YCBCR_FORMAT_YUYV,
+      VDP_CHROMA_TYPE_422,
+      {VA_FOURCC_YUY2, VA_LSB_FIRST, 16, },
+  },
+#ifdef HAVE_VDPAU_HIGH_BIT_DEPTH
+  {
+      FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_YCBCR,
+      VDP_YCBCR_FORMAT_Y_U_V_444,
+      VDP_CHROMA_TYPE_444,
+      {VA_FOURCC_444P, VA_LSB_FIRST, 24, },
+  },
+  {
+      FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_YCBCR,
+      VDP_YCBCR_FORMAT_P010,
+      VDP_CHROMA_TYPE_420_16,
+      {VA_FOURCC_P010, VA_LSB_FIRST, 24, },
+  },
+  {
+      FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_YCBCR,
+      VDP_YCBCR_FORMAT_P016,
+      VDP_CHROMA_TYPE_420_16,
+      {VA_FOURCC_P016, VA_LSB_FIRST, 24, },
+  },
+#endif
+  { FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_NONE, 0, 0, {0, 0, 0, } },
 };
 // clang-format on
 
+const FluVaDriversVdpauImageFormatMapItem *
+flu_va_drivers_vdpau_lookup_image_format (uint32_t fourcc)
+{
+  const FluVaDriversVdpauImageFormatMapItem *item =
+      FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_MAP;
+
+  for (; item->type != FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_TYPE_NONE; item++) {
+    if (item->va_image_format.fourcc == fourcc)
+      return item;
+  }
+  return NULL;
+}
+
 VAStatus
 flu_va_drivers_map_va_profile_to_vdpau_decoder_profile (
     VAProfile va_profile, VdpDecoderProfile *vdp_profile)
@@ -41,6 +88,27 @@ flu_va_drivers_map_va_profile_to_vdpau_decoder_profile (
   VAStatus ret = VA_STATUS_SUCCESS;
 
   switch (va_profile) {
+    case VAProfileMPEG2Simple:
+      *vdp_profile = VDP_DECODER_PROFILE_MPEG2_SIMPLE;
+      break;
+    case VAProfileMPEG2Main:
+      *vdp_profile = VDP_DECODER_PROFILE_MPEG2_MAIN;
+      break;
+    case VAProfileMPEG4Simple:
+      *vdp_profile = VDP_DECODER_PROFILE_MPEG4_PART2_SP;
+      break;
+    case VAProfileMPEG4AdvancedSimple:
+      *vdp_profile = VDP_DECODER_PROFILE_MPEG4_PART2_ASP;
+      break;
+    case VAProfileVC1Simple:
+      *vdp_profile = VDP_DECODER_PROFILE_VC1_SIMPLE;
+      break;
+    case VAProfileVC1Main:
+      *vdp_profile = VDP_DECODER_PROFILE_VC1_MAIN;
+      break;
+    case VAProfileVC1Advanced:
+      *vdp_profile = VDP_DECODER_PROFILE_VC1_ADVANCED;
+      break;
     case VAProfileH264ConstrainedBaseline:
       *vdp_profile = VDP_DECODER_PROFILE_H264_BASELINE;
       break;
@@ -50,6 +118,27 @@ flu_va_drivers_map_va_profile_to_vdpau_decoder_profile (
     case VAProfileH264High:
       *vdp_profile = VDP_DECODER_PROFILE_H264_HIGH;
       break;
+    case VAProfileHEVCMain:
+      *vdp_profile = VDP_DECODER_PROFILE_HEVC_MAIN;
+      break;
+    case VAProfileHEVCMain10:
+      *vdp_profile = VDP_DECODER_PROFILE_HEVC_MAIN_10;
+      break;
+#ifdef HAVE_VDPAU_HIGH_BIT_DEPTH
+    case VAProfileHEVCMain12:
+      *vdp_profile = VDP_DECODER_PROFILE_HEVC_MAIN_12;
+      break;
+#endif
+#ifdef HAVE_VDPAU_VP9
+    case VAProfileVP9Profile0:
+      *vdp_profile = VDP_DECODER_PROFILE_VP9_PROFILE_0;
+      break;
+#endif
+#ifdef HAVE_VDPAU_AV1
+    case VAProfileAV1Profile0:
+      *vdp_profile = VDP_DECODER_PROFILE_AV1_MAIN;
+      break;
+#endif
     default:
       ret = VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
   }
@@ -57,6 +146,62 @@ flu_va_drivers_map_va_profile_to_vdpau_decoder_profile (
   return ret;
 }
 
+const FluVaDriversVdpauCodecOps *
+flu_va_drivers_vdpau_get_codec_ops (VAProfile va_profile)
+{
+  switch (va_profile) {
+    case VAProfileMPEG2Simple:
+    case VAProfileMPEG2Main:
+      return &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_MPEG2;
+    case VAProfileMPEG4Simple:
+    case VAProfileMPEG4AdvancedSimple:
+      return &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_MPEG4;
+    case VAProfileVC1Simple:
+    case VAProfileVC1Main:
+    case VAProfileVC1Advanced:
+      return &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_VC1;
+    case VAProfileH264ConstrainedBaseline:
+    case VAProfileH264Main:
+    case VAProfileH264High:
+      return &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_H264;
+    case VAProfileHEVCMain:
+    case VAProfileHEVCMain10:
+#ifdef HAVE_VDPAU_HIGH_BIT_DEPTH
+    case VAProfileHEVCMain12:
+#endif
+      return &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_HEVC;
+#ifdef HAVE_VDPAU_VP9
+    case VAProfileVP9Profile0:
+      return &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_VP9;
+#endif
+#ifdef HAVE_VDPAU_AV1
+    case VAProfileAV1Profile0:
+      return &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_AV1;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+/* VDPAU has no 4:2:2 nor 4:4:4 decoding through the picture information of
+ * the supported codecs. Higher bit depth profiles may carry 8-bit streams. */
+unsigned int
+flu_va_drivers_vdpau_get_profile_rt_formats (VAProfile va_profile)
+{
+  switch (va_profile) {
+#ifdef HAVE_VDPAU_HIGH_BIT_DEPTH
+    case VAProfileHEVCMain10:
+    case VAProfileAV1Profile0:
+      return VA_RT_FORMAT_YUV420 | VA_RT_FORMAT_YUV420_10;
+    case VAProfileHEVCMain12:
+      return VA_RT_FORMAT_YUV420 | VA_RT_FORMAT_YUV420_10 |
+             VA_RT_FORMAT_YUV420_12;
+#endif
+    default:
+      return VA_RT_FORMAT_YUV420;
+  }
+}
+
 VAStatus
 flu_va_drivers_map_va_rt_format_to_vdp_chroma_type (
     int va_rt_format, VdpChromaType *vdp_chroma_type)
@@ -66,6 +211,19 @@ flu_va_drivers_map_va_rt_format_to_vdp_chroma_type (
     case VA_RT_FORMAT_YUV420:
       *vdp_chroma_type = VDP_CHROMA_TYPE_420;
       break;
+    case VA_RT_FORMAT_YUV422:
+      *vdp_chroma_type = VDP_CHROMA_TYPE_422;
+      break;
+    case VA_RT_FORMAT_YUV444:
+      *vdp_chroma_type = VDP_CHROMA_TYPE_444;
+      break;
+#ifdef HAVE_VDPAU_HIGH_BIT_DEPTH
+    /* 16-bit samples, with the 10 or 12 bits in the most significant ones. */
+    case VA_RT_FORMAT_YUV420_10:
+    case VA_RT_FORMAT_YUV420_12:
+      *vdp_chroma_type = VDP_CHROMA_TYPE_420_16;
+      break;
+#endif
     default:
       ret = VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
   }
@@ -132,99 +290,316 @@ flu_va_drivers_vdpau_is_entrypoint_supported (VAEntrypoint va_entrypoint)
   return va_entrypoint == VAEntrypointVLD;
 }
 
+/* Only clears the per-picture state, the scratch storage is kept at its
+ * high-water capacity until the context is destroyed. The sequence and
+ * picture level fields of vdp_pic_info are kept, see
+ * FluVaDriversVdpauH264ParamCache; the per-picture ones are all set again by
+ * the picture and slice parameters. */
 void
 flu_va_drivers_vdpau_context_object_reset (
     FluVaDriversVdpauContextObject *context_obj)
 {
   context_obj->current_render_target = VA_INVALID_ID;
-  memset (&context_obj->vdp_pic_info, 0, sizeof (context_obj->vdp_pic_info));
-  context_obj->last_slice_param = NULL;
-  if (context_obj->vdp_bs_buf != NULL)
-    free (context_obj->vdp_bs_buf);
-  context_obj->vdp_bs_buf = NULL;
-  context_obj->cap_vdp_bs_buf = 0;
-  context_obj->num_vdp_bs_buf = 0;
+  if (context_obj->codec_ops->begin_picture != NULL)
+    context_obj->codec_ops->begin_picture (context_obj);
+  context_obj->num_slice_params = 0;
+  context_obj->bitstream.size = 0;
+  flu_va_drivers_vdpau_bitstream_release (
+      &context_obj->bitstream, context_obj->decode_queue.buffer_pool);
 }
 
-static void
-flu_va_drivers_vdpau_context_object_free_vdp_bs_buf (
+void
+flu_va_drivers_vdpau_context_object_finalize (
     FluVaDriversVdpauContextObject *context_obj)
 {
-  if (context_obj->vdp_bs_buf == NULL)
-    return;
+  free (context_obj->slice_params);
+  context_obj->slice_params = NULL;
+  context_obj->num_slice_params = 0;
+  context_obj->cap_slice_params = 0;
+  flu_va_drivers_vdpau_bitstream_finalize (&context_obj->bitstream);
+}
+
+VAStatus
+flu_va_drivers_vdpau_context_object_push_slice_params (
+    FluVaDriversVdpauContextObject *context_obj, const void *params,
+    size_t param_size, unsigned int num)
+{
+  size_t size;
+
+  if (context_obj->num_slice_params == 0)
+    context_obj->slice_param_size = param_size;
+  else if (context_obj->slice_param_size != param_size)
+    return VA_STATUS_ERROR_INVALID_BUFFER;
+
+  if (num > SIZE_MAX / param_size - context_obj->num_slice_params)
+    return VA_STATUS_ERROR_ALLOCATION_FAILED;
+  size = (context_obj->num_slice_params + num) * param_size;
+
+  if (size > context_obj->cap_slice_params) {
+    uint8_t *slice_params;
+    size_t cap = context_obj->cap_slice_params ? context_obj->cap_slice_params
+                                               : 4 * param_size;
 
-  free (context_obj->vdp_bs_buf);
-  context_obj->vdp_bs_buf = NULL;
-  context_obj->num_vdp_bs_buf = 0;
-  context_obj->cap_vdp_bs_buf = 0;
+    while (cap < size)
+      cap *= 2;
+
+    slice_params = realloc (context_obj->slice_params, cap);
+    if (slice_params == NULL)
+      return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    context_obj->slice_params = slice_params;
+    context_obj->cap_slice_params = cap;
+  }
+
+  memcpy (context_obj->slice_params +
+              context_obj->num_slice_params * param_size,
+      params, num * param_size);
+  context_obj->num_slice_params += num;
+
+  return VA_STATUS_SUCCESS;
 }
 
-static VAStatus
-flu_va_drivers_vdpau_context_object_alloc_vdp_bs_buf (
-    FluVaDriversVdpauContextObject *context_obj, int prepend_nalu_start_code)
+const VASliceParameterBufferBase *
+flu_va_drivers_vdpau_context_object_get_slice_params (
+    FluVaDriversVdpauContextObject *context_obj, unsigned int i)
 {
-  if (!prepend_nalu_start_code)
-    context_obj->cap_vdp_bs_buf = 1;
-  else
-    context_obj->cap_vdp_bs_buf = 2;
+  const uint8_t *param =
+      context_obj->slice_params + i * context_obj->slice_param_size;
+
+  return (const VASliceParameterBufferBase *) param;
+}
+
+VAStatus
+flu_va_drivers_vdpau_context_object_push_slice_data (
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauBufferObject *buffer_obj,
+    unsigned int *num_extra_h264_slices)
+{
+  size_t data_size = buffer_obj->size * buffer_obj->num_elements;
+  uint64_t bitstream_size = 0;
+  unsigned int i;
+  VAStatus ret;
+
+  // A slice data buffer holds the data of all the slice parameters
+  // rendered since the previous slice data buffer.
+  if (context_obj->num_slice_params == 0)
+    return VA_STATUS_ERROR_UNKNOWN;
 
-  context_obj->num_vdp_bs_buf = 0;
-  context_obj->vdp_bs_buf =
-      malloc (context_obj->cap_vdp_bs_buf * sizeof (VdpBitstreamBuffer));
+  for (i = 0; i < context_obj->num_slice_params; i++) {
+    const VASliceParameterBufferBase *param =
+        flu_va_drivers_vdpau_context_object_get_slice_params (context_obj, i);
 
-  if (context_obj->vdp_bs_buf == NULL)
+    if (param->slice_data_offset > data_size ||
+        param->slice_data_size > data_size - param->slice_data_offset)
+      return VA_STATUS_ERROR_INVALID_BUFFER;
+    bitstream_size += sizeof (NALU_START_CODE) + param->slice_data_size;
+  }
+  if (bitstream_size > UINT32_MAX)
     return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+  // The slices are laid out contiguously with their start codes, so
+  // that the picture reaches VDPAU as a single bitstream buffer.
+  ret = flu_va_drivers_vdpau_bitstream_reserve (
+      &context_obj->bitstream, bitstream_size);
+  if (ret != VA_STATUS_SUCCESS)
+    return ret;
+
+  for (i = 0; i < context_obj->num_slice_params; i++) {
+    const VASliceParameterBufferBase *param =
+        flu_va_drivers_vdpau_context_object_get_slice_params (context_obj, i);
+    uint8_t *buf = (uint8_t *) buffer_obj->data + param->slice_data_offset;
+    unsigned int start_code_size;
+
+    if (num_extra_h264_slices != NULL) {
+      FluVaDriversH264BitstreamInfo info;
+
+      flu_va_drivers_bitstream_inspect_h264 (
+          buf, param->slice_data_size, &info);
+      start_code_size = info.start_code_size;
+      if (info.num_slices > 1)
+        *num_extra_h264_slices += info.num_slices - 1;
+    } else {
+      start_code_size = flu_va_drivers_bitstream_start_code_size (
+          buf, param->slice_data_size);
+    }
+
+    if (start_code_size == 0)
+      flu_va_drivers_vdpau_bitstream_append (&context_obj->bitstream,
+          NALU_START_CODE, sizeof (NALU_START_CODE));
+
+    flu_va_drivers_vdpau_bitstream_append (
+        &context_obj->bitstream, buf, param->slice_data_size);
+  }
+  context_obj->num_slice_params = 0;
+
   return VA_STATUS_SUCCESS;
 }
 
-static VAStatus
-flu_va_drivers_vdpau_context_object_try_realloc_vdp_bs_buf (
-    FluVaDriversVdpauContextObject *context_obj)
+const uint8_t *
+flu_va_drivers_vdpau_context_object_get_slice_data (
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauBufferObject *buffer_obj, unsigned int i)
 {
-  if (context_obj->num_vdp_bs_buf != context_obj->cap_vdp_bs_buf)
-    return VA_STATUS_SUCCESS;
+  const VASliceParameterBufferBase *param =
+        flu_va_drivers_vdpau_context_object_get_slice_params (context_obj, i);
+  size_t data_size = buffer_obj->size * buffer_obj->num_elements;
 
-  context_obj->cap_vdp_bs_buf *= 2;
-  context_obj->vdp_bs_buf = realloc (context_obj->vdp_bs_buf,
-      context_obj->cap_vdp_bs_buf * sizeof (VdpBitstreamBuffer));
+  if (param->slice_data_offset > data_size ||
+      param->slice_data_size > data_size - param->slice_data_offset)
+    return NULL;
 
-  if (context_obj->vdp_bs_buf == NULL)
+  return (const uint8_t *) buffer_obj->data + param->slice_data_offset;
+}
+
+VAStatus
+flu_va_drivers_vdpau_context_object_append_slice (
+    FluVaDriversVdpauContextObject *context_obj, const uint8_t *data,
+    uint32_t size, const uint8_t *start_code, unsigned int start_code_size)
+{
+  VAStatus ret;
+
+  if (flu_va_drivers_bitstream_start_code_size (data, size) != 0)
+    start_code_size = 0;
+  if (size > UINT32_MAX - start_code_size)
     return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+  ret = flu_va_drivers_vdpau_bitstream_reserve (
+      &context_obj->bitstream, start_code_size + size);
+  if (ret != VA_STATUS_SUCCESS)
+    return ret;
+
+  if (start_code_size != 0)
+    flu_va_drivers_vdpau_bitstream_append (
+        &context_obj->bitstream, start_code, start_code_size);
+  flu_va_drivers_vdpau_bitstream_append (&context_obj->bitstream, data, size);
+
   return VA_STATUS_SUCCESS;
 }
 
+static const uint8_t FLU_VA_DRIVERS_ZIGZAG_8X8[64] = {
+  0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40,
+  48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29,
+  22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54,
+  47, 55, 62, 63
+};
+
+void
+flu_va_drivers_vdpau_unzigzag_matrix_8x8 (uint8_t *dst, const uint8_t *src)
+{
+  unsigned int i;
+
+  for (i = 0; i < 64; i++)
+    dst[FLU_VA_DRIVERS_ZIGZAG_8X8[i]] = src[i];
+}
+
+/* A picture without IQ matrix uses the flat scaling lists. */
 static void
-flu_va_drivers_vdpau_context_object_append_vdp_bs_buf (
-    FluVaDriversVdpauContextObject *context_obj, const uint8_t *bs_data,
-    uint32_t num_bytes)
+flu_va_driver_vdpau_end_picture_h264 (
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauDecoderConfig *decoder_config)
+{
+  FluVaDriversVdpauH264ParamCache *cache = &context_obj->param_cache.h264;
+  VdpPictureInfoH264 *vdp_pic_info = &context_obj->vdp_pic_info.h264;
+
+  /* Sized from the DPB size of the SPS. */
+  decoder_config->max_references = vdp_pic_info->num_ref_frames;
+  if (cache->iq_matrix_rendered || cache->has_flat_scaling_lists)
+    return;
+
+  memset (vdp_pic_info->scaling_lists_4x4, 16,
+      sizeof (vdp_pic_info->scaling_lists_4x4));
+  memset (vdp_pic_info->scaling_lists_8x8, 16,
+      sizeof (vdp_pic_info->scaling_lists_8x8));
+  cache->has_iq_matrix = 0;
+  cache->has_flat_scaling_lists = 1;
+}
+
+void
+flu_va_drivers_vdpau_ref_frame_cache_clear (
+    FluVaDriversVdpauRefFrameCache *cache, uint64_t surface_epoch)
+{
+  int i;
+
+  cache->surface_epoch = surface_epoch;
+  for (i = 0; i < FLU_VA_DRIVERS_VDPAU_REF_FRAME_CACHE_SIZE; i++)
+    cache->surfaces[i].surface_id = VA_INVALID_ID;
+  cache->has_ref_frames = 0;
+}
+
+void
+flu_va_drivers_vdpau_ref_frame_cache_sync (
+    FluVaDriversVdpauDriverData *driver_data,
+    FluVaDriversVdpauRefFrameCache *cache)
 {
-  context_obj->vdp_bs_buf[context_obj->num_vdp_bs_buf].struct_version =
-      VDP_BITSTREAM_BUFFER_VERSION;
-  context_obj->vdp_bs_buf[context_obj->num_vdp_bs_buf].bitstream = bs_data;
-  context_obj->vdp_bs_buf[context_obj->num_vdp_bs_buf].bitstream_bytes =
-      num_bytes;
-  context_obj->num_vdp_bs_buf++;
+  uint64_t surface_epoch;
+
+  surface_epoch =
+      __atomic_load_n (&driver_data->surface_epoch, __ATOMIC_ACQUIRE);
+  if (cache->surface_epoch != surface_epoch)
+    flu_va_drivers_vdpau_ref_frame_cache_clear (cache, surface_epoch);
 }
 
 VAStatus
-flu_va_driver_vdpau_translate_ref_frame_h264 (VADriverContextP ctx,
-    VAPictureH264 *va_ref_frame, VdpReferenceFrameH264 *vdp_ref_frame)
+flu_va_drivers_vdpau_ref_frame_cache_lookup_surface (
+    FluVaDriversVdpauDriverData *driver_data,
+    FluVaDriversVdpauRefFrameCache *cache, VASurfaceID surface_id,
+    VdpVideoSurface *vdp_surface)
 {
-  FluVaDriversVdpauDriverData *driver_data =
-      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  FluVaDriversVdpauSurfaceMapEntry *entry;
   FluVaDriversVdpauSurfaceObject *surface_obj;
 
-  if (va_ref_frame->picture_id == VA_INVALID_ID) {
-    vdp_ref_frame->surface = VDP_INVALID_HANDLE;
+  /* The low bits of the ID are the surface heap index. */
+  entry = &cache->surfaces[surface_id &
+                           (FLU_VA_DRIVERS_VDPAU_REF_FRAME_CACHE_SIZE - 1)];
+  if (entry->surface_id == surface_id) {
+    *vdp_surface = entry->vdp_surface;
     return VA_STATUS_SUCCESS;
   }
 
   surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
-      &driver_data->surface_heap, va_ref_frame->picture_id);
+      &driver_data->surface_heap, surface_id);
   if (surface_obj == NULL)
     return VA_STATUS_ERROR_INVALID_SURFACE;
 
-  vdp_ref_frame->surface = surface_obj->vdp_surface;
+  entry->surface_id = surface_id;
+  entry->vdp_surface = surface_obj->vdp_surface;
+  *vdp_surface = surface_obj->vdp_surface;
+  return VA_STATUS_SUCCESS;
+}
+
+VAStatus
+flu_va_drivers_vdpau_ref_frame_cache_lookup_reference (
+    FluVaDriversVdpauDriverData *driver_data,
+    FluVaDriversVdpauRefFrameCache *cache, VASurfaceID surface_id,
+    VdpVideoSurface *vdp_surface)
+{
+  if (surface_id == VA_INVALID_SURFACE) {
+    *vdp_surface = VDP_INVALID_HANDLE;
+    return VA_STATUS_SUCCESS;
+  }
+
+  return flu_va_drivers_vdpau_ref_frame_cache_lookup_surface (
+      driver_data, cache, surface_id, vdp_surface);
+}
+
+VAStatus
+flu_va_driver_vdpau_translate_ref_frame_h264 (
+    FluVaDriversVdpauDriverData *driver_data,
+    FluVaDriversVdpauRefFrameCache *cache, VAPictureH264 *va_ref_frame,
+    VdpReferenceFrameH264 *vdp_ref_frame)
+{
+  VAStatus ret;
+
+  if (va_ref_frame->picture_id == VA_INVALID_ID) {
+    vdp_ref_frame->surface = VDP_INVALID_HANDLE;
+    return VA_STATUS_SUCCESS;
+  }
+
+  ret = flu_va_drivers_vdpau_ref_frame_cache_lookup_surface (driver_data,
+      cache, va_ref_frame->picture_id, &vdp_ref_frame->surface);
+  if (ret != VA_STATUS_SUCCESS)
+    return ret;
+
   vdp_ref_frame->is_long_term =
       (va_ref_frame->flags & VA_PICTURE_H264_LONG_TERM_REFERENCE) != 0;
 
@@ -247,16 +622,61 @@ flu_va_driver_vdpau_translate_ref_frame_h264 (VADriverContextP ctx,
   return VA_STATUS_SUCCESS;
 }
 
+/* The DPB mostly slides by one picture between consecutive frames, so most
+ * entries are either unchanged at their index or only need the surface map. */
+static VAStatus
+flu_va_driver_vdpau_translate_ref_frames_h264 (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj, VAPictureH264 *va_ref_frames,
+    VdpReferenceFrameH264 *vdp_ref_frames)
+{
+  FluVaDriversVdpauDriverData *driver_data =
+      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  FluVaDriversVdpauRefFrameCache *cache = &context_obj->ref_frame_cache;
+  VAStatus ret;
+  int i;
+
+  flu_va_drivers_vdpau_ref_frame_cache_sync (driver_data, cache);
+
+  for (i = 0; i < 16; i++) {
+    if (cache->has_ref_frames &&
+        memcmp (&va_ref_frames[i], &cache->va_ref_frames[i],
+            sizeof (*va_ref_frames)) == 0) {
+      vdp_ref_frames[i] = cache->vdp_ref_frames[i];
+      continue;
+    }
+
+    ret = flu_va_driver_vdpau_translate_ref_frame_h264 (
+        driver_data, cache, &va_ref_frames[i], &vdp_ref_frames[i]);
+    if (ret != VA_STATUS_SUCCESS) {
+      cache->has_ref_frames = 0;
+      return ret;
+    }
+  }
+
+  memcpy (cache->va_ref_frames, va_ref_frames, sizeof (cache->va_ref_frames));
+  memcpy (
+      cache->vdp_ref_frames, vdp_ref_frames, sizeof (cache->vdp_ref_frames));
+  cache->has_ref_frames = 1;
+
+  return VA_STATUS_SUCCESS;
+}
+
+static void
+flu_va_driver_vdpau_begin_picture_h264 (
+    FluVaDriversVdpauContextObject *context_obj)
+{
+  context_obj->vdp_pic_info.h264.slice_count = 0;
+  context_obj->param_cache.h264.iq_matrix_rendered = 0;
+}
+
 #define _MAP_FIELD(FIELD) vdp_pic_info->FIELD = param->FIELD;
-VAStatus
+static VAStatus
 flu_va_driver_vdpau_translate_buffer_h264 (VADriverContextP ctx,
     FluVaDriversVdpauContextObject *context_obj,
     FluVaDriversVdpauBufferObject *buffer_obj)
 {
   VAStatus ret = VA_STATUS_SUCCESS;
-  VdpPictureInfoH264 *vdp_pic_info = &context_obj->vdp_pic_info;
-
-  assert (buffer_obj->num_elements == 1);
+  VdpPictureInfoH264 *vdp_pic_info = &context_obj->vdp_pic_info.h264;
 
   switch (buffer_obj->type) {
     case VAPictureParameterBufferType:
@@ -265,51 +685,75 @@ flu_va_driver_vdpau_translate_buffer_h264 (VADriverContextP ctx,
     {
       VAPictureParameterBufferH264 *param =
           (VAPictureParameterBufferH264 *) buffer_obj->data;
-      int i;
+      FluVaDriversVdpauH264ParamCache *cache = &context_obj->param_cache.h264;
+      int pic_param_changed = 0;
+
+      /* SPS level fields. */
+      if (!cache->has_pic_param ||
+          param->seq_fields.value != cache->pic_param.seq_fields.value ||
+          param->num_ref_frames != cache->pic_param.num_ref_frames) {
+        /* Note: Rec. ITU-T H.264. Section: 6.2: For now only 4:2:0 support. */
+        if (param->seq_fields.bits.chroma_format_idc != 1 ||
+            param->seq_fields.bits.residual_colour_transform_flag != 0) {
+          cache->has_pic_param = 0;
+          ret = VA_STATUS_ERROR_UNKNOWN;
+          break;
+        }
+
+        // _MAP_BITS_FIELD (seq_fields, chroma_format_idc);
+        // _MAP_BITS_FIELD (seq_fields, gaps_in_frame_num_value_allowed_flag);
+        _MAP_BITS_FIELD (seq_fields, frame_mbs_only_flag);
+        _MAP_BITS_FIELD (seq_fields, mb_adaptive_frame_field_flag);
+        _MAP_BITS_FIELD (seq_fields, direct_8x8_inference_flag);
+        // _MAP_BITS_FIELD (seq_fields, MinLumaBiPredSize8x8);
+        _MAP_BITS_FIELD (seq_fields, log2_max_frame_num_minus4);
+        _MAP_BITS_FIELD (seq_fields, pic_order_cnt_type);
+        _MAP_BITS_FIELD (seq_fields, log2_max_pic_order_cnt_lsb_minus4);
+        _MAP_BITS_FIELD (seq_fields, delta_pic_order_always_zero_flag);
+        _MAP_FIELD (num_ref_frames);
+        pic_param_changed = 1;
+      }
 
-      /* Note: Rec. ITU-T H.264. Section: 6.2: For now only 4:2:0 support. */
-      if (param->seq_fields.bits.chroma_format_idc != 1 ||
-          param->seq_fields.bits.residual_colour_transform_flag != 0) {
-        ret = VA_STATUS_ERROR_UNKNOWN;
-        break;
+      /* PPS level fields, along with field_pic_flag and reference_pic_flag
+       * that share pic_fields. */
+      if (pic_param_changed ||
+          param->pic_fields.value != cache->pic_param.pic_fields.value ||
+          param->chroma_qp_index_offset !=
+              cache->pic_param.chroma_qp_index_offset ||
+          param->second_chroma_qp_index_offset !=
+              cache->pic_param.second_chroma_qp_index_offset ||
+          param->pic_init_qp_minus26 != cache->pic_param.pic_init_qp_minus26) {
+        _MAP_BITS_FIELD (pic_fields, entropy_coding_mode_flag);
+        _MAP_BITS_FIELD (pic_fields, weighted_pred_flag);
+        _MAP_BITS_FIELD (pic_fields, weighted_bipred_idc);
+        _MAP_BITS_FIELD (pic_fields, transform_8x8_mode_flag);
+        _MAP_BITS_FIELD (pic_fields, field_pic_flag);
+
+        _MAP_BITS_FIELD (pic_fields, constrained_intra_pred_flag);
+        _MAP_BITS_FIELD (pic_fields, pic_order_present_flag);
+        _MAP_BITS_FIELD (pic_fields, deblocking_filter_control_present_flag);
+        _MAP_BITS_FIELD (pic_fields, redundant_pic_cnt_present_flag);
+        vdp_pic_info->is_reference = param->pic_fields.bits.reference_pic_flag;
+        _MAP_FIELD (chroma_qp_index_offset);
+        _MAP_FIELD (second_chroma_qp_index_offset);
+        _MAP_FIELD (pic_init_qp_minus26);
+        pic_param_changed = 1;
+      }
+
+      if (pic_param_changed) {
+        cache->pic_param = *param;
+        cache->has_pic_param = 1;
       }
 
+      /* Per-picture fields. */
       vdp_pic_info->field_order_cnt[0] = param->CurrPic.TopFieldOrderCnt;
       vdp_pic_info->field_order_cnt[1] = param->CurrPic.TopFieldOrderCnt;
-      // _MAP_BITS_FIELD (seq_fields, chroma_format_idc);
-      // _MAP_BITS_FIELD (seq_fields, gaps_in_frame_num_value_allowed_flag);
-      _MAP_BITS_FIELD (seq_fields, frame_mbs_only_flag);
-      _MAP_BITS_FIELD (seq_fields, mb_adaptive_frame_field_flag);
-      _MAP_BITS_FIELD (seq_fields, direct_8x8_inference_flag);
-      // _MAP_BITS_FIELD (seq_fields, MinLumaBiPredSize8x8);
-      _MAP_BITS_FIELD (seq_fields, log2_max_frame_num_minus4);
-      _MAP_BITS_FIELD (seq_fields, pic_order_cnt_type);
-      _MAP_BITS_FIELD (seq_fields, log2_max_pic_order_cnt_lsb_minus4);
-      _MAP_BITS_FIELD (seq_fields, delta_pic_order_always_zero_flag);
-
-      _MAP_BITS_FIELD (pic_fields, entropy_coding_mode_flag);
-      _MAP_BITS_FIELD (pic_fields, weighted_pred_flag);
-      _MAP_BITS_FIELD (pic_fields, weighted_bipred_idc);
-      _MAP_BITS_FIELD (pic_fields, transform_8x8_mode_flag);
-      _MAP_BITS_FIELD (pic_fields, field_pic_flag);
-
-      _MAP_BITS_FIELD (pic_fields, constrained_intra_pred_flag);
-      _MAP_BITS_FIELD (pic_fields, pic_order_present_flag);
-      _MAP_BITS_FIELD (pic_fields, deblocking_filter_control_present_flag);
-      _MAP_BITS_FIELD (pic_fields, redundant_pic_cnt_present_flag);
-      vdp_pic_info->is_reference = param->pic_fields.bits.reference_pic_flag;
-
       vdp_pic_info->bottom_field_flag =
           param->pic_fields.bits.field_pic_flag &&
           (param->CurrPic.flags & VA_PICTURE_H264_BOTTOM_FIELD) != 0;
-      _MAP_FIELD (num_ref_frames);
-      _MAP_FIELD (chroma_qp_index_offset);
-      _MAP_FIELD (second_chroma_qp_index_offset);
-      _MAP_FIELD (pic_init_qp_minus26);
-
-      for (i = 0; ret == VA_STATUS_SUCCESS && i < 16; i++)
-        ret = flu_va_driver_vdpau_translate_ref_frame_h264 (ctx,
-            &param->ReferenceFrames[i], &vdp_pic_info->referenceFrames[i]);
+
+      ret = flu_va_driver_vdpau_translate_ref_frames_h264 (ctx, context_obj,
+          param->ReferenceFrames, vdp_pic_info->referenceFrames);
       if (ret != VA_STATUS_SUCCESS)
         break;
 
@@ -320,75 +764,46 @@ flu_va_driver_vdpau_translate_buffer_h264 (VADriverContextP ctx,
     case VAIQMatrixBufferType: {
       VAIQMatrixBufferH264 *iq_matrix =
           (VAIQMatrixBufferH264 *) buffer_obj->data;
+      FluVaDriversVdpauH264ParamCache *cache = &context_obj->param_cache.h264;
+
+      cache->iq_matrix_rendered = 1;
+      if (cache->has_iq_matrix &&
+          memcmp (&cache->iq_matrix, iq_matrix, sizeof (*iq_matrix)) == 0)
+        break;
 
       memcpy (vdp_pic_info->scaling_lists_4x4, iq_matrix->ScalingList4x4,
           sizeof (iq_matrix->ScalingList4x4));
       memcpy (vdp_pic_info->scaling_lists_8x8, iq_matrix->ScalingList8x8,
           sizeof (iq_matrix->ScalingList8x8));
+      cache->iq_matrix = *iq_matrix;
+      cache->has_iq_matrix = 1;
+      cache->has_flat_scaling_lists = 0;
       break;
     }
     case VASliceParameterBufferType: {
       VASliceParameterBufferH264 *param =
           (VASliceParameterBufferH264 *) buffer_obj->data;
 
-      if (context_obj->last_buffer_type != VASliceDataBufferType)
-        flu_va_drivers_vdpau_context_object_free_vdp_bs_buf (context_obj);
+      ret = flu_va_drivers_vdpau_context_object_push_slice_params (
+          context_obj, param, sizeof (*param), buffer_obj->num_elements);
+      if (ret != VA_STATUS_SUCCESS)
+        break;
 
       vdp_pic_info->slice_count += buffer_obj->num_elements;
+      param += buffer_obj->num_elements - 1;
       _MAP_FIELD (num_ref_idx_l0_active_minus1);
       _MAP_FIELD (num_ref_idx_l1_active_minus1);
-      context_obj->last_slice_param = param;
       break;
     }
     case VASliceDataBufferType: {
-      uint8_t *buf;
-      int prepend_nalu_start_code = 0;
-
-      // TODO: vaEndPicture or vaRenderPicture vfunc should ensure to set
-      // vdp_bs_buf back to NULL and num_vdp_bs_buf to 0, so the next sequence
-      // of calls to vaBeginPicture, vaRenderPicture, vaEndPicture will have an
-      // empty vdp_bs_buf.
-
-      assert (
-          (context_obj->vdp_bs_buf != NULL &&
-              context_obj->num_vdp_bs_buf > 0 &&
-              context_obj->num_vdp_bs_buf <= context_obj->cap_vdp_bs_buf) ||
-          (context_obj->vdp_bs_buf == NULL &&
-              context_obj->num_vdp_bs_buf == 0 &&
-              context_obj->cap_vdp_bs_buf == 0));
-      // This driver supports only if a VASliceDataBufferType buffer follows a
-      // a VASliceParameterBufferType buffer. Also, this driver supports only
-      // one buffer of this type between vaBeginPicture and vaEndPicture
-      // lifetime as it seems to be the most common.
-      if (context_obj->last_slice_param == NULL ||
-          context_obj->last_buffer_type != VASliceParameterBufferType) {
-        ret = VA_STATUS_ERROR_UNKNOWN;
-        break;
-      }
-
-      buf =
-          buffer_obj->data + context_obj->last_slice_param->slice_data_offset;
-      prepend_nalu_start_code =
-          memcmp (buf, NALU_START_CODE, sizeof (NALU_START_CODE)) != 0 &&
-          memcmp (buf, NALU_START_CODE_4, sizeof (NALU_START_CODE_4)) != 0;
-
-      if (context_obj->vdp_bs_buf == NULL) {
-        ret = flu_va_drivers_vdpau_context_object_alloc_vdp_bs_buf (
-            context_obj, prepend_nalu_start_code);
-        if (ret != VA_STATUS_SUCCESS)
-          break;
-      }
-      if ((ret = flu_va_drivers_vdpau_context_object_try_realloc_vdp_bs_buf (
-               context_obj)) != VA_STATUS_SUCCESS)
-        break;
-
-      if (prepend_nalu_start_code)
-        flu_va_drivers_vdpau_context_object_append_vdp_bs_buf (
-            context_obj, NALU_START_CODE, sizeof (NALU_START_CODE));
-
-      flu_va_drivers_vdpau_context_object_append_vdp_bs_buf (
-          context_obj, buf, context_obj->last_slice_param->slice_data_size);
-
+      unsigned int num_extra_slices = 0;
+
+      // Some clients describe several concatenated slices with a single
+      // slice parameter.
+      ret = flu_va_drivers_vdpau_context_object_push_slice_data (
+          context_obj, buffer_obj, &num_extra_slices);
+      if (ret == VA_STATUS_SUCCESS)
+        vdp_pic_info->slice_count += num_extra_slices;
       break;
     }
     default:
@@ -401,8 +816,8 @@ flu_va_driver_vdpau_translate_buffer_h264 (VADriverContextP ctx,
 }
 #undef _MAP_FIELD
 
-int
-flu_va_driver_vdpau_is_buffer_type_supported (VABufferType buffer_type)
+static int
+flu_va_driver_vdpau_is_buffer_type_supported_h264 (VABufferType buffer_type)
 {
   switch (buffer_type) {
     case VAPictureParameterBufferType:
@@ -413,4 +828,14 @@ flu_va_driver_vdpau_is_buffer_type_supported (VABufferType buffer_type)
     default:
       return 0;
   }
-}
\ No newline at end of file
+}
+
+const FluVaDriversVdpauCodecOps FLU_VA_DRIVERS_VDPAU_CODEC_OPS_H264 = {
+  .vdp_pic_info_size = sizeof (VdpPictureInfoH264),
+  .default_max_references = 4,
+  .is_buffer_type_supported =
+      flu_va_driver_vdpau_is_buffer_type_supported_h264,
+  .begin_picture = flu_va_driver_vdpau_begin_picture_h264,
+  .translate_buffer = flu_va_driver_vdpau_translate_buffer_h264,
+  .end_picture = flu_va_driver_vdpau_end_picture_h264,
+};
\ No newline at end of file
@@ -32,6 +32,8 @@ struct _FluVaDriversVdpauImageFormatMapItem
 {
   FluVaDriversVdpauImageFormatType type;
   uint32_t vdp_image_format;
+  /* Chroma type of the surfaces the format is got from and put to. */
+  VdpChromaType vdp_chroma_type;
   VAImageFormat va_image_format;
 };
 
@@ -42,9 +44,20 @@ typedef const FluVaDriversVdpauImageFormatMapItem
 
 extern FluVaDriversVdpauImageFormatMap FLU_VA_DRIVERS_VDPAU_IMAGE_FORMAT_MAP;
 
+/* Returns NULL if the fourcc is not in the image format map. */
+const FluVaDriversVdpauImageFormatMapItem *
+flu_va_drivers_vdpau_lookup_image_format (uint32_t fourcc);
+
 VAStatus flu_va_drivers_map_va_profile_to_vdpau_decoder_profile (
     VAProfile va_profile, VdpDecoderProfile *vdp_profile);
 
+/* Codec translating the buffers of a profile, or NULL if unsupported. */
+const FluVaDriversVdpauCodecOps *flu_va_drivers_vdpau_get_codec_ops (
+    VAProfile va_profile);
+
+/* VA_RT_FORMAT_* a profile decodes to, regardless of the device. */
+unsigned int flu_va_drivers_vdpau_get_profile_rt_formats (VAProfile va_profile);
+
 VAStatus flu_va_drivers_map_va_rt_format_to_vdp_chroma_type (
     int va_rt_format, VdpChromaType *vdp_chroma_type);
 
@@ -65,13 +78,68 @@ VAConfigAttrib *flu_va_drivers_vdpau_lookup_config_attrib_type (
     VAConfigAttrib *attrib_list, int num_attribs,
     VAConfigAttribType attrib_type);
 
-VAStatus flu_va_driver_vdpau_translate_buffer_h264 (VADriverContextP ctx,
-    FluVaDriversVdpauContextObject *context_obj,
-    FluVaDriversVdpauBufferObject *buffer_obj);
+extern const FluVaDriversVdpauCodecOps FLU_VA_DRIVERS_VDPAU_CODEC_OPS_H264;
+
+void flu_va_drivers_vdpau_ref_frame_cache_clear (
+    FluVaDriversVdpauRefFrameCache *cache, uint64_t surface_epoch);
+
+/* Clears the cache if a surface was destroyed since it was filled. */
+void flu_va_drivers_vdpau_ref_frame_cache_sync (
+    FluVaDriversVdpauDriverData *driver_data,
+    FluVaDriversVdpauRefFrameCache *cache);
+
+VAStatus flu_va_drivers_vdpau_ref_frame_cache_lookup_surface (
+    FluVaDriversVdpauDriverData *driver_data,
+    FluVaDriversVdpauRefFrameCache *cache, VASurfaceID surface_id,
+    VdpVideoSurface *vdp_surface);
+
+/* As flu_va_drivers_vdpau_ref_frame_cache_lookup_surface, for a reference
+ * that may be missing, which maps VA_INVALID_SURFACE to VDP_INVALID_HANDLE. */
+VAStatus flu_va_drivers_vdpau_ref_frame_cache_lookup_reference (
+    FluVaDriversVdpauDriverData *driver_data,
+    FluVaDriversVdpauRefFrameCache *cache, VASurfaceID surface_id,
+    VdpVideoSurface *vdp_surface);
 
 void flu_va_drivers_vdpau_context_object_reset (
     FluVaDriversVdpauContextObject *context_obj);
 
-int flu_va_driver_vdpau_is_buffer_type_supported (VABufferType buffer_type);
+void flu_va_drivers_vdpau_context_object_finalize (
+    FluVaDriversVdpauContextObject *context_obj);
+
+/* Queues a copy of num slice parameters of param_size bytes each, until
+ * their slice data buffer is rendered. */
+VAStatus flu_va_drivers_vdpau_context_object_push_slice_params (
+    FluVaDriversVdpauContextObject *context_obj, const void *params,
+    size_t param_size, unsigned int num);
+
+/* Copy of the i-th queued slice parameter. */
+const VASliceParameterBufferBase *
+flu_va_drivers_vdpau_context_object_get_slice_params (
+    FluVaDriversVdpauContextObject *context_obj, unsigned int i);
+
+/* Appends the data of the queued slice parameters to the picture bitstream,
+ * adding the missing start codes. If num_extra_h264_slices is not NULL, the
+ * data is inspected as H.264 and the slices found beyond one per slice
+ * parameter are added to it. */
+VAStatus flu_va_drivers_vdpau_context_object_push_slice_data (
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauBufferObject *buffer_obj,
+    unsigned int *num_extra_h264_slices);
+
+/* Data of the i-th queued slice parameter within its slice data buffer, or
+ * NULL if it lies out of the buffer. */
+const uint8_t *flu_va_drivers_vdpau_context_object_get_slice_data (
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauBufferObject *buffer_obj, unsigned int i);
+
+/* Appends a slice to the picture bitstream, after start_code unless the data
+ * already begins with a start code prefix. */
+VAStatus flu_va_drivers_vdpau_context_object_append_slice (
+    FluVaDriversVdpauContextObject *context_obj, const uint8_t *data,
+    uint32_t size, const uint8_t *start_code, unsigned int start_code_size);
+
+/* Converts an 8x8 matrix from zigzag scan to raster order. */
+void flu_va_drivers_vdpau_unzigzag_matrix_8x8 (
+    uint8_t *dst, const uint8_t *src);
 
 #endif /* __FLU_VA_DRIVERS_VDPAU_UTILS_H__ */
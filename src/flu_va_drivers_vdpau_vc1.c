@@ -0,0 +1,251 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "flu_va_drivers_vdpau_vc1.h"
+#include "flu_va_drivers_vdpau_utils.h"
+
+#define FLU_VA_DRIVERS_VC1_PROFILE_ADVANCED 3
+
+#define FLU_VA_DRIVERS_VC1_P_PICTURE 1
+#define FLU_VA_DRIVERS_VC1_B_PICTURE 2
+#define FLU_VA_DRIVERS_VC1_BI_PICTURE 3
+#define FLU_VA_DRIVERS_VC1_SKIPPED_PICTURE 4
+
+/* Note: SMPTE 421M. Annex E. */
+#define FLU_VA_DRIVERS_VC1_SLICE_START_CODE 0x0b
+#define FLU_VA_DRIVERS_VC1_FIELD_START_CODE 0x0c
+#define FLU_VA_DRIVERS_VC1_FRAME_START_CODE 0x0d
+
+/* VDPAU numbers the picture types as I, P, reserved, B and BI. A skipped
+ * picture is a P picture without macroblock layer. */
+static uint8_t
+flu_va_driver_vdpau_translate_picture_type_vc1 (uint32_t picture_type)
+{
+  switch (picture_type) {
+    case FLU_VA_DRIVERS_VC1_P_PICTURE:
+    case FLU_VA_DRIVERS_VC1_SKIPPED_PICTURE:
+      return 1;
+    case FLU_VA_DRIVERS_VC1_B_PICTURE:
+      return 3;
+    case FLU_VA_DRIVERS_VC1_BI_PICTURE:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+#define _MAP_SEQUENCE_FIELD(FIELD)                                            \
+  vdp_pic_info->FIELD = param->sequence_fields.bits.FIELD
+#define _MAP_ENTRYPOINT_FIELD(FIELD)                                          \
+  vdp_pic_info->FIELD = param->entrypoint_fields.bits.FIELD
+static VAStatus
+flu_va_driver_vdpau_translate_pic_param_vc1 (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj,
+    const VAPictureParameterBufferVC1 *param)
+{
+  FluVaDriversVdpauDriverData *driver_data =
+      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  FluVaDriversVdpauRefFrameCache *cache = &context_obj->ref_frame_cache;
+  VdpPictureInfoVC1 *vdp_pic_info = &context_obj->vdp_pic_info.vc1;
+  uint32_t picture_type = param->picture_fields.bits.picture_type;
+  uint32_t frame_coding_mode = param->picture_fields.bits.frame_coding_mode;
+  VAStatus ret = VA_STATUS_SUCCESS;
+
+  context_obj->param_cache.vc1.is_advanced =
+      param->sequence_fields.bits.profile ==
+      FLU_VA_DRIVERS_VC1_PROFILE_ADVANCED;
+  context_obj->param_cache.vc1.is_first_field =
+      param->picture_fields.bits.is_first_field;
+
+  vdp_pic_info->picture_type =
+      flu_va_driver_vdpau_translate_picture_type_vc1 (picture_type);
+  /* VDPAU keeps 1 for the reserved FCM code. */
+  vdp_pic_info->frame_coding_mode =
+      frame_coding_mode ? frame_coding_mode + 1 : 0;
+  vdp_pic_info->postprocflag = param->post_processing != 0;
+  vdp_pic_info->deblockEnable = param->post_processing & 1;
+  _MAP_SEQUENCE_FIELD (pulldown);
+  _MAP_SEQUENCE_FIELD (interlace);
+  _MAP_SEQUENCE_FIELD (tfcntrflag);
+  _MAP_SEQUENCE_FIELD (finterpflag);
+  _MAP_SEQUENCE_FIELD (psf);
+  _MAP_SEQUENCE_FIELD (multires);
+  _MAP_SEQUENCE_FIELD (overlap);
+  _MAP_SEQUENCE_FIELD (syncmarker);
+  /* Bit 1 tells whether the current frame is range reduced. */
+  vdp_pic_info->rangered = param->sequence_fields.bits.rangered |
+                           (param->range_reduction_frame << 1);
+  vdp_pic_info->maxbframes = param->sequence_fields.bits.max_b_frames;
+  _MAP_ENTRYPOINT_FIELD (panscan_flag);
+  _MAP_ENTRYPOINT_FIELD (loopfilter);
+  vdp_pic_info->refdist_flag =
+      param->reference_fields.bits.reference_distance_flag;
+  vdp_pic_info->dquant = param->pic_quantizer_fields.bits.dquant;
+  vdp_pic_info->quantizer = param->pic_quantizer_fields.bits.quantizer;
+  vdp_pic_info->pquant = param->pic_quantizer_fields.bits.pic_quantizer_scale;
+  vdp_pic_info->extended_mv = param->mv_fields.bits.extended_mv_flag;
+  vdp_pic_info->extended_dmv = param->mv_fields.bits.extended_dmv_flag;
+  vdp_pic_info->vstransform =
+      param->transform_fields.bits.variable_sized_transform_flag;
+  vdp_pic_info->fastuvmc = param->fast_uvmc_flag;
+  vdp_pic_info->range_mapy_flag = param->range_mapping_fields.bits.luma_flag;
+  vdp_pic_info->range_mapy = param->range_mapping_fields.bits.luma;
+  vdp_pic_info->range_mapuv_flag =
+      param->range_mapping_fields.bits.chroma_flag;
+  vdp_pic_info->range_mapuv = param->range_mapping_fields.bits.chroma;
+
+  vdp_pic_info->forward_reference = VDP_INVALID_HANDLE;
+  vdp_pic_info->backward_reference = VDP_INVALID_HANDLE;
+  if (picture_type != FLU_VA_DRIVERS_VC1_P_PICTURE &&
+      picture_type != FLU_VA_DRIVERS_VC1_SKIPPED_PICTURE &&
+      picture_type != FLU_VA_DRIVERS_VC1_B_PICTURE)
+    return VA_STATUS_SUCCESS;
+
+  flu_va_drivers_vdpau_ref_frame_cache_sync (driver_data, cache);
+  ret = flu_va_drivers_vdpau_ref_frame_cache_lookup_reference (driver_data,
+      cache, param->forward_reference_picture,
+      &vdp_pic_info->forward_reference);
+  if (ret == VA_STATUS_SUCCESS && picture_type == FLU_VA_DRIVERS_VC1_B_PICTURE)
+    ret = flu_va_drivers_vdpau_ref_frame_cache_lookup_reference (driver_data,
+        cache, param->backward_reference_picture,
+        &vdp_pic_info->backward_reference);
+
+  return ret;
+}
+#undef _MAP_ENTRYPOINT_FIELD
+#undef _MAP_SEQUENCE_FIELD
+
+/* VDPAU parses the Advanced profile bitstream from its start codes, which VA
+ * clients strip from the slice data: the picture starts with a frame or
+ * second field start code and the next slices with a slice start code. The
+ * Simple and Main profile frames have no start code. */
+static VAStatus
+flu_va_driver_vdpau_push_slice_data_vc1 (
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauBufferObject *buffer_obj)
+{
+  FluVaDriversVdpauVC1ParamCache *vc1_cache = &context_obj->param_cache.vc1;
+  VdpPictureInfoVC1 *vdp_pic_info = &context_obj->vdp_pic_info.vc1;
+  unsigned int i;
+  VAStatus ret;
+
+  if (context_obj->num_slice_params == 0)
+    return VA_STATUS_ERROR_UNKNOWN;
+
+  for (i = 0; i < context_obj->num_slice_params; i++) {
+    const VASliceParameterBufferBase *param =
+        flu_va_drivers_vdpau_context_object_get_slice_params (context_obj, i);
+    const uint8_t *data;
+    uint8_t start_code[4] = { 0x00, 0x00, 0x01,
+      FLU_VA_DRIVERS_VC1_SLICE_START_CODE };
+
+    data = flu_va_drivers_vdpau_context_object_get_slice_data (
+        context_obj, buffer_obj, i);
+    if (data == NULL)
+      return VA_STATUS_ERROR_INVALID_BUFFER;
+
+    if (context_obj->bitstream.size == 0)
+      start_code[3] = vc1_cache->is_first_field
+                          ? FLU_VA_DRIVERS_VC1_FRAME_START_CODE
+                          : FLU_VA_DRIVERS_VC1_FIELD_START_CODE;
+    ret = flu_va_drivers_vdpau_context_object_append_slice (context_obj, data,
+        param->slice_data_size, start_code,
+        vc1_cache->is_advanced ? sizeof (start_code) : 0);
+    if (ret != VA_STATUS_SUCCESS)
+      return ret;
+  }
+  vdp_pic_info->slice_count += context_obj->num_slice_params;
+  context_obj->num_slice_params = 0;
+
+  return VA_STATUS_SUCCESS;
+}
+
+static int
+flu_va_driver_vdpau_is_buffer_type_supported_vc1 (VABufferType buffer_type)
+{
+  switch (buffer_type) {
+    case VAPictureParameterBufferType:
+    case VABitPlaneBufferType:
+    case VASliceParameterBufferType:
+    case VASliceDataBufferType:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static void
+flu_va_driver_vdpau_begin_picture_vc1 (
+    FluVaDriversVdpauContextObject *context_obj)
+{
+  context_obj->vdp_pic_info.vc1.slice_count = 0;
+}
+
+static VAStatus
+flu_va_driver_vdpau_translate_buffer_vc1 (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauBufferObject *buffer_obj)
+{
+  VAStatus ret = VA_STATUS_SUCCESS;
+
+  switch (buffer_obj->type) {
+    case VAPictureParameterBufferType:
+      ret = flu_va_driver_vdpau_translate_pic_param_vc1 (ctx, context_obj,
+          (VAPictureParameterBufferVC1 *) buffer_obj->data);
+      break;
+    /* VDPAU decodes the bitplanes from the bitstream. */
+    case VABitPlaneBufferType:
+      break;
+    case VASliceParameterBufferType:
+      ret = flu_va_drivers_vdpau_context_object_push_slice_params (context_obj,
+          buffer_obj->data, sizeof (VASliceParameterBufferVC1),
+          buffer_obj->num_elements);
+      break;
+    case VASliceDataBufferType:
+      ret = flu_va_driver_vdpau_push_slice_data_vc1 (context_obj, buffer_obj);
+      break;
+    default:
+      ret = VA_STATUS_ERROR_UNSUPPORTED_BUFFERTYPE;
+      break;
+  }
+
+  context_obj->last_buffer_type = buffer_obj->type;
+  return ret;
+}
+
+static void
+flu_va_driver_vdpau_end_picture_vc1 (
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauDecoderConfig *decoder_config)
+{
+  decoder_config->max_references = 2;
+}
+
+const FluVaDriversVdpauCodecOps FLU_VA_DRIVERS_VDPAU_CODEC_OPS_VC1 = {
+  .vdp_pic_info_size = sizeof (VdpPictureInfoVC1),
+  .default_max_references = 2,
+  .is_buffer_type_supported = flu_va_driver_vdpau_is_buffer_type_supported_vc1,
+  .begin_picture = flu_va_driver_vdpau_begin_picture_vc1,
+  .translate_buffer = flu_va_driver_vdpau_translate_buffer_vc1,
+  .end_picture = flu_va_driver_vdpau_end_picture_vc1,
+};
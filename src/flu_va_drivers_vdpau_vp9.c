@@ -0,0 +1,523 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "flu_va_drivers_vdpau_vp9.h"
+#include "flu_va_drivers_vdpau_utils.h"
+#include "flu_va_drivers_bitstream.h"
+
+#ifdef HAVE_VDPAU_VP9
+
+#define FLU_VA_DRIVERS_VP9_FRAME_MARKER 2
+#define FLU_VA_DRIVERS_VP9_SYNC_CODE 0x498342
+#define FLU_VA_DRIVERS_VP9_KEY_FRAME 0
+#define FLU_VA_DRIVERS_VP9_CS_BT_601 1
+#define FLU_VA_DRIVERS_VP9_CS_RGB 7
+#define FLU_VA_DRIVERS_VP9_MAX_SEGMENTS 8
+#define FLU_VA_DRIVERS_VP9_SEG_LVL_MAX 4
+
+static const uint8_t FLU_VA_DRIVERS_VP9_SEGMENTATION_FEATURE_BITS[] = {
+  8, 6, 2, 0
+};
+static const uint8_t FLU_VA_DRIVERS_VP9_SEGMENTATION_FEATURE_SIGNED[] = {
+  1, 1, 0, 0
+};
+
+/* su(n) */
+static int32_t
+flu_va_drivers_vp9_read_signed (
+    FluVaDriversBitReader *reader, unsigned int num_bits)
+{
+  int32_t value = flu_va_drivers_bit_reader_read (reader, num_bits);
+
+  return flu_va_drivers_bit_reader_read (reader, 1) ? -value : value;
+}
+
+/* Frame type bits of an uncompressed header, returns 0 for a frame that only
+ * shows an existing one. */
+static int
+flu_va_driver_vdpau_peek_frame_vp9 (
+    const uint8_t *data, size_t size, int *frame_type, int *show_frame)
+{
+  FluVaDriversBitReader reader;
+  unsigned int profile;
+
+  flu_va_drivers_bit_reader_init_raw (&reader, data, size);
+  if (flu_va_drivers_bit_reader_read (&reader, 2) !=
+      FLU_VA_DRIVERS_VP9_FRAME_MARKER)
+    return 0;
+  profile = flu_va_drivers_bit_reader_read (&reader, 1);
+  profile |= flu_va_drivers_bit_reader_read (&reader, 1) << 1;
+  if (profile == 3)
+    flu_va_drivers_bit_reader_read (&reader, 1);
+  if (flu_va_drivers_bit_reader_read (&reader, 1))
+    return 0;
+  *frame_type = flu_va_drivers_bit_reader_read (&reader, 1);
+  *show_frame = flu_va_drivers_bit_reader_read (&reader, 1);
+
+  return !reader.overflow;
+}
+
+/* VDPAU takes a single frame, while the client may hand a whole superframe,
+ * typically a hidden alternate reference followed by a frame that only shows
+ * an existing one. The only frame that is decoded is kept, as long as it
+ * matches the type and visibility of the picture parameters. Other
+ * superframes cannot be decoded as one picture without dropping frames, so
+ * they are rejected: clients must split them and submit each decoded frame as
+ * a picture of its own, as FFmpeg and GStreamer do. Note: VP9 Bitstream
+ * Specification. Annex B. */
+static VAStatus
+flu_va_driver_vdpau_select_frame_vp9 (const VdpPictureInfoVP9 *vdp_pic_info,
+    const uint8_t *data, size_t size, size_t *frame_offset,
+    size_t *frame_size)
+{
+  const uint8_t *index;
+  unsigned int num_frames, num_decoded = 0, mag, index_size, i, j;
+  size_t offset = 0;
+  uint8_t marker;
+
+  *frame_offset = 0;
+  *frame_size = size;
+
+  if (size == 0)
+    return VA_STATUS_SUCCESS;
+  marker = data[size - 1];
+  if ((marker & 0xe0) != 0xc0)
+    return VA_STATUS_SUCCESS;
+  num_frames = (marker & 0x7) + 1;
+  mag = ((marker >> 3) & 0x3) + 1;
+  index_size = 2 + mag * num_frames;
+  if (size < index_size || data[size - index_size] != marker)
+    return VA_STATUS_SUCCESS;
+
+  size -= index_size;
+  index = data + size + 1;
+  for (i = 0; i < num_frames; i++) {
+    size_t this_size = 0;
+    int frame_type, show_frame;
+
+    for (j = 0; j < mag; j++)
+      this_size |= (size_t) index[i * mag + j] << (8 * j);
+    if (this_size == 0 || this_size > size - offset)
+      return VA_STATUS_ERROR_INVALID_BUFFER;
+
+    if (flu_va_driver_vdpau_peek_frame_vp9 (
+            data + offset, this_size, &frame_type, &show_frame)) {
+      if ((frame_type == FLU_VA_DRIVERS_VP9_KEY_FRAME) !=
+              vdp_pic_info->keyFrame ||
+          show_frame != vdp_pic_info->showFrame || ++num_decoded > 1)
+        return VA_STATUS_ERROR_INVALID_BUFFER;
+      *frame_offset = offset;
+      *frame_size = this_size;
+    }
+    offset += this_size;
+  }
+
+  return num_decoded == 1 ? VA_STATUS_SUCCESS
+                          : VA_STATUS_ERROR_INVALID_BUFFER;
+}
+
+/* Resets the state carried across frames, see setup_past_independence () in
+ * the spec. */
+static void
+flu_va_driver_vdpau_reset_frame_state_vp9 (VdpPictureInfoVP9 *vdp_pic_info)
+{
+  memset (vdp_pic_info->segmentFeatureEnable, 0,
+      sizeof (vdp_pic_info->segmentFeatureEnable));
+  memset (vdp_pic_info->segmentFeatureData, 0,
+      sizeof (vdp_pic_info->segmentFeatureData));
+  vdp_pic_info->segmentFeatureMode = 0;
+  vdp_pic_info->mbRefLfDelta[0] = 1;
+  vdp_pic_info->mbRefLfDelta[1] = 0;
+  vdp_pic_info->mbRefLfDelta[2] = (uint32_t) -1;
+  vdp_pic_info->mbRefLfDelta[3] = (uint32_t) -1;
+  vdp_pic_info->mbModeLfDelta[0] = 0;
+  vdp_pic_info->mbModeLfDelta[1] = 0;
+}
+
+static void
+flu_va_driver_vdpau_parse_color_config_vp9 (VdpPictureInfoVP9 *vdp_pic_info,
+    FluVaDriversBitReader *reader, unsigned int profile)
+{
+  if (profile >= 2)
+    flu_va_drivers_bit_reader_read (reader, 1); /* ten_or_twelve_bit */
+  vdp_pic_info->colorSpace = flu_va_drivers_bit_reader_read (reader, 3);
+  if (vdp_pic_info->colorSpace != FLU_VA_DRIVERS_VP9_CS_RGB) {
+    flu_va_drivers_bit_reader_read (reader, 1); /* color_range */
+    if (profile == 1 || profile == 3)
+      flu_va_drivers_bit_reader_skip (reader, 3);
+  } else if (profile == 1 || profile == 3) {
+    flu_va_drivers_bit_reader_read (reader, 1);
+  }
+}
+
+/* frame_size () and render_size () */
+static void
+flu_va_driver_vdpau_skip_frame_size_vp9 (
+    FluVaDriversBitReader *reader, int has_frame_size)
+{
+  if (has_frame_size)
+    flu_va_drivers_bit_reader_skip (reader, 32);
+  if (flu_va_drivers_bit_reader_read (reader, 1))
+    flu_va_drivers_bit_reader_skip (reader, 32);
+}
+
+/* VA carries the per-segment results rather than the syntax elements, so the
+ * loop filter deltas, quantizer and segmentation features are read from the
+ * uncompressed header. They persist from frame to frame in vdp_pic_info until
+ * updated or reset. Note: VP9 Bitstream Specification. Section: 6.2. */
+static VAStatus
+flu_va_driver_vdpau_parse_frame_header_vp9 (
+    VdpPictureInfoVP9 *vdp_pic_info, const uint8_t *data, size_t size)
+{
+  FluVaDriversBitReader reader;
+  unsigned int profile, frame_type, show_frame, error_resilient_mode;
+  unsigned int intra_only = 0;
+  unsigned int i, j;
+
+  flu_va_drivers_bit_reader_init_raw (&reader, data, size);
+  if (flu_va_drivers_bit_reader_read (&reader, 2) !=
+      FLU_VA_DRIVERS_VP9_FRAME_MARKER)
+    return VA_STATUS_ERROR_INVALID_BUFFER;
+  profile = flu_va_drivers_bit_reader_read (&reader, 1);
+  profile |= flu_va_drivers_bit_reader_read (&reader, 1) << 1;
+  if (profile == 3)
+    flu_va_drivers_bit_reader_read (&reader, 1);
+  /* show_existing_frame */
+  if (flu_va_drivers_bit_reader_read (&reader, 1))
+    return VA_STATUS_ERROR_INVALID_BUFFER;
+
+  frame_type = flu_va_drivers_bit_reader_read (&reader, 1);
+  show_frame = flu_va_drivers_bit_reader_read (&reader, 1);
+  error_resilient_mode = flu_va_drivers_bit_reader_read (&reader, 1);
+
+  if (frame_type == FLU_VA_DRIVERS_VP9_KEY_FRAME) {
+    if (flu_va_drivers_bit_reader_read (&reader, 24) !=
+        FLU_VA_DRIVERS_VP9_SYNC_CODE)
+      return VA_STATUS_ERROR_INVALID_BUFFER;
+    flu_va_driver_vdpau_parse_color_config_vp9 (vdp_pic_info, &reader, profile);
+    flu_va_driver_vdpau_skip_frame_size_vp9 (&reader, 1);
+  } else {
+    if (!show_frame)
+      intra_only = flu_va_drivers_bit_reader_read (&reader, 1);
+    if (!error_resilient_mode)
+      flu_va_drivers_bit_reader_read (&reader, 2); /* reset_frame_context */
+    if (intra_only) {
+      if (flu_va_drivers_bit_reader_read (&reader, 24) !=
+          FLU_VA_DRIVERS_VP9_SYNC_CODE)
+        return VA_STATUS_ERROR_INVALID_BUFFER;
+      if (profile > 0)
+        flu_va_driver_vdpau_parse_color_config_vp9 (
+            vdp_pic_info, &reader, profile);
+      else
+        vdp_pic_info->colorSpace = FLU_VA_DRIVERS_VP9_CS_BT_601;
+      flu_va_drivers_bit_reader_read (&reader, 8); /* refresh_frame_flags */
+      flu_va_driver_vdpau_skip_frame_size_vp9 (&reader, 1);
+    } else {
+      int found_ref = 0;
+
+      /* refresh_frame_flags, then ref_frame_idx and ref_frame_sign_bias. */
+      flu_va_drivers_bit_reader_skip (&reader, 8 + 3 * 4);
+      /* frame_size_with_refs () */
+      for (i = 0; i < 3 && !found_ref; i++)
+        found_ref = flu_va_drivers_bit_reader_read (&reader, 1);
+      flu_va_driver_vdpau_skip_frame_size_vp9 (&reader, !found_ref);
+      flu_va_drivers_bit_reader_read (&reader, 1); /* allow_high_precision_mv */
+      /* read_interpolation_filter () */
+      if (!flu_va_drivers_bit_reader_read (&reader, 1))
+        flu_va_drivers_bit_reader_read (&reader, 2);
+    }
+  }
+
+  /* refresh_frame_context, frame_parallel_decoding_mode */
+  if (!error_resilient_mode)
+    flu_va_drivers_bit_reader_skip (&reader, 2);
+  flu_va_drivers_bit_reader_read (&reader, 2); /* frame_context_idx */
+
+  if (frame_type == FLU_VA_DRIVERS_VP9_KEY_FRAME || intra_only ||
+      error_resilient_mode)
+    flu_va_driver_vdpau_reset_frame_state_vp9 (vdp_pic_info);
+
+  /* loop_filter_params () */
+  flu_va_drivers_bit_reader_skip (&reader, 6 + 3);
+  vdp_pic_info->modeRefLfEnabled = flu_va_drivers_bit_reader_read (&reader, 1);
+  if (vdp_pic_info->modeRefLfEnabled &&
+      flu_va_drivers_bit_reader_read (&reader, 1)) {
+    for (i = 0; i < 4; i++) {
+      if (flu_va_drivers_bit_reader_read (&reader, 1))
+        vdp_pic_info->mbRefLfDelta[i] =
+            flu_va_drivers_vp9_read_signed (&reader, 6);
+    }
+    for (i = 0; i < 2; i++) {
+      if (flu_va_drivers_bit_reader_read (&reader, 1))
+        vdp_pic_info->mbModeLfDelta[i] =
+            flu_va_drivers_vp9_read_signed (&reader, 6);
+    }
+  }
+
+  /* quantization_params () */
+  vdp_pic_info->qpYAc = flu_va_drivers_bit_reader_read (&reader, 8);
+  vdp_pic_info->qpYDc = flu_va_drivers_bit_reader_read (&reader, 1)
+                            ? flu_va_drivers_vp9_read_signed (&reader, 4)
+                            : 0;
+  vdp_pic_info->qpChDc = flu_va_drivers_bit_reader_read (&reader, 1)
+                             ? flu_va_drivers_vp9_read_signed (&reader, 4)
+                             : 0;
+  vdp_pic_info->qpChAc = flu_va_drivers_bit_reader_read (&reader, 1)
+                             ? flu_va_drivers_vp9_read_signed (&reader, 4)
+                             : 0;
+
+  /* segmentation_params (), the probabilities are given by VA. */
+  if (flu_va_drivers_bit_reader_read (&reader, 1)) {
+    if (flu_va_drivers_bit_reader_read (&reader, 1)) {
+      for (i = 0; i < 7; i++) {
+        if (flu_va_drivers_bit_reader_read (&reader, 1))
+          flu_va_drivers_bit_reader_read (&reader, 8);
+      }
+      if (flu_va_drivers_bit_reader_read (&reader, 1)) {
+        for (i = 0; i < 3; i++) {
+          if (flu_va_drivers_bit_reader_read (&reader, 1))
+            flu_va_drivers_bit_reader_read (&reader, 8);
+        }
+      }
+    }
+
+    /* segmentation_update_data */
+    if (flu_va_drivers_bit_reader_read (&reader, 1)) {
+      vdp_pic_info->segmentFeatureMode =
+          flu_va_drivers_bit_reader_read (&reader, 1);
+      for (i = 0; i < FLU_VA_DRIVERS_VP9_MAX_SEGMENTS; i++) {
+        for (j = 0; j < FLU_VA_DRIVERS_VP9_SEG_LVL_MAX; j++) {
+          int16_t value = 0;
+
+          vdp_pic_info->segmentFeatureEnable[i][j] =
+              flu_va_drivers_bit_reader_read (&reader, 1);
+          if (vdp_pic_info->segmentFeatureEnable[i][j]) {
+            value = flu_va_drivers_bit_reader_read (
+                &reader, FLU_VA_DRIVERS_VP9_SEGMENTATION_FEATURE_BITS[j]);
+            if (FLU_VA_DRIVERS_VP9_SEGMENTATION_FEATURE_SIGNED[j] &&
+                flu_va_drivers_bit_reader_read (&reader, 1))
+              value = -value;
+          }
+          vdp_pic_info->segmentFeatureData[i][j] = value;
+        }
+      }
+    }
+  }
+
+  return reader.overflow ? VA_STATUS_ERROR_INVALID_BUFFER : VA_STATUS_SUCCESS;
+}
+
+#define _MAP_BITS_FIELD(FIELD, BITS_FIELD)                                    \
+  vdp_pic_info->FIELD = param->pic_fields.bits.BITS_FIELD
+static VAStatus
+flu_va_driver_vdpau_translate_pic_param_vp9 (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj,
+    const VADecPictureParameterBufferVP9 *param)
+{
+  FluVaDriversVdpauDriverData *driver_data =
+      (FluVaDriversVdpauDriverData *) ctx->pDriverData;
+  FluVaDriversVdpauRefFrameCache *cache = &context_obj->ref_frame_cache;
+  VdpPictureInfoVP9 *vdp_pic_info = &context_obj->vdp_pic_info.vp9;
+  VAStatus ret;
+
+  /* Only 8-bit 4:2:0 is supported for now. */
+  if (param->profile != 0 || param->bit_depth != 8)
+    return VA_STATUS_ERROR_UNKNOWN;
+
+  /* The frame size may change on inter frames, the references are then
+   * scaled by the decoder. */
+  vdp_pic_info->width = param->frame_width;
+  vdp_pic_info->height = param->frame_height;
+  vdp_pic_info->profile = param->profile;
+  vdp_pic_info->keyFrame =
+      param->pic_fields.bits.frame_type == FLU_VA_DRIVERS_VP9_KEY_FRAME;
+  _MAP_BITS_FIELD (frameContextIdx, frame_context_idx);
+  _MAP_BITS_FIELD (showFrame, show_frame);
+  _MAP_BITS_FIELD (errorResilient, error_resilient_mode);
+  _MAP_BITS_FIELD (frameParallelDecoding, frame_parallel_decoding_mode);
+  _MAP_BITS_FIELD (subSamplingX, subsampling_x);
+  _MAP_BITS_FIELD (subSamplingY, subsampling_y);
+  _MAP_BITS_FIELD (intraOnly, intra_only);
+  _MAP_BITS_FIELD (allowHighPrecisionMv, allow_high_precision_mv);
+  _MAP_BITS_FIELD (refreshEntropyProbs, refresh_frame_context);
+  _MAP_BITS_FIELD (resetFrameContext, reset_frame_context);
+  _MAP_BITS_FIELD (mcompFilterType, mcomp_filter_type);
+  vdp_pic_info->bitDepthMinus8Luma = param->bit_depth - 8;
+  vdp_pic_info->bitDepthMinus8Chroma = param->bit_depth - 8;
+  vdp_pic_info->loopFilterLevel = param->filter_level;
+  vdp_pic_info->loopFilterSharpness = param->sharpness_level;
+  vdp_pic_info->log2TileColumns = param->log2_tile_columns;
+  vdp_pic_info->log2TileRows = param->log2_tile_rows;
+  _MAP_BITS_FIELD (segmentEnabled, segmentation_enabled);
+  _MAP_BITS_FIELD (segmentMapUpdate, segmentation_update_map);
+  _MAP_BITS_FIELD (segmentMapTemporalUpdate, segmentation_temporal_update);
+  memcpy (vdp_pic_info->mbSegmentTreeProbs, param->mb_segment_tree_probs,
+      sizeof (param->mb_segment_tree_probs));
+  memcpy (vdp_pic_info->segmentPredProbs, param->segment_pred_probs,
+      sizeof (param->segment_pred_probs));
+  vdp_pic_info->uncompressedHeaderSize = param->frame_header_length_in_bytes;
+  vdp_pic_info->compressedHeaderSize = param->first_partition_size;
+
+  vdp_pic_info->refFrameSignBias[0] = 0;
+  _MAP_BITS_FIELD (refFrameSignBias[1], last_ref_frame_sign_bias);
+  _MAP_BITS_FIELD (refFrameSignBias[2], golden_ref_frame_sign_bias);
+  _MAP_BITS_FIELD (refFrameSignBias[3], alt_ref_frame_sign_bias);
+  _MAP_BITS_FIELD (activeRefIdx[0], last_ref_frame);
+  _MAP_BITS_FIELD (activeRefIdx[1], golden_ref_frame);
+  _MAP_BITS_FIELD (activeRefIdx[2], alt_ref_frame);
+
+  vdp_pic_info->lastReference = VDP_INVALID_HANDLE;
+  vdp_pic_info->goldenReference = VDP_INVALID_HANDLE;
+  vdp_pic_info->altReference = VDP_INVALID_HANDLE;
+  /* The slots of intra frames may hold surfaces destroyed since. */
+  if (vdp_pic_info->keyFrame || vdp_pic_info->intraOnly)
+    return VA_STATUS_SUCCESS;
+
+  flu_va_drivers_vdpau_ref_frame_cache_sync (driver_data, cache);
+  ret = flu_va_drivers_vdpau_ref_frame_cache_lookup_reference (driver_data,
+      cache, param->reference_frames[param->pic_fields.bits.last_ref_frame],
+      &vdp_pic_info->lastReference);
+  if (ret == VA_STATUS_SUCCESS)
+    ret = flu_va_drivers_vdpau_ref_frame_cache_lookup_reference (driver_data,
+        cache, param->reference_frames[param->pic_fields.bits.golden_ref_frame],
+        &vdp_pic_info->goldenReference);
+  if (ret == VA_STATUS_SUCCESS)
+    ret = flu_va_drivers_vdpau_ref_frame_cache_lookup_reference (driver_data,
+        cache, param->reference_frames[param->pic_fields.bits.alt_ref_frame],
+        &vdp_pic_info->altReference);
+
+  return ret;
+}
+#undef _MAP_BITS_FIELD
+
+static int
+flu_va_driver_vdpau_is_buffer_type_supported_vp9 (VABufferType buffer_type)
+{
+  switch (buffer_type) {
+    case VAPictureParameterBufferType:
+    case VASliceParameterBufferType:
+    case VASliceDataBufferType:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static VAStatus
+flu_va_driver_vdpau_translate_buffer_vp9 (VADriverContextP ctx,
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauBufferObject *buffer_obj)
+{
+  VAStatus ret = VA_STATUS_SUCCESS;
+  VdpPictureInfoVP9 *vdp_pic_info = &context_obj->vdp_pic_info.vp9;
+
+  switch (buffer_obj->type) {
+    case VAPictureParameterBufferType:
+      ret = flu_va_driver_vdpau_translate_pic_param_vp9 (ctx, context_obj,
+          (VADecPictureParameterBufferVP9 *) buffer_obj->data);
+      break;
+    case VASliceParameterBufferType:
+      ret = flu_va_drivers_vdpau_context_object_push_slice_params (context_obj,
+          buffer_obj->data, sizeof (VASliceParameterBufferVP9),
+          buffer_obj->num_elements);
+      break;
+    case VASliceDataBufferType: {
+      size_t data_size = buffer_obj->size * buffer_obj->num_elements;
+      unsigned int i;
+
+      if (context_obj->num_slice_params == 0) {
+        ret = VA_STATUS_ERROR_UNKNOWN;
+        break;
+      }
+
+      // VP9 has no start codes, each slice parameter describes a frame
+      // that is passed as is.
+      for (i = 0; i < context_obj->num_slice_params; i++) {
+        const VASliceParameterBufferBase *param =
+            flu_va_drivers_vdpau_context_object_get_slice_params (
+                context_obj, i);
+        const uint8_t *buf;
+        size_t frame_offset, frame_size;
+
+        if (param->slice_data_offset > data_size ||
+            param->slice_data_size > data_size - param->slice_data_offset) {
+          ret = VA_STATUS_ERROR_INVALID_BUFFER;
+          break;
+        }
+
+        buf = (uint8_t *) buffer_obj->data + param->slice_data_offset;
+        ret = flu_va_driver_vdpau_select_frame_vp9 (vdp_pic_info, buf,
+            param->slice_data_size, &frame_offset, &frame_size);
+        if (ret != VA_STATUS_SUCCESS)
+          break;
+
+        ret = flu_va_driver_vdpau_parse_frame_header_vp9 (
+            vdp_pic_info, buf + frame_offset, frame_size);
+        if (ret != VA_STATUS_SUCCESS)
+          break;
+
+        ret = flu_va_drivers_vdpau_bitstream_reserve (
+            &context_obj->bitstream, frame_size);
+        if (ret != VA_STATUS_SUCCESS)
+          break;
+        flu_va_drivers_vdpau_bitstream_append (
+            &context_obj->bitstream, buf + frame_offset, frame_size);
+      }
+      context_obj->num_slice_params = 0;
+      break;
+    }
+    default:
+      ret = VA_STATUS_ERROR_UNSUPPORTED_BUFFERTYPE;
+      break;
+  }
+
+  context_obj->last_buffer_type = buffer_obj->type;
+  return ret;
+}
+
+/* Inter frames may grow past the context size without a key frame, the
+ * decoder is then recreated with the larger size. */
+static void
+flu_va_driver_vdpau_end_picture_vp9 (
+    FluVaDriversVdpauContextObject *context_obj,
+    FluVaDriversVdpauDecoderConfig *decoder_config)
+{
+  VdpPictureInfoVP9 *vdp_pic_info = &context_obj->vdp_pic_info.vp9;
+
+  if (vdp_pic_info->width > decoder_config->width)
+    decoder_config->width = vdp_pic_info->width;
+  if (vdp_pic_info->height > decoder_config->height)
+    decoder_config->height = vdp_pic_info->height;
+  decoder_config->max_references = 8;
+}
+
+const FluVaDriversVdpauCodecOps FLU_VA_DRIVERS_VDPAU_CODEC_OPS_VP9 = {
+  .vdp_pic_info_size = sizeof (VdpPictureInfoVP9),
+  .default_max_references = 8,
+  .is_buffer_type_supported = flu_va_driver_vdpau_is_buffer_type_supported_vp9,
+  .begin_picture = NULL,
+  .translate_buffer = flu_va_driver_vdpau_translate_buffer_vp9,
+  .end_picture = flu_va_driver_vdpau_end_picture_vp9,
+};
+
+#endif /* HAVE_VDPAU_VP9 */
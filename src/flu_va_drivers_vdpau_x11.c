@@ -415,6 +415,14 @@ flu_va_drivers_vdpau_render (VADriverContextP ctx,
   if (vdp_st != VDP_STATUS_OK)
     return VA_STATUS_ERROR_SURFACE_IN_DISPLAYING;
 
+  /* Published after the presentation it refers to, see
+   * flu_va_drivers_vdpau_surface_wait_display. */
+  surface_obj->vdp_output_surface = vdp_output_surface;
+  surface_obj->vdp_presentation_queue =
+      presentation_queue_map_entry->vdp_presentation_queue;
+  __atomic_store_n (&surface_obj->state,
+      FLU_VA_DRIVERS_VDPAU_SURFACE_STATE_DISPLAYING, __ATOMIC_RELEASE);
+
   context_obj->vdp_output_surface_idx =
       (context_obj->vdp_output_surface_idx + 1) %
       FLU_VA_DRIVERS_VDPAU_NUM_OUTPUT_SURFACES;
@@ -0,0 +1,148 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Times the start code handling of the H.264 slice data: the memcmp check of
+ * the leading start code used before, against the inspection that also
+ * counts the NAL units of the slice. */
+
+#include <string.h>
+#include "flu_va_drivers_bitstream.h"
+#include "flu_va_drivers_vdpau_test_utils.h"
+
+#define NUM_SLICES 8
+#define SLICE_SIZE 16384
+
+typedef struct _BenchFrame BenchFrame;
+
+struct _BenchFrame
+{
+  uint8_t data[NUM_SLICES * SLICE_SIZE];
+  unsigned int num_start_codes;
+  unsigned int num_slices;
+};
+
+static const uint8_t START_CODE[3] = { 0x00, 0x00, 0x01 };
+static const uint8_t START_CODE_4[4] = { 0x00, 0x00, 0x00, 0x01 };
+
+static int
+bench_has_start_code_memcmp (const uint8_t *buf, uint32_t size)
+{
+  return (size >= sizeof (START_CODE) &&
+             memcmp (buf, START_CODE, sizeof (START_CODE)) == 0) ||
+         (size >= sizeof (START_CODE_4) &&
+             memcmp (buf, START_CODE_4, sizeof (START_CODE_4)) == 0);
+}
+
+/* Slices of pseudo-random payload, with its emulation prevention bytes, each
+ * behind a start code and the header of a non-IDR slice NAL unit. */
+static void
+bench_frame_init (BenchFrame *frame)
+{
+  uint32_t seed = 0x12345678;
+  unsigned int i, j, num_zeros;
+
+  for (i = 0; i < NUM_SLICES; i++) {
+    uint8_t *slice = frame->data + i * SLICE_SIZE;
+
+    memcpy (slice, START_CODE, sizeof (START_CODE));
+    slice[3] = 0x41;
+    num_zeros = 0;
+    for (j = 4; j < SLICE_SIZE; j++) {
+      seed = seed * 1103515245 + 12345;
+      /* Zero bytes are common in slice data. */
+      slice[j] = (seed >> 16) & 0x1 ? 0 : seed >> 24;
+      if (num_zeros >= 2 && slice[j] <= 3)
+        slice[j] = 3;
+      num_zeros = slice[j] == 0 ? num_zeros + 1 : 0;
+    }
+  }
+}
+
+static void
+bench_memcmp (void *user_data)
+{
+  BenchFrame *frame = user_data;
+  unsigned int i;
+
+  frame->num_start_codes = 0;
+  for (i = 0; i < NUM_SLICES; i++) {
+    frame->num_start_codes += bench_has_start_code_memcmp (
+        frame->data + i * SLICE_SIZE, SLICE_SIZE);
+  }
+}
+
+static void
+bench_inspect (void *user_data)
+{
+  BenchFrame *frame = user_data;
+  FluVaDriversH264BitstreamInfo info;
+  unsigned int i;
+
+  frame->num_start_codes = 0;
+  frame->num_slices = 0;
+  for (i = 0; i < NUM_SLICES; i++) {
+    flu_va_drivers_bitstream_inspect_h264 (
+        frame->data + i * SLICE_SIZE, SLICE_SIZE, &info);
+    frame->num_start_codes += info.start_code_size != 0;
+    frame->num_slices += info.num_slices;
+  }
+}
+
+/* The slices of the frame concatenated behind a single slice parameter. */
+static void
+bench_inspect_concatenated (void *user_data)
+{
+  BenchFrame *frame = user_data;
+  FluVaDriversH264BitstreamInfo info;
+
+  flu_va_drivers_bitstream_inspect_h264 (
+      frame->data, sizeof (frame->data), &info);
+  frame->num_start_codes = info.start_code_size != 0;
+  frame->num_slices = info.num_slices;
+}
+
+int
+main (int argc, char **argv)
+{
+  static BenchFrame frame;
+  double ns;
+
+  bench_frame_init (&frame);
+  printf ("%u slices of %u bytes per frame\n", NUM_SLICES, SLICE_SIZE);
+
+  flu_va_drivers_vdpau_test_bench ("memcmp start code", bench_memcmp, &frame);
+  FLU_VA_DRIVERS_TEST_CHECK (frame.num_start_codes == NUM_SLICES);
+
+  ns = flu_va_drivers_vdpau_test_bench (
+      "inspect_h264 per slice", bench_inspect, &frame);
+  FLU_VA_DRIVERS_TEST_CHECK (frame.num_start_codes == NUM_SLICES);
+  FLU_VA_DRIVERS_TEST_CHECK (frame.num_slices == NUM_SLICES);
+  printf ("%-40s %12.2f GB/s\n", "inspect_h264 throughput",
+      sizeof (frame.data) / ns);
+
+  flu_va_drivers_vdpau_test_bench (
+      "inspect_h264 concatenated", bench_inspect_concatenated, &frame);
+  FLU_VA_DRIVERS_TEST_CHECK (frame.num_slices == NUM_SLICES);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,250 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Times the translation of the parameters of an H.264 picture: with the SPS,
+ * PPS and scaling lists kept from the previous picture of the stream, and
+ * translated from scratch as before they were cached. */
+
+#include <string.h>
+#include "flu_va_drivers_vdpau.h"
+#include "flu_va_drivers_vdpau_utils.h"
+#include "flu_va_drivers_vdpau_test_utils.h"
+
+#define NUM_SURFACES 17
+#define NUM_REF_FRAMES 4
+#define SURFACE_ID_OFFSET (3 << 24)
+
+typedef struct _BenchFixture BenchFixture;
+
+struct _BenchFixture
+{
+  struct VADriverContext ctx;
+  FluVaDriversVdpauDriverData driver_data;
+  FluVaDriversVdpauContextObject context_obj;
+  VASurfaceID surfaces[NUM_SURFACES];
+  VAPictureParameterBufferH264 pic_param;
+  VAIQMatrixBufferH264 iq_matrix;
+  VASliceParameterBufferH264 slice_param;
+  unsigned int frame_num;
+};
+
+static void
+bench_fixture_init (BenchFixture *fixture)
+{
+  FluVaDriversVdpauDriverData *driver_data = &fixture->driver_data;
+  FluVaDriversVdpauContextObject *context_obj = &fixture->context_obj;
+  VAPictureParameterBufferH264 *pic_param = &fixture->pic_param;
+  unsigned int i;
+
+  memset (fixture, 0, sizeof (*fixture));
+  fixture->ctx.pDriverData = driver_data;
+  driver_data->ctx = &fixture->ctx;
+  flu_va_drivers_vdpau_test_vdp_impl_init (&driver_data->vdp_impl);
+  flu_va_drivers_vdpau_buffer_pool_init (&driver_data->buffer_pool);
+  object_heap_init (&driver_data->surface_heap,
+      sizeof (FluVaDriversVdpauSurfaceObject), SURFACE_ID_OFFSET);
+
+  for (i = 0; i < NUM_SURFACES; i++) {
+    FluVaDriversVdpauSurfaceObject *surface_obj;
+    int id = object_heap_allocate (&driver_data->surface_heap);
+
+    FLU_VA_DRIVERS_TEST_CHECK (id != -1);
+    surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
+        &driver_data->surface_heap, id);
+    surface_obj->vdp_surface = 100 + i;
+    surface_obj->context_id = VA_INVALID_ID;
+    fixture->surfaces[i] = id;
+  }
+
+  context_obj->codec_ops = &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_H264;
+  context_obj->decode_queue.buffer_pool = &driver_data->buffer_pool;
+  flu_va_drivers_vdpau_ref_frame_cache_clear (&context_obj->ref_frame_cache,
+      driver_data->surface_epoch);
+  flu_va_drivers_vdpau_context_object_reset (context_obj);
+
+  /* A 1080p High profile stream with CABAC, 8x8 transforms and weighted
+   * prediction. */
+  for (i = 0; i < 16; i++) {
+    pic_param->ReferenceFrames[i].picture_id = VA_INVALID_ID;
+    pic_param->ReferenceFrames[i].flags = VA_PICTURE_H264_INVALID;
+  }
+  pic_param->picture_width_in_mbs_minus1 = 1920 / 16 - 1;
+  pic_param->picture_height_in_mbs_minus1 = 1088 / 16 - 1;
+  pic_param->num_ref_frames = NUM_REF_FRAMES;
+  pic_param->seq_fields.bits.chroma_format_idc = 1;
+  pic_param->seq_fields.bits.frame_mbs_only_flag = 1;
+  pic_param->seq_fields.bits.direct_8x8_inference_flag = 1;
+  pic_param->seq_fields.bits.log2_max_frame_num_minus4 = 4;
+  pic_param->seq_fields.bits.log2_max_pic_order_cnt_lsb_minus4 = 2;
+  pic_param->pic_init_qp_minus26 = -3;
+  pic_param->chroma_qp_index_offset = -2;
+  pic_param->second_chroma_qp_index_offset = -2;
+  pic_param->pic_fields.bits.entropy_coding_mode_flag = 1;
+  pic_param->pic_fields.bits.weighted_pred_flag = 1;
+  pic_param->pic_fields.bits.weighted_bipred_idc = 2;
+  pic_param->pic_fields.bits.transform_8x8_mode_flag = 1;
+  pic_param->pic_fields.bits.deblocking_filter_control_present_flag = 1;
+  pic_param->pic_fields.bits.reference_pic_flag = 1;
+
+  for (i = 0; i < sizeof (fixture->iq_matrix.ScalingList4x4); i++)
+    fixture->iq_matrix.ScalingList4x4[i / 16][i % 16] = 6 + i % 16 * 3;
+  for (i = 0; i < sizeof (fixture->iq_matrix.ScalingList8x8); i++)
+    fixture->iq_matrix.ScalingList8x8[i / 64][i % 64] = 6 + i % 64;
+
+  fixture->slice_param.slice_data_size = 4096;
+  fixture->slice_param.slice_type = 0;
+  fixture->slice_param.num_ref_idx_l0_active_minus1 = NUM_REF_FRAMES - 1;
+}
+
+static void
+bench_fixture_finalize (BenchFixture *fixture)
+{
+  FluVaDriversVdpauDriverData *driver_data = &fixture->driver_data;
+  unsigned int i;
+
+  flu_va_drivers_vdpau_context_object_finalize (&fixture->context_obj);
+  for (i = 0; i < NUM_SURFACES; i++)
+    object_heap_free (&driver_data->surface_heap,
+        object_heap_lookup (&driver_data->surface_heap, fixture->surfaces[i]));
+  object_heap_destroy (&driver_data->surface_heap);
+  flu_va_drivers_vdpau_buffer_pool_destroy (&driver_data->buffer_pool);
+}
+
+static void
+bench_fixture_render (BenchFixture *fixture, VABufferType type, void *data,
+    size_t size)
+{
+  FluVaDriversVdpauBufferObject buffer_obj;
+
+  memset (&buffer_obj, 0, sizeof (buffer_obj));
+  buffer_obj.type = type;
+  buffer_obj.data = data;
+  buffer_obj.capacity = size;
+  buffer_obj.size = size;
+  buffer_obj.num_elements = 1;
+  buffer_obj.derived_image = VA_INVALID_ID;
+
+  FLU_VA_DRIVERS_TEST_CHECK (
+      fixture->context_obj.codec_ops->translate_buffer (&fixture->ctx,
+          &fixture->context_obj, &buffer_obj) == VA_STATUS_SUCCESS);
+}
+
+/* Translates the next picture of the stream, which references the previous
+ * NUM_REF_FRAMES ones, as vaRenderPicture and vaEndPicture do. */
+static void
+bench_fixture_translate_picture (BenchFixture *fixture)
+{
+  FluVaDriversVdpauContextObject *context_obj = &fixture->context_obj;
+  VAPictureParameterBufferH264 *pic_param = &fixture->pic_param;
+  FluVaDriversVdpauDecoderConfig decoder_config;
+  unsigned int n = fixture->frame_num++, i;
+
+  pic_param->CurrPic.picture_id = fixture->surfaces[n % NUM_SURFACES];
+  pic_param->CurrPic.TopFieldOrderCnt = 2 * n;
+  pic_param->CurrPic.BottomFieldOrderCnt = 2 * n;
+  pic_param->frame_num = n & 0xff;
+  for (i = 0; i < NUM_REF_FRAMES && i < n; i++) {
+    VAPictureH264 *ref = &pic_param->ReferenceFrames[i];
+    unsigned int ref_n = n - 1 - i;
+
+    ref->picture_id = fixture->surfaces[ref_n % NUM_SURFACES];
+    ref->frame_idx = ref_n & 0xff;
+    ref->flags = VA_PICTURE_H264_SHORT_TERM_REFERENCE;
+    ref->TopFieldOrderCnt = 2 * ref_n;
+    ref->BottomFieldOrderCnt = 2 * ref_n;
+  }
+
+  flu_va_drivers_vdpau_context_object_reset (context_obj);
+  context_obj->codec_ops->begin_picture (context_obj);
+  bench_fixture_render (fixture, VAPictureParameterBufferType, pic_param,
+      sizeof (*pic_param));
+  bench_fixture_render (fixture, VAIQMatrixBufferType, &fixture->iq_matrix,
+      sizeof (fixture->iq_matrix));
+  bench_fixture_render (fixture, VASliceParameterBufferType,
+      &fixture->slice_param, sizeof (fixture->slice_param));
+  memset (&decoder_config, 0, sizeof (decoder_config));
+  context_obj->codec_ops->end_picture (context_obj, &decoder_config);
+}
+
+static void
+bench_cached (void *user_data)
+{
+  bench_fixture_translate_picture (user_data);
+}
+
+/* What every picture cost before the parameters were cached: the picture
+ * info cleared, then all of it translated again. */
+static void
+bench_uncached (void *user_data)
+{
+  BenchFixture *fixture = user_data;
+  FluVaDriversVdpauContextObject *context_obj = &fixture->context_obj;
+
+  memset (&context_obj->vdp_pic_info, 0, sizeof (context_obj->vdp_pic_info));
+  memset (&context_obj->param_cache, 0, sizeof (context_obj->param_cache));
+  bench_fixture_translate_picture (fixture);
+}
+
+/* Translates the first num_frames pictures of the stream. */
+static void
+bench_translate_stream (FluVaDriversVdpauTestBenchFunc func,
+    unsigned int num_frames, VdpPictureInfoH264 *vdp_pic_info)
+{
+  static BenchFixture fixture;
+  unsigned int i;
+
+  bench_fixture_init (&fixture);
+  for (i = 0; i < num_frames; i++)
+    func (&fixture);
+  *vdp_pic_info = fixture.context_obj.vdp_pic_info.h264;
+  bench_fixture_finalize (&fixture);
+}
+
+int
+main (int argc, char **argv)
+{
+  static BenchFixture fixture;
+  VdpPictureInfoH264 cached_pic_info, uncached_pic_info;
+  double cached_ns, uncached_ns;
+
+  /* Both translate the stream into the same picture info. */
+  bench_translate_stream (bench_cached, 2 * NUM_SURFACES, &cached_pic_info);
+  bench_translate_stream (
+      bench_uncached, 2 * NUM_SURFACES, &uncached_pic_info);
+  FLU_VA_DRIVERS_TEST_CHECK (memcmp (&cached_pic_info, &uncached_pic_info,
+                                 sizeof (cached_pic_info)) == 0);
+
+  bench_fixture_init (&fixture);
+  uncached_ns = flu_va_drivers_vdpau_test_bench (
+      "H.264 picture, translated from scratch", bench_uncached, &fixture);
+  bench_fixture_finalize (&fixture);
+
+  bench_fixture_init (&fixture);
+  cached_ns = flu_va_drivers_vdpau_test_bench (
+      "H.264 picture, SPS/PPS unchanged", bench_cached, &fixture);
+  bench_fixture_finalize (&fixture);
+
+  printf ("%-40s %12.2fx\n", "speedup", uncached_ns / cached_ns);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __FLU_VA_DRIVERS_VDPAU_TEST_DRIVER_H__
+#define __FLU_VA_DRIVERS_VDPAU_TEST_DRIVER_H__
+
+/* The entry points of the driver are static, so the tests that call them
+ * are built along with its source, on the stub device. */
+#include "flu_va_drivers_vdpau.c"
+#include "flu_va_drivers_vdpau_test_utils.h"
+
+#define FLU_VA_DRIVERS_TEST_SLICE_SIZE 2048
+
+static void
+flu_va_drivers_vdpau_test_driver_init (VADriverContextP ctx)
+{
+  FluVaDriversVdpauDriverData *driver_data;
+
+  memset (ctx, 0, sizeof (*ctx));
+  driver_data = calloc (1, sizeof (FluVaDriversVdpauDriverData));
+  FLU_VA_DRIVERS_TEST_CHECK (driver_data != NULL);
+  driver_data->ctx = ctx;
+  ctx->pDriverData = driver_data;
+
+  flu_va_drivers_vdpau_test_vdp_impl_init (&driver_data->vdp_impl);
+  flu_va_drivers_vdpau_data_init_objects (driver_data);
+  flu_va_drivers_vdpau_caps_init (
+      &driver_data->caps_storage[0], &driver_data->vdp_impl);
+  driver_data->caps = &driver_data->caps_storage[0];
+  driver_data->has_device = 1;
+}
+
+static void
+flu_va_drivers_vdpau_test_driver_create_buffer (VADriverContextP ctx,
+    VAContextID context, VABufferType type, unsigned int size, void *data,
+    VABufferID *buffer)
+{
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_CreateBuffer (ctx, context,
+                                 type, size, 1, data, buffer) ==
+                             VA_STATUS_SUCCESS);
+}
+
+/* Decodes the H.264 frame n of a width x height stream into target as the
+ * libva clients do, referencing the previous frame in reference unless it
+ * is VA_INVALID_SURFACE. The frame is not waited for. */
+static void
+flu_va_drivers_vdpau_test_driver_decode_h264 (VADriverContextP ctx,
+    VAContextID context, unsigned int width, unsigned int height,
+    unsigned int num_ref_frames, unsigned int n, VASurfaceID target,
+    VASurfaceID reference)
+{
+  VAPictureParameterBufferH264 pic_param;
+  VAIQMatrixBufferH264 iq_matrix;
+  VASliceParameterBufferH264 slice_param;
+  uint8_t slice_data[FLU_VA_DRIVERS_TEST_SLICE_SIZE];
+  VABufferID buffers[4];
+  unsigned int i;
+
+  memset (&pic_param, 0, sizeof (pic_param));
+  pic_param.CurrPic.picture_id = target;
+  pic_param.CurrPic.TopFieldOrderCnt = 2 * n;
+  pic_param.CurrPic.BottomFieldOrderCnt = 2 * n;
+  for (i = 0; i < 16; i++) {
+    pic_param.ReferenceFrames[i].picture_id = VA_INVALID_ID;
+    pic_param.ReferenceFrames[i].flags = VA_PICTURE_H264_INVALID;
+  }
+  if (reference != VA_INVALID_SURFACE) {
+    pic_param.ReferenceFrames[0].picture_id = reference;
+    pic_param.ReferenceFrames[0].flags = VA_PICTURE_H264_SHORT_TERM_REFERENCE;
+    pic_param.ReferenceFrames[0].TopFieldOrderCnt = 2 * (n - 1);
+    pic_param.ReferenceFrames[0].BottomFieldOrderCnt = 2 * (n - 1);
+  }
+  pic_param.picture_width_in_mbs_minus1 = (width + 15) / 16 - 1;
+  pic_param.picture_height_in_mbs_minus1 = (height + 15) / 16 - 1;
+  pic_param.num_ref_frames = num_ref_frames;
+  pic_param.seq_fields.bits.chroma_format_idc = 1;
+  pic_param.seq_fields.bits.frame_mbs_only_flag = 1;
+  pic_param.pic_fields.bits.reference_pic_flag = 1;
+  pic_param.frame_num = n & 0xf;
+
+  memset (&iq_matrix, 16, sizeof (iq_matrix));
+
+  memset (&slice_param, 0, sizeof (slice_param));
+  slice_param.slice_data_size = FLU_VA_DRIVERS_TEST_SLICE_SIZE;
+  slice_param.slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+  slice_param.slice_type = reference != VA_INVALID_SURFACE ? 0 : 2;
+
+  /* An IDR slice: the stub device does not look at its content. */
+  memset (slice_data, 0xa5, sizeof (slice_data));
+  slice_data[0] = 0;
+  slice_data[1] = 0;
+  slice_data[2] = 1;
+  slice_data[3] = 0x65;
+
+  flu_va_drivers_vdpau_test_driver_create_buffer (ctx, context,
+      VAPictureParameterBufferType, sizeof (pic_param), &pic_param,
+      &buffers[0]);
+  flu_va_drivers_vdpau_test_driver_create_buffer (ctx, context,
+      VAIQMatrixBufferType, sizeof (iq_matrix), &iq_matrix, &buffers[1]);
+  flu_va_drivers_vdpau_test_driver_create_buffer (ctx, context,
+      VASliceParameterBufferType, sizeof (slice_param), &slice_param,
+      &buffers[2]);
+  flu_va_drivers_vdpau_test_driver_create_buffer (ctx, context,
+      VASliceDataBufferType, sizeof (slice_data), slice_data, &buffers[3]);
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_BeginPicture (
+                                 ctx, context, target) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_RenderPicture (
+                                 ctx, context, buffers, 4) ==
+                             VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_EndPicture (ctx, context) == VA_STATUS_SUCCESS);
+  for (i = 0; i < 4; i++) {
+    FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyBuffer (
+                                   ctx, buffers[i]) == VA_STATUS_SUCCESS);
+  }
+}
+
+#endif /* __FLU_VA_DRIVERS_VDPAU_TEST_DRIVER_H__ */
@@ -0,0 +1,135 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __FLU_VA_DRIVERS_VDPAU_TEST_TRANSLATOR_H__
+#define __FLU_VA_DRIVERS_VDPAU_TEST_TRANSLATOR_H__
+
+/* Replays VA buffers through the translator of a codec, without a device
+ * context: the surfaces are created on the stub device and the resulting
+ * picture information and bitstream are read back from the context. */
+#include <string.h>
+#include "flu_va_drivers_vdpau.h"
+#include "flu_va_drivers_vdpau_utils.h"
+#include "flu_va_drivers_vdpau_test_utils.h"
+
+#define FLU_VA_DRIVERS_TEST_NUM_SURFACES 10
+#define FLU_VA_DRIVERS_TEST_SURFACE_ID_OFFSET (3 << 24)
+
+typedef struct _FluVaDriversVdpauTestTranslator FluVaDriversVdpauTestTranslator;
+
+struct _FluVaDriversVdpauTestTranslator
+{
+  struct VADriverContext ctx;
+  FluVaDriversVdpauDriverData driver_data;
+  FluVaDriversVdpauContextObject context_obj;
+  VASurfaceID surfaces[FLU_VA_DRIVERS_TEST_NUM_SURFACES];
+  VdpVideoSurface vdp_surfaces[FLU_VA_DRIVERS_TEST_NUM_SURFACES];
+};
+
+static void
+flu_va_drivers_vdpau_test_translator_init (
+    FluVaDriversVdpauTestTranslator *translator,
+    const FluVaDriversVdpauCodecOps *codec_ops)
+{
+  FluVaDriversVdpauDriverData *driver_data = &translator->driver_data;
+  FluVaDriversVdpauContextObject *context_obj = &translator->context_obj;
+  unsigned int i;
+
+  memset (translator, 0, sizeof (*translator));
+  translator->ctx.pDriverData = driver_data;
+  driver_data->ctx = &translator->ctx;
+  flu_va_drivers_vdpau_test_vdp_impl_init (&driver_data->vdp_impl);
+  flu_va_drivers_vdpau_buffer_pool_init (&driver_data->buffer_pool);
+  object_heap_init (&driver_data->surface_heap,
+      sizeof (FluVaDriversVdpauSurfaceObject),
+      FLU_VA_DRIVERS_TEST_SURFACE_ID_OFFSET);
+
+  for (i = 0; i < FLU_VA_DRIVERS_TEST_NUM_SURFACES; i++) {
+    FluVaDriversVdpauSurfaceObject *surface_obj;
+    int id = object_heap_allocate (&driver_data->surface_heap);
+
+    FLU_VA_DRIVERS_TEST_CHECK (id != -1);
+    surface_obj = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
+        &driver_data->surface_heap, id);
+    FLU_VA_DRIVERS_TEST_CHECK (
+        driver_data->vdp_impl.vdp_video_surface_create (
+            driver_data->vdp_impl.vdp_device, VDP_CHROMA_TYPE_420, 64, 64,
+            &surface_obj->vdp_surface) == VDP_STATUS_OK);
+    surface_obj->context_id = VA_INVALID_ID;
+    translator->surfaces[i] = id;
+    translator->vdp_surfaces[i] = surface_obj->vdp_surface;
+  }
+
+  context_obj->codec_ops = codec_ops;
+  context_obj->decode_queue.buffer_pool = &driver_data->buffer_pool;
+  flu_va_drivers_vdpau_ref_frame_cache_clear (&context_obj->ref_frame_cache,
+      driver_data->surface_epoch);
+  flu_va_drivers_vdpau_context_object_reset (context_obj);
+}
+
+static void
+flu_va_drivers_vdpau_test_translator_finalize (
+    FluVaDriversVdpauTestTranslator *translator)
+{
+  FluVaDriversVdpauDriverData *driver_data = &translator->driver_data;
+  unsigned int i;
+
+  flu_va_drivers_vdpau_context_object_finalize (&translator->context_obj);
+  for (i = 0; i < FLU_VA_DRIVERS_TEST_NUM_SURFACES; i++)
+    object_heap_free (&driver_data->surface_heap,
+        object_heap_lookup (
+            &driver_data->surface_heap, translator->surfaces[i]));
+  object_heap_destroy (&driver_data->surface_heap);
+  flu_va_drivers_vdpau_buffer_pool_destroy (&driver_data->buffer_pool);
+}
+
+static VAStatus
+flu_va_drivers_vdpau_test_translator_render (
+    FluVaDriversVdpauTestTranslator *translator, VABufferType type,
+    void *data, size_t size)
+{
+  FluVaDriversVdpauBufferObject buffer_obj;
+
+  memset (&buffer_obj, 0, sizeof (buffer_obj));
+  buffer_obj.type = type;
+  buffer_obj.data = data;
+  buffer_obj.capacity = size;
+  buffer_obj.size = size;
+  buffer_obj.num_elements = 1;
+  buffer_obj.derived_image = VA_INVALID_ID;
+
+  return translator->context_obj.codec_ops->translate_buffer (
+      &translator->ctx, &translator->context_obj, &buffer_obj);
+}
+
+static void
+flu_va_drivers_vdpau_test_translator_end_picture (
+    FluVaDriversVdpauTestTranslator *translator,
+    FluVaDriversVdpauDecoderConfig *decoder_config)
+{
+  memset (decoder_config, 0, sizeof (*decoder_config));
+  translator->context_obj.codec_ops->end_picture (
+      &translator->context_obj, decoder_config);
+}
+
+#endif /* __FLU_VA_DRIVERS_VDPAU_TEST_TRANSLATOR_H__ */
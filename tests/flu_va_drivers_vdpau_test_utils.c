@@ -0,0 +1,596 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include "flu_va_drivers_vdpau_test_utils.h"
+
+#define FLU_VA_DRIVERS_TEST_MAX_SIZE 8192
+#define FLU_VA_DRIVERS_TEST_MAX_SURFACES 256
+#define FLU_VA_DRIVERS_TEST_MAX_DECODERS 64
+#define FLU_VA_DRIVERS_TEST_BENCH_MIN_NS 200000000
+
+/* Content of a stub video surface: the luma and both chroma planes, packed,
+ * in the sample size and subsampling of its chroma type. */
+typedef struct _FluVaDriversVdpauTestSurface FluVaDriversVdpauTestSurface;
+
+struct _FluVaDriversVdpauTestSurface
+{
+  VdpVideoSurface handle;
+  VdpChromaType chroma_type;
+  uint32_t width;
+  uint32_t height;
+  uint32_t chroma_width;
+  uint32_t chroma_height;
+  unsigned int sample_bytes;
+  uint8_t *planes[3];
+};
+
+typedef struct _FluVaDriversVdpauTestDecoder FluVaDriversVdpauTestDecoder;
+
+struct _FluVaDriversVdpauTestDecoder
+{
+  VdpDecoder handle;
+  uint32_t max_references;
+};
+
+static uint32_t next_handle = 1;
+static unsigned int num_renders;
+static unsigned int num_put_bits;
+static unsigned int render_delay_ms;
+static uint32_t render_max_references;
+
+static pthread_mutex_t objects_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FluVaDriversVdpauTestSurface surfaces[FLU_VA_DRIVERS_TEST_MAX_SURFACES];
+static unsigned int num_surfaces;
+static unsigned int num_surface_creates;
+static FluVaDriversVdpauTestDecoder decoders[FLU_VA_DRIVERS_TEST_MAX_DECODERS];
+
+static uint32_t
+flu_va_drivers_vdpau_test_new_handle (void)
+{
+  return __atomic_fetch_add (&next_handle, 1, __ATOMIC_RELAXED);
+}
+
+/* The driver serializes the accesses to the content of a surface, only the
+ * table is shared between the threads. */
+static FluVaDriversVdpauTestSurface *
+flu_va_drivers_vdpau_test_lookup_surface (VdpVideoSurface handle)
+{
+  FluVaDriversVdpauTestSurface *surface = NULL;
+  unsigned int i;
+
+  pthread_mutex_lock (&objects_mutex);
+  for (i = 0; i < FLU_VA_DRIVERS_TEST_MAX_SURFACES; i++) {
+    if (surfaces[i].handle == handle && handle != 0) {
+      surface = &surfaces[i];
+      break;
+    }
+  }
+  pthread_mutex_unlock (&objects_mutex);
+
+  return surface;
+}
+
+static VdpStatus
+flu_va_drivers_vdpau_test_get_information_string (
+    char const **information_string)
+{
+  *information_string = "flu-va-drivers test device";
+  return VDP_STATUS_OK;
+}
+
+static VdpStatus
+flu_va_drivers_vdpau_test_decoder_query_capabilities (VdpDevice device,
+    VdpDecoderProfile profile, VdpBool *is_supported, uint32_t *max_level,
+    uint32_t *max_macroblocks, uint32_t *max_width, uint32_t *max_height)
+{
+  *is_supported = VDP_TRUE;
+  *max_level = 255;
+  *max_macroblocks = (FLU_VA_DRIVERS_TEST_MAX_SIZE / 16) *
+                     (FLU_VA_DRIVERS_TEST_MAX_SIZE / 16);
+  *max_width = FLU_VA_DRIVERS_TEST_MAX_SIZE;
+  *max_height = FLU_VA_DRIVERS_TEST_MAX_SIZE;
+  return VDP_STATUS_OK;
+}
+
+static VdpStatus
+flu_va_drivers_vdpau_test_video_surface_query_capabilities (VdpDevice device,
+    VdpChromaType surface_chroma_type, VdpBool *is_supported,
+    uint32_t *max_width, uint32_t *max_height)
+{
+  *is_supported = VDP_TRUE;
+  *max_width = FLU_VA_DRIVERS_TEST_MAX_SIZE;
+  *max_height = FLU_VA_DRIVERS_TEST_MAX_SIZE;
+  return VDP_STATUS_OK;
+}
+
+static VdpStatus
+flu_va_drivers_vdpau_test_query_get_put_bits_y_cb_cr_capabilities (
+    VdpDevice device, VdpChromaType surface_chroma_type,
+    VdpYCbCrFormat bits_ycbcr_format, VdpBool *is_supported)
+{
+  *is_supported = VDP_TRUE;
+  return VDP_STATUS_OK;
+}
+
+static VdpStatus
+flu_va_drivers_vdpau_test_output_surface_query_capabilities (VdpDevice device,
+    VdpRGBAFormat surface_rgba_format, VdpBool *is_supported,
+    uint32_t *max_width, uint32_t *max_height)
+{
+  *is_supported = VDP_TRUE;
+  *max_width = FLU_VA_DRIVERS_TEST_MAX_SIZE;
+  *max_height = FLU_VA_DRIVERS_TEST_MAX_SIZE;
+  return VDP_STATUS_OK;
+}
+
+static VdpStatus
+flu_va_drivers_vdpau_test_query_get_put_bits_native_capabilities (
+    VdpDevice device, VdpRGBAFormat surface_rgba_format,
+    VdpBool *is_supported)
+{
+  *is_supported = VDP_TRUE;
+  return VDP_STATUS_OK;
+}
+
+static VdpStatus
+flu_va_drivers_vdpau_test_video_mixer_query_feature_support (
+    VdpDevice device, VdpVideoMixerFeature feature, VdpBool *is_supported)
+{
+  *is_supported = VDP_FALSE;
+  return VDP_STATUS_OK;
+}
+
+static VdpStatus
+flu_va_drivers_vdpau_test_video_surface_create (VdpDevice device,
+    VdpChromaType chroma_type, uint32_t width, uint32_t height,
+    VdpVideoSurface *surface)
+{
+  FluVaDriversVdpauTestSurface *slot = NULL;
+  size_t luma_size, chroma_size;
+  unsigned int i;
+
+  pthread_mutex_lock (&objects_mutex);
+  for (i = 0; i < FLU_VA_DRIVERS_TEST_MAX_SURFACES; i++) {
+    if (surfaces[i].handle == 0) {
+      slot = &surfaces[i];
+      break;
+    }
+  }
+  if (slot == NULL) {
+    pthread_mutex_unlock (&objects_mutex);
+    return VDP_STATUS_RESOURCES;
+  }
+
+  memset (slot, 0, sizeof (*slot));
+  slot->chroma_type = chroma_type;
+  slot->width = width;
+  slot->height = height;
+  slot->chroma_width = (width + 1) / 2;
+  slot->chroma_height = (height + 1) / 2;
+  slot->sample_bytes = 1;
+  switch (chroma_type) {
+    case VDP_CHROMA_TYPE_420:
+      break;
+#ifdef HAVE_VDPAU_HIGH_BIT_DEPTH
+    case VDP_CHROMA_TYPE_420_16:
+      slot->sample_bytes = 2;
+      break;
+#endif
+    case VDP_CHROMA_TYPE_422:
+      slot->chroma_height = height;
+      break;
+    case VDP_CHROMA_TYPE_444:
+      slot->chroma_width = width;
+      slot->chroma_height = height;
+      break;
+    default:
+      pthread_mutex_unlock (&objects_mutex);
+      return VDP_STATUS_INVALID_CHROMA_TYPE;
+  }
+
+  luma_size = (size_t) width * height * slot->sample_bytes;
+  chroma_size =
+      (size_t) slot->chroma_width * slot->chroma_height * slot->sample_bytes;
+  slot->planes[0] = calloc (1, luma_size);
+  slot->planes[1] = calloc (1, chroma_size);
+  slot->planes[2] = calloc (1, chroma_size);
+  if (slot->planes[0] == NULL || slot->planes[1] == NULL ||
+      slot->planes[2] == NULL) {
+    for (i = 0; i < 3; i++)
+      free (slot->planes[i]);
+    pthread_mutex_unlock (&objects_mutex);
+    return VDP_STATUS_RESOURCES;
+  }
+
+  slot->handle = flu_va_drivers_vdpau_test_new_handle ();
+  *surface = slot->handle;
+  num_surfaces++;
+  num_surface_creates++;
+  pthread_mutex_unlock (&objects_mutex);
+
+  return VDP_STATUS_OK;
+}
+
+static VdpStatus
+flu_va_drivers_vdpau_test_video_surface_destroy (VdpVideoSurface handle)
+{
+  FluVaDriversVdpauTestSurface *surface =
+      flu_va_drivers_vdpau_test_lookup_surface (handle);
+  unsigned int i;
+
+  if (surface == NULL)
+    return VDP_STATUS_INVALID_HANDLE;
+
+  pthread_mutex_lock (&objects_mutex);
+  for (i = 0; i < 3; i++)
+    free (surface->planes[i]);
+  surface->handle = 0;
+  num_surfaces--;
+  pthread_mutex_unlock (&objects_mutex);
+
+  return VDP_STATUS_OK;
+}
+
+static uint8_t *
+flu_va_drivers_vdpau_test_surface_sample (FluVaDriversVdpauTestSurface *surface,
+    unsigned int plane, uint32_t x, uint32_t y)
+{
+  uint32_t width = plane == 0 ? surface->width : surface->chroma_width;
+
+  return surface->planes[plane] +
+         ((size_t) y * width + x) * surface->sample_bytes;
+}
+
+/* Copies the sample of an image plane to the surface sample, or the other
+ * way around. */
+static void
+flu_va_drivers_vdpau_test_copy_sample (FluVaDriversVdpauTestSurface *surface,
+    uint8_t *image_sample, unsigned int plane, uint32_t x, uint32_t y,
+    int to_surface)
+{
+  uint8_t *surface_sample =
+      flu_va_drivers_vdpau_test_surface_sample (surface, plane, x, y);
+
+  if (to_surface)
+    memcpy (surface_sample, image_sample, surface->sample_bytes);
+  else
+    memcpy (image_sample, surface_sample, surface->sample_bytes);
+}
+
+/* Copies the content of the surface to the planes in the given format, or
+ * the other way around. */
+static VdpStatus
+flu_va_drivers_vdpau_test_transfer_bits (VdpVideoSurface handle,
+    VdpYCbCrFormat format, uint8_t *const *data, const uint32_t *pitches,
+    int to_surface)
+{
+  FluVaDriversVdpauTestSurface *surface =
+      flu_va_drivers_vdpau_test_lookup_surface (handle);
+  VdpChromaType chroma_type;
+  unsigned int sb, x, y, p;
+
+  if (surface == NULL)
+    return VDP_STATUS_INVALID_HANDLE;
+  sb = surface->sample_bytes;
+
+  switch (format) {
+    case VDP_YCBCR_FORMAT_NV12:
+#ifdef HAVE_VDPAU_HIGH_BIT_DEPTH
+    case VDP_YCBCR_FORMAT_P010:
+    case VDP_YCBCR_FORMAT_P016:
+      chroma_type = format == VDP_YCBCR_FORMAT_NV12 ? VDP_CHROMA_TYPE_420
+                                                    : VDP_CHROMA_TYPE_420_16;
+#else
+      chroma_type = VDP_CHROMA_TYPE_420;
+#endif
+      if (surface->chroma_type != chroma_type)
+        return VDP_STATUS_INVALID_Y_CB_CR_FORMAT;
+      for (y = 0; y < surface->height; y++) {
+        for (x = 0; x < surface->width; x++) {
+          flu_va_drivers_vdpau_test_copy_sample (surface,
+              data[0] + (size_t) y * pitches[0] + x * sb, 0, x, y,
+              to_surface);
+        }
+      }
+      for (y = 0; y < surface->chroma_height; y++) {
+        for (x = 0; x < surface->chroma_width; x++) {
+          for (p = 1; p <= 2; p++) {
+            flu_va_drivers_vdpau_test_copy_sample (surface,
+                data[1] + (size_t) y * pitches[1] + (2 * x + p - 1) * sb, p,
+                x, y, to_surface);
+          }
+        }
+      }
+      break;
+    case VDP_YCBCR_FORMAT_YUYV:
+      if (surface->chroma_type != VDP_CHROMA_TYPE_422)
+        return VDP_STATUS_INVALID_Y_CB_CR_FORMAT;
+      for (y = 0; y < surface->height; y++) {
+        uint8_t *row = data[0] + (size_t) y * pitches[0];
+
+        for (x = 0; x < surface->chroma_width; x++) {
+          flu_va_drivers_vdpau_test_copy_sample (
+              surface, row + 4 * x, 0, 2 * x, y, to_surface);
+          flu_va_drivers_vdpau_test_copy_sample (
+              surface, row + 4 * x + 1, 1, x, y, to_surface);
+          if (2 * x + 1 < surface->width) {
+            flu_va_drivers_vdpau_test_copy_sample (
+                surface, row + 4 * x + 2, 0, 2 * x + 1, y, to_surface);
+          }
+          flu_va_drivers_vdpau_test_copy_sample (
+              surface, row + 4 * x + 3, 2, x, y, to_surface);
+        }
+      }
+      break;
+    case VDP_YCBCR_FORMAT_Y_U_V_444:
+      if (surface->chroma_type != VDP_CHROMA_TYPE_444)
+        return VDP_STATUS_INVALID_Y_CB_CR_FORMAT;
+      for (p = 0; p < 3; p++) {
+        for (y = 0; y < surface->height; y++) {
+          for (x = 0; x < surface->width; x++) {
+            flu_va_drivers_vdpau_test_copy_sample (surface,
+                data[p] + (size_t) y * pitches[p] + x, p, x, y, to_surface);
+          }
+        }
+      }
+      break;
+    default:
+      return VDP_STATUS_INVALID_Y_CB_CR_FORMAT;
+  }
+
+  return VDP_STATUS_OK;
+}
+
+static VdpStatus
+flu_va_drivers_vdpau_test_video_surface_get_bits_y_cb_cr (
+    VdpVideoSurface surface, VdpYCbCrFormat destination_ycbcr_format,
+    void *const *destination_data, uint32_t const *destination_pitches)
+{
+  return flu_va_drivers_vdpau_test_transfer_bits (surface,
+      destination_ycbcr_format, (uint8_t *const *) destination_data,
+      destination_pitches, 0);
+}
+
+static VdpStatus
+flu_va_drivers_vdpau_test_video_surface_put_bits_y_cb_cr (
+    VdpVideoSurface surface, VdpYCbCrFormat source_ycbcr_format,
+    void const *const *source_data, uint32_t const *source_pitches)
+{
+  __atomic_fetch_add (&num_put_bits, 1, __ATOMIC_RELAXED);
+  return flu_va_drivers_vdpau_test_transfer_bits (surface,
+      source_ycbcr_format, (uint8_t *const *) source_data, source_pitches, 1);
+}
+
+static VdpStatus
+flu_va_drivers_vdpau_test_decoder_create (VdpDevice device,
+    VdpDecoderProfile profile, uint32_t width, uint32_t height,
+    uint32_t max_references, VdpDecoder *decoder)
+{
+  unsigned int i;
+
+  pthread_mutex_lock (&objects_mutex);
+  for (i = 0; i < FLU_VA_DRIVERS_TEST_MAX_DECODERS; i++) {
+    if (decoders[i].handle == 0) {
+      decoders[i].handle = flu_va_drivers_vdpau_test_new_handle ();
+      decoders[i].max_references = max_references;
+      *decoder = decoders[i].handle;
+      pthread_mutex_unlock (&objects_mutex);
+      return VDP_STATUS_OK;
+    }
+  }
+  pthread_mutex_unlock (&objects_mutex);
+
+  return VDP_STATUS_RESOURCES;
+}
+
+static VdpStatus
+flu_va_drivers_vdpau_test_decoder_destroy (VdpDecoder decoder)
+{
+  unsigned int i;
+
+  pthread_mutex_lock (&objects_mutex);
+  for (i = 0; i < FLU_VA_DRIVERS_TEST_MAX_DECODERS; i++) {
+    if (decoders[i].handle == decoder) {
+      decoders[i].handle = 0;
+      break;
+    }
+  }
+  pthread_mutex_unlock (&objects_mutex);
+
+  return i < FLU_VA_DRIVERS_TEST_MAX_DECODERS ? VDP_STATUS_OK
+                                              : VDP_STATUS_INVALID_HANDLE;
+}
+
+/* Fills the target with the number of the render, so that the content of
+ * every decoded picture differs from the previous one. */
+static VdpStatus
+flu_va_drivers_vdpau_test_decoder_render (VdpDecoder decoder,
+    VdpVideoSurface target, VdpPictureInfo const *picture_info,
+    uint32_t bitstream_buffer_count,
+    VdpBitstreamBuffer const *bitstream_buffers)
+{
+  FluVaDriversVdpauTestSurface *surface =
+      flu_va_drivers_vdpau_test_lookup_surface (target);
+  uint32_t max_references = 0;
+  unsigned int i, n;
+
+  if (surface == NULL)
+    return VDP_STATUS_INVALID_HANDLE;
+
+  pthread_mutex_lock (&objects_mutex);
+  for (i = 0; i < FLU_VA_DRIVERS_TEST_MAX_DECODERS; i++) {
+    if (decoders[i].handle == decoder)
+      max_references = decoders[i].max_references;
+  }
+  pthread_mutex_unlock (&objects_mutex);
+  if (max_references == 0)
+    return VDP_STATUS_INVALID_HANDLE;
+
+  if (render_delay_ms > 0) {
+    struct timespec delay = { render_delay_ms / 1000,
+      (render_delay_ms % 1000) * 1000000 };
+
+    nanosleep (&delay, NULL);
+  }
+
+  n = __atomic_add_fetch (&num_renders, 1, __ATOMIC_RELAXED);
+  memset (surface->planes[0], n,
+      (size_t) surface->width * surface->height * surface->sample_bytes);
+  for (i = 1; i < 3; i++) {
+    memset (surface->planes[i], n, (size_t) surface->chroma_width *
+                                       surface->chroma_height *
+                                       surface->sample_bytes);
+  }
+  __atomic_store_n (&render_max_references, max_references, __ATOMIC_RELAXED);
+
+  return VDP_STATUS_OK;
+}
+
+static VdpStatus
+flu_va_drivers_vdpau_test_destroy (uint32_t handle)
+{
+  return VDP_STATUS_OK;
+}
+
+void
+flu_va_drivers_vdpau_test_vdp_impl_init (FluVaDriversVdpauVdpDeviceImpl *impl)
+{
+  memset (impl, 0, sizeof (*impl));
+  impl->vdp_device = flu_va_drivers_vdpau_test_new_handle ();
+  impl->vdp_get_information_string =
+      flu_va_drivers_vdpau_test_get_information_string;
+  impl->vdp_decoder_query_capabilities =
+      flu_va_drivers_vdpau_test_decoder_query_capabilities;
+  impl->vdp_video_surface_query_capabilities =
+      flu_va_drivers_vdpau_test_video_surface_query_capabilities;
+  impl->vdp_video_surface_query_get_put_bits_y_cb_cr_capabilities =
+      flu_va_drivers_vdpau_test_query_get_put_bits_y_cb_cr_capabilities;
+  impl->vdp_output_surface_query_capabilities =
+      flu_va_drivers_vdpau_test_output_surface_query_capabilities;
+  impl->vdp_output_surface_query_get_put_bits_native_capabilities =
+      flu_va_drivers_vdpau_test_query_get_put_bits_native_capabilities;
+  impl->vdp_video_mixer_query_feature_support =
+      flu_va_drivers_vdpau_test_video_mixer_query_feature_support;
+  impl->vdp_video_surface_create =
+      flu_va_drivers_vdpau_test_video_surface_create;
+  impl->vdp_video_surface_destroy =
+      flu_va_drivers_vdpau_test_video_surface_destroy;
+  impl->vdp_video_surface_get_bits_y_cb_cr =
+      flu_va_drivers_vdpau_test_video_surface_get_bits_y_cb_cr;
+  impl->vdp_video_surface_put_bits_y_cb_cr =
+      flu_va_drivers_vdpau_test_video_surface_put_bits_y_cb_cr;
+  impl->vdp_output_surface_destroy = flu_va_drivers_vdpau_test_destroy;
+  impl->vdp_decoder_create = flu_va_drivers_vdpau_test_decoder_create;
+  impl->vdp_decoder_destroy = flu_va_drivers_vdpau_test_decoder_destroy;
+  impl->vdp_decoder_render = flu_va_drivers_vdpau_test_decoder_render;
+  impl->vdp_video_mixer_destroy = flu_va_drivers_vdpau_test_destroy;
+  impl->vdp_presentation_queue_destroy = flu_va_drivers_vdpau_test_destroy;
+  impl->vdp_presentation_queue_target_destroy =
+      flu_va_drivers_vdpau_test_destroy;
+}
+
+unsigned int
+flu_va_drivers_vdpau_test_get_num_renders (void)
+{
+  return __atomic_load_n (&num_renders, __ATOMIC_RELAXED);
+}
+
+unsigned int
+flu_va_drivers_vdpau_test_get_num_put_bits (void)
+{
+  return __atomic_load_n (&num_put_bits, __ATOMIC_RELAXED);
+}
+
+uint32_t
+flu_va_drivers_vdpau_test_get_render_max_references (void)
+{
+  return __atomic_load_n (&render_max_references, __ATOMIC_RELAXED);
+}
+
+void
+flu_va_drivers_vdpau_test_set_render_delay (unsigned int delay_ms)
+{
+  __atomic_store_n (&render_delay_ms, delay_ms, __ATOMIC_RELAXED);
+}
+
+unsigned int
+flu_va_drivers_vdpau_test_get_num_video_surfaces (void)
+{
+  unsigned int n;
+
+  pthread_mutex_lock (&objects_mutex);
+  n = num_surfaces;
+  pthread_mutex_unlock (&objects_mutex);
+
+  return n;
+}
+
+unsigned int
+flu_va_drivers_vdpau_test_get_num_video_surface_creates (void)
+{
+  unsigned int n;
+
+  pthread_mutex_lock (&objects_mutex);
+  n = num_surface_creates;
+  pthread_mutex_unlock (&objects_mutex);
+
+  return n;
+}
+
+static uint64_t
+flu_va_drivers_vdpau_test_get_time_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+double
+flu_va_drivers_vdpau_test_bench (
+    const char *name, FluVaDriversVdpauTestBenchFunc func, void *user_data)
+{
+  uint64_t num_calls = 1, elapsed, start, i;
+  double ns_per_call;
+
+  /* Warm the caches and the state kept by func. */
+  func (user_data);
+
+  for (;;) {
+    start = flu_va_drivers_vdpau_test_get_time_ns ();
+    for (i = 0; i < num_calls; i++)
+      func (user_data);
+    elapsed = flu_va_drivers_vdpau_test_get_time_ns () - start;
+    if (elapsed >= FLU_VA_DRIVERS_TEST_BENCH_MIN_NS)
+      break;
+    num_calls *= 2;
+  }
+
+  ns_per_call = (double) elapsed / num_calls;
+  printf ("%-40s %12.1f ns\n", name, ns_per_call);
+
+  return ns_per_call;
+}
@@ -0,0 +1,73 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __FLU_VA_DRIVERS_VDPAU_TEST_UTILS_H__
+#define __FLU_VA_DRIVERS_VDPAU_TEST_UTILS_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "flu_va_drivers_vdpau_vdp_device_impl.h"
+
+#define FLU_VA_DRIVERS_TEST_CHECK(expr)                                       \
+  do {                                                                        \
+    if (!(expr)) {                                                            \
+      fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,       \
+          #expr);                                                             \
+      exit (EXIT_FAILURE);                                                    \
+    }                                                                         \
+  } while (0)
+
+/* Stand-in for a VDPAU device: every query succeeds with generous limits,
+ * the created objects are distinct handles, video surfaces keep their
+ * content in memory and decoding fills the target with the render number. */
+void flu_va_drivers_vdpau_test_vdp_impl_init (
+    FluVaDriversVdpauVdpDeviceImpl *impl);
+
+/* Number of vdp_decoder_render calls on the stub device, from any thread. */
+unsigned int flu_va_drivers_vdpau_test_get_num_renders (void);
+
+/* Number of vdp_video_surface_put_bits_y_cb_cr calls on the stub device. */
+unsigned int flu_va_drivers_vdpau_test_get_num_put_bits (void);
+
+/* max_references of the decoder used by the last render. */
+uint32_t flu_va_drivers_vdpau_test_get_render_max_references (void);
+
+/* Makes every render sleep, to leave decode jobs pending. */
+void flu_va_drivers_vdpau_test_set_render_delay (unsigned int delay_ms);
+
+/* Number of live video surfaces, and of surfaces ever created. */
+unsigned int flu_va_drivers_vdpau_test_get_num_video_surfaces (void);
+unsigned int flu_va_drivers_vdpau_test_get_num_video_surface_creates (void);
+
+typedef void (*FluVaDriversVdpauTestBenchFunc) (void *user_data);
+
+/* Calls func in batches of growing size until a batch lasts long enough to
+ * time, prints the cost of one call under name and returns it in ns. */
+double flu_va_drivers_vdpau_test_bench (
+    const char *name, FluVaDriversVdpauTestBenchFunc func, void *user_data);
+
+#endif /* __FLU_VA_DRIVERS_VDPAU_TEST_UTILS_H__ */
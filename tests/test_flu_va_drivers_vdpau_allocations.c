@@ -0,0 +1,293 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Calls the entry points of the VDPAU driver on a stub device, with every
+ * malloc, calloc and realloc of the driver wrapped through the --wrap option
+ * of the linker. Checks that once the pools are warm an H.264 frame does not
+ * allocate, and that vaCreateSurfaces leaves the surface heap as it was when
+ * an allocation fails. */
+
+#include "flu_va_drivers_vdpau_test_driver.h"
+
+#define WIDTH 320
+#define HEIGHT 240
+#define NUM_SURFACES 4
+#define NUM_WARMUP_FRAMES 16
+#define NUM_FRAMES 256
+
+void *__real_malloc (size_t size);
+void *__real_calloc (size_t nmemb, size_t size);
+void *__real_realloc (void *ptr, size_t size);
+
+#define NUM_BATCH_SURFACES 200
+#define MAX_FREE_SLOTS 1024
+
+static int counting;
+static unsigned int num_allocations;
+/* Number of allocations that still succeed before all of them fail, or -1
+ * for no failure. */
+static int num_allocations_until_failure = -1;
+
+static int
+test_allocation_fails (void)
+{
+  int remaining;
+
+  if (__atomic_load_n (&counting, __ATOMIC_RELAXED))
+    __atomic_fetch_add (&num_allocations, 1, __ATOMIC_RELAXED);
+
+  remaining =
+      __atomic_load_n (&num_allocations_until_failure, __ATOMIC_RELAXED);
+  if (remaining < 0)
+    return 0;
+  if (remaining == 0)
+    return 1;
+  __atomic_store_n (
+      &num_allocations_until_failure, remaining - 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+void *
+__wrap_malloc (size_t size)
+{
+  if (test_allocation_fails ())
+    return NULL;
+  return __real_malloc (size);
+}
+
+void *
+__wrap_calloc (size_t nmemb, size_t size)
+{
+  if (test_allocation_fails ())
+    return NULL;
+  return __real_calloc (nmemb, size);
+}
+
+void *
+__wrap_realloc (void *ptr, size_t size)
+{
+  if (test_allocation_fails ())
+    return NULL;
+  return __real_realloc (ptr, size);
+}
+
+typedef struct _TestFixture TestFixture;
+
+struct _TestFixture
+{
+  struct VADriverContext ctx;
+  VAConfigID config;
+  VAContextID context;
+  VASurfaceID surfaces[NUM_SURFACES];
+};
+
+static void
+test_fixture_init (TestFixture *fixture)
+{
+  VADriverContextP ctx = &fixture->ctx;
+
+  memset (fixture, 0, sizeof (*fixture));
+  flu_va_drivers_vdpau_test_driver_init (ctx);
+
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateConfig (ctx, VAProfileH264High,
+          VAEntrypointVLD, NULL, 0, &fixture->config) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateSurfaces (ctx, WIDTH, HEIGHT,
+          VA_RT_FORMAT_YUV420, NUM_SURFACES,
+          fixture->surfaces) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateContext (ctx, fixture->config, WIDTH, HEIGHT,
+          VA_PROGRESSIVE, fixture->surfaces, NUM_SURFACES,
+          &fixture->context) == VA_STATUS_SUCCESS);
+}
+
+static void
+test_fixture_finalize (TestFixture *fixture)
+{
+  VADriverContextP ctx = &fixture->ctx;
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyContext (
+                                 ctx, fixture->context) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_DestroySurfaces (ctx, fixture->surfaces,
+          NUM_SURFACES) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyConfig (
+                                 ctx, fixture->config) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_Terminate (ctx) == VA_STATUS_SUCCESS);
+}
+
+/* Decodes frame n, referencing the previous frame. */
+static void
+test_fixture_decode_frame (TestFixture *fixture, unsigned int n)
+{
+  VASurfaceID target = fixture->surfaces[n % NUM_SURFACES];
+
+  flu_va_drivers_vdpau_test_driver_decode_h264 (&fixture->ctx,
+      fixture->context, WIDTH, HEIGHT, 1, n, target,
+      n > 0 ? fixture->surfaces[(n - 1) % NUM_SURFACES] : VA_INVALID_SURFACE);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_SyncSurface (
+                                 &fixture->ctx, target) == VA_STATUS_SUCCESS);
+}
+
+static void
+test_steady_state (void)
+{
+  TestFixture fixture;
+  unsigned int n, num_renders;
+
+  test_fixture_init (&fixture);
+
+  for (n = 0; n < NUM_WARMUP_FRAMES; n++)
+    test_fixture_decode_frame (&fixture, n);
+
+  num_renders = flu_va_drivers_vdpau_test_get_num_renders ();
+  __atomic_store_n (&counting, 1, __ATOMIC_RELAXED);
+  for (; n < NUM_WARMUP_FRAMES + NUM_FRAMES; n++)
+    test_fixture_decode_frame (&fixture, n);
+  __atomic_store_n (&counting, 0, __ATOMIC_RELAXED);
+
+  if (num_allocations != 0) {
+    fprintf (stderr, "%u allocations in %u steady-state frames\n",
+        num_allocations, NUM_FRAMES);
+  }
+  FLU_VA_DRIVERS_TEST_CHECK (num_allocations == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_test_get_num_renders () - num_renders ==
+      NUM_FRAMES);
+
+  test_fixture_finalize (&fixture);
+}
+
+/* Walks the free list of the heap into indices, returns its length. */
+static unsigned int
+test_get_free_slots (object_heap_p heap, int *indices)
+{
+  unsigned int n = 0;
+  int index = heap->next_free;
+
+  while (index >= 0) {
+    uint8_t *bucket = heap->bucket[index / heap->heap_increment];
+    object_base_p obj = (object_base_p) (bucket +
+                                         (index % heap->heap_increment) *
+                                             heap->object_size);
+
+    FLU_VA_DRIVERS_TEST_CHECK (n < MAX_FREE_SLOTS);
+    indices[n++] = index;
+    index = obj->next_free;
+  }
+
+  return n;
+}
+
+/* Lets vaCreateSurfaces allocate a growing number of times before failing,
+ * which makes it fail while expanding the heap in object_heap_allocate_n,
+ * and then while creating the VDPAU surfaces. After every failure the free
+ * list of the heap starts as before, followed by the slots it grew by, and
+ * only the surfaces created beforehand can be looked up. */
+static void
+test_create_surfaces_rollback (void)
+{
+  static int free_slots[MAX_FREE_SLOTS], new_free_slots[MAX_FREE_SLOTS];
+  VASurfaceID surfaces[NUM_SURFACES], batch[NUM_BATCH_SURFACES];
+  FluVaDriversVdpauSurfaceObject *surface_objs[NUM_SURFACES];
+  struct VADriverContext ctx;
+  FluVaDriversVdpauDriverData *driver_data;
+  object_heap_p heap;
+  object_heap_iterator iter;
+  object_base_p obj;
+  unsigned int i, n, num_free, new_num_free, num_allocated;
+  int heap_size, heap_failures = 0, surface_failures = 0;
+  VAStatus va_st;
+
+  flu_va_drivers_vdpau_test_driver_init (&ctx);
+  driver_data = (FluVaDriversVdpauDriverData *) ctx.pDriverData;
+  heap = &driver_data->surface_heap;
+
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateSurfaces (&ctx, WIDTH, HEIGHT,
+          VA_RT_FORMAT_YUV420, NUM_SURFACES, surfaces) == VA_STATUS_SUCCESS);
+  for (i = 0; i < NUM_SURFACES; i++) {
+    surface_objs[i] = (FluVaDriversVdpauSurfaceObject *) object_heap_lookup (
+        heap, surfaces[i]);
+  }
+
+  for (n = 0;; n++) {
+    num_free = test_get_free_slots (heap, free_slots);
+    heap_size = heap->heap_size;
+
+    __atomic_store_n (&num_allocations_until_failure, n, __ATOMIC_RELAXED);
+    va_st = flu_va_drivers_vdpau_CreateSurfaces (&ctx, WIDTH, HEIGHT,
+        VA_RT_FORMAT_YUV420, NUM_BATCH_SURFACES, batch);
+    __atomic_store_n (&num_allocations_until_failure, -1, __ATOMIC_RELAXED);
+    if (va_st == VA_STATUS_SUCCESS)
+      break;
+
+    if (va_st == VA_STATUS_ERROR_ALLOCATION_FAILED)
+      heap_failures++;
+    else if (va_st == VA_STATUS_ERROR_OPERATION_FAILED)
+      surface_failures++;
+    else
+      FLU_VA_DRIVERS_TEST_CHECK (0);
+
+    new_num_free = test_get_free_slots (heap, new_free_slots);
+    FLU_VA_DRIVERS_TEST_CHECK (new_num_free >= num_free);
+    FLU_VA_DRIVERS_TEST_CHECK (memcmp (free_slots, new_free_slots,
+                                   num_free * sizeof (int)) == 0);
+    for (i = num_free; i < new_num_free; i++)
+      FLU_VA_DRIVERS_TEST_CHECK (new_free_slots[i] >= heap_size);
+
+    for (i = 0; i < NUM_BATCH_SURFACES; i++)
+      FLU_VA_DRIVERS_TEST_CHECK (batch[i] == VA_INVALID_SURFACE);
+    for (i = 0; i < NUM_SURFACES; i++) {
+      FLU_VA_DRIVERS_TEST_CHECK (
+          object_heap_lookup (heap, surfaces[i]) ==
+          (object_base_p) surface_objs[i]);
+    }
+    num_allocated = 0;
+    for (obj = object_heap_first (heap, &iter); obj != NULL;
+         obj = object_heap_next (heap, &iter))
+      num_allocated++;
+    FLU_VA_DRIVERS_TEST_CHECK (num_allocated == NUM_SURFACES);
+  }
+  FLU_VA_DRIVERS_TEST_CHECK (heap_failures > 0 && surface_failures > 0);
+
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_DestroySurfaces (&ctx, batch, NUM_BATCH_SURFACES) ==
+      VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_DestroySurfaces (&ctx, surfaces, NUM_SURFACES) ==
+      VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_Terminate (&ctx) == VA_STATUS_SUCCESS);
+}
+
+int
+main (int argc, char **argv)
+{
+  test_steady_state ();
+  test_create_surfaces_rollback ();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,411 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Replays the VA buffers of AV1 frames through the translator of the VDPAU
+ * driver and checks the resulting VdpPictureInfoAV1: the picture parameters,
+ * the reference slots and the sizes and order hints remembered for them, and
+ * the tile offsets across the adopted slice data buffers. */
+
+#include "flu_va_drivers_vdpau_av1.h"
+#include "flu_va_drivers_vdpau_test_translator.h"
+
+#define AV1_KEY_FRAME 0
+#define AV1_INTER_FRAME 1
+#define AV1_PRIMARY_REF_NONE 7
+
+static void
+test_init_pic_param (VADecPictureParameterBufferAV1 *param,
+    unsigned int frame_type, VASurfaceID current_frame, uint8_t order_hint)
+{
+  unsigned int i;
+
+  memset (param, 0, sizeof (*param));
+  param->order_hint_bits_minus_1 = 6;
+  param->seq_info_fields.fields.enable_order_hint = 1;
+  param->seq_info_fields.fields.enable_cdef = 1;
+  param->seq_info_fields.fields.subsampling_x = 1;
+  param->seq_info_fields.fields.subsampling_y = 1;
+  param->current_frame = current_frame;
+  param->current_display_picture = current_frame;
+  param->frame_width_minus1 = 351;
+  param->frame_height_minus1 = 287;
+  for (i = 0; i < 8; i++)
+    param->ref_frame_map[i] = VA_INVALID_SURFACE;
+  param->primary_ref_frame = AV1_PRIMARY_REF_NONE;
+  param->order_hint = order_hint;
+  param->tile_cols = 1;
+  param->tile_rows = 1;
+  param->width_in_sbs_minus_1[0] = 5;
+  param->height_in_sbs_minus_1[0] = 4;
+  param->pic_info_fields.bits.frame_type = frame_type;
+  param->pic_info_fields.bits.show_frame = 1;
+  param->base_qindex = 100;
+}
+
+static VAStatus
+test_render_pic_param (FluVaDriversVdpauTestTranslator *fixture,
+    VADecPictureParameterBufferAV1 *param)
+{
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  fixture->context_obj.current_render_target = param->current_frame;
+  return flu_va_drivers_vdpau_test_translator_render (
+      fixture, VAPictureParameterBufferType, param, sizeof (*param));
+}
+
+static void
+test_pic_param (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const VdpPictureInfoAV1 *info = &fixture->context_obj.vdp_pic_info.av1;
+  VADecPictureParameterBufferAV1 param;
+  FluVaDriversVdpauDecoderConfig decoder_config;
+  unsigned int i;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_AV1);
+
+  test_init_pic_param (&param, AV1_KEY_FRAME, fixture->surfaces[0], 0);
+  param.bit_depth_idx = 1;
+  param.tile_cols = 2;
+  param.width_in_sbs_minus_1[1] = 2;
+  param.pic_info_fields.bits.use_superres = 1;
+  param.superres_scale_denominator = 12;
+  /* Primary strength 3, secondary strength 1. */
+  param.cdef_y_strengths[1] = (3 << 2) | 1;
+  param.cdef_uv_strengths[2] = (2 << 2) | 3;
+  param.loop_restoration_fields.bits.cbframe_restoration_type = 2;
+  param.loop_restoration_fields.bits.lr_unit_shift = 1;
+  param.loop_restoration_fields.bits.lr_uv_shift = 1;
+  param.y_dc_delta_q = -3;
+  param.ref_deltas[2] = -1;
+  param.mode_control_fields.bits.tx_mode = 2;
+  /* The slots of a key frame are not looked up. */
+  for (i = 0; i < 8; i++)
+    param.ref_frame_map[i] = VA_INVALID_SURFACE - 1;
+
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_pic_param (fixture, &param) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->width == 352);
+  FLU_VA_DRIVERS_TEST_CHECK (info->height == 288);
+  FLU_VA_DRIVERS_TEST_CHECK (info->bit_depth_minus8 == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->enable_order_hint == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->order_hint_bits_minus1 == 6);
+  FLU_VA_DRIVERS_TEST_CHECK (info->enable_cdef == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->frame_type == AV1_KEY_FRAME);
+  FLU_VA_DRIVERS_TEST_CHECK (info->show_frame == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->enable_superres == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->coded_denom == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->num_tile_cols == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->num_tile_rows == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->tile_widths[0] == 6);
+  FLU_VA_DRIVERS_TEST_CHECK (info->tile_widths[1] == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->tile_heights[0] == 5);
+  /* VDPAU has the secondary strength in the high bits. */
+  FLU_VA_DRIVERS_TEST_CHECK (info->cdef_y_strength[1] == ((1 << 4) | 3));
+  FLU_VA_DRIVERS_TEST_CHECK (info->cdef_uv_strength[2] == ((3 << 4) | 2));
+  FLU_VA_DRIVERS_TEST_CHECK (info->enable_restoration == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->lr_type[0] == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->lr_type[1] == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->lr_unit_size[0] == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->lr_unit_size[1] == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->lr_unit_size[2] == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->base_qindex == 100);
+  FLU_VA_DRIVERS_TEST_CHECK (info->qp_y_dc_delta_q == -3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->loop_filter_ref_deltas[2] == -1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->tx_mode == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->coded_lossless == 0);
+  for (i = 0; i < 8; i++)
+    FLU_VA_DRIVERS_TEST_CHECK (info->ref_frame_map[i] == VDP_INVALID_HANDLE);
+  for (i = 0; i < 7; i++)
+    FLU_VA_DRIVERS_TEST_CHECK (info->ref_frame[i].index == VDP_INVALID_HANDLE);
+  FLU_VA_DRIVERS_TEST_CHECK (info->primary_ref_frame == VDP_INVALID_HANDLE);
+
+  flu_va_drivers_vdpau_test_translator_end_picture (
+      fixture, &decoder_config);
+  FLU_VA_DRIVERS_TEST_CHECK (decoder_config.max_references == 8);
+  FLU_VA_DRIVERS_TEST_CHECK (decoder_config.width == 352);
+  FLU_VA_DRIVERS_TEST_CHECK (decoder_config.height == 288);
+
+  /* Lossless needs a zero quantizer index in every segment. */
+  test_init_pic_param (&param, AV1_KEY_FRAME, fixture->surfaces[0], 0);
+  param.base_qindex = 0;
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_pic_param (fixture, &param) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->coded_lossless == 1);
+  param.seg_info.segment_info_fields.bits.enabled = 1;
+  param.seg_info.feature_mask[5] = 1;
+  param.seg_info.feature_data[5][0] = 4;
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_pic_param (fixture, &param) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentation_enabled == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentation_feature_mask[5] == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentation_feature_data[5][0] == 4);
+  FLU_VA_DRIVERS_TEST_CHECK (info->coded_lossless == 0);
+  param.seg_info.feature_data[5][0] = 0;
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_pic_param (fixture, &param) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->coded_lossless == 1);
+
+  /* Only the Main profile is supported, without large scale tiles. */
+  test_init_pic_param (&param, AV1_KEY_FRAME, fixture->surfaces[0], 0);
+  param.profile = 1;
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_pic_param (fixture, &param) == VA_STATUS_ERROR_UNKNOWN);
+  test_init_pic_param (&param, AV1_KEY_FRAME, fixture->surfaces[0], 0);
+  param.pic_info_fields.bits.large_scale_tile = 1;
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_pic_param (fixture, &param) == VA_STATUS_ERROR_UNKNOWN);
+  test_init_pic_param (&param, AV1_KEY_FRAME, fixture->surfaces[0], 0);
+  param.tile_cols = 64;
+  FLU_VA_DRIVERS_TEST_CHECK (test_render_pic_param (fixture, &param) ==
+                             VA_STATUS_ERROR_INVALID_PARAMETER);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+/* VA only gives the order hint and size of the current frame, those of the
+ * references come from the frames that filled their slot. */
+static void
+test_references (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const VdpPictureInfoAV1 *info = &fixture->context_obj.vdp_pic_info.av1;
+  VASurfaceID *surfaces = fixture->surfaces;
+  VdpVideoSurface *vdp_surfaces = fixture->vdp_surfaces;
+  VADecPictureParameterBufferAV1 param;
+  unsigned int i;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_AV1);
+
+  /* A key frame, then a smaller inter frame referencing it in every
+   * slot. */
+  test_init_pic_param (&param, AV1_KEY_FRAME, surfaces[0], 0);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_pic_param (fixture, &param) == VA_STATUS_SUCCESS);
+
+  test_init_pic_param (&param, AV1_INTER_FRAME, surfaces[1], 4);
+  param.frame_width_minus1 = 319;
+  param.frame_height_minus1 = 239;
+  for (i = 0; i < 8; i++)
+    param.ref_frame_map[i] = surfaces[0];
+  for (i = 0; i < 7; i++)
+    param.ref_frame_idx[i] = i;
+  param.primary_ref_frame = 0;
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_pic_param (fixture, &param) == VA_STATUS_SUCCESS);
+  for (i = 0; i < 8; i++)
+    FLU_VA_DRIVERS_TEST_CHECK (info->ref_frame_map[i] == vdp_surfaces[0]);
+  for (i = 0; i < 7; i++) {
+    FLU_VA_DRIVERS_TEST_CHECK (info->ref_frame[i].index == vdp_surfaces[0]);
+    FLU_VA_DRIVERS_TEST_CHECK (info->ref_frame[i].width == 352);
+    FLU_VA_DRIVERS_TEST_CHECK (info->ref_frame[i].height == 288);
+  }
+  FLU_VA_DRIVERS_TEST_CHECK (info->primary_ref_frame == vdp_surfaces[0]);
+  FLU_VA_DRIVERS_TEST_CHECK (info->SkipModeFrame0 == 0);
+
+  /* A frame between both: the skip mode uses the closest forward and
+   * backward references, LAST_FRAME and LAST2_FRAME. */
+  test_init_pic_param (&param, AV1_INTER_FRAME, surfaces[2], 2);
+  for (i = 0; i < 8; i++)
+    param.ref_frame_map[i] = surfaces[0];
+  param.ref_frame_map[1] = surfaces[1];
+  param.ref_frame_idx[1] = 1;
+  param.primary_ref_frame = 1;
+  param.mode_control_fields.bits.skip_mode_present = 1;
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_pic_param (fixture, &param) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->ref_frame[0].index == vdp_surfaces[0]);
+  FLU_VA_DRIVERS_TEST_CHECK (info->ref_frame[0].width == 352);
+  FLU_VA_DRIVERS_TEST_CHECK (info->ref_frame[1].index == vdp_surfaces[1]);
+  FLU_VA_DRIVERS_TEST_CHECK (info->ref_frame[1].width == 320);
+  FLU_VA_DRIVERS_TEST_CHECK (info->ref_frame[1].height == 240);
+  FLU_VA_DRIVERS_TEST_CHECK (info->primary_ref_frame == vdp_surfaces[1]);
+  FLU_VA_DRIVERS_TEST_CHECK (info->skip_mode == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->SkipModeFrame0 == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->SkipModeFrame1 == 2);
+
+  /* With film grain, the frame is decoded to its display picture, which
+   * the next frames reference in its place. */
+  test_init_pic_param (&param, AV1_INTER_FRAME, surfaces[3], 6);
+  param.current_display_picture = surfaces[4];
+  for (i = 0; i < 8; i++)
+    param.ref_frame_map[i] = surfaces[2];
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_pic_param (fixture, &param) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      fixture->context_obj.current_render_target == surfaces[4]);
+
+  test_init_pic_param (&param, AV1_INTER_FRAME, surfaces[5], 8);
+  for (i = 0; i < 8; i++)
+    param.ref_frame_map[i] = surfaces[3];
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_pic_param (fixture, &param) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->ref_frame_map[0] == vdp_surfaces[4]);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      fixture->context_obj.current_render_target == surfaces[5]);
+
+  /* A slot that no reference uses may hold a surface that is gone. */
+  param.ref_frame_map[7] =
+      FLU_VA_DRIVERS_TEST_SURFACE_ID_OFFSET + FLU_VA_DRIVERS_TEST_NUM_SURFACES;
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_pic_param (fixture, &param) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->ref_frame_map[7] == VDP_INVALID_HANDLE);
+  param.ref_frame_idx[6] = 7;
+  FLU_VA_DRIVERS_TEST_CHECK (test_render_pic_param (fixture, &param) ==
+                             VA_STATUS_ERROR_INVALID_SURFACE);
+  param.ref_frame_idx[6] = 8;
+  FLU_VA_DRIVERS_TEST_CHECK (test_render_pic_param (fixture, &param) ==
+                             VA_STATUS_ERROR_INVALID_PARAMETER);
+
+  /* A display picture that is not a surface of the driver. */
+  test_init_pic_param (&param, AV1_KEY_FRAME, surfaces[0], 0);
+  param.current_display_picture =
+      FLU_VA_DRIVERS_TEST_SURFACE_ID_OFFSET + FLU_VA_DRIVERS_TEST_NUM_SURFACES;
+  FLU_VA_DRIVERS_TEST_CHECK (test_render_pic_param (fixture, &param) ==
+                             VA_STATUS_ERROR_INVALID_SURFACE);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+static void
+test_render_tile (FluVaDriversVdpauTestTranslator *fixture,
+    unsigned int tile_row, unsigned int tile_column, uint32_t offset,
+    uint32_t size)
+{
+  VASliceParameterBufferAV1 slice_param;
+
+  memset (&slice_param, 0, sizeof (slice_param));
+  slice_param.slice_data_offset = offset;
+  slice_param.slice_data_size = size;
+  slice_param.slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+  slice_param.tile_row = tile_row;
+  slice_param.tile_column = tile_column;
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceParameterBufferType,
+                                 &slice_param, sizeof (slice_param)) ==
+                             VA_STATUS_SUCCESS);
+}
+
+/* Renders a slice data buffer of size bytes from the buffer pool, as
+ * vaCreateBuffer does, and returns the storage it is left with. */
+static VAStatus
+test_render_tile_groups (FluVaDriversVdpauTestTranslator *fixture,
+    uint32_t size, void **data)
+{
+  FluVaDriversVdpauBufferPool *pool = &fixture->driver_data.buffer_pool;
+  FluVaDriversVdpauBufferObject buffer_obj;
+  VAStatus ret;
+
+  memset (&buffer_obj, 0, sizeof (buffer_obj));
+  buffer_obj.type = VASliceDataBufferType;
+  buffer_obj.data = flu_va_drivers_vdpau_buffer_pool_acquire (
+      pool, size, &buffer_obj.capacity);
+  FLU_VA_DRIVERS_TEST_CHECK (buffer_obj.data != NULL);
+  memset (buffer_obj.data, size, size);
+  buffer_obj.size = size;
+  buffer_obj.num_elements = 1;
+  buffer_obj.derived_image = VA_INVALID_ID;
+  *data = buffer_obj.data;
+
+  ret = fixture->context_obj.codec_ops->translate_buffer (
+      &fixture->ctx, &fixture->context_obj, &buffer_obj);
+  /* Adopted by the bitstream, or still owned by the buffer object. */
+  FLU_VA_DRIVERS_TEST_CHECK ((ret == VA_STATUS_SUCCESS) ==
+                             (buffer_obj.data != *data));
+  flu_va_drivers_vdpau_buffer_pool_release (
+      pool, buffer_obj.data, buffer_obj.capacity);
+
+  return ret;
+}
+
+/* The tile groups are not copied, and the tile offsets are relative to the
+ * whole picture, across the slice data buffers. */
+static void
+test_tile_groups (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const VdpPictureInfoAV1 *info = &fixture->context_obj.vdp_pic_info.av1;
+  const FluVaDriversVdpauBitstream *bitstream =
+      &fixture->context_obj.bitstream;
+  VADecPictureParameterBufferAV1 param;
+  static const uint32_t expected[] = { 0, 10, 10, 16, 16, 21, 21, 28 };
+  void *data[2];
+  unsigned int i;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_AV1);
+  test_init_pic_param (&param, AV1_KEY_FRAME, fixture->surfaces[0], 0);
+  param.tile_cols = 2;
+  param.tile_rows = 2;
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_pic_param (fixture, &param) == VA_STATUS_SUCCESS);
+
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_tile_groups (fixture, 16, &data[0]) ==
+      VA_STATUS_ERROR_UNKNOWN);
+
+  test_render_tile (fixture, 0, 0, 0, 10);
+  test_render_tile (fixture, 0, 1, 10, 6);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_tile_groups (fixture, 16, &data[0]) == VA_STATUS_SUCCESS);
+  test_render_tile (fixture, 1, 0, 0, 5);
+  test_render_tile (fixture, 1, 1, 5, 7);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_tile_groups (fixture, 12, &data[1]) == VA_STATUS_SUCCESS);
+
+  for (i = 0; i < sizeof (expected) / sizeof (*expected); i++)
+    FLU_VA_DRIVERS_TEST_CHECK (info->tile_info[i] == expected[i]);
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->num_buffers == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->buffers[0].bitstream == data[0]);
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->buffers[0].bitstream_bytes == 16);
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->buffers[1].bitstream == data[1]);
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->buffers[1].bitstream_bytes == 12);
+
+  /* A tile outside of the tile grid, and one past its data. */
+  test_render_tile (fixture, 2, 0, 0, 4);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_tile_groups (fixture, 4, &data[0]) ==
+      VA_STATUS_ERROR_INVALID_PARAMETER);
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->num_buffers == 0);
+  test_render_tile (fixture, 1, 1, 2, 4);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_render_tile_groups (fixture, 4, &data[0]) ==
+      VA_STATUS_ERROR_INVALID_BUFFER);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+int
+main (int argc, char **argv)
+{
+  test_pic_param ();
+  test_references ();
+  test_tile_groups ();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,367 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Calls the entry points of the VDPAU driver on a stub device and checks
+ * what reaches the device. */
+
+#include "flu_va_drivers_vdpau_test_driver.h"
+
+#define WIDTH 320
+#define HEIGHT 240
+#define NUM_SURFACES 4
+
+typedef struct _TestFixture TestFixture;
+
+struct _TestFixture
+{
+  struct VADriverContext ctx;
+  VAConfigID config;
+  VAContextID context;
+  VASurfaceID surfaces[NUM_SURFACES];
+};
+
+static void
+test_fixture_init (TestFixture *fixture)
+{
+  VADriverContextP ctx = &fixture->ctx;
+
+  memset (fixture, 0, sizeof (*fixture));
+  flu_va_drivers_vdpau_test_driver_init (ctx);
+
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateConfig (ctx, VAProfileH264High,
+          VAEntrypointVLD, NULL, 0, &fixture->config) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateSurfaces (ctx, WIDTH, HEIGHT,
+          VA_RT_FORMAT_YUV420, NUM_SURFACES,
+          fixture->surfaces) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateContext (ctx, fixture->config, WIDTH, HEIGHT,
+          VA_PROGRESSIVE, fixture->surfaces, NUM_SURFACES,
+          &fixture->context) == VA_STATUS_SUCCESS);
+}
+
+static void
+test_fixture_finalize (TestFixture *fixture)
+{
+  VADriverContextP ctx = &fixture->ctx;
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyContext (
+                                 ctx, fixture->context) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_DestroySurfaces (ctx, fixture->surfaces,
+          NUM_SURFACES) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyConfig (
+                                 ctx, fixture->config) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_Terminate (ctx) == VA_STATUS_SUCCESS);
+}
+
+/* Decodes frame n with num_ref_frames in the SPS and waits for it. */
+static void
+test_fixture_decode_frame (
+    TestFixture *fixture, unsigned int num_ref_frames, unsigned int n)
+{
+  VASurfaceID target = fixture->surfaces[n % NUM_SURFACES];
+
+  flu_va_drivers_vdpau_test_driver_decode_h264 (&fixture->ctx,
+      fixture->context, WIDTH, HEIGHT, num_ref_frames, n, target,
+      n > 0 ? fixture->surfaces[(n - 1) % NUM_SURFACES] : VA_INVALID_SURFACE);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_SyncSurface (
+                                 &fixture->ctx, target) == VA_STATUS_SUCCESS);
+}
+
+/* The decoder holds the references of the SPS, not those the context was
+ * created for, whether the stream uses fewer or more of them. */
+static void
+test_decoder_references (void)
+{
+  static const unsigned int num_ref_frames[] = { 1, 3, 1, 16 };
+  TestFixture fixture;
+  unsigned int i, n = 0;
+
+  test_fixture_init (&fixture);
+
+  for (i = 0; i < sizeof (num_ref_frames) / sizeof (num_ref_frames[0]);
+       i++) {
+    test_fixture_decode_frame (&fixture, num_ref_frames[i], n++);
+    FLU_VA_DRIVERS_TEST_CHECK (
+        flu_va_drivers_vdpau_test_get_render_max_references () ==
+        num_ref_frames[i]);
+    test_fixture_decode_frame (&fixture, num_ref_frames[i], n++);
+    FLU_VA_DRIVERS_TEST_CHECK (
+        flu_va_drivers_vdpau_test_get_render_max_references () ==
+        num_ref_frames[i]);
+  }
+
+  test_fixture_finalize (&fixture);
+}
+
+static int
+test_fixture_has_contexts (TestFixture *fixture)
+{
+  FluVaDriversVdpauDriverData *driver_data =
+      (FluVaDriversVdpauDriverData *) fixture->ctx.pDriverData;
+  object_heap_iterator iter;
+
+  return object_heap_first (&driver_data->context_heap, &iter) != NULL;
+}
+
+/* A context that fails to be created leaves no slot behind, Terminate would
+ * destroy it otherwise. */
+static void
+test_create_context_errors (void)
+{
+  VASurfaceID surfaces[2];
+  TestFixture fixture;
+  VAContextID context;
+
+  test_fixture_init (&fixture);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyContext (&fixture.ctx,
+                                 fixture.context) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (!test_fixture_has_contexts (&fixture));
+
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateContext (&fixture.ctx, fixture.config,
+          1 << 16, HEIGHT, VA_PROGRESSIVE, fixture.surfaces, NUM_SURFACES,
+          &context) == VA_STATUS_ERROR_RESOLUTION_NOT_SUPPORTED);
+  FLU_VA_DRIVERS_TEST_CHECK (!test_fixture_has_contexts (&fixture));
+
+  surfaces[0] = fixture.surfaces[0];
+  surfaces[1] = VA_INVALID_SURFACE;
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateContext (&fixture.ctx, fixture.config, WIDTH,
+          HEIGHT, VA_PROGRESSIVE, surfaces, 2,
+          &context) == VA_STATUS_ERROR_INVALID_SURFACE);
+  FLU_VA_DRIVERS_TEST_CHECK (!test_fixture_has_contexts (&fixture));
+
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateContext (&fixture.ctx, fixture.config, WIDTH,
+          HEIGHT, VA_PROGRESSIVE, fixture.surfaces, NUM_SURFACES,
+          &fixture.context) == VA_STATUS_SUCCESS);
+  test_fixture_finalize (&fixture);
+}
+
+/* A picture decoded into a surface while one of its derived images is
+ * mapped is kept over the writes to the mapping. */
+static void
+test_derive_image_decode_while_mapped (void)
+{
+  VADriverContextP ctx;
+  TestFixture fixture;
+  VAImage image;
+  uint8_t *data;
+  uint8_t decoded;
+
+  test_fixture_init (&fixture);
+  ctx = &fixture.ctx;
+  test_fixture_decode_frame (&fixture, 1, 0);
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DeriveImage (ctx,
+                                 fixture.surfaces[0], &image) ==
+                             VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_MapBuffer (ctx, image.buf,
+                                 (void **) &data) == VA_STATUS_SUCCESS);
+  memset (data, 0x11, image.data_size);
+
+  flu_va_drivers_vdpau_test_driver_decode_h264 (ctx, fixture.context, WIDTH,
+      HEIGHT, 1, 4, fixture.surfaces[0], VA_INVALID_SURFACE);
+  decoded = flu_va_drivers_vdpau_test_get_num_renders ();
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_UnmapBuffer (ctx, image.buf) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_SyncSurface (ctx, fixture.surfaces[0]) ==
+      VA_STATUS_SUCCESS);
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_MapBuffer (ctx, image.buf,
+                                 (void **) &data) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (data[image.offsets[0]] == decoded);
+  FLU_VA_DRIVERS_TEST_CHECK (data[image.offsets[1]] == decoded);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_UnmapBuffer (ctx, image.buf) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyImage (
+                                 ctx, image.image_id) == VA_STATUS_SUCCESS);
+
+  test_fixture_finalize (&fixture);
+}
+
+/* Reads the luma sample at (x, y) of the surface through vaGetImage. */
+static uint8_t
+test_fixture_get_luma (
+    TestFixture *fixture, VASurfaceID surface, unsigned int x, unsigned int y)
+{
+  VADriverContextP ctx = &fixture->ctx;
+  VAImageFormat format = { .fourcc = VA_FOURCC_NV12 };
+  VAImage image;
+  uint8_t *data, luma;
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_CreateImage (ctx, &format,
+                                 WIDTH, HEIGHT, &image) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_GetImage (ctx, surface, 0, 0, WIDTH, HEIGHT,
+          image.image_id) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_MapBuffer (ctx, image.buf,
+                                 (void **) &data) == VA_STATUS_SUCCESS);
+  luma = data[image.offsets[0] + y * image.pitches[0] + x];
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_UnmapBuffer (ctx, image.buf) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyImage (
+                                 ctx, image.image_id) == VA_STATUS_SUCCESS);
+
+  return luma;
+}
+
+/* A derived image mapped without access flags is only uploaded to its
+ * surface when it was written to. */
+static void
+test_derive_image_map_access (void)
+{
+  VADriverContextP ctx;
+  TestFixture fixture;
+  VAImage image;
+  unsigned int num_put_bits;
+  uint8_t *data, sum = 0;
+  unsigned int i;
+
+  test_fixture_init (&fixture);
+  ctx = &fixture.ctx;
+  test_fixture_decode_frame (&fixture, 1, 0);
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DeriveImage (ctx,
+                                 fixture.surfaces[0], &image) ==
+                             VA_STATUS_SUCCESS);
+  num_put_bits = flu_va_drivers_vdpau_test_get_num_put_bits ();
+  for (i = 0; i < 4; i++) {
+    FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_MapBuffer (ctx,
+                                   image.buf, (void **) &data) ==
+                               VA_STATUS_SUCCESS);
+    sum += data[image.offsets[0] + i];
+    FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_UnmapBuffer (
+                                   ctx, image.buf) == VA_STATUS_SUCCESS);
+  }
+  FLU_VA_DRIVERS_TEST_CHECK (sum != 0);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_test_get_num_put_bits () == num_put_bits);
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_MapBuffer (ctx, image.buf,
+                                 (void **) &data) == VA_STATUS_SUCCESS);
+  data[image.offsets[0] + image.pitches[0] + 1] = 0x42;
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_UnmapBuffer (ctx, image.buf) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_test_get_num_put_bits () == num_put_bits + 1);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_fixture_get_luma (&fixture, fixture.surfaces[0], 1, 1) == 0x42);
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyImage (
+                                 ctx, image.image_id) == VA_STATUS_SUCCESS);
+  test_fixture_finalize (&fixture);
+}
+
+/* A surface destroyed while it is the reference of a queued decode to
+ * another surface is only released once that decode is done. */
+static void
+test_destroy_reference_surface (void)
+{
+  VADriverContextP ctx;
+  TestFixture fixture;
+  unsigned int num_renders;
+
+  test_fixture_init (&fixture);
+  ctx = &fixture.ctx;
+  test_fixture_decode_frame (&fixture, 1, 0);
+
+  num_renders = flu_va_drivers_vdpau_test_get_num_renders ();
+  flu_va_drivers_vdpau_test_set_render_delay (50);
+  flu_va_drivers_vdpau_test_driver_decode_h264 (ctx, fixture.context, WIDTH,
+      HEIGHT, 1, 1, fixture.surfaces[1], fixture.surfaces[0]);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroySurfaces (ctx,
+                                 &fixture.surfaces[0], 1) ==
+                             VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_test_get_num_renders () == num_renders + 1);
+  flu_va_drivers_vdpau_test_set_render_delay (0);
+
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateSurfaces (ctx, WIDTH, HEIGHT,
+          VA_RT_FORMAT_YUV420, 1, &fixture.surfaces[0]) == VA_STATUS_SUCCESS);
+  test_fixture_finalize (&fixture);
+}
+
+/* Surfaces without context have nothing to wait for, whether they were
+ * never decoded to or their context was destroyed. */
+static void
+test_sync_surface_without_context (void)
+{
+  VADriverContextP ctx;
+  TestFixture fixture;
+  VASurfaceID surface;
+  VASurfaceStatus status;
+  unsigned int i;
+
+  test_fixture_init (&fixture);
+  ctx = &fixture.ctx;
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateSurfaces (ctx, WIDTH, HEIGHT,
+          VA_RT_FORMAT_YUV420, 1, &surface) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_SyncSurface (ctx, surface) == VA_STATUS_SUCCESS);
+
+  for (i = 0; i < NUM_SURFACES; i++) {
+    flu_va_drivers_vdpau_test_driver_decode_h264 (ctx, fixture.context,
+        WIDTH, HEIGHT, 1, i, fixture.surfaces[i],
+        i > 0 ? fixture.surfaces[i - 1] : VA_INVALID_SURFACE);
+  }
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyContext (ctx,
+                                 fixture.context) == VA_STATUS_SUCCESS);
+  for (i = 0; i < NUM_SURFACES; i++) {
+    FLU_VA_DRIVERS_TEST_CHECK (
+        flu_va_drivers_vdpau_SyncSurface (ctx, fixture.surfaces[i]) ==
+        VA_STATUS_SUCCESS);
+    FLU_VA_DRIVERS_TEST_CHECK (
+        flu_va_drivers_vdpau_QuerySurfaceStatus (ctx, fixture.surfaces[i],
+            &status) == VA_STATUS_SUCCESS);
+    FLU_VA_DRIVERS_TEST_CHECK (status == VASurfaceReady);
+  }
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroySurfaces (
+                                 ctx, &surface, 1) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateContext (ctx, fixture.config, WIDTH, HEIGHT,
+          VA_PROGRESSIVE, fixture.surfaces, NUM_SURFACES,
+          &fixture.context) == VA_STATUS_SUCCESS);
+  test_fixture_finalize (&fixture);
+}
+
+int
+main (int argc, char **argv)
+{
+  test_decoder_references ();
+  test_create_context_errors ();
+  test_derive_image_decode_while_mapped ();
+  test_derive_image_map_access ();
+  test_destroy_reference_surface ();
+  test_sync_surface_without_context ();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,508 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Replays the VA buffers of HEVC pictures through the translator of the
+ * VDPAU driver and checks the resulting VdpPictureInfoHEVC: the picture
+ * parameters, the reference picture sets, the scaling lists and the fields
+ * parsed from the first slice segment header. */
+
+#include "flu_va_drivers_vdpau_hevc.h"
+#include "flu_va_drivers_vdpau_test_translator.h"
+
+#define NAL_TRAIL_R 1
+#define NAL_BLA_W_LP 16
+#define NAL_IDR_W_RADL 19
+#define NAL_RSV_IRAP_23 23
+
+/* Slice segment header writer, with emulation prevention. */
+typedef struct _TestBitWriter TestBitWriter;
+
+struct _TestBitWriter
+{
+  uint8_t data[64];
+  size_t size;
+  unsigned int num_bits;
+  unsigned int num_zeros;
+  uint8_t byte;
+};
+
+static void
+test_bit_writer_put_byte (TestBitWriter *writer, uint8_t byte)
+{
+  if (writer->num_zeros >= 2 && byte <= 3) {
+    writer->data[writer->size++] = 3;
+    writer->num_zeros = 0;
+  }
+  writer->data[writer->size++] = byte;
+  writer->num_zeros = byte == 0 ? writer->num_zeros + 1 : 0;
+}
+
+static void
+test_bit_writer_init (TestBitWriter *writer)
+{
+  static const uint8_t start_code[] = { 0, 0, 1 };
+
+  memset (writer, 0, sizeof (*writer));
+  memcpy (writer->data, start_code, sizeof (start_code));
+  writer->size = sizeof (start_code);
+}
+
+static void
+test_bit_writer_put (TestBitWriter *writer, uint32_t value, unsigned int n)
+{
+  while (n-- > 0) {
+    writer->byte = (writer->byte << 1) | ((value >> n) & 1);
+    if (++writer->num_bits % 8 == 0) {
+      test_bit_writer_put_byte (writer, writer->byte);
+      writer->byte = 0;
+    }
+  }
+}
+
+static void
+test_bit_writer_put_ue (TestBitWriter *writer, uint32_t value)
+{
+  unsigned int n = 0;
+
+  while ((value + 1) >> (n + 1))
+    n++;
+  test_bit_writer_put (writer, 0, n);
+  test_bit_writer_put (writer, value + 1, n + 1);
+}
+
+/* Writes the rbsp stop bit, then some slice data. */
+static void
+test_bit_writer_finish (TestBitWriter *writer)
+{
+  test_bit_writer_put (writer, 1, 1);
+  while (writer->num_bits % 8 != 0)
+    test_bit_writer_put (writer, 0, 1);
+  test_bit_writer_put (writer, 0xa5a5a5a5, 32);
+}
+
+static void
+test_bit_writer_put_nal_header (TestBitWriter *writer, unsigned int type)
+{
+  test_bit_writer_put (writer, 0, 1);
+  test_bit_writer_put (writer, type, 6);
+  test_bit_writer_put (writer, 1, 9); /* nuh_layer_id, nuh_temporal_id_plus1 */
+  test_bit_writer_put (writer, 1, 1); /* first_slice_segment_in_pic_flag */
+}
+
+/* Renders a slice parameter buffer describing the whole slice data buffer,
+ * then the slice data. */
+static void
+test_fixture_render_slice (
+    FluVaDriversVdpauTestTranslator *fixture, TestBitWriter *writer)
+{
+  VASliceParameterBufferHEVC slice_param;
+
+  memset (&slice_param, 0, sizeof (slice_param));
+  slice_param.slice_data_size = writer->size;
+  slice_param.LongSliceFlags.fields.LastSliceOfPic = 1;
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceParameterBufferType,
+                                 &slice_param, sizeof (slice_param)) ==
+                             VA_STATUS_SUCCESS);
+  /* The driver copies the parameters, the client may reuse them. */
+  memset (&slice_param, 0xff, sizeof (slice_param));
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceDataBufferType, writer->data,
+                                 writer->size) == VA_STATUS_SUCCESS);
+}
+
+static void
+test_init_pic_param (VAPictureParameterBufferHEVC *param)
+{
+  unsigned int i;
+
+  memset (param, 0, sizeof (*param));
+  param->CurrPic.picture_id = VA_INVALID_SURFACE;
+  param->CurrPic.flags = VA_PICTURE_HEVC_INVALID;
+  for (i = 0; i < 15; i++) {
+    param->ReferenceFrames[i].picture_id = VA_INVALID_SURFACE;
+    param->ReferenceFrames[i].flags = VA_PICTURE_HEVC_INVALID;
+  }
+
+  param->pic_width_in_luma_samples = 1920;
+  param->pic_height_in_luma_samples = 1080;
+  param->pic_fields.bits.chroma_format_idc = 1;
+  param->pic_fields.bits.amp_enabled_flag = 1;
+  param->pic_fields.bits.strong_intra_smoothing_enabled_flag = 1;
+  param->pic_fields.bits.tiles_enabled_flag = 1;
+  param->sps_max_dec_pic_buffering_minus1 = 5;
+  param->bit_depth_luma_minus8 = 2;
+  param->bit_depth_chroma_minus8 = 2;
+  param->log2_min_luma_coding_block_size_minus3 = 0;
+  param->log2_diff_max_min_luma_coding_block_size = 3;
+  param->log2_diff_max_min_transform_block_size = 3;
+  param->init_qp_minus26 = -4;
+  param->pps_cb_qp_offset = -2;
+  param->pps_cr_qp_offset = 3;
+  param->num_tile_columns_minus1 = 2;
+  param->num_tile_rows_minus1 = 1;
+  param->column_width_minus1[0] = 9;
+  param->column_width_minus1[1] = 9;
+  param->column_width_minus1[2] = 9;
+  param->row_height_minus1[0] = 7;
+  param->row_height_minus1[1] = 8;
+  param->slice_parsing_fields.bits.sample_adaptive_offset_enabled_flag = 1;
+  param->slice_parsing_fields.bits.sps_temporal_mvp_enabled_flag = 1;
+  param->log2_max_pic_order_cnt_lsb_minus4 = 4;
+  param->num_short_term_ref_pic_sets = 3;
+  param->pps_beta_offset_div2 = 1;
+  param->num_extra_slice_header_bits = 2;
+  param->slice_parsing_fields.bits.output_flag_present_flag = 1;
+}
+
+static void
+test_pic_param (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const VdpPictureInfoHEVC *info = &fixture->context_obj.vdp_pic_info.hevc;
+  VAPictureParameterBufferHEVC param;
+  FluVaDriversVdpauDecoderConfig decoder_config;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_HEVC);
+  test_init_pic_param (&param);
+  param.CurrPic.pic_order_cnt = 0;
+  param.slice_parsing_fields.bits.IdrPicFlag = 1;
+  param.slice_parsing_fields.bits.RapPicFlag = 1;
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+
+  FLU_VA_DRIVERS_TEST_CHECK (info->chroma_format_idc == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->pic_width_in_luma_samples == 1920);
+  FLU_VA_DRIVERS_TEST_CHECK (info->pic_height_in_luma_samples == 1080);
+  FLU_VA_DRIVERS_TEST_CHECK (info->bit_depth_luma_minus8 == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->bit_depth_chroma_minus8 == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->log2_max_pic_order_cnt_lsb_minus4 == 4);
+  FLU_VA_DRIVERS_TEST_CHECK (info->sps_max_dec_pic_buffering_minus1 == 5);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      info->log2_diff_max_min_luma_coding_block_size == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->amp_enabled_flag == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->sample_adaptive_offset_enabled_flag == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->strong_intra_smoothing_enabled_flag == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->sps_temporal_mvp_enabled_flag == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->num_short_term_ref_pic_sets == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->init_qp_minus26 == -4);
+  FLU_VA_DRIVERS_TEST_CHECK (info->pps_cb_qp_offset == -2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->pps_cr_qp_offset == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->output_flag_present_flag == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->num_extra_slice_header_bits == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->tiles_enabled_flag == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->uniform_spacing_flag == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->num_tile_columns_minus1 == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->num_tile_rows_minus1 == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->column_width_minus1[2] == 9);
+  FLU_VA_DRIVERS_TEST_CHECK (info->row_height_minus1[1] == 8);
+  FLU_VA_DRIVERS_TEST_CHECK (info->pps_beta_offset_div2 == 1);
+  /* Not carried by VA, derived from the deblocking parameters. */
+  FLU_VA_DRIVERS_TEST_CHECK (info->deblocking_filter_control_present_flag);
+  FLU_VA_DRIVERS_TEST_CHECK (info->IDRPicFlag == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->RAPPicFlag == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->NumPocTotalCurr == 0);
+
+  flu_va_drivers_vdpau_test_translator_end_picture (
+      fixture, &decoder_config);
+  FLU_VA_DRIVERS_TEST_CHECK (decoder_config.max_references == 6);
+
+  /* Only 4:2:0 is supported. */
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  param.pic_fields.bits.chroma_format_idc = 2;
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) != VA_STATUS_SUCCESS);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+/* StCurrBefore is sorted by decreasing POC and StCurrAfter by increasing
+ * POC, whatever the order of the VA reference frames. */
+static void
+test_ref_pic_sets (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const VdpPictureInfoHEVC *info = &fixture->context_obj.vdp_pic_info.hevc;
+  VAPictureParameterBufferHEVC param;
+  static const struct
+  {
+    int32_t poc;
+    uint32_t flags;
+  } refs[] = {
+    { 4, VA_PICTURE_HEVC_RPS_ST_CURR_BEFORE },
+    { 16, VA_PICTURE_HEVC_RPS_ST_CURR_AFTER },
+    { 8, VA_PICTURE_HEVC_RPS_ST_CURR_BEFORE },
+    { 0, VA_PICTURE_HEVC_RPS_LT_CURR | VA_PICTURE_HEVC_LONG_TERM_REFERENCE },
+    { 12, VA_PICTURE_HEVC_RPS_ST_CURR_AFTER },
+  };
+  unsigned int i;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_HEVC);
+  test_init_pic_param (&param);
+  param.CurrPic.picture_id =
+      fixture->surfaces[FLU_VA_DRIVERS_TEST_NUM_SURFACES - 1];
+  param.CurrPic.flags = 0;
+  param.CurrPic.pic_order_cnt = 10;
+  for (i = 0; i < sizeof (refs) / sizeof (*refs); i++) {
+    param.ReferenceFrames[i].picture_id = fixture->surfaces[i];
+    param.ReferenceFrames[i].pic_order_cnt = refs[i].poc;
+    param.ReferenceFrames[i].flags = refs[i].flags;
+  }
+  /* Flagged invalid, whatever its surface. */
+  param.ReferenceFrames[i].picture_id = fixture->surfaces[0];
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+
+  for (i = 0; i < sizeof (refs) / sizeof (*refs); i++) {
+    FLU_VA_DRIVERS_TEST_CHECK (info->RefPics[i] == fixture->vdp_surfaces[i]);
+    FLU_VA_DRIVERS_TEST_CHECK (info->PicOrderCntVal[i] == refs[i].poc);
+    FLU_VA_DRIVERS_TEST_CHECK (info->IsLongTerm[i] == (i == 3));
+  }
+  for (; i < 16; i++)
+    FLU_VA_DRIVERS_TEST_CHECK (info->RefPics[i] == VDP_INVALID_HANDLE);
+
+  FLU_VA_DRIVERS_TEST_CHECK (info->CurrPicOrderCntVal == 10);
+  FLU_VA_DRIVERS_TEST_CHECK (info->NumPocStCurrBefore == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->RefPicSetStCurrBefore[0] == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->RefPicSetStCurrBefore[1] == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->NumPocStCurrAfter == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->RefPicSetStCurrAfter[0] == 4);
+  FLU_VA_DRIVERS_TEST_CHECK (info->RefPicSetStCurrAfter[1] == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->NumPocLtCurr == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->RefPicSetLtCurr[0] == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->NumPocTotalCurr == 5);
+
+  /* A reference that is not a surface of the driver. */
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  param.ReferenceFrames[0].picture_id =
+      FLU_VA_DRIVERS_TEST_SURFACE_ID_OFFSET + FLU_VA_DRIVERS_TEST_NUM_SURFACES;
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) ==
+                             VA_STATUS_ERROR_INVALID_SURFACE);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+static void
+test_scaling_lists (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const VdpPictureInfoHEVC *info = &fixture->context_obj.vdp_pic_info.hevc;
+  VAPictureParameterBufferHEVC param;
+  VAIQMatrixBufferHEVC iq_matrix;
+  FluVaDriversVdpauDecoderConfig decoder_config;
+  unsigned int i;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_HEVC);
+  test_init_pic_param (&param);
+  param.pic_fields.bits.scaling_list_enabled_flag = 1;
+
+  for (i = 0; i < sizeof (iq_matrix); i++)
+    ((uint8_t *) &iq_matrix)[i] = i % 251;
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAIQMatrixBufferType, &iq_matrix,
+                                 sizeof (iq_matrix)) == VA_STATUS_SUCCESS);
+  flu_va_drivers_vdpau_test_translator_end_picture (
+      fixture, &decoder_config);
+
+  FLU_VA_DRIVERS_TEST_CHECK (memcmp (info->ScalingList4x4,
+                                 iq_matrix.ScalingList4x4,
+                                 sizeof (iq_matrix.ScalingList4x4)) == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (memcmp (info->ScalingList8x8,
+                                 iq_matrix.ScalingList8x8,
+                                 sizeof (iq_matrix.ScalingList8x8)) == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (memcmp (info->ScalingList16x16,
+                                 iq_matrix.ScalingList16x16,
+                                 sizeof (iq_matrix.ScalingList16x16)) == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (memcmp (info->ScalingList32x32,
+                                 iq_matrix.ScalingList32x32,
+                                 sizeof (iq_matrix.ScalingList32x32)) == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (memcmp (info->ScalingListDCCoeff16x16,
+                                 iq_matrix.ScalingListDC16x16,
+                                 sizeof (iq_matrix.ScalingListDC16x16)) == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (memcmp (info->ScalingListDCCoeff32x32,
+                                 iq_matrix.ScalingListDC32x32,
+                                 sizeof (iq_matrix.ScalingListDC32x32)) == 0);
+
+  /* Without IQ matrix the picture gets the flat lists. */
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+  flu_va_drivers_vdpau_test_translator_end_picture (
+      fixture, &decoder_config);
+  for (i = 0; i < sizeof (info->ScalingList32x32); i++)
+    FLU_VA_DRIVERS_TEST_CHECK (((const uint8_t *) info->ScalingList32x32)[i] ==
+                               16);
+  FLU_VA_DRIVERS_TEST_CHECK (info->ScalingListDCCoeff16x16[5] == 16);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+/* The slice headers follow test_init_pic_param: two extra slice header bits,
+ * output_flag_present_flag, 8-bit POC LSBs and three short-term reference
+ * picture sets in the SPS. */
+static void
+test_slice_header_begin (TestBitWriter *writer, unsigned int nal_unit_type)
+{
+  test_bit_writer_init (writer);
+  test_bit_writer_put_nal_header (writer, nal_unit_type);
+  if (nal_unit_type >= NAL_BLA_W_LP && nal_unit_type <= NAL_RSV_IRAP_23)
+    test_bit_writer_put (writer, 0, 1); /* no_output_of_prior_pics_flag */
+  test_bit_writer_put_ue (writer, 0);   /* slice_pic_parameter_set_id */
+  test_bit_writer_put (writer, 0, 2);   /* slice_reserved_flag */
+  test_bit_writer_put_ue (writer, 1);   /* slice_type */
+  test_bit_writer_put (writer, 1, 1);   /* pic_output_flag */
+  if (nal_unit_type != NAL_IDR_W_RADL)
+    test_bit_writer_put (writer, 0x2a, 8); /* slice_pic_order_cnt_lsb */
+}
+
+static void
+test_render_slice_picture (FluVaDriversVdpauTestTranslator *fixture,
+    VAPictureParameterBufferHEVC *param, TestBitWriter *writer)
+{
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, param,
+                                 sizeof (*param)) == VA_STATUS_SUCCESS);
+  test_bit_writer_finish (writer);
+  test_fixture_render_slice (fixture, writer);
+}
+
+static void
+test_slice_header (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const VdpPictureInfoHEVC *info = &fixture->context_obj.vdp_pic_info.hevc;
+  VAPictureParameterBufferHEVC param;
+  TestBitWriter writer;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_HEVC);
+  test_init_pic_param (&param);
+
+  /* IDR: no reference picture set. */
+  test_slice_header_begin (&writer, NAL_IDR_W_RADL);
+  test_render_slice_picture (fixture, &param, &writer);
+  FLU_VA_DRIVERS_TEST_CHECK (info->CurrRpsIdx == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->NumDeltaPocsOfRefRpsIdx == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->NumLongTermPictureSliceHeaderBits == 0);
+  /* The slice data reaches the bitstream untouched. */
+  FLU_VA_DRIVERS_TEST_CHECK (fixture->context_obj.bitstream.size ==
+                             writer.size);
+  FLU_VA_DRIVERS_TEST_CHECK (memcmp (fixture->context_obj.bitstream.data,
+                                 writer.data, writer.size) == 0);
+
+  /* A set of the SPS, selected with ceil (log2 (3)) bits, and a long-term
+   * picture: num_long_term_pics, poc_lsb_lt, used_by_curr_pic_lt_flag,
+   * delta_poc_msb_present_flag and delta_poc_msb_cycle_lt. */
+  param.slice_parsing_fields.bits.long_term_ref_pics_present_flag = 1;
+  test_slice_header_begin (&writer, NAL_TRAIL_R);
+  test_bit_writer_put (&writer, 1, 1); /* short_term_ref_pic_set_sps_flag */
+  test_bit_writer_put (&writer, 2, 2); /* short_term_ref_pic_set_idx */
+  test_bit_writer_put_ue (&writer, 1);
+  test_bit_writer_put (&writer, 0x11, 8);
+  test_bit_writer_put (&writer, 1, 1);
+  test_bit_writer_put (&writer, 1, 1);
+  test_bit_writer_put_ue (&writer, 3);
+  test_render_slice_picture (fixture, &param, &writer);
+  FLU_VA_DRIVERS_TEST_CHECK (info->CurrRpsIdx == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->NumDeltaPocsOfRefRpsIdx == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->NumLongTermPictureSliceHeaderBits ==
+                             3 + 8 + 1 + 1 + 5);
+
+  /* A set predicted from the last one of the SPS, which has three pictures:
+   * inter_ref_pic_set_prediction_flag, delta_idx_minus1, delta_rps_sign,
+   * abs_delta_rps_minus1, then used_by_curr_pic_flag and use_delta_flag of
+   * each of the four entries. */
+  param.slice_parsing_fields.bits.long_term_ref_pics_present_flag = 0;
+  param.st_rps_bits = 1 + 1 + 1 + 1 + 6;
+  test_slice_header_begin (&writer, NAL_TRAIL_R);
+  test_bit_writer_put (&writer, 0, 1); /* short_term_ref_pic_set_sps_flag */
+  test_bit_writer_put (&writer, 1, 1);
+  test_bit_writer_put_ue (&writer, 0);
+  test_bit_writer_put (&writer, 0, 1);
+  test_bit_writer_put_ue (&writer, 0);
+  test_bit_writer_put (&writer, 1, 1);
+  test_bit_writer_put (&writer, 1, 2);
+  test_bit_writer_put (&writer, 1, 1);
+  test_bit_writer_put (&writer, 0, 2);
+  test_render_slice_picture (fixture, &param, &writer);
+  FLU_VA_DRIVERS_TEST_CHECK (info->CurrRpsIdx == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->NumDeltaPocsOfRefRpsIdx == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->NumShortTermPictureSliceHeaderBits == 10);
+
+  /* An explicit set, skipped as a whole, followed by a long-term picture of
+   * the SPS: num_long_term_sps, num_long_term_pics, lt_idx_sps and
+   * delta_poc_msb_present_flag. */
+  param.slice_parsing_fields.bits.long_term_ref_pics_present_flag = 1;
+  param.num_long_term_ref_pic_sps = 2;
+  param.st_rps_bits = 1 + 3 + 1 + 1 + 1;
+  test_slice_header_begin (&writer, NAL_TRAIL_R);
+  test_bit_writer_put (&writer, 0, 1); /* short_term_ref_pic_set_sps_flag */
+  test_bit_writer_put (&writer, 0, 1); /* inter_ref_pic_set_prediction_flag */
+  test_bit_writer_put_ue (&writer, 1); /* num_negative_pics */
+  test_bit_writer_put_ue (&writer, 0); /* num_positive_pics */
+  test_bit_writer_put_ue (&writer, 0); /* delta_poc_s0_minus1 */
+  test_bit_writer_put (&writer, 1, 1); /* used_by_curr_pic_s0_flag */
+  test_bit_writer_put_ue (&writer, 1);
+  test_bit_writer_put_ue (&writer, 0);
+  test_bit_writer_put (&writer, 1, 1);
+  test_bit_writer_put (&writer, 0, 1);
+  test_render_slice_picture (fixture, &param, &writer);
+  FLU_VA_DRIVERS_TEST_CHECK (info->CurrRpsIdx == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->NumDeltaPocsOfRefRpsIdx == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->NumLongTermPictureSliceHeaderBits ==
+                             3 + 1 + 1 + 1);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+int
+main (int argc, char **argv)
+{
+  test_pic_param ();
+  test_ref_pic_sets ();
+  test_scaling_lists ();
+  test_slice_header ();
+
+  return EXIT_SUCCESS;
+}
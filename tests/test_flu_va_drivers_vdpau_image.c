@@ -0,0 +1,338 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Round trips the content of surfaces of the stub device through vaPutImage,
+ * vaGetImage and the mappings of vaDeriveImage, in every image format, with
+ * odd sizes and partial rectangles, and checks that the derived images see
+ * the pictures put or decoded into their surface. */
+
+#include "flu_va_drivers_vdpau_test_driver.h"
+
+typedef struct _TestRect TestRect;
+
+struct _TestRect
+{
+  unsigned int src_x;
+  unsigned int src_y;
+  unsigned int dest_x;
+  unsigned int dest_y;
+  unsigned int width;
+  unsigned int height;
+};
+
+static uint8_t
+test_pattern (unsigned int seed, int plane, unsigned int row, unsigned int col)
+{
+  return (seed * 101 + plane * 67 + row * 13 + col * 7) & 0xff;
+}
+
+/* Bytes per row and rows of the samples of a width x height picture in the
+ * plane, and offsets of the x, y pixel in them. */
+static void
+test_get_plane_rect (const VAImage *image, int plane, unsigned int x,
+    unsigned int y, unsigned int width, unsigned int height,
+    unsigned int *col, unsigned int *row, unsigned int *row_bytes,
+    unsigned int *num_rows)
+{
+  unsigned int x_shift, y_shift, sample_bytes;
+
+  flu_va_drivers_vdpau_get_plane_layout (
+      image->format.fourcc, plane, &x_shift, &y_shift, &sample_bytes);
+  *col = (x >> x_shift) * sample_bytes;
+  *row = y >> y_shift;
+  *row_bytes = ((width + (1 << x_shift) - 1) >> x_shift) * sample_bytes;
+  *num_rows = (height + (1 << y_shift) - 1) >> y_shift;
+}
+
+static void
+test_image_create (VADriverContextP ctx, uint32_t fourcc, unsigned int width,
+    unsigned int height, VAImage *image)
+{
+  VAImageFormat format;
+
+  memset (&format, 0, sizeof (format));
+  format.fourcc = fourcc;
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_CreateImage (ctx, &format,
+                                 width, height, image) == VA_STATUS_SUCCESS);
+}
+
+static uint8_t *
+test_image_map (VADriverContextP ctx, const VAImage *image)
+{
+  void *data;
+
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_MapBuffer (ctx, image->buf, &data) ==
+      VA_STATUS_SUCCESS);
+
+  return data;
+}
+
+static void
+test_image_unmap (VADriverContextP ctx, const VAImage *image)
+{
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_UnmapBuffer (
+                                 ctx, image->buf) == VA_STATUS_SUCCESS);
+}
+
+static void
+test_image_fill (VADriverContextP ctx, const VAImage *image, unsigned int seed)
+{
+  unsigned int col, row, row_bytes, num_rows, r, c;
+  uint8_t *data = test_image_map (ctx, image);
+  int i;
+
+  for (i = 0; i < image->num_planes; i++) {
+    test_get_plane_rect (image, i, 0, 0, image->width, image->height, &col,
+        &row, &row_bytes, &num_rows);
+    for (r = 0; r < num_rows; r++) {
+      for (c = 0; c < row_bytes; c++) {
+        data[image->offsets[i] + r * image->pitches[i] + c] =
+            test_pattern (seed, i, r, c);
+      }
+    }
+  }
+  test_image_unmap (ctx, image);
+}
+
+/* Checks that the image holds the pattern of seed, but in rect, when not
+ * NULL, where it holds the pattern of rect_seed at the source position. */
+static void
+test_image_check (VADriverContextP ctx, const VAImage *image,
+    unsigned int seed, const TestRect *rect, unsigned int rect_seed)
+{
+  unsigned int col, row, row_bytes, num_rows, r, c;
+  unsigned int src_col, src_row, dest_col, dest_row;
+  unsigned int rect_row_bytes, rect_num_rows;
+  uint8_t *data = test_image_map (ctx, image);
+  uint8_t expected;
+  int i;
+
+  for (i = 0; i < image->num_planes; i++) {
+    test_get_plane_rect (image, i, 0, 0, image->width, image->height, &col,
+        &row, &row_bytes, &num_rows);
+    if (rect != NULL) {
+      test_get_plane_rect (image, i, rect->src_x, rect->src_y, rect->width,
+          rect->height, &src_col, &src_row, &rect_row_bytes, &rect_num_rows);
+      test_get_plane_rect (image, i, rect->dest_x, rect->dest_y, rect->width,
+          rect->height, &dest_col, &dest_row, &rect_row_bytes,
+          &rect_num_rows);
+    }
+
+    for (r = 0; r < num_rows; r++) {
+      for (c = 0; c < row_bytes; c++) {
+        if (rect != NULL && r >= dest_row && r < dest_row + rect_num_rows &&
+            c >= dest_col && c < dest_col + rect_row_bytes) {
+          expected = test_pattern (rect_seed, i, r - dest_row + src_row,
+              c - dest_col + src_col);
+        } else {
+          expected = test_pattern (seed, i, r, c);
+        }
+        if (data[image->offsets[i] + r * image->pitches[i] + c] != expected) {
+          fprintf (stderr, "%.4s %ux%u: plane %d, row %u, byte %u differs\n",
+              (const char *) &image->format.fourcc, image->width,
+              image->height, i, r, c);
+          FLU_VA_DRIVERS_TEST_CHECK (0);
+        }
+      }
+    }
+  }
+  test_image_unmap (ctx, image);
+}
+
+/* Reads the surface back into a new image and checks it. */
+static void
+test_surface_check (VADriverContextP ctx, VASurfaceID surface,
+    uint32_t fourcc, unsigned int width, unsigned int height,
+    unsigned int seed, const TestRect *rect, unsigned int rect_seed)
+{
+  VAImage image;
+
+  test_image_create (ctx, fourcc, width, height, &image);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_GetImage (ctx, surface, 0, 0, width, height,
+          image.image_id) == VA_STATUS_SUCCESS);
+  test_image_check (ctx, &image, seed, rect, rect_seed);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyImage (
+                                 ctx, image.image_id) == VA_STATUS_SUCCESS);
+}
+
+/* Puts a whole image into a surface and then a rectangle of another one,
+ * reading the surface back after each. */
+static void
+test_put_get_image (unsigned int rt_format, uint32_t fourcc,
+    unsigned int width, unsigned int height)
+{
+  struct VADriverContext ctx;
+  VASurfaceID surface;
+  VAImage image;
+  TestRect rect = { 4, 2, 2, 6, width / 2 + 1, height / 3 + 1 };
+
+  flu_va_drivers_vdpau_test_driver_init (&ctx);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateSurfaces (&ctx, width, height, rt_format, 1,
+          &surface) == VA_STATUS_SUCCESS);
+
+  test_image_create (&ctx, fourcc, width, height, &image);
+  test_image_fill (&ctx, &image, 1);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_PutImage (&ctx, surface, image.image_id, 0, 0,
+          width, height, 0, 0, width, height) == VA_STATUS_SUCCESS);
+  test_surface_check (&ctx, surface, fourcc, width, height, 1, NULL, 0);
+
+  test_image_fill (&ctx, &image, 2);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_PutImage (&ctx, surface, image.image_id,
+          rect.src_x, rect.src_y, rect.width, rect.height, rect.dest_x,
+          rect.dest_y, rect.width, rect.height) == VA_STATUS_SUCCESS);
+  test_surface_check (&ctx, surface, fourcc, width, height, 1, &rect, 2);
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyImage (
+                                 &ctx, image.image_id) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroySurfaces (
+                                 &ctx, &surface, 1) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_Terminate (&ctx) == VA_STATUS_SUCCESS);
+}
+
+/* Writes a surface through a mapping of its derived image, and checks that
+ * the derived image then follows the pictures put into the surface. */
+static void
+test_derive_image (unsigned int rt_format, unsigned int width,
+    unsigned int height)
+{
+  struct VADriverContext ctx;
+  VASurfaceID surface;
+  VAImage derived, image;
+
+  flu_va_drivers_vdpau_test_driver_init (&ctx);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateSurfaces (&ctx, width, height, rt_format, 1,
+          &surface) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DeriveImage (
+                                 &ctx, surface, &derived) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      derived.width == width && derived.height == height);
+
+  test_image_fill (&ctx, &derived, 3);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_SyncSurface (
+                                 &ctx, surface) == VA_STATUS_SUCCESS);
+  test_surface_check (&ctx, surface, derived.format.fourcc, width, height, 3,
+      NULL, 0);
+  test_image_check (&ctx, &derived, 3, NULL, 0);
+
+  test_image_create (&ctx, derived.format.fourcc, width, height, &image);
+  test_image_fill (&ctx, &image, 4);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_PutImage (&ctx, surface, image.image_id, 0, 0,
+          width, height, 0, 0, width, height) == VA_STATUS_SUCCESS);
+  test_image_check (&ctx, &derived, 4, NULL, 0);
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyImage (
+                                 &ctx, image.image_id) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyImage (
+                                 &ctx, derived.image_id) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroySurfaces (
+                                 &ctx, &surface, 1) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_Terminate (&ctx) == VA_STATUS_SUCCESS);
+}
+
+/* A derived image mapped again after a decode into its surface reads the
+ * decoded picture, not the shadow of the previous mapping. */
+static void
+test_derive_image_decode (void)
+{
+  struct VADriverContext ctx;
+  VAConfigID config;
+  VAContextID context;
+  VASurfaceID surface;
+  VAImage derived;
+  unsigned int n;
+  uint8_t *data;
+
+  flu_va_drivers_vdpau_test_driver_init (&ctx);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateConfig (&ctx, VAProfileH264High,
+          VAEntrypointVLD, NULL, 0, &config) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateSurfaces (&ctx, 176, 144, VA_RT_FORMAT_YUV420,
+          1, &surface) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_CreateContext (&ctx, config, 176, 144,
+          VA_PROGRESSIVE, &surface, 1, &context) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DeriveImage (
+                                 &ctx, surface, &derived) == VA_STATUS_SUCCESS);
+
+  for (n = 0; n < 3; n++) {
+    flu_va_drivers_vdpau_test_driver_decode_h264 (
+        &ctx, context, 176, 144, 1, n, surface, VA_INVALID_SURFACE);
+    data = test_image_map (&ctx, &derived);
+    FLU_VA_DRIVERS_TEST_CHECK (
+        data[derived.offsets[0]] ==
+        (uint8_t) flu_va_drivers_vdpau_test_get_num_renders ());
+    FLU_VA_DRIVERS_TEST_CHECK (
+        data[derived.offsets[1]] ==
+        (uint8_t) flu_va_drivers_vdpau_test_get_num_renders ());
+    test_image_unmap (&ctx, &derived);
+  }
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyImage (
+                                 &ctx, derived.image_id) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroyContext (
+                                 &ctx, context) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_DestroySurfaces (
+                                 &ctx, &surface, 1) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_DestroyConfig (&ctx, config) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_Terminate (&ctx) == VA_STATUS_SUCCESS);
+}
+
+int
+main (int argc, char **argv)
+{
+  test_put_get_image (VA_RT_FORMAT_YUV420, VA_FOURCC_NV12, 320, 240);
+  test_put_get_image (VA_RT_FORMAT_YUV420, VA_FOURCC_NV12, 321, 243);
+  /* YUY2 pairs the pixels, so its width stays even. */
+  test_put_get_image (VA_RT_FORMAT_YUV422, VA_FOURCC_YUY2, 322, 241);
+#ifdef HAVE_VDPAU_HIGH_BIT_DEPTH
+  test_put_get_image (VA_RT_FORMAT_YUV444, VA_FOURCC_444P, 321, 241);
+  test_put_get_image (VA_RT_FORMAT_YUV420_10, VA_FOURCC_P010, 320, 240);
+  test_put_get_image (VA_RT_FORMAT_YUV420_10, VA_FOURCC_P010, 321, 243);
+  test_put_get_image (VA_RT_FORMAT_YUV420_12, VA_FOURCC_P016, 321, 243);
+#endif
+
+  test_derive_image (VA_RT_FORMAT_YUV420, 320, 240);
+  test_derive_image (VA_RT_FORMAT_YUV420, 321, 243);
+  test_derive_image (VA_RT_FORMAT_YUV422, 322, 241);
+#ifdef HAVE_VDPAU_HIGH_BIT_DEPTH
+  test_derive_image (VA_RT_FORMAT_YUV444, 321, 241);
+  test_derive_image (VA_RT_FORMAT_YUV420_10, 320, 240);
+  test_derive_image (VA_RT_FORMAT_YUV420_10, 321, 243);
+  test_derive_image (VA_RT_FORMAT_YUV420_12, 321, 243);
+#endif
+  test_derive_image_decode ();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,320 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Replays the VA buffers of MPEG-2 pictures through the translator of the
+ * VDPAU driver and checks the resulting VdpPictureInfoMPEG1Or2, the
+ * quantizer matrices and the slice start codes given back to the
+ * bitstream. */
+
+#include "flu_va_drivers_vdpau_mpeg2.h"
+#include "flu_va_drivers_vdpau_test_translator.h"
+
+#define MPEG2_I_PICTURE 1
+#define MPEG2_P_PICTURE 2
+#define MPEG2_B_PICTURE 3
+
+static void
+test_init_pic_param (VAPictureParameterBufferMPEG2 *param,
+    int32_t picture_coding_type, VASurfaceID forward, VASurfaceID backward)
+{
+  memset (param, 0, sizeof (*param));
+  param->horizontal_size = 720;
+  param->vertical_size = 576;
+  param->forward_reference_picture = forward;
+  param->backward_reference_picture = backward;
+  param->picture_coding_type = picture_coding_type;
+  param->f_code = 0x1234;
+  param->picture_coding_extension.bits.intra_dc_precision = 2;
+  param->picture_coding_extension.bits.picture_structure = 3;
+  param->picture_coding_extension.bits.top_field_first = 1;
+  param->picture_coding_extension.bits.frame_pred_frame_dct = 1;
+  param->picture_coding_extension.bits.q_scale_type = 1;
+  param->picture_coding_extension.bits.alternate_scan = 1;
+  param->picture_coding_extension.bits.progressive_frame = 1;
+  param->picture_coding_extension.bits.is_first_field = 1;
+}
+
+static void
+test_pic_param (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const VdpPictureInfoMPEG1Or2 *info =
+      &fixture->context_obj.vdp_pic_info.mpeg2;
+  VAPictureParameterBufferMPEG2 param;
+  FluVaDriversVdpauDecoderConfig decoder_config;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_MPEG2);
+
+  /* An I picture ignores the references it is given. */
+  test_init_pic_param (&param, MPEG2_I_PICTURE, fixture->surfaces[0],
+      fixture->surfaces[1]);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->picture_coding_type == MPEG2_I_PICTURE);
+  FLU_VA_DRIVERS_TEST_CHECK (info->picture_structure == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_dc_precision == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->top_field_first == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->frame_pred_frame_dct == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->concealment_motion_vectors == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_vlc_format == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->q_scale_type == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->alternate_scan == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->full_pel_forward_vector == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->full_pel_backward_vector == 0);
+  /* f_code[0][0] is the highest nibble of the VA f_code. */
+  FLU_VA_DRIVERS_TEST_CHECK (info->f_code[0][0] == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->f_code[0][1] == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->f_code[1][0] == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->f_code[1][1] == 4);
+  FLU_VA_DRIVERS_TEST_CHECK (info->forward_reference == VDP_INVALID_HANDLE);
+  FLU_VA_DRIVERS_TEST_CHECK (info->backward_reference == VDP_INVALID_HANDLE);
+
+  /* A P picture only has a forward reference. */
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  test_init_pic_param (&param, MPEG2_P_PICTURE, fixture->surfaces[0],
+      fixture->surfaces[1]);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->picture_coding_type == MPEG2_P_PICTURE);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      info->forward_reference == fixture->vdp_surfaces[0]);
+  FLU_VA_DRIVERS_TEST_CHECK (info->backward_reference == VDP_INVALID_HANDLE);
+
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  test_init_pic_param (&param, MPEG2_B_PICTURE, fixture->surfaces[2],
+      fixture->surfaces[3]);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      info->forward_reference == fixture->vdp_surfaces[2]);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      info->backward_reference == fixture->vdp_surfaces[3]);
+
+  flu_va_drivers_vdpau_test_translator_end_picture (
+      fixture, &decoder_config);
+  FLU_VA_DRIVERS_TEST_CHECK (decoder_config.max_references == 2);
+
+  /* A reference that is not a surface of the driver. */
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  test_init_pic_param (&param, MPEG2_B_PICTURE, fixture->surfaces[2],
+      FLU_VA_DRIVERS_TEST_SURFACE_ID_OFFSET +
+          FLU_VA_DRIVERS_TEST_NUM_SURFACES);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) ==
+                             VA_STATUS_ERROR_INVALID_SURFACE);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+/* VA gives the matrices in zigzag scan order, VDPAU in raster order. The
+ * matrices persist across pictures, the defaults being used until the
+ * first IQ matrix buffer. */
+static void
+test_iq_matrix (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const VdpPictureInfoMPEG1Or2 *info =
+      &fixture->context_obj.vdp_pic_info.mpeg2;
+  VAPictureParameterBufferMPEG2 param;
+  VAIQMatrixBufferMPEG2 iq_matrix;
+  FluVaDriversVdpauDecoderConfig decoder_config;
+  unsigned int i;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_MPEG2);
+  test_init_pic_param (
+      &param, MPEG2_I_PICTURE, VA_INVALID_SURFACE, VA_INVALID_SURFACE);
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+  flu_va_drivers_vdpau_test_translator_end_picture (
+      fixture, &decoder_config);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[0] == 8);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[1] == 16);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[8] == 16);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[9] == 16);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[63] == 83);
+  for (i = 0; i < 64; i++)
+    FLU_VA_DRIVERS_TEST_CHECK (info->non_intra_quantizer_matrix[i] == 16);
+
+  memset (&iq_matrix, 0, sizeof (iq_matrix));
+  iq_matrix.load_intra_quantiser_matrix = 1;
+  iq_matrix.load_non_intra_quantiser_matrix = 1;
+  for (i = 0; i < 64; i++) {
+    iq_matrix.intra_quantiser_matrix[i] = i + 1;
+    iq_matrix.non_intra_quantiser_matrix[i] = 100 + i;
+  }
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAIQMatrixBufferType, &iq_matrix,
+                                 sizeof (iq_matrix)) == VA_STATUS_SUCCESS);
+  flu_va_drivers_vdpau_test_translator_end_picture (
+      fixture, &decoder_config);
+  /* The zigzag scan goes (0,0), (0,1), (1,0), (2,0), (1,1)... */
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[0] == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[1] == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[8] == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[16] == 4);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[9] == 5);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[63] == 64);
+  FLU_VA_DRIVERS_TEST_CHECK (info->non_intra_quantizer_matrix[8] == 102);
+  FLU_VA_DRIVERS_TEST_CHECK (info->non_intra_quantizer_matrix[63] == 163);
+
+  /* Kept by the next picture. */
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+  flu_va_drivers_vdpau_test_translator_end_picture (
+      fixture, &decoder_config);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[8] == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->non_intra_quantizer_matrix[8] == 102);
+
+  /* Matrices that are not loaded go back to the defaults. */
+  iq_matrix.load_intra_quantiser_matrix = 0;
+  iq_matrix.load_non_intra_quantiser_matrix = 0;
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAIQMatrixBufferType, &iq_matrix,
+                                 sizeof (iq_matrix)) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[8] == 16);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[63] == 83);
+  FLU_VA_DRIVERS_TEST_CHECK (info->non_intra_quantizer_matrix[8] == 16);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+static void
+test_init_slice_param (VASliceParameterBufferMPEG2 *slice_param,
+    uint32_t offset, uint32_t size, uint32_t slice_vertical_position)
+{
+  memset (slice_param, 0, sizeof (*slice_param));
+  slice_param->slice_data_offset = offset;
+  slice_param->slice_data_size = size;
+  slice_param->slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+  slice_param->slice_vertical_position = slice_vertical_position;
+}
+
+/* Each slice gets back the slice start code of its row, unless the client
+ * kept it. */
+static void
+test_slices (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const FluVaDriversVdpauBitstream *bitstream =
+      &fixture->context_obj.bitstream;
+  const VdpPictureInfoMPEG1Or2 *info =
+      &fixture->context_obj.vdp_pic_info.mpeg2;
+  VAPictureParameterBufferMPEG2 param;
+  VASliceParameterBufferMPEG2 slice_param;
+  uint8_t slice_data[] = { 0x12, 0x34, 0x56, 0x78, 0x00, 0x00, 0x01, 0x06,
+    0x9a, 0xbc };
+  static const uint8_t expected[] = { 0x00, 0x00, 0x01, 0x01, 0x12, 0x34,
+    0x56, 0x78, 0x00, 0x00, 0x01, 0x06, 0x9a, 0xbc, 0x00, 0x00, 0x01, 0x24,
+    0x56, 0x78 };
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_MPEG2);
+  test_init_pic_param (
+      &param, MPEG2_I_PICTURE, VA_INVALID_SURFACE, VA_INVALID_SURFACE);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+
+  /* Slice data without slice parameters. */
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceDataBufferType, slice_data,
+                                 sizeof (slice_data)) ==
+                             VA_STATUS_ERROR_UNKNOWN);
+
+  /* Two slices in the same slice data buffer, the second one with its
+   * start code. */
+  test_init_slice_param (&slice_param, 0, 4, 0);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceParameterBufferType,
+                                 &slice_param, sizeof (slice_param)) ==
+                             VA_STATUS_SUCCESS);
+  test_init_slice_param (&slice_param, 4, 6, 5);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceParameterBufferType,
+                                 &slice_param, sizeof (slice_param)) ==
+                             VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceDataBufferType, slice_data,
+                                 sizeof (slice_data)) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->slice_count == 2);
+
+  /* A third one in its own buffer. */
+  test_init_slice_param (&slice_param, 2, 2, 0x23);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceParameterBufferType,
+                                 &slice_param, sizeof (slice_param)) ==
+                             VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceDataBufferType, slice_data,
+                                 sizeof (slice_data)) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->slice_count == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->size == sizeof (expected));
+  FLU_VA_DRIVERS_TEST_CHECK (
+      memcmp (bitstream->data, expected, sizeof (expected)) == 0);
+
+  /* A slice past the end of its data. */
+  test_init_slice_param (&slice_param, 4, sizeof (slice_data) - 3, 0);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceParameterBufferType,
+                                 &slice_param, sizeof (slice_param)) ==
+                             VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceDataBufferType, slice_data,
+                                 sizeof (slice_data)) ==
+                             VA_STATUS_ERROR_INVALID_BUFFER);
+
+  /* The next picture starts over. */
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  FLU_VA_DRIVERS_TEST_CHECK (info->slice_count == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->size == 0);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+int
+main (int argc, char **argv)
+{
+  test_pic_param ();
+  test_iq_matrix ();
+  test_slices ();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,257 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Replays the VA buffers of MPEG-4 Part 2 VOPs through the translator of
+ * the VDPAU driver and checks the resulting VdpPictureInfoMPEG4Part2, the
+ * quantizer matrices and the VOP start code given back to the
+ * bitstream. */
+
+#include "flu_va_drivers_vdpau_mpeg4.h"
+#include "flu_va_drivers_vdpau_test_translator.h"
+
+#define MPEG4_I_VOP 0
+#define MPEG4_P_VOP 1
+#define MPEG4_B_VOP 2
+#define MPEG4_S_VOP 3
+
+static void
+test_init_pic_param (VAPictureParameterBufferMPEG4 *param,
+    uint32_t vop_coding_type, VASurfaceID forward, VASurfaceID backward)
+{
+  memset (param, 0, sizeof (*param));
+  param->vop_width = 352;
+  param->vop_height = 288;
+  param->forward_reference_picture = forward;
+  param->backward_reference_picture = backward;
+  param->vol_fields.bits.chroma_format = 1;
+  param->vol_fields.bits.interlaced = 1;
+  param->vol_fields.bits.quant_type = 1;
+  param->vol_fields.bits.quarter_sample = 1;
+  param->vol_fields.bits.resync_marker_disable = 1;
+  param->vop_fields.bits.vop_coding_type = vop_coding_type;
+  param->vop_fields.bits.vop_rounding_type = 1;
+  param->vop_fields.bits.top_field_first = 1;
+  param->vop_fcode_forward = 2;
+  param->vop_fcode_backward = 3;
+  param->vop_time_increment_resolution = 30000;
+  param->TRB = 7;
+  param->TRD = 11;
+}
+
+static void
+test_pic_param (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const VdpPictureInfoMPEG4Part2 *info =
+      &fixture->context_obj.vdp_pic_info.mpeg4;
+  VAPictureParameterBufferMPEG4 param;
+  FluVaDriversVdpauDecoderConfig decoder_config;
+  static const struct
+  {
+    uint32_t vop_coding_type;
+    int num_references;
+  } types[] = {
+    { MPEG4_I_VOP, 0 },
+    { MPEG4_P_VOP, 1 },
+    { MPEG4_B_VOP, 2 },
+    { MPEG4_S_VOP, 1 },
+  };
+  unsigned int i;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_MPEG4);
+
+  for (i = 0; i < sizeof (types) / sizeof (*types); i++) {
+    flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+    test_init_pic_param (&param, types[i].vop_coding_type,
+        fixture->surfaces[2], fixture->surfaces[3]);
+    FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                   fixture, VAPictureParameterBufferType,
+                                   &param, sizeof (param)) ==
+                               VA_STATUS_SUCCESS);
+    FLU_VA_DRIVERS_TEST_CHECK (
+        info->vop_coding_type == types[i].vop_coding_type);
+    FLU_VA_DRIVERS_TEST_CHECK (
+        info->forward_reference == (types[i].num_references > 0
+                                           ? fixture->vdp_surfaces[2]
+                                           : VDP_INVALID_HANDLE));
+    FLU_VA_DRIVERS_TEST_CHECK (
+        info->backward_reference == (types[i].num_references > 1
+                                            ? fixture->vdp_surfaces[3]
+                                            : VDP_INVALID_HANDLE));
+  }
+
+  /* VA has no field temporal distances, the frame ones are used for both
+   * fields. */
+  FLU_VA_DRIVERS_TEST_CHECK (info->trd[0] == 11);
+  FLU_VA_DRIVERS_TEST_CHECK (info->trd[1] == 11);
+  FLU_VA_DRIVERS_TEST_CHECK (info->trb[0] == 7);
+  FLU_VA_DRIVERS_TEST_CHECK (info->trb[1] == 7);
+  FLU_VA_DRIVERS_TEST_CHECK (info->vop_time_increment_resolution == 30000);
+  FLU_VA_DRIVERS_TEST_CHECK (info->vop_fcode_forward == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->vop_fcode_backward == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->resync_marker_disable == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->interlaced == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->quant_type == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->quarter_sample == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->short_video_header == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->rounding_control == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->alternate_vertical_scan_flag == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->top_field_first == 1);
+
+  flu_va_drivers_vdpau_test_translator_end_picture (
+      fixture, &decoder_config);
+  FLU_VA_DRIVERS_TEST_CHECK (decoder_config.max_references == 2);
+
+  /* A reference that is not a surface of the driver. */
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  test_init_pic_param (&param, MPEG4_B_VOP, fixture->surfaces[2],
+      FLU_VA_DRIVERS_TEST_SURFACE_ID_OFFSET +
+          FLU_VA_DRIVERS_TEST_NUM_SURFACES);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) ==
+                             VA_STATUS_ERROR_INVALID_SURFACE);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+/* The defaults of the MPEG quantization type are used until the first IQ
+ * matrix buffer, the loaded matrices are unzigzagged. */
+static void
+test_iq_matrix (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const VdpPictureInfoMPEG4Part2 *info =
+      &fixture->context_obj.vdp_pic_info.mpeg4;
+  VAPictureParameterBufferMPEG4 param;
+  VAIQMatrixBufferMPEG4 iq_matrix;
+  FluVaDriversVdpauDecoderConfig decoder_config;
+  unsigned int i;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_MPEG4);
+  test_init_pic_param (
+      &param, MPEG4_I_VOP, VA_INVALID_SURFACE, VA_INVALID_SURFACE);
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+  flu_va_drivers_vdpau_test_translator_end_picture (
+      fixture, &decoder_config);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[0] == 8);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[1] == 17);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[63] == 45);
+  FLU_VA_DRIVERS_TEST_CHECK (info->non_intra_quantizer_matrix[0] == 16);
+  FLU_VA_DRIVERS_TEST_CHECK (info->non_intra_quantizer_matrix[63] == 33);
+
+  memset (&iq_matrix, 0, sizeof (iq_matrix));
+  iq_matrix.load_intra_quant_mat = 1;
+  for (i = 0; i < 64; i++)
+    iq_matrix.intra_quant_mat[i] = i + 1;
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAIQMatrixBufferType, &iq_matrix,
+                                 sizeof (iq_matrix)) == VA_STATUS_SUCCESS);
+  flu_va_drivers_vdpau_test_translator_end_picture (
+      fixture, &decoder_config);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[1] == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[8] == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->intra_quantizer_matrix[63] == 64);
+  FLU_VA_DRIVERS_TEST_CHECK (info->non_intra_quantizer_matrix[1] == 17);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+static void
+test_render_slice (
+    FluVaDriversVdpauTestTranslator *fixture, uint8_t *data, uint32_t size)
+{
+  VASliceParameterBufferMPEG4 slice_param;
+
+  memset (&slice_param, 0, sizeof (slice_param));
+  slice_param.slice_data_size = size;
+  slice_param.slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceParameterBufferType,
+                                 &slice_param, sizeof (slice_param)) ==
+                             VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceDataBufferType, data, size) ==
+                             VA_STATUS_SUCCESS);
+}
+
+/* The VOP start code is given back to the first slice when the client
+ * stripped it, the video packets that follow are passed as they are. */
+static void
+test_slices (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const FluVaDriversVdpauBitstream *bitstream =
+      &fixture->context_obj.bitstream;
+  VAPictureParameterBufferMPEG4 param;
+  uint8_t vop[] = { 0x12, 0x34, 0x56 };
+  uint8_t video_packet[] = { 0x78, 0x9a };
+  uint8_t vop_with_start_code[] = { 0x00, 0x00, 0x01, 0xb6, 0x12 };
+  static const uint8_t expected[] = { 0x00, 0x00, 0x01, 0xb6, 0x12, 0x34,
+    0x56, 0x78, 0x9a };
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_MPEG4);
+  test_init_pic_param (
+      &param, MPEG4_I_VOP, VA_INVALID_SURFACE, VA_INVALID_SURFACE);
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+  test_render_slice (fixture, vop, sizeof (vop));
+  test_render_slice (fixture, video_packet, sizeof (video_packet));
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->size == sizeof (expected));
+  FLU_VA_DRIVERS_TEST_CHECK (
+      memcmp (bitstream->data, expected, sizeof (expected)) == 0);
+
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+  test_render_slice (fixture, vop_with_start_code,
+      sizeof (vop_with_start_code));
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->size == sizeof (vop_with_start_code));
+  FLU_VA_DRIVERS_TEST_CHECK (memcmp (bitstream->data, vop_with_start_code,
+                                 sizeof (vop_with_start_code)) == 0);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+int
+main (int argc, char **argv)
+{
+  test_pic_param ();
+  test_iq_matrix ();
+  test_slices ();
+
+  return EXIT_SUCCESS;
+}
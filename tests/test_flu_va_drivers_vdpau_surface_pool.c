@@ -0,0 +1,190 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Releases and acquires video surfaces of the stub device through the
+ * surface pool, and checks that a surface is only reused for the same
+ * chroma type and size, and that the idle surfaces are bounded in number
+ * and in bytes. */
+
+#include <string.h>
+#include "flu_va_drivers_vdpau_surface_pool.h"
+#include "flu_va_drivers_vdpau_test_utils.h"
+
+#define WIDTH 320
+#define HEIGHT 240
+/* Bytes of a WIDTH x HEIGHT 4:2:0 surface, as accounted by the pool. */
+#define SURFACE_SIZE (WIDTH * HEIGHT * 3 / 2)
+
+static VdpVideoSurface
+test_acquire (FluVaDriversVdpauSurfacePool *pool, VdpChromaType chroma_type,
+    uint32_t width, uint32_t height)
+{
+  VdpVideoSurface vdp_surface = VDP_INVALID_HANDLE;
+
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_surface_pool_acquire (pool,
+                                 chroma_type, width, height, &vdp_surface) ==
+                             VDP_STATUS_OK);
+  FLU_VA_DRIVERS_TEST_CHECK (vdp_surface != VDP_INVALID_HANDLE);
+
+  return vdp_surface;
+}
+
+static void
+test_match (FluVaDriversVdpauVdpDeviceImpl *impl)
+{
+  FluVaDriversVdpauSurfacePool pool;
+  FluVaDriversVdpauSurfacePoolStats stats;
+  VdpVideoSurface vdp_surface, other[3];
+  unsigned int i, num_surfaces;
+
+  num_surfaces = flu_va_drivers_vdpau_test_get_num_video_surfaces ();
+  flu_va_drivers_vdpau_surface_pool_init (&pool, impl);
+
+  vdp_surface = test_acquire (&pool, VDP_CHROMA_TYPE_420, WIDTH, HEIGHT);
+  flu_va_drivers_vdpau_surface_pool_release (
+      &pool, VDP_CHROMA_TYPE_420, WIDTH, HEIGHT, vdp_surface);
+
+  other[0] = test_acquire (&pool, VDP_CHROMA_TYPE_422, WIDTH, HEIGHT);
+  other[1] = test_acquire (&pool, VDP_CHROMA_TYPE_420, WIDTH + 2, HEIGHT);
+  other[2] = test_acquire (&pool, VDP_CHROMA_TYPE_420, WIDTH, HEIGHT - 2);
+  for (i = 0; i < 3; i++)
+    FLU_VA_DRIVERS_TEST_CHECK (other[i] != vdp_surface);
+  flu_va_drivers_vdpau_surface_pool_get_stats (&pool, &stats);
+  FLU_VA_DRIVERS_TEST_CHECK (stats.hits == 0 && stats.misses == 4);
+
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_acquire (&pool, VDP_CHROMA_TYPE_420, WIDTH, HEIGHT) ==
+      vdp_surface);
+  flu_va_drivers_vdpau_surface_pool_get_stats (&pool, &stats);
+  FLU_VA_DRIVERS_TEST_CHECK (stats.hits == 1 && stats.cached_bytes == 0);
+
+  flu_va_drivers_vdpau_surface_pool_release (
+      &pool, VDP_CHROMA_TYPE_420, WIDTH, HEIGHT, vdp_surface);
+  flu_va_drivers_vdpau_surface_pool_release (
+      &pool, VDP_CHROMA_TYPE_422, WIDTH, HEIGHT, other[0]);
+  flu_va_drivers_vdpau_surface_pool_release (
+      &pool, VDP_CHROMA_TYPE_420, WIDTH + 2, HEIGHT, other[1]);
+  flu_va_drivers_vdpau_surface_pool_release (
+      &pool, VDP_CHROMA_TYPE_420, WIDTH, HEIGHT - 2, other[2]);
+  flu_va_drivers_vdpau_surface_pool_destroy (&pool);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_test_get_num_video_surfaces () == num_surfaces);
+}
+
+/* Releasing more surfaces than the pool holds destroys the oldest ones. */
+static void
+test_max_entries (FluVaDriversVdpauVdpDeviceImpl *impl)
+{
+  VdpVideoSurface vdp_surfaces[FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_SIZE + 16];
+  const unsigned int n = sizeof (vdp_surfaces) / sizeof (vdp_surfaces[0]);
+  FluVaDriversVdpauSurfacePool pool;
+  FluVaDriversVdpauSurfacePoolStats stats;
+  unsigned int i, num_surfaces;
+
+  num_surfaces = flu_va_drivers_vdpau_test_get_num_video_surfaces ();
+  flu_va_drivers_vdpau_surface_pool_init (&pool, impl);
+
+  for (i = 0; i < n; i++)
+    vdp_surfaces[i] = test_acquire (&pool, VDP_CHROMA_TYPE_420, 16, 16);
+  for (i = 0; i < n; i++) {
+    flu_va_drivers_vdpau_surface_pool_release (
+        &pool, VDP_CHROMA_TYPE_420, 16, 16, vdp_surfaces[i]);
+  }
+
+  flu_va_drivers_vdpau_surface_pool_get_stats (&pool, &stats);
+  FLU_VA_DRIVERS_TEST_CHECK (stats.evictions == n - pool.num_entries);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      pool.num_entries == FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_SIZE);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_test_get_num_video_surfaces () ==
+      num_surfaces + FLU_VA_DRIVERS_VDPAU_SURFACE_POOL_SIZE);
+
+  /* The most recently released surfaces are kept. */
+  FLU_VA_DRIVERS_TEST_CHECK (
+      test_acquire (&pool, VDP_CHROMA_TYPE_420, 16, 16) ==
+      vdp_surfaces[n - 1]);
+  flu_va_drivers_vdpau_surface_pool_release (
+      &pool, VDP_CHROMA_TYPE_420, 16, 16, vdp_surfaces[n - 1]);
+
+  flu_va_drivers_vdpau_surface_pool_destroy (&pool);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_test_get_num_video_surfaces () == num_surfaces);
+}
+
+/* The idle surfaces never add up to more than max_bytes. */
+static void
+test_max_bytes (FluVaDriversVdpauVdpDeviceImpl *impl)
+{
+  FluVaDriversVdpauSurfacePool pool;
+  FluVaDriversVdpauSurfacePoolStats stats;
+  VdpVideoSurface vdp_surfaces[3], large;
+  unsigned int i, num_surfaces;
+
+  num_surfaces = flu_va_drivers_vdpau_test_get_num_video_surfaces ();
+  flu_va_drivers_vdpau_surface_pool_init (&pool, impl);
+  pool.max_bytes = 2 * SURFACE_SIZE;
+
+  for (i = 0; i < 3; i++) {
+    vdp_surfaces[i] =
+        test_acquire (&pool, VDP_CHROMA_TYPE_420, WIDTH, HEIGHT);
+  }
+  large = test_acquire (&pool, VDP_CHROMA_TYPE_420, 2 * WIDTH, 2 * HEIGHT);
+  for (i = 0; i < 3; i++) {
+    flu_va_drivers_vdpau_surface_pool_release (
+        &pool, VDP_CHROMA_TYPE_420, WIDTH, HEIGHT, vdp_surfaces[i]);
+  }
+
+  flu_va_drivers_vdpau_surface_pool_get_stats (&pool, &stats);
+  FLU_VA_DRIVERS_TEST_CHECK (stats.cached_bytes == 2 * SURFACE_SIZE);
+  FLU_VA_DRIVERS_TEST_CHECK (stats.peak_cached_bytes <= pool.max_bytes);
+  FLU_VA_DRIVERS_TEST_CHECK (stats.evictions == 1);
+
+  /* A surface larger than the whole pool is destroyed right away. */
+  flu_va_drivers_vdpau_surface_pool_release (
+      &pool, VDP_CHROMA_TYPE_420, 2 * WIDTH, 2 * HEIGHT, large);
+  flu_va_drivers_vdpau_surface_pool_get_stats (&pool, &stats);
+  FLU_VA_DRIVERS_TEST_CHECK (stats.cached_bytes == 2 * SURFACE_SIZE);
+  FLU_VA_DRIVERS_TEST_CHECK (stats.evictions == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_test_get_num_video_surfaces () ==
+      num_surfaces + 2);
+
+  flu_va_drivers_vdpau_surface_pool_destroy (&pool);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      flu_va_drivers_vdpau_test_get_num_video_surfaces () == num_surfaces);
+}
+
+int
+main (int argc, char **argv)
+{
+  FluVaDriversVdpauVdpDeviceImpl impl;
+
+  memset (&impl, 0, sizeof (impl));
+  flu_va_drivers_vdpau_test_vdp_impl_init (&impl);
+
+  test_match (&impl);
+  test_max_entries (&impl);
+  test_max_bytes (&impl);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,280 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Replays the VA buffers of VC-1 pictures through the translator of the
+ * VDPAU driver and checks the resulting VdpPictureInfoVC1 and the start
+ * codes given back to the Advanced profile bitstream. */
+
+#include "flu_va_drivers_vdpau_vc1.h"
+#include "flu_va_drivers_vdpau_test_translator.h"
+
+#define VC1_PROFILE_MAIN 1
+#define VC1_PROFILE_ADVANCED 3
+
+/* VA picture types. */
+#define VC1_I_PICTURE 0
+#define VC1_P_PICTURE 1
+#define VC1_B_PICTURE 2
+#define VC1_BI_PICTURE 3
+#define VC1_SKIPPED_PICTURE 4
+
+#define VC1_SLICE_START_CODE 0x0b
+#define VC1_FIELD_START_CODE 0x0c
+#define VC1_FRAME_START_CODE 0x0d
+
+static void
+test_init_pic_param (VAPictureParameterBufferVC1 *param, uint32_t profile,
+    uint32_t picture_type, VASurfaceID forward, VASurfaceID backward)
+{
+  memset (param, 0, sizeof (*param));
+  param->forward_reference_picture = forward;
+  param->backward_reference_picture = backward;
+  param->inloop_decoded_picture = VA_INVALID_SURFACE;
+  param->sequence_fields.bits.profile = profile;
+  param->sequence_fields.bits.interlace = 1;
+  param->sequence_fields.bits.finterpflag = 1;
+  param->sequence_fields.bits.overlap = 1;
+  param->sequence_fields.bits.max_b_frames = 3;
+  param->entrypoint_fields.bits.loopfilter = 1;
+  param->coded_width = 1920;
+  param->coded_height = 1080;
+  param->picture_fields.bits.picture_type = picture_type;
+  param->picture_fields.bits.is_first_field = 1;
+  param->pic_quantizer_fields.bits.dquant = 2;
+  param->pic_quantizer_fields.bits.quantizer = 1;
+  param->pic_quantizer_fields.bits.pic_quantizer_scale = 9;
+  param->mv_fields.bits.extended_mv_flag = 1;
+  param->transform_fields.bits.variable_sized_transform_flag = 1;
+  param->fast_uvmc_flag = 1;
+}
+
+static void
+test_pic_param (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const VdpPictureInfoVC1 *info = &fixture->context_obj.vdp_pic_info.vc1;
+  VAPictureParameterBufferVC1 param;
+  FluVaDriversVdpauDecoderConfig decoder_config;
+  /* VDPAU numbers the picture types as I, P, reserved, B and BI, and
+   * decodes a skipped picture as a P picture. */
+  static const struct
+  {
+    uint32_t va_type;
+    uint8_t vdp_type;
+    int num_references;
+  } types[] = {
+    { VC1_I_PICTURE, 0, 0 },
+    { VC1_P_PICTURE, 1, 1 },
+    { VC1_B_PICTURE, 3, 2 },
+    { VC1_BI_PICTURE, 4, 0 },
+    { VC1_SKIPPED_PICTURE, 1, 1 },
+  };
+  unsigned int i;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_VC1);
+
+  for (i = 0; i < sizeof (types) / sizeof (*types); i++) {
+    flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+    test_init_pic_param (&param, VC1_PROFILE_ADVANCED, types[i].va_type,
+        fixture->surfaces[0], fixture->surfaces[1]);
+    FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                   fixture, VAPictureParameterBufferType,
+                                   &param, sizeof (param)) ==
+                               VA_STATUS_SUCCESS);
+    FLU_VA_DRIVERS_TEST_CHECK (info->picture_type == types[i].vdp_type);
+    FLU_VA_DRIVERS_TEST_CHECK (
+        info->forward_reference == (types[i].num_references > 0
+                                           ? fixture->vdp_surfaces[0]
+                                           : VDP_INVALID_HANDLE));
+    FLU_VA_DRIVERS_TEST_CHECK (
+        info->backward_reference == (types[i].num_references > 1
+                                            ? fixture->vdp_surfaces[1]
+                                            : VDP_INVALID_HANDLE));
+  }
+
+  FLU_VA_DRIVERS_TEST_CHECK (info->frame_coding_mode == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->postprocflag == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->deblockEnable == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->interlace == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->finterpflag == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->overlap == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->pulldown == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->rangered == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->maxbframes == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->loopfilter == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->panscan_flag == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->dquant == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->quantizer == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->pquant == 9);
+  FLU_VA_DRIVERS_TEST_CHECK (info->extended_mv == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->extended_dmv == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->vstransform == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->fastuvmc == 1);
+
+  /* VDPAU keeps 1 for the reserved frame coding mode: field interlaced is 3.
+   * The low bit of the post processing enables the deblocking, the range
+   * reduction of the frame goes to bit 1 of rangered. */
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  test_init_pic_param (&param, VC1_PROFILE_MAIN, VC1_I_PICTURE,
+      VA_INVALID_SURFACE, VA_INVALID_SURFACE);
+  param.picture_fields.bits.frame_coding_mode = 2;
+  param.post_processing = 1;
+  param.sequence_fields.bits.rangered = 1;
+  param.range_reduction_frame = 1;
+  param.range_mapping_fields.bits.luma_flag = 1;
+  param.range_mapping_fields.bits.luma = 5;
+  param.range_mapping_fields.bits.chroma_flag = 1;
+  param.range_mapping_fields.bits.chroma = 6;
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->frame_coding_mode == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->postprocflag == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->deblockEnable == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->rangered == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->range_mapy_flag == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->range_mapy == 5);
+  FLU_VA_DRIVERS_TEST_CHECK (info->range_mapuv_flag == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->range_mapuv == 6);
+
+  flu_va_drivers_vdpau_test_translator_end_picture (
+      fixture, &decoder_config);
+  FLU_VA_DRIVERS_TEST_CHECK (decoder_config.max_references == 2);
+
+  /* A reference that is not a surface of the driver. */
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  test_init_pic_param (&param, VC1_PROFILE_ADVANCED, VC1_P_PICTURE,
+      FLU_VA_DRIVERS_TEST_SURFACE_ID_OFFSET +
+          FLU_VA_DRIVERS_TEST_NUM_SURFACES,
+      VA_INVALID_SURFACE);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) ==
+                             VA_STATUS_ERROR_INVALID_SURFACE);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+/* Renders a picture of one slice data buffer holding num_slices slices of
+ * size bytes each. */
+static void
+test_render_picture (FluVaDriversVdpauTestTranslator *fixture,
+    VAPictureParameterBufferVC1 *param, uint8_t *data, uint32_t size,
+    unsigned int num_slices)
+{
+  VASliceParameterBufferVC1 slice_param;
+  uint8_t bitplane[16];
+  unsigned int i;
+
+  memset (bitplane, 0xff, sizeof (bitplane));
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, param,
+                                 sizeof (*param)) == VA_STATUS_SUCCESS);
+  /* Accepted, VDPAU decodes the bitplanes from the bitstream. */
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VABitPlaneBufferType, bitplane,
+                                 sizeof (bitplane)) == VA_STATUS_SUCCESS);
+  for (i = 0; i < num_slices; i++) {
+    memset (&slice_param, 0, sizeof (slice_param));
+    slice_param.slice_data_offset = i * size;
+    slice_param.slice_data_size = size;
+    slice_param.slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+    slice_param.slice_vertical_position = 4 * i;
+    FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                   fixture, VASliceParameterBufferType,
+                                   &slice_param, sizeof (slice_param)) ==
+                               VA_STATUS_SUCCESS);
+  }
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceDataBufferType, data,
+                                 num_slices * size) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      fixture->context_obj.vdp_pic_info.vc1.slice_count == num_slices);
+}
+
+static void
+test_slices (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const FluVaDriversVdpauBitstream *bitstream =
+      &fixture->context_obj.bitstream;
+  VAPictureParameterBufferVC1 param;
+  uint8_t slice_data[] = { 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc };
+  /* The frame start code, then a slice start code. */
+  static const uint8_t expected_frame[] = { 0x00, 0x00, 0x01,
+    VC1_FRAME_START_CODE, 0x12, 0x34, 0x56, 0x00, 0x00, 0x01,
+    VC1_SLICE_START_CODE, 0x78, 0x9a, 0xbc };
+  static const uint8_t expected_field[] = { 0x00, 0x00, 0x01,
+    VC1_FIELD_START_CODE, 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc };
+  /* Kept by a client. */
+  uint8_t frame_data[] = { 0x00, 0x00, 0x01, VC1_FRAME_START_CODE, 0x12,
+    0x34 };
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_VC1);
+
+  test_init_pic_param (&param, VC1_PROFILE_ADVANCED, VC1_I_PICTURE,
+      VA_INVALID_SURFACE, VA_INVALID_SURFACE);
+  test_render_picture (fixture, &param, slice_data, 3, 2);
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->size == sizeof (expected_frame));
+  FLU_VA_DRIVERS_TEST_CHECK (
+      memcmp (bitstream->data, expected_frame, sizeof (expected_frame)) == 0);
+
+  /* The second field of a field interlaced frame. */
+  param.picture_fields.bits.frame_coding_mode = 2;
+  param.picture_fields.bits.is_first_field = 0;
+  test_render_picture (fixture, &param, slice_data, sizeof (slice_data), 1);
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->size == sizeof (expected_field));
+  FLU_VA_DRIVERS_TEST_CHECK (
+      memcmp (bitstream->data, expected_field, sizeof (expected_field)) == 0);
+
+  test_init_pic_param (&param, VC1_PROFILE_ADVANCED, VC1_I_PICTURE,
+      VA_INVALID_SURFACE, VA_INVALID_SURFACE);
+  test_render_picture (fixture, &param, frame_data, sizeof (frame_data), 1);
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->size == sizeof (frame_data));
+  FLU_VA_DRIVERS_TEST_CHECK (
+      memcmp (bitstream->data, frame_data, sizeof (frame_data)) == 0);
+
+  /* The Simple and Main profile frames have no start code. */
+  test_init_pic_param (&param, VC1_PROFILE_MAIN, VC1_I_PICTURE,
+      VA_INVALID_SURFACE, VA_INVALID_SURFACE);
+  test_render_picture (fixture, &param, slice_data, sizeof (slice_data), 1);
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->size == sizeof (slice_data));
+  FLU_VA_DRIVERS_TEST_CHECK (
+      memcmp (bitstream->data, slice_data, sizeof (slice_data)) == 0);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+int
+main (int argc, char **argv)
+{
+  test_pic_param ();
+  test_slices ();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,486 @@
+/* flu-va-drivers
+ * Copyright 2022-2023 Fluendo S.A. <support@fluendo.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Replays the VA buffers of VP9 frames through the translator of the VDPAU
+ * driver and checks the resulting VdpPictureInfoVP9: the picture parameters,
+ * the fields read from the uncompressed header and carried across frames,
+ * and the frame selected from a superframe. */
+
+#include "flu_va_drivers_vdpau_vp9.h"
+#include "flu_va_drivers_vdpau_test_translator.h"
+
+#define VP9_KEY_FRAME 0
+#define VP9_NON_KEY_FRAME 1
+#define VP9_SYNC_CODE 0x498342
+#define VP9_CS_BT_709 2
+
+/* Uncompressed header writer, VP9 has no emulation prevention. */
+typedef struct _TestBitWriter TestBitWriter;
+
+struct _TestBitWriter
+{
+  uint8_t data[64];
+  size_t size;
+  unsigned int num_bits;
+  uint8_t byte;
+};
+
+static void
+test_bit_writer_init (TestBitWriter *writer)
+{
+  memset (writer, 0, sizeof (*writer));
+}
+
+static void
+test_bit_writer_put (TestBitWriter *writer, uint32_t value, unsigned int n)
+{
+  while (n-- > 0) {
+    writer->byte = (writer->byte << 1) | ((value >> n) & 1);
+    if (++writer->num_bits % 8 == 0) {
+      writer->data[writer->size++] = writer->byte;
+      writer->byte = 0;
+    }
+  }
+}
+
+/* su(n) */
+static void
+test_bit_writer_put_signed (
+    TestBitWriter *writer, int32_t value, unsigned int n)
+{
+  test_bit_writer_put (writer, value < 0 ? -value : value, n);
+  test_bit_writer_put (writer, value < 0, 1);
+}
+
+/* Pads the header to a byte, then writes some compressed data. */
+static void
+test_bit_writer_finish (TestBitWriter *writer)
+{
+  while (writer->num_bits % 8 != 0)
+    test_bit_writer_put (writer, 0, 1);
+  test_bit_writer_put (writer, 0xa5a5a5a5, 32);
+}
+
+/* Up to frame_context_idx, with a loop filter without delta update. */
+static void
+test_put_frame_header_begin (TestBitWriter *writer, unsigned int frame_type,
+    unsigned int show_frame, unsigned int error_resilient_mode)
+{
+  test_bit_writer_init (writer);
+  test_bit_writer_put (writer, 2, 2); /* frame_marker */
+  test_bit_writer_put (writer, 0, 2); /* profile */
+  test_bit_writer_put (writer, 0, 1); /* show_existing_frame */
+  test_bit_writer_put (writer, frame_type, 1);
+  test_bit_writer_put (writer, show_frame, 1);
+  test_bit_writer_put (writer, error_resilient_mode, 1);
+  if (frame_type == VP9_KEY_FRAME) {
+    test_bit_writer_put (writer, VP9_SYNC_CODE, 24);
+    test_bit_writer_put (writer, VP9_CS_BT_709, 3);
+    test_bit_writer_put (writer, 0, 1); /* color_range */
+    test_bit_writer_put (writer, 351, 16); /* frame_width_minus_1 */
+    test_bit_writer_put (writer, 287, 16); /* frame_height_minus_1 */
+    test_bit_writer_put (writer, 0, 1); /* render_and_frame_size_different */
+  } else {
+    if (!show_frame)
+      test_bit_writer_put (writer, 0, 1); /* intra_only */
+    if (!error_resilient_mode)
+      test_bit_writer_put (writer, 0, 2); /* reset_frame_context */
+    test_bit_writer_put (writer, 0x01, 8); /* refresh_frame_flags */
+    test_bit_writer_put (writer, 0, 3 * 4); /* ref_frame_idx, sign bias */
+    test_bit_writer_put (writer, 1, 1); /* found_ref */
+    test_bit_writer_put (writer, 0, 1); /* render_and_frame_size_different */
+    test_bit_writer_put (writer, 1, 1); /* allow_high_precision_mv */
+    test_bit_writer_put (writer, 1, 1); /* is_filter_switchable */
+  }
+  if (!error_resilient_mode)
+    test_bit_writer_put (writer, 3, 2); /* refresh_frame_context... */
+  test_bit_writer_put (writer, 0, 2); /* frame_context_idx */
+  test_bit_writer_put (writer, 10, 6); /* loop_filter_level */
+  test_bit_writer_put (writer, 3, 3); /* loop_filter_sharpness */
+  test_bit_writer_put (writer, 1, 1); /* loop_filter_delta_enabled */
+}
+
+/* The quantization parameters and no segmentation. */
+static void
+test_put_frame_header_end (TestBitWriter *writer, unsigned int base_q_idx)
+{
+  test_bit_writer_put (writer, base_q_idx, 8);
+  test_bit_writer_put (writer, 0, 3); /* delta_coded */
+  test_bit_writer_put (writer, 0, 1); /* segmentation_enabled */
+  test_bit_writer_finish (writer);
+}
+
+static void
+test_init_pic_param (VADecPictureParameterBufferVP9 *param,
+    FluVaDriversVdpauTestTranslator *fixture, unsigned int frame_type,
+    unsigned int show_frame)
+{
+  unsigned int i;
+
+  memset (param, 0, sizeof (*param));
+  param->frame_width = 352;
+  param->frame_height = 288;
+  for (i = 0; i < 8; i++)
+    param->reference_frames[i] = fixture->surfaces[i];
+  param->pic_fields.bits.subsampling_x = 1;
+  param->pic_fields.bits.subsampling_y = 1;
+  param->pic_fields.bits.frame_type = frame_type;
+  param->pic_fields.bits.show_frame = show_frame;
+  param->pic_fields.bits.mcomp_filter_type = 4;
+  param->pic_fields.bits.refresh_frame_context = 1;
+  param->pic_fields.bits.frame_context_idx = 2;
+  param->pic_fields.bits.last_ref_frame = 5;
+  param->pic_fields.bits.golden_ref_frame = 1;
+  param->pic_fields.bits.golden_ref_frame_sign_bias = 1;
+  param->pic_fields.bits.alt_ref_frame = 7;
+  param->filter_level = 10;
+  param->sharpness_level = 3;
+  param->log2_tile_columns = 1;
+  param->frame_header_length_in_bytes = 12;
+  param->first_partition_size = 345;
+  for (i = 0; i < 7; i++)
+    param->mb_segment_tree_probs[i] = 200 + i;
+  for (i = 0; i < 3; i++)
+    param->segment_pred_probs[i] = 100 + i;
+  param->profile = 0;
+  param->bit_depth = 8;
+}
+
+static void
+test_render_frame (FluVaDriversVdpauTestTranslator *fixture,
+    VADecPictureParameterBufferVP9 *param, uint8_t *data, uint32_t size,
+    VAStatus expected)
+{
+  VASliceParameterBufferVP9 slice_param;
+
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, param,
+                                 sizeof (*param)) == VA_STATUS_SUCCESS);
+
+  memset (&slice_param, 0, sizeof (slice_param));
+  slice_param.slice_data_size = size;
+  slice_param.slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceParameterBufferType,
+                                 &slice_param, sizeof (slice_param)) ==
+                             VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VASliceDataBufferType, data, size) ==
+                             expected);
+}
+
+static void
+test_pic_param (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const VdpPictureInfoVP9 *info = &fixture->context_obj.vdp_pic_info.vp9;
+  VADecPictureParameterBufferVP9 param;
+  FluVaDriversVdpauDecoderConfig decoder_config;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_VP9);
+
+  /* The slots of a key frame are not looked up. */
+  test_init_pic_param (&param, fixture, VP9_KEY_FRAME, 1);
+  param.reference_frames[5] = VA_INVALID_SURFACE - 1;
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->width == 352);
+  FLU_VA_DRIVERS_TEST_CHECK (info->height == 288);
+  FLU_VA_DRIVERS_TEST_CHECK (info->keyFrame == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->showFrame == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->subSamplingX == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->subSamplingY == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->mcompFilterType == 4);
+  FLU_VA_DRIVERS_TEST_CHECK (info->refreshEntropyProbs == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->frameContextIdx == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->bitDepthMinus8Luma == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->loopFilterLevel == 10);
+  FLU_VA_DRIVERS_TEST_CHECK (info->loopFilterSharpness == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->log2TileColumns == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->log2TileRows == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->mbSegmentTreeProbs[6] == 206);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentPredProbs[2] == 102);
+  FLU_VA_DRIVERS_TEST_CHECK (info->uncompressedHeaderSize == 12);
+  FLU_VA_DRIVERS_TEST_CHECK (info->compressedHeaderSize == 345);
+  FLU_VA_DRIVERS_TEST_CHECK (info->lastReference == VDP_INVALID_HANDLE);
+  FLU_VA_DRIVERS_TEST_CHECK (info->goldenReference == VDP_INVALID_HANDLE);
+  FLU_VA_DRIVERS_TEST_CHECK (info->altReference == VDP_INVALID_HANDLE);
+
+  /* The references of an inter frame are taken from their slot. */
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  test_init_pic_param (&param, fixture, VP9_NON_KEY_FRAME, 1);
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) == VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->keyFrame == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->activeRefIdx[0] == 5);
+  FLU_VA_DRIVERS_TEST_CHECK (info->activeRefIdx[1] == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->activeRefIdx[2] == 7);
+  FLU_VA_DRIVERS_TEST_CHECK (info->refFrameSignBias[0] == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->refFrameSignBias[1] == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->refFrameSignBias[2] == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->refFrameSignBias[3] == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->lastReference == fixture->vdp_surfaces[5]);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      info->goldenReference == fixture->vdp_surfaces[1]);
+  FLU_VA_DRIVERS_TEST_CHECK (info->altReference == fixture->vdp_surfaces[7]);
+
+  flu_va_drivers_vdpau_test_translator_end_picture (
+      fixture, &decoder_config);
+  FLU_VA_DRIVERS_TEST_CHECK (decoder_config.max_references == 8);
+  FLU_VA_DRIVERS_TEST_CHECK (decoder_config.width == 352);
+  FLU_VA_DRIVERS_TEST_CHECK (decoder_config.height == 288);
+
+  /* The decoder only grows with the frame size. */
+  decoder_config.width = 640;
+  decoder_config.height = 200;
+  fixture->context_obj.codec_ops->end_picture (
+      &fixture->context_obj, &decoder_config);
+  FLU_VA_DRIVERS_TEST_CHECK (decoder_config.width == 640);
+  FLU_VA_DRIVERS_TEST_CHECK (decoder_config.height == 288);
+
+  /* A reference that is not a surface of the driver. */
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  param.reference_frames[7] = FLU_VA_DRIVERS_TEST_SURFACE_ID_OFFSET +
+                              FLU_VA_DRIVERS_TEST_NUM_SURFACES;
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) ==
+                             VA_STATUS_ERROR_INVALID_SURFACE);
+
+  /* Only 8-bit Profile 0 is supported. */
+  flu_va_drivers_vdpau_context_object_reset (&fixture->context_obj);
+  test_init_pic_param (&param, fixture, VP9_KEY_FRAME, 1);
+  param.bit_depth = 10;
+  FLU_VA_DRIVERS_TEST_CHECK (flu_va_drivers_vdpau_test_translator_render (
+                                 fixture, VAPictureParameterBufferType, &param,
+                                 sizeof (param)) != VA_STATUS_SUCCESS);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+/* The loop filter deltas, quantizer deltas and segmentation features are
+ * read from the uncompressed header, and kept until updated or reset. */
+static void
+test_frame_header (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const VdpPictureInfoVP9 *info = &fixture->context_obj.vdp_pic_info.vp9;
+  VADecPictureParameterBufferVP9 param;
+  TestBitWriter writer;
+  unsigned int i;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_VP9);
+
+  test_put_frame_header_begin (&writer, VP9_KEY_FRAME, 1, 0);
+  test_bit_writer_put (&writer, 1, 1); /* loop_filter_delta_update */
+  test_bit_writer_put (&writer, 1, 1); /* update_ref_delta[0] */
+  test_bit_writer_put_signed (&writer, -3, 6);
+  test_bit_writer_put (&writer, 0, 3);
+  test_bit_writer_put (&writer, 0, 1); /* update_mode_delta[0] */
+  test_bit_writer_put (&writer, 1, 1);
+  test_bit_writer_put_signed (&writer, 2, 6);
+  test_bit_writer_put (&writer, 60, 8); /* base_q_idx */
+  test_bit_writer_put (&writer, 1, 1); /* delta_q_y_dc */
+  test_bit_writer_put_signed (&writer, -2, 4);
+  test_bit_writer_put (&writer, 0, 1); /* delta_q_uv_dc */
+  test_bit_writer_put (&writer, 1, 1); /* delta_q_uv_ac */
+  test_bit_writer_put_signed (&writer, 3, 4);
+  test_bit_writer_put (&writer, 1, 1); /* segmentation_enabled */
+  test_bit_writer_put (&writer, 1, 1); /* segmentation_update_map */
+  test_bit_writer_put (&writer, 1, 1); /* prob_coded */
+  test_bit_writer_put (&writer, 100, 8);
+  test_bit_writer_put (&writer, 0, 6);
+  test_bit_writer_put (&writer, 1, 1); /* segmentation_temporal_update */
+  test_bit_writer_put (&writer, 0, 3);
+  test_bit_writer_put (&writer, 1, 1); /* segmentation_update_data */
+  test_bit_writer_put (&writer, 1, 1); /* segmentation_abs_or_delta_update */
+  for (i = 0; i < 8; i++) {
+    test_bit_writer_put (&writer, i == 1, 1); /* alternate quantizer */
+    if (i == 1)
+      test_bit_writer_put_signed (&writer, -20, 8);
+    test_bit_writer_put (&writer, 0, 1); /* alternate loop filter */
+    test_bit_writer_put (&writer, i == 2, 1); /* reference frame */
+    if (i == 2)
+      test_bit_writer_put (&writer, 3, 2);
+    test_bit_writer_put (&writer, i == 3, 1); /* skip */
+  }
+  test_bit_writer_finish (&writer);
+
+  test_init_pic_param (&param, fixture, VP9_KEY_FRAME, 1);
+  test_render_frame (
+      fixture, &param, writer.data, writer.size, VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->colorSpace == VP9_CS_BT_709);
+  FLU_VA_DRIVERS_TEST_CHECK (info->modeRefLfEnabled == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->mbRefLfDelta[0] == (uint32_t) -3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->mbRefLfDelta[1] == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->mbRefLfDelta[2] == (uint32_t) -1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->mbRefLfDelta[3] == (uint32_t) -1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->mbModeLfDelta[0] == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->mbModeLfDelta[1] == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->qpYAc == 60);
+  FLU_VA_DRIVERS_TEST_CHECK (info->qpYDc == -2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->qpChDc == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->qpChAc == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentFeatureMode == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentFeatureEnable[1][0] == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentFeatureData[1][0] == -20);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentFeatureEnable[2][2] == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentFeatureData[2][2] == 3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentFeatureEnable[3][3] == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentFeatureEnable[0][0] == 0);
+  /* The frame is passed as it is. */
+  FLU_VA_DRIVERS_TEST_CHECK (fixture->context_obj.bitstream.size ==
+                             writer.size);
+  FLU_VA_DRIVERS_TEST_CHECK (memcmp (fixture->context_obj.bitstream.data,
+                                 writer.data, writer.size) == 0);
+
+  /* An inter frame without updates keeps them. */
+  test_put_frame_header_begin (&writer, VP9_NON_KEY_FRAME, 1, 0);
+  test_bit_writer_put (&writer, 0, 1); /* loop_filter_delta_update */
+  test_put_frame_header_end (&writer, 70);
+  test_init_pic_param (&param, fixture, VP9_NON_KEY_FRAME, 1);
+  test_render_frame (
+      fixture, &param, writer.data, writer.size, VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->qpYAc == 70);
+  FLU_VA_DRIVERS_TEST_CHECK (info->qpYDc == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->mbRefLfDelta[0] == (uint32_t) -3);
+  FLU_VA_DRIVERS_TEST_CHECK (info->mbModeLfDelta[1] == 2);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentFeatureMode == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentFeatureData[1][0] == -20);
+
+  /* An error resilient frame resets them. */
+  test_put_frame_header_begin (&writer, VP9_NON_KEY_FRAME, 1, 1);
+  test_bit_writer_put (&writer, 0, 1); /* loop_filter_delta_update */
+  test_put_frame_header_end (&writer, 80);
+  param.pic_fields.bits.error_resilient_mode = 1;
+  test_render_frame (
+      fixture, &param, writer.data, writer.size, VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (info->errorResilient == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->mbRefLfDelta[0] == 1);
+  FLU_VA_DRIVERS_TEST_CHECK (info->mbModeLfDelta[1] == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentFeatureMode == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentFeatureEnable[1][0] == 0);
+  FLU_VA_DRIVERS_TEST_CHECK (info->segmentFeatureData[1][0] == 0);
+
+  /* A truncated header. */
+  test_render_frame (
+      fixture, &param, writer.data, 4, VA_STATUS_ERROR_INVALID_BUFFER);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+/* Appends the superframe index of frames of one byte sizes. */
+static void
+test_put_superframe_index (
+    TestBitWriter *writer, const uint8_t *sizes, unsigned int num_frames)
+{
+  uint8_t marker = 0xc0 | (num_frames - 1);
+  unsigned int i;
+
+  test_bit_writer_put (writer, marker, 8);
+  for (i = 0; i < num_frames; i++)
+    test_bit_writer_put (writer, sizes[i], 8);
+  test_bit_writer_put (writer, marker, 8);
+}
+
+/* Only the frame that is decoded is passed to VDPAU, here a hidden frame
+ * followed by a frame that shows an existing one. */
+static void
+test_superframe (void)
+{
+  FluVaDriversVdpauTestTranslator *fixture = calloc (1, sizeof (*fixture));
+  const FluVaDriversVdpauBitstream *bitstream =
+      &fixture->context_obj.bitstream;
+  VADecPictureParameterBufferVP9 param;
+  TestBitWriter frame, superframe;
+  uint8_t sizes[3];
+  unsigned int i;
+
+  flu_va_drivers_vdpau_test_translator_init (
+      fixture, &FLU_VA_DRIVERS_VDPAU_CODEC_OPS_VP9);
+
+  test_put_frame_header_begin (&frame, VP9_NON_KEY_FRAME, 0, 0);
+  test_bit_writer_put (&frame, 0, 1); /* loop_filter_delta_update */
+  test_put_frame_header_end (&frame, 90);
+
+  test_bit_writer_init (&superframe);
+  for (i = 0; i < frame.size; i++)
+    test_bit_writer_put (&superframe, frame.data[i], 8);
+  /* frame_marker, profile 0, show_existing_frame of slot 3. */
+  test_bit_writer_put (&superframe, 0x8b, 8);
+  sizes[0] = frame.size;
+  sizes[1] = 1;
+  test_put_superframe_index (&superframe, sizes, 2);
+
+  test_init_pic_param (&param, fixture, VP9_NON_KEY_FRAME, 0);
+  test_render_frame (
+      fixture, &param, superframe.data, superframe.size, VA_STATUS_SUCCESS);
+  FLU_VA_DRIVERS_TEST_CHECK (fixture->context_obj.vdp_pic_info.vp9.qpYAc ==
+                             90);
+  FLU_VA_DRIVERS_TEST_CHECK (bitstream->size == frame.size);
+  FLU_VA_DRIVERS_TEST_CHECK (
+      memcmp (bitstream->data, frame.data, frame.size) == 0);
+
+  /* The decoded frame does not match the picture parameters. */
+  param.pic_fields.bits.show_frame = 1;
+  test_render_frame (fixture, &param, superframe.data, superframe.size,
+      VA_STATUS_ERROR_INVALID_BUFFER);
+
+  /* Two decoded frames cannot be one picture. */
+  test_bit_writer_init (&superframe);
+  for (i = 0; i < 2 * frame.size; i++)
+    test_bit_writer_put (&superframe, frame.data[i % frame.size], 8);
+  sizes[1] = frame.size;
+  test_put_superframe_index (&superframe, sizes, 2);
+  param.pic_fields.bits.show_frame = 0;
+  test_render_frame (fixture, &param, superframe.data, superframe.size,
+      VA_STATUS_ERROR_INVALID_BUFFER);
+
+  /* A frame size past the end of the superframe. */
+  sizes[1] = frame.size + 1;
+  superframe.size -= 4;
+  superframe.num_bits -= 4 * 8;
+  test_put_superframe_index (&superframe, sizes, 2);
+  test_render_frame (fixture, &param, superframe.data, superframe.size,
+      VA_STATUS_ERROR_INVALID_BUFFER);
+
+  flu_va_drivers_vdpau_test_translator_finalize (fixture);
+  free (fixture);
+}
+
+int
+main (int argc, char **argv)
+{
+  test_pic_param ();
+  test_frame_header ();
+  test_superframe ();
+
+  return EXIT_SUCCESS;
+}